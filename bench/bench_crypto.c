@@ -0,0 +1,483 @@
+/**
+ * Microbenchmarks for the cryptographic primitives. Every operation is run over
+ * a range of message sizes on every backend available on this machine, and the
+ * median and 99th percentile of the samples are reported.
+ *
+ * Each sample repeats the operation until it takes at least BENCH_SAMPLE_NS,
+ * so small messages aren't drowned out by the cost of reading the clock. The
+ * cycle counts come from the timestamp counter, which ticks at a fixed rate
+ * instead of following the current core clock, so they are only comparable
+ * between runs on the same machine.
+ *
+ * Usage: bench_crypto [--json] [--max-size=BYTES] [--filter=NAME]
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "constants.h"
+#include "core/buffer.h"
+#include "crypto/aes.h"
+#include "crypto/aes_ctr.h"
+#include "crypto/chacha20.h"
+#include "crypto/hmac.h"
+#include "crypto/pbkdf2.h"
+#include "crypto/sha256.h"
+#include "stddefs.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BENCH_HAS_TSC
+#include <x86intrin.h>
+#endif
+
+#define BENCH_MIN_SIZE 16ul
+#define BENCH_MAX_SIZE (64ul * 1024 * 1024)
+#define BENCH_SAMPLE_NS 200000.0
+#define BENCH_CASE_NS 300000000.0
+#define BENCH_WARMUP_NS 20000000.0
+#define BENCH_MIN_SAMPLES 5
+#define BENCH_MAX_SAMPLES 101
+#define BENCH_UNALIGNED_OFFSET 7
+#define BENCH_KEY_SIZE 32
+
+typedef struct {
+  aes_ctx_t aes;
+  chacha20_ctx_t chacha20;
+  uint8_t key[BENCH_KEY_SIZE];
+  uint8_t iv[AES_IV_SIZE];
+  uint8_t* in;
+  uint8_t* out;
+} bench_state_t;
+
+/* Runs the operation once over a message of the given size */
+typedef void (*bench_op_t)(bench_state_t* state, const size_t size);
+
+typedef struct {
+  const char* name;
+  const char* backend;
+  const char* variant;
+  const char* unit;
+  size_t size;
+  size_t samples;
+  size_t repeats;
+  double ns[2];
+  double cycles[2];
+} bench_result_t;
+
+static bool json = false;
+static bool first_result = true;
+static size_t max_size = BENCH_MAX_SIZE;
+static const char* filter = NULL;
+static const char* pending_header = NULL;
+
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double now_cycles() {
+#ifdef BENCH_HAS_TSC
+  return (double)__rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static int compare_doubles(const void* a, const void* b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+/* Uses the nearest-rank method, so the result is always a real sample */
+static double percentile(double* samples, const size_t n, const double p) {
+  size_t rank = (size_t)(p * n + 0.999999);
+  if (rank < 1) rank = 1;
+  if (rank > n) rank = n;
+  return samples[rank - 1];
+}
+
+static void format_size(const size_t size, char* out) {
+  if (size >= 1024 * 1024 && size % (1024 * 1024) == 0) {
+    sprintf(out, "%lu MiB", (unsigned long)(size / (1024 * 1024)));
+  } else if (size >= 1024 && size % 1024 == 0) {
+    sprintf(out, "%lu KiB", (unsigned long)(size / 1024));
+  } else {
+    sprintf(out, "%lu B", (unsigned long)size);
+  }
+}
+
+static void print_header(const char* unit) {
+  if (strcmp(unit, "byte") == 0) {
+    printf("\n%-30s %-10s %-10s %8s %12s %12s %9s %9s %8s %8s\n", "operation",
+           "backend", "variant", "size", "med ns", "p99 ns", "med MB/s",
+           "p99 MB/s", "med c/B", "p99 c/B");
+  } else {
+    printf("\n%-30s %-10s %-10s %8s %12s %12s %9s %9s %8s %8s\n", "operation",
+           "backend", "variant", "iters", "med ns", "p99 ns", "med it/s",
+           "p99 it/s", "med c/it", "p99 c/it");
+  }
+}
+
+/* Headers are only printed once a group has a result, so filters stay tidy */
+static void begin_group(const char* unit) { pending_header = unit; }
+
+static void print_result(const bench_result_t* r) {
+  /* Throughput is calculated from time, so the p99 time gives the p99 rate */
+  double rate[2], per_unit[2];
+  int i;
+  for (i = 0; i < 2; ++i) {
+    rate[i] = r->size / (r->ns[i] * 1e-9);
+    per_unit[i] = r->cycles[i] / r->size;
+  }
+
+  if (json) {
+    printf("%s\n    {\"name\": \"%s\", \"backend\": \"%s\", ",
+           first_result ? "" : ",", r->name, r->backend);
+    printf("\"variant\": \"%s\", ", r->variant);
+    printf("\"unit\": \"%s\", \"size\": %lu, \"samples\": %lu, ", r->unit,
+           (unsigned long)r->size, (unsigned long)r->samples);
+    printf("\"repeats\": %lu, \"median_ns\": %.1f, \"p99_ns\": %.1f, ",
+           (unsigned long)r->repeats, r->ns[0], r->ns[1]);
+    printf("\"median_per_sec\": %.1f, \"p99_per_sec\": %.1f, ", rate[0],
+           rate[1]);
+#ifdef BENCH_HAS_TSC
+    printf("\"median_cycles_per_unit\": %.3f, \"p99_cycles_per_unit\": %.3f}",
+           per_unit[0], per_unit[1]);
+#else
+    printf("\"median_cycles_per_unit\": null, \"p99_cycles_per_unit\": null}");
+#endif
+    first_result = false;
+    fflush(stdout);
+    return;
+  }
+
+  if (pending_header) {
+    print_header(pending_header);
+    pending_header = NULL;
+  }
+
+  char size[32];
+  format_size(r->size, size);
+  if (strcmp(r->unit, "byte") == 0) {
+    printf("%-30s %-10s %-10s %8s %12.0f %12.0f %9.1f %9.1f %8.2f %8.2f\n",
+           r->name, r->backend, r->variant, size, r->ns[0], r->ns[1],
+           rate[0] / 1e6, rate[1] / 1e6, per_unit[0], per_unit[1]);
+  } else {
+    printf("%-30s %-10s %-10s %8lu %12.0f %12.0f %9.0f %9.0f %8.0f %8.0f\n",
+           r->name, r->backend, r->variant, (unsigned long)r->size, r->ns[0],
+           r->ns[1], rate[0], rate[1], per_unit[0], per_unit[1]);
+  }
+  fflush(stdout);
+}
+
+/**
+ * Measures an operation. The first run doubles as the calibration, which sets
+ * how many runs make up a sample and how many samples fit in the time budget.
+ */
+static void run_case(const char* name, const char* backend, const char* variant,
+                     const char* unit, bench_op_t op, bench_state_t* state,
+                     const size_t size, const size_t units) {
+  if (filter && !strstr(name, filter)) return;
+
+  double start = now_ns();
+  op(state, size);
+  double single = now_ns() - start;
+  if (single < 1) single = 1;
+
+  /* Warm up the caches, branch predictors, and clock speed */
+  while (now_ns() - start < BENCH_WARMUP_NS) op(state, size);
+
+  size_t repeats = (size_t)(BENCH_SAMPLE_NS / single) + 1;
+  size_t samples = (size_t)(BENCH_CASE_NS / (single * repeats));
+  if (samples < BENCH_MIN_SAMPLES) samples = BENCH_MIN_SAMPLES;
+  if (samples > BENCH_MAX_SAMPLES) samples = BENCH_MAX_SAMPLES;
+
+  double ns[BENCH_MAX_SAMPLES], cycles[BENCH_MAX_SAMPLES];
+  size_t s, i;
+  for (s = 0; s < samples; ++s) {
+    double t0 = now_ns(), c0 = now_cycles();
+    for (i = 0; i < repeats; ++i) op(state, size);
+    double c1 = now_cycles(), t1 = now_ns();
+    ns[s] = (t1 - t0) / repeats;
+    cycles[s] = (c1 - c0) / repeats;
+  }
+  qsort(ns, samples, sizeof(double), compare_doubles);
+  qsort(cycles, samples, sizeof(double), compare_doubles);
+
+  bench_result_t result;
+  result.name = name;
+  result.backend = backend;
+  result.variant = variant;
+  result.unit = unit;
+  result.size = units;
+  result.samples = samples;
+  result.repeats = repeats;
+  result.ns[0] = percentile(ns, samples, 0.5);
+  result.ns[1] = percentile(ns, samples, 0.99);
+  result.cycles[0] = percentile(cycles, samples, 0.5);
+  result.cycles[1] = percentile(cycles, samples, 0.99);
+  print_result(&result);
+}
+
+static void op_aes_encrypt(bench_state_t* state, const size_t size) {
+  buf_t in, out;
+  size_t i;
+  for (i = 0; i + AES_BLOCK_SIZE <= size; i += AES_BLOCK_SIZE) {
+    buf_view(&in, state->in + i, AES_BLOCK_SIZE);
+    buf_view(&out, state->out + i, AES_BLOCK_SIZE);
+    aes_encrypt(&state->aes, &in, &out);
+  }
+}
+
+static void op_aes_ctr(bench_state_t* state, const size_t size) {
+  buf_t iv, in, out;
+  buf_view(&iv, state->iv, AES_IV_SIZE);
+  buf_view(&in, state->in, size);
+  buf_view(&out, state->out, size);
+  aes_ctr_crypt(&state->aes, &iv, 0, &in, &out);
+}
+
+/* Starts mid-block, with the data one byte off from the allocation */
+static void op_aes_ctr_unaligned(bench_state_t* state, const size_t size) {
+  buf_t iv, in, out;
+  buf_view(&iv, state->iv, AES_IV_SIZE);
+  buf_view(&in, state->in + 1, size);
+  buf_view(&out, state->out + 1, size);
+  aes_ctr_crypt(&state->aes, &iv, BENCH_UNALIGNED_OFFSET, &in, &out);
+}
+
+static void op_chacha20(bench_state_t* state, const size_t size) {
+  buf_t iv, in, out;
+  buf_view(&iv, state->iv, AES_IV_SIZE);
+  buf_view(&in, state->in, size);
+  buf_view(&out, state->out, size);
+  chacha20_crypt(&state->chacha20, &iv, 0, &in, &out);
+}
+
+static void op_chacha20_unaligned(bench_state_t* state, const size_t size) {
+  buf_t iv, in, out;
+  buf_view(&iv, state->iv, AES_IV_SIZE);
+  buf_view(&in, state->in + 1, size);
+  buf_view(&out, state->out + 1, size);
+  chacha20_crypt(&state->chacha20, &iv, BENCH_UNALIGNED_OFFSET, &in, &out);
+}
+
+static void op_sha256(bench_state_t* state, const size_t size) {
+  sha256_ctx_t ctx;
+  sha256_hash_t digest;
+  buf_t in;
+  buf_view(&in, state->in, size);
+  sha256_init(&ctx);
+  sha256_update(&ctx, &in);
+  sha256_finalize(&ctx, &digest);
+}
+
+static void op_hmac(bench_state_t* state, const size_t size) {
+  uint8_t mac[SHA256_HASH_SIZE];
+  buf_t key, in, out;
+  buf_view(&key, state->key, BENCH_KEY_SIZE);
+  buf_view(&in, state->in, size);
+  buf_view(&out, mac, SHA256_HASH_SIZE);
+  hmac_sha256_hash(&key, &in, &out);
+}
+
+/* The size is the iteration count, with a password and salt of usual size */
+static void op_pbkdf2(bench_state_t* state, const size_t iterations) {
+  uint8_t hash[SHA256_HASH_SIZE];
+  buf_t password, salt, out;
+  buf_view(&password, state->key, BENCH_KEY_SIZE);
+  buf_view(&salt, state->in, PASSWORD_SALT_SIZE);
+  buf_view(&out, hash, SHA256_HASH_SIZE);
+  buf_clear(&out);
+  pbkdf2_hmac_sha256_hash(&password, &salt, iterations, &out,
+                          SHA256_HASH_SIZE);
+}
+
+/* Three derivations at once, like the ones made when changing the password */
+static void op_pbkdf2_many(bench_state_t* state, const size_t iterations) {
+  uint8_t hashes[3][SHA256_HASH_SIZE];
+  buf_t password, salt, out[3];
+  pbkdf2_job_t jobs[3];
+  size_t i;
+  buf_view(&password, state->key, BENCH_KEY_SIZE);
+  buf_view(&salt, state->in, PASSWORD_SALT_SIZE);
+  for (i = 0; i < 3; ++i) {
+    buf_view(&out[i], hashes[i], SHA256_HASH_SIZE);
+    buf_clear(&out[i]);
+    jobs[i].data = &password;
+    jobs[i].salt = &salt;
+    jobs[i].iterations = iterations;
+    jobs[i].out = &out[i];
+    jobs[i].dklen = SHA256_HASH_SIZE;
+  }
+  pbkdf2_hmac_sha256_hash_many(jobs, 3);
+}
+
+static const char* aes_backend_name(const aes_backend_t backend) {
+  switch (backend) {
+    case AES_BACKEND_REFERENCE:
+      return "reference";
+    case AES_BACKEND_TTABLE:
+      return "ttable";
+    case AES_BACKEND_AESNI:
+      return "aesni";
+    case AES_BACKEND_BITSLICE:
+      return "bitslice";
+    default:
+      return "unknown";
+  }
+}
+
+static void bench_aes(bench_state_t* state) {
+  const aes_backend_t backends[] = {AES_BACKEND_REFERENCE, AES_BACKEND_TTABLE,
+                                    AES_BACKEND_BITSLICE, AES_BACKEND_AESNI};
+  aes_backend_t initial = aes_get_backend();
+  buf_t key;
+  buf_view(&key, state->key, AES_KEY_SIZE);
+
+  size_t b, size;
+  begin_group("byte");
+  for (b = 0; b < sizeof(backends) / sizeof(backends[0]); ++b) {
+    if (!aes_set_backend(backends[b])) continue;
+    const char* name = aes_backend_name(backends[b]);
+    aes_init(&state->aes, &key);
+    for (size = BENCH_MIN_SIZE; size <= max_size; size *= 4) {
+      run_case("aes_encrypt", name, "ecb", "byte", op_aes_encrypt, state, size,
+               size);
+    }
+    for (size = BENCH_MIN_SIZE; size <= max_size; size *= 4) {
+      run_case("aes_ctr_crypt", name, "aligned", "byte", op_aes_ctr, state,
+               size, size);
+    }
+    for (size = BENCH_MIN_SIZE; size <= max_size; size *= 4) {
+      run_case("aes_ctr_crypt", name, "unaligned", "byte", op_aes_ctr_unaligned,
+               state, size, size);
+    }
+  }
+  aes_set_backend(initial);
+}
+
+static void bench_chacha20(bench_state_t* state) {
+  buf_t key;
+  buf_view(&key, state->key, CHACHA20_KEY_SIZE);
+  chacha20_init(&state->chacha20, &key);
+
+  size_t size;
+  begin_group("byte");
+  for (size = BENCH_MIN_SIZE; size <= max_size; size *= 4) {
+    run_case("chacha20_crypt", "auto", "aligned", "byte", op_chacha20, state,
+             size, size);
+  }
+  for (size = BENCH_MIN_SIZE; size <= max_size; size *= 4) {
+    run_case("chacha20_crypt", "auto", "unaligned", "byte",
+             op_chacha20_unaligned, state, size, size);
+  }
+}
+
+static const char* sha256_backend_name(const sha256_backend_t backend) {
+  return backend == SHA256_BACKEND_SHANI ? "shani" : "portable";
+}
+
+static void bench_sha256(bench_state_t* state) {
+  const sha256_backend_t backends[] = {SHA256_BACKEND_PORTABLE,
+                                       SHA256_BACKEND_SHANI};
+  sha256_backend_t initial = sha256_get_backend();
+
+  size_t b, size;
+  begin_group("byte");
+  for (b = 0; b < sizeof(backends) / sizeof(backends[0]); ++b) {
+    if (!sha256_set_backend(backends[b])) continue;
+    const char* name = sha256_backend_name(backends[b]);
+    for (size = BENCH_MIN_SIZE; size <= max_size; size *= 4) {
+      run_case("sha256_update", name, "oneshot", "byte", op_sha256, state,
+               size, size);
+    }
+    for (size = BENCH_MIN_SIZE; size <= max_size; size *= 4) {
+      run_case("hmac_sha256_hash", name, "oneshot", "byte", op_hmac, state,
+               size, size);
+    }
+  }
+  sha256_set_backend(initial);
+}
+
+static void bench_pbkdf2(bench_state_t* state) {
+  const sha256_backend_t backends[] = {SHA256_BACKEND_PORTABLE,
+                                       SHA256_BACKEND_SHANI};
+  const size_t iterations[] = {1, 1024, PBKDF2_ITERATIONS};
+  sha256_backend_t initial = sha256_get_backend();
+
+  size_t b, i;
+  begin_group("iteration");
+  for (b = 0; b < sizeof(backends) / sizeof(backends[0]); ++b) {
+    if (!sha256_set_backend(backends[b])) continue;
+    for (i = 0; i < sizeof(iterations) / sizeof(iterations[0]); ++i) {
+      run_case("pbkdf2_hmac_sha256_hash", sha256_backend_name(backends[b]),
+               "dklen=32", "iteration", op_pbkdf2, state, iterations[i],
+               iterations[i]);
+    }
+    for (i = 0; i < sizeof(iterations) / sizeof(iterations[0]); ++i) {
+      run_case("pbkdf2_hmac_sha256_hash_many",
+               sha256_backend_name(backends[b]), "jobs=3", "iteration",
+               op_pbkdf2_many, state, iterations[i], iterations[i]);
+    }
+  }
+  sha256_set_backend(initial);
+}
+
+static bool parse_args(int argc, char* argv[]) {
+  int i;
+  for (i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (strncmp(argv[i], "--max-size=", 11) == 0) {
+      max_size = strtoul(argv[i] + 11, NULL, 10);
+      if (max_size < BENCH_MIN_SIZE) max_size = BENCH_MIN_SIZE;
+      if (max_size > BENCH_MAX_SIZE) max_size = BENCH_MAX_SIZE;
+    } else if (strncmp(argv[i], "--filter=", 9) == 0) {
+      filter = argv[i] + 9;
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--json] [--max-size=BYTES] [--filter=NAME]\n",
+              argv[0]);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  if (!parse_args(argc, argv)) return EXIT_USAGE;
+
+  /* Leave room for the unaligned runs to start one byte in */
+  bench_state_t state;
+  state.in = malloc(max_size + 1);
+  state.out = malloc(max_size + 1);
+  if (!state.in || !state.out) {
+    fprintf(stderr, "Failed to allocate %lu bytes\n", (unsigned long)max_size);
+    return EXIT_UNKNOWN;
+  }
+
+  /* The contents don't matter, but keep them away from all zeroes */
+  size_t i;
+  srand(1);
+  for (i = 0; i <= max_size; ++i) state.in[i] = (uint8_t)rand();
+  for (i = 0; i < BENCH_KEY_SIZE; ++i) state.key[i] = (uint8_t)rand();
+  for (i = 0; i < AES_IV_SIZE; ++i) state.iv[i] = (uint8_t)rand();
+  memset(state.out, 0, max_size + 1);
+
+  if (json) printf("{\n  \"benchmarks\": [");
+  bench_aes(&state);
+  bench_chacha20(&state);
+  bench_sha256(&state);
+  bench_pbkdf2(&state);
+  if (json) printf("\n  ]\n}\n");
+
+  free(state.in);
+  free(state.out);
+  return EXIT_OK;
+}
@@ -0,0 +1,269 @@
+/**
+ * Benchmarks for streaming files through the encrypted iostream, comparing the
+ * synchronous backend against io_uring where the kernel supports it. Every case
+ * moves a whole file in READFILE_BULK_CHUNK pieces, the same way bins are read
+ * and written, and the median and 99th percentile of the samples are reported.
+ *
+ * The files are created in the given directory, so the same run can be pointed
+ * at a tmpfs mount and at a real disk to compare the two. Cold reads drop the
+ * file from the page cache before each sample, which does nothing on tmpfs.
+ * Writes are timed up to the point the data is handed to the kernel, and are
+ * not synced to the disk.
+ *
+ * Usage: bench_io [--json] [--dir=PATH] [--size=BYTES] [--filter=NAME]
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "core/buffer.h"
+#include "core/iostream.h"
+#include "crypto/cipher.h"
+#include "stddefs.h"
+
+#define BENCH_DEFAULT_SIZE (256ul * 1024 * 1024)
+#define BENCH_MIN_SIZE (1ul * 1024 * 1024)
+#define BENCH_SAMPLES 9
+#define BENCH_KEY_SIZE 32
+#define BENCH_HEADER_SIZE 64
+
+typedef struct {
+  cipher_ctx_t cipher;
+  buf_t iv;
+  buf_t chunk;
+  char src[4096];
+  char dst[4096];
+  size_t size;
+} bench_state_t;
+
+/* Runs the operation once over the whole file */
+typedef void (*bench_op_t)(bench_state_t* state);
+
+static bool json = false;
+static bool first_result = true;
+static const char* dir = "/tmp";
+static size_t size = BENCH_DEFAULT_SIZE;
+static const char* filter = NULL;
+
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+/* Uses the nearest-rank method, so the result is always a real sample */
+static double percentile(double* samples, const size_t n, const double p) {
+  size_t rank = (size_t)(p * n + 0.999999);
+  if (rank < 1) rank = 1;
+  if (rank > n) rank = n;
+  return samples[rank - 1];
+}
+
+static const char* backend_name(const iostream_backend_t backend) {
+  return backend == IOSTREAM_BACKEND_URING ? "io_uring" : "sync";
+}
+
+static FILE* open_file(const char* path, const char* mode) {
+  FILE* file = fopen(path, mode);
+  if (!file) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    exit(EXIT_IO_ERROR);
+  }
+  return file;
+}
+
+/* Asks the kernel to forget the cached pages of a file */
+static void drop_cache(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return;
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+static void stream_out(bench_state_t* state, FILE* file) {
+  iostream_t ios;
+  iostream_init(&ios, file, &state->cipher, &state->iv, BENCH_HEADER_SIZE);
+  size_t remaining = state->size;
+  while (remaining > 0) {
+    size_t chunk =
+        remaining < READFILE_BULK_CHUNK ? remaining : READFILE_BULK_CHUNK;
+    state->chunk.size = chunk;
+    iostream_write(&ios, &state->chunk);
+    remaining -= chunk;
+  }
+  iostream_free(&ios);
+}
+
+static void op_write(bench_state_t* state) {
+  FILE* file = open_file(state->dst, "wb");
+  stream_out(state, file);
+  fclose(file);
+}
+
+static void op_read(bench_state_t* state) {
+  FILE* file = open_file(state->src, "rb");
+  iostream_t ios;
+  iostream_init(&ios, file, &state->cipher, &state->iv, BENCH_HEADER_SIZE);
+  size_t remaining = state->size;
+  while (remaining > 0) {
+    size_t chunk =
+        remaining < READFILE_BULK_CHUNK ? remaining : READFILE_BULK_CHUNK;
+    iostream_read(&ios, chunk, &state->chunk);
+    remaining -= chunk;
+  }
+  iostream_free(&ios);
+  fclose(file);
+}
+
+/* Re-encrypts one file into another, like rotating the IV of a bin does */
+static void op_transcrypt(bench_state_t* state) {
+  FILE* in = open_file(state->src, "rb");
+  FILE* out = open_file(state->dst, "wb");
+  iostream_t r, w;
+  iostream_init(&r, in, &state->cipher, &state->iv, BENCH_HEADER_SIZE);
+  iostream_init(&w, out, &state->cipher, &state->iv, BENCH_HEADER_SIZE);
+  size_t remaining = state->size;
+  while (remaining > 0) {
+    size_t chunk =
+        remaining < READFILE_BULK_CHUNK ? remaining : READFILE_BULK_CHUNK;
+    iostream_read(&r, chunk, &state->chunk);
+    iostream_write(&w, &state->chunk);
+    remaining -= chunk;
+  }
+  iostream_free(&r);
+  iostream_free(&w);
+  fclose(in);
+  fclose(out);
+}
+
+static void print_result(const char* name, const char* backend,
+                         const char* variant, double* ns) {
+  double rate[2];
+  rate[0] = size / (ns[0] * 1e-9);
+  rate[1] = size / (ns[1] * 1e-9);
+  if (json) {
+    printf("%s\n    {\"name\": \"%s\", \"backend\": \"%s\", ",
+           first_result ? "" : ",", name, backend);
+    printf("\"variant\": \"%s\", \"size\": %lu, \"samples\": %d, ", variant,
+           (unsigned long)size, BENCH_SAMPLES);
+    printf("\"median_ns\": %.1f, \"p99_ns\": %.1f, ", ns[0], ns[1]);
+    printf("\"median_per_sec\": %.1f, \"p99_per_sec\": %.1f}", rate[0],
+           rate[1]);
+    first_result = false;
+  } else {
+    printf("%-20s %-10s %-8s %12.2f %12.2f %10.1f %10.1f\n", name, backend,
+           variant, ns[0] / 1e6, ns[1] / 1e6, rate[0] / 1e6, rate[1] / 1e6);
+  }
+  fflush(stdout);
+}
+
+static void run_case(const char* name, const char* variant, bench_op_t op,
+                     bench_state_t* state, const bool cold) {
+  if (filter && !strstr(name, filter)) return;
+
+  /* The first run warms up the allocator, the pool, and the page cache */
+  op(state);
+  double samples[BENCH_SAMPLES];
+  int i;
+  for (i = 0; i < BENCH_SAMPLES; ++i) {
+    if (cold) drop_cache(state->src);
+    double start = now_ns();
+    op(state);
+    samples[i] = now_ns() - start;
+  }
+
+  qsort(samples, BENCH_SAMPLES, sizeof(double), compare_doubles);
+  double ns[2];
+  ns[0] = percentile(samples, BENCH_SAMPLES, 0.5);
+  ns[1] = percentile(samples, BENCH_SAMPLES, 0.99);
+  print_result(name, backend_name(iostream_get_backend()), variant, ns);
+}
+
+static bool parse_args(int argc, char* argv[]) {
+  int i;
+  for (i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else if (strncmp(argv[i], "--dir=", 6) == 0) {
+      dir = argv[i] + 6;
+    } else if (strncmp(argv[i], "--size=", 7) == 0) {
+      size = strtoul(argv[i] + 7, NULL, 10);
+      if (size < BENCH_MIN_SIZE) size = BENCH_MIN_SIZE;
+    } else if (strncmp(argv[i], "--filter=", 9) == 0) {
+      filter = argv[i] + 9;
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--json] [--dir=PATH] [--size=BYTES] "
+              "[--filter=NAME]\n",
+              argv[0]);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  if (!parse_args(argc, argv)) return EXIT_USAGE;
+
+  bench_state_t state;
+  state.size = size;
+  sprintf(state.src, "%.4000s/bench_io.src", dir);
+  sprintf(state.dst, "%.4000s/bench_io.dst", dir);
+
+  /* The contents don't matter, but keep them away from all zeroes */
+  uint8_t key[BENCH_KEY_SIZE], iv[AES_IV_SIZE];
+  size_t i;
+  srand(1);
+  for (i = 0; i < BENCH_KEY_SIZE; ++i) key[i] = (uint8_t)rand();
+  for (i = 0; i < AES_IV_SIZE; ++i) iv[i] = (uint8_t)rand();
+  buf_t key_buf;
+  buf_view(&key_buf, key, AES_KEY_SIZE);
+  cipher_init(&state.cipher, CIPHER_AES_CTR, &key_buf);
+  buf_view(&state.iv, iv, AES_IV_SIZE);
+  buf_initf(&state.chunk, READFILE_BULK_CHUNK);
+  for (i = 0; i < READFILE_BULK_CHUNK; ++i) state.chunk.data[i] = rand();
+
+  /* Lay down the source file once for all the reading cases */
+  FILE* src = open_file(state.src, "wb");
+  stream_out(&state, src);
+  fclose(src);
+
+  if (json) {
+    printf("{\n  \"benchmarks\": [");
+  } else {
+    printf("%-20s %-10s %-8s %12s %12s %10s %10s\n", "operation", "backend",
+           "variant", "med ms", "p99 ms", "med MB/s", "p99 MB/s");
+  }
+
+  const iostream_backend_t backends[] = {IOSTREAM_BACKEND_SYNC,
+                                         IOSTREAM_BACKEND_URING};
+  iostream_backend_t initial = iostream_get_backend();
+  size_t b;
+  for (b = 0; b < sizeof(backends) / sizeof(backends[0]); ++b) {
+    if (!iostream_set_backend(backends[b])) continue;
+    run_case("iostream_read", "cached", op_read, &state, false);
+    run_case("iostream_read", "cold", op_read, &state, true);
+    run_case("iostream_write", "cached", op_write, &state, false);
+    run_case("iostream_transcrypt", "cached", op_transcrypt, &state, false);
+  }
+  iostream_set_backend(initial);
+  if (json) printf("\n  ]\n}\n");
+
+  remove(state.src);
+  remove(state.dst);
+  buf_free(&state.chunk);
+  return EXIT_OK;
+}
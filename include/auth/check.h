@@ -14,7 +14,8 @@
 bool prompt_password(buf_t* kek);
 
 /**
- * Checks if the password is correct against the stored password.
+ * Checks if the password is correct against the stored password. Legacy agents
+ * are migrated to the current auth format once the password is confirmed.
  * @param password The buffer containing the raw password
  * @param kek The decrypted kek if needed. Set to NULL to ignore.
  * @returns True if password is correct, false otherwise.
@@ -23,14 +24,31 @@ bool prompt_password(buf_t* kek);
 bool check_password(buf_t* password, buf_t* kek);
 
 /**
- * Writes the auth details stored by the auth_t struct.
+ * Initialises the buffers for the auth object.
+ * @param auth
+ * @author Aryan Jassal
+ */
+void auth_init(auth_t* auth);
+
+/**
+ * Frees the buffers used by the auth object.
+ * @param auth
+ * @author Aryan Jassal
+ */
+void auth_free(auth_t* auth);
+
+/**
+ * Writes the auth details stored by the auth_t struct. Only the current format
+ * can be written. The details are written to a temporary file first and renamed
+ * over the old ones, so a failed write never leaves the agent locked out.
  * @param auth
  * @author Aryan Jassal
  */
 void write_auth(const auth_t* auth);
 
 /**
- * Reads the auth details stored on disk into the auth_t struct.
+ * Reads the auth details stored on disk into the auth_t struct. Legacy records
+ * are detected and flagged in the struct.
  * @param auth
  * @author Aryan Jassal
  */
@@ -2,14 +2,61 @@
 #define __AUTH_HASH_H__
 
 #include "core/buffer.h"
+#include "crypto/pbkdf2.h"
 
 /**
  * Hashes a password using SHA256-HMAC-PBKDF2 hashing algorithm.
  * @param password The raw password
  * @param salt
+ * @param iterations The number of PBKDF2 iterations
  * @param hash The output hash
  * @author Aryan Jassal
  */
-void hash_password(const buf_t* password, const buf_t* salt, buf_t* hash);
+void hash_password(const buf_t* password, const buf_t* salt,
+                   const size_t iterations, buf_t* hash);
+
+/**
+ * Prepares a password hash to be computed by hash_passwords(). The hash uses
+ * the same parameters as hash_password().
+ * @param job The job to fill in
+ * @param password The raw password
+ * @param salt
+ * @param iterations The number of PBKDF2 iterations
+ * @param hash The output hash
+ * @author Aryan Jassal
+ */
+void hash_password_job(pbkdf2_job_t* job, const buf_t* password,
+                       const buf_t* salt, const size_t iterations,
+                       buf_t* hash);
+
+/**
+ * Computes several independent password hashes at once, which takes about as
+ * long as computing one of them.
+ * @param jobs The hashes to compute, prepared using hash_password_job()
+ * @param count The number of jobs
+ * @author Aryan Jassal
+ */
+void hash_passwords(const pbkdf2_job_t* jobs, const size_t count);
+
+/**
+ * Benchmarks password hashing on this host and picks the number of iterations
+ * which takes about KDF_TARGET_MS to hash a password. The target can be changed
+ * using the TRANSCODINE_KDF_TARGET_MS environment variable. The result is kept
+ * between PBKDF2_MIN_ITERATIONS and PBKDF2_MAX_ITERATIONS, so slow hosts still
+ * get at least the fixed count used before calibration.
+ * @returns The number of PBKDF2 iterations to store with the password
+ * @author Aryan Jassal
+ */
+size_t calibrate_iterations();
+
+/**
+ * Expands a key for a single purpose from the root key. This is cheap, so the
+ * password only needs to be hashed once no matter how many keys depend on it.
+ * @param root_key The root key, hashed from the password
+ * @param label The purpose of the key
+ * @param key The output 32-byte key
+ * @author Aryan Jassal
+ */
+void expand_root_key(const buf_t* root_key, const char* label, buf_t* key);
 
 #endif
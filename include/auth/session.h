@@ -0,0 +1,37 @@
+/**
+ * Sessions keep the database key in the Linux kernel keyring after a
+ * successful login, so later commands can skip hashing the password. Sessions
+ * are opt-in by setting TRANSCODINE_SESSION_TIMEOUT to the number of seconds
+ * the key should be kept for. The kernel drops the key once the timeout passes,
+ * and `agent lock` revokes it straight away.
+ *
+ * The key is stored in the session keyring, so it is only visible to the
+ * processes of the login session which unlocked the agent. Processes without a
+ * session keyring fall back to the user session keyring instead. The key never
+ * touches the disk.
+ */
+
+#ifndef __AUTH_SESSION_H__
+#define __AUTH_SESSION_H__
+
+#include "core/buffer.h"
+#include "stddefs.h"
+
+/**
+ * Gets the key to the database. If a session is active, the cached key is
+ * used. Otherwise, the user is prompted for their password, and a new session
+ * is started with the derived key if sessions are enabled.
+ * @param db_key The output database key
+ * @returns True if the key was unlocked, false if the password was incorrect
+ * @author Aryan Jassal
+ */
+bool prompt_db_key(buf_t* db_key);
+
+/**
+ * Ends the session for the current agent, if there is one.
+ * @returns True if a session was ended, false otherwise
+ * @author Aryan Jassal
+ */
+bool session_revoke();
+
+#endif
@@ -17,7 +17,7 @@
  * for 64-bit archive, where 64-bit refers to the bits in the size field.
  *
  * [40-byte Global Header]
- *   [8-byte VERSION]: "ARCHV-64"
+ *   [8-byte VERSION]: "ARCHV-64" or "ARCHC-64"
  *   [16-byte BIN_ID]: Like "abcd1234wxyz6789"
  *   [16-byte AES_IV]
  * [8-byte Magic Block]
@@ -32,6 +32,10 @@
  * [Footer]
  *   [8-byte END]: "ARCHVEND"
  *
+ * The version string also selects the cipher used for everything after the
+ * global header. "ARCHV-64" bins are encrypted with AES-CTR, and "ARCHC-64"
+ * bins are encrypted with ChaCha20. The layout is otherwise identical.
+ *
  * Here, the bin id is a randomly generated bin id. The encryption keys are kept
  * in the database with respect to the bin id. This makes the file name for each
  * bin irrelevalt to decryption as they can be fetched dynamically from the db.
@@ -53,7 +57,7 @@
 
 #include "core/buffer.h"
 #include "core/iostream.h"
-#include "crypto/aes.h"
+#include "crypto/cipher.h"
 #include "stddefs.h"
 
 typedef struct {
@@ -65,9 +69,10 @@ typedef struct {
 typedef struct {
   buf_t id;
   buf_t aes_iv;
-  aes_ctx_t aes_ctx;
+  cipher_ctx_t cipher;
   const char *encrypted_path;
   const char *working_path;
+  int fd;
   bin_filectx_t write_ctx;
 } bin_t;
 
@@ -97,11 +102,12 @@ void bin_init(bin_t *bin);
  * @param bin
  * @param bin_id A buffer containing the bin ID for this bin
  * @param aes_key An initialised buffer to store the generated AES key in
+ * @param cipher The cipher used to encrypt the bin
  * @param encrypted_path The path where to create the encrypted bin file
  * @author Aryan Jassal
  */
 void bin_create(bin_t *bin, const buf_t *bin_id, buf_t *aes_key,
-                const char *encrypted_path);
+                const cipher_t cipher, const char *encrypted_path);
 
 /**
  * Takes an encrypted path and returns the metadata stored in the global header.
@@ -115,7 +121,9 @@ void bin_meta(const char *encrypted_path, buf_t *data);
 
 /**
  * Takes an encrypted path and an AES key to decrypt the bin and store it at the
- * decrypted bin path.
+ * decrypted bin path. The cipher is picked based on the version of the bin. The
+ * working copy is kept open until the bin is closed, and every operation on the
+ * bin goes through that one descriptor.
  * @param bin
  * @param aes_key The private AES key to use to decrypt the bin file
  * @param encrypted_path The path where to find the encrypted bin file
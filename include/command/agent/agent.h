@@ -7,7 +7,8 @@
  *
  *  agent
  *  ├── setup
- *  └── reset
+ *  ├── reset
+ *  └── lock
  */
 
 #include "utils/args.h"
@@ -15,6 +16,7 @@
 extern cmd_handler_t cmd_agent;
 extern cmd_handler_t cmd_agent_setup;
 extern cmd_handler_t cmd_agent_reset;
+extern cmd_handler_t cmd_agent_lock;
 extern const int num_agent_commands;
 
 #endif
@@ -0,0 +1,21 @@
+#ifndef __COMMAND_AGENT_LOCK_H__
+#define __COMMAND_AGENT_LOCK_H__
+
+#include "utils/args.h"
+
+/**
+ * Locks the agent by ending the current session, so the next command asks for
+ * the password again. Does nothing if sessions aren't being used.
+ * @param argc
+ * @param argv
+ * @param flagc
+ * @param flagv
+ * @param path The command path to this handler
+ * @param self The object for this handler
+ * @returns Exit code
+ * @author Aryan Jassal
+ */
+int handler_agent_lock(int argc, char* argv[], int flagc, char* flagv[],
+                       const char* path, cmd_handler_t* self);
+
+#endif
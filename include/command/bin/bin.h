@@ -16,6 +16,8 @@
 
 #include "utils/args.h"
 
+extern flag_handler_t flag_chacha20;
+
 extern cmd_handler_t cmd_bin;
 extern cmd_handler_t cmd_bin_create;
 extern cmd_handler_t cmd_bin_rename;
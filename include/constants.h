@@ -27,7 +27,12 @@
 /* Crypto parameters */
 #define SHA256_HASH_SIZE 32
 #define SHA256_BLOCK_SIZE 64
+#define SHA256_MB_LANES 8
 #define PBKDF2_ITERATIONS 16384
+#define PBKDF2_MIN_ITERATIONS PBKDF2_ITERATIONS
+#define PBKDF2_MAX_ITERATIONS (1 << 24)
+#define KDF_TARGET_MS 150
+#define KDF_CALIBRATION_MS 25
 #define XOR_KEY "==<>==XOR-^.V.^-KEY==<>=="
 #define XOR_DIFFUSION 31
 #define AES_BLOCK_SIZE 16
@@ -38,6 +43,14 @@
 #define AES_NR AES_ROUNDS
 #define AES_NB (AES_BLOCK_SIZE / 4)
 #define AES_KEY_SCHEDULE_SIZE (AES_BLOCK_SIZE * (AES_NR + 1))
+#define AES_CTR_BATCH_BLOCKS 8
+#define AES_BITSLICE_WORDS 8
+#define CHACHA20_KEY_SIZE 32
+#define CHACHA20_BLOCK_SIZE 64
+#define CHACHA20_IV_SIZE 16
+#define CHACHA20_KEY_LABEL "transcodine-chacha20-key"
+#define CIPHER_PARALLEL_THRESHOLD (256 * 1024)
+#define CIPHER_PARALLEL_SLICE (64 * 1024)
 
 /* Bootstrap file names */
 #define CONFIG_DIR ".transcodine"
@@ -51,6 +64,7 @@
 #define BIN_GLOBAL_HEADER_SIZE 40
 #define BIN_FILE_HEADER_SIZE 24
 #define BIN_MAGIC_VERSION "ARCHV-64"
+#define BIN_MAGIC_VERSION_CHACHA20 "ARCHC-64"
 #define BIN_MAGIC_UNLOCKED "UNLOCKED"
 #define BIN_MAGIC_FILE "ARCHVFLE"
 #define BIN_MAGIC_END "ARCHVEND"
@@ -78,12 +92,33 @@
 /* Password handling parameters */
 #define PASSWORD_SALT_SIZE 16
 #define KEK_SIZE 32
+#define AUTH_MAGIC_SIZE 8
+#define AUTH_MAGIC_VERSION "AUTHHKDF"
+#define HKDF_LABEL_VERIFIER "transcodine-verifier"
+#define HKDF_LABEL_KEK_WRAP "transcodine-kek-wrap"
+#define HKDF_LABEL_DB_KEY "transcodine-db-key"
+#define DB_LEGACY_KEY_SALT "aes-key-edb"
+#define SESSION_KEY_TYPE "user"
+#define SESSION_KEY_PREFIX "transcodine:"
 
 #define READFILE_CHUNK 512
+#define READFILE_BULK_CHUNK (1024 * 1024)
 
 /* Library method parameters */
 #define BUFFER_GROWTH_FACTOR 2
 #define MAP_LOAD_FACTOR 0.75f
 #define MAP_GROWTH_FACTOR 2
+#define THREADPOOL_MAX_THREADS 16
+#define IOSTREAM_WINDOW_SIZE (16 * 1024)
+#define IOSTREAM_READAHEAD_WINDOW (4 * 1024 * 1024)
+#define IOSTREAM_READAHEAD_SEGMENTS 4
+#define IOSTREAM_READAHEAD_MIN (256 * 1024)
+#define IOSTREAM_URING_DEPTH 4
+#define IOSTREAM_URING_BLOCK (128 * 1024)
+#define IOSTREAM_URING_MIN (512 * 1024)
+#define IOSTREAM_DIRECT_ALIGN 4096
+#define IOSTREAM_DIRECT_CHUNK (4 * 1024 * 1024)
+#define PIPELINE_DEPTH 2
+#define PIPELINE_MIN (256 * 1024)
 
 #endif
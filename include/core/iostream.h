@@ -4,34 +4,205 @@
 #include <stdio.h>
 
 #include "core/buffer.h"
-#include "crypto/aes.h"
+#include "core/uring.h"
+#include "crypto/cipher.h"
+
+/* How large reads and writes reach the file */
+typedef enum {
+  IOSTREAM_BACKEND_SYNC,
+  IOSTREAM_BACKEND_URING
+} iostream_backend_t;
+
+/* How a mapped stream is expected to move through the file */
+typedef enum { IOSTREAM_SEQUENTIAL, IOSTREAM_RANDOM } iostream_access_t;
+
+/* State for the read-ahead helper. Only used inside the iostream. */
+typedef struct iostream_readahead_t iostream_readahead_t;
 
 typedef struct {
   FILE* fd;
-  const aes_ctx_t* aes_ctx;
+  int raw_fd;
+  const cipher_ctx_t* cipher;
   buf_t counter;
+  buf_t scratch;
+  buf_t window;
+  size_t window_offset;
+  size_t dirty_start;
+  size_t dirty_end;
+  size_t fd_offset;
+  bool fd_writing;
+  uint8_t* map;
+  size_t map_size;
+  iostream_access_t map_access;
+  uring_t* uring;
+  bool uring_failed;
+  bool direct;
+  uint8_t* direct_buffer;
+  size_t direct_size;
+  size_t direct_cache_offset;
+  size_t direct_cache_len;
+  bool direct_padded;
   size_t file_offset;
   size_t stream_offset;
+  iostream_readahead_t* readahead;
 } iostream_t;
 
+/**
+ * Selects the backend used for large reads and writes by every stream. Both
+ * backends produce identical files, so this is only useful for testing and
+ * benchmarking. Don't switch backends while a stream is in use.
+ * @param backend The backend to use
+ * @returns True if the backend was selected, false if it is unsupported
+ * @author Aryan Jassal
+ */
+bool iostream_set_backend(const iostream_backend_t backend);
+
+/**
+ * Returns the backend used for large reads and writes. The backend will be
+ * selected automatically if this is the first use. io_uring is preferred
+ * wherever the kernel supports it, and TRANSCODINE_IO_BACKEND can be set to
+ * "sync" or "uring" to override this.
+ * @returns The active backend
+ * @author Aryan Jassal
+ */
+iostream_backend_t iostream_get_backend();
+
+/**
+ * Opens a file for a stream over a raw descriptor. If TRANSCODINE_DIRECT_IO is
+ * set to 1, the file is opened with O_DIRECT wherever the file system supports
+ * it, so streaming a large bin doesn't push everything else out of the page
+ * cache. Otherwise, or on platforms without direct IO, this is a plain open.
+ * @param path
+ * @param flags The flags passed to open. New files are created as if by fopen.
+ * @returns The file descriptor, or -1 if the file couldn't be opened
+ * @author Aryan Jassal
+ */
+int iostream_open(const char* path, const int flags);
+
+/**
+ * Closes a descriptor opened by iostream_open(). Free every stream using it
+ * first, so their data reaches the file.
+ * @param fd
+ * @author Aryan Jassal
+ */
+void iostream_close(const int fd);
+
+/**
+ * Gets the size of the file behind a descriptor, without opening the file again
+ * by its path.
+ * @param fd
+ * @returns The size of the file in bytes
+ * @author Aryan Jassal
+ */
+size_t iostream_file_size(const int fd);
+
+/**
+ * Copies the whole file behind one descriptor into another, replacing whatever
+ * the destination held before. The data goes through streams without a cipher,
+ * so direct IO is used for both sides wherever the descriptors allow it.
+ * @param dst The descriptor to copy into, which must be open for reading and
+ * writing
+ * @param src The descriptor to copy from
+ * @author Aryan Jassal
+ */
+void iostream_copy(const int dst, const int src);
+
+/**
+ * Replaces the file at a path with the whole file behind a descriptor. The copy
+ * is written to a temporary file next to the original, synced, and then renamed
+ * over it, so the original is never left half-written if the copy is cut short.
+ * @param path The file to replace, which doesn't need to exist yet
+ * @param src The descriptor to copy from
+ * @author Aryan Jassal
+ */
+void iostream_replace(const char* path, const int src);
+
 /**
  * Initialise an iostream. This allows to abstract away reading the file and
  * decrypting it or encrypting the data when writing to file while automatically
  * managing streamability. The iostream internally tracks the location of the
- * file and the offset for the ciphertext. Note that you can't go back in an
- * iostream. You need to re-open an iostream to do that.
+ * file and the offset for the ciphertext. The stream can be moved to any offset
+ * with iostream_seek(), so one stream can find a record and then go back to it.
+ *
+ * Small reads and writes go through a window of IOSTREAM_WINDOW_SIZE bytes of
+ * ciphertext, so walking the headers of a file only touches the file when the
+ * stream leaves the window. The stream also remembers where the file is, and
+ * only seeks when the next IO doesn't carry on from there. Do not move the file
+ * position yourself once the stream has started doing IO.
  * @param iostream
  * @param fd The encrypted target file.
- * @param aes_ctx AES context for decryption and encryption.
- * @param iv The AES IV is copied to an internal buffer for counter.
+ * @param cipher Cipher context for decryption and encryption. Passing NULL
+ * gives a stream which reads and writes the file as it is, for copying files
+ * with the same IO paths.
+ * @param iv The IV is copied to an internal buffer for counter. Ignored without
+ * a cipher.
  * @param offset The file offset of encrypted data from the start of the file.
  * @author Aryan Jassal
  */
-void iostream_init(iostream_t* iostream, FILE* fd, const aes_ctx_t* aes_ctx,
+void iostream_init(iostream_t* iostream, FILE* fd, const cipher_ctx_t* cipher,
                    const buf_t* iv, const size_t offset);
 
+/**
+ * Initialise an iostream over a raw file descriptor instead of a stdio file.
+ * These streams read and write at their own offset with pread and pwrite, and
+ * never use or move the file position shared by the descriptor. Any number of
+ * them can run over one descriptor at once, from different threads and without
+ * locking, as long as they don't write to the same bytes. The descriptor is
+ * left open on free.
+ *
+ * Descriptors opened with O_DIRECT give a direct stream. Direct streams only
+ * move whole blocks of IOSTREAM_DIRECT_ALIGN bytes at aligned offsets, through
+ * an aligned buffer owned by the stream. The partial blocks at either end of a
+ * write are read and written back around it, and a write which ends inside a
+ * block pads the file to the end of the block until the stream is flushed.
+ * Direct streams are never mapped and never use io_uring, and they must be the
+ * only stream using the file while they are open.
+ * @param iostream
+ * @param fd The encrypted target file descriptor.
+ * @param cipher Cipher context for decryption and encryption.
+ * @param iv The IV is copied to an internal buffer for counter.
+ * @param offset The file offset of encrypted data from the start of the file.
+ * @author Aryan Jassal
+ */
+void iostream_init_fd(iostream_t* iostream, const int fd,
+                      const cipher_ctx_t* cipher, const buf_t* iv,
+                      const size_t offset);
+
+/**
+ * Enables read-ahead for the next part of the stream. A helper thread generates
+ * the keystream up to IOSTREAM_READAHEAD_WINDOW bytes ahead of the stream
+ * offset, so reads and writes only need to XOR the data while the helper keeps
+ * working during file IO. This only pays off for long sequential streams, so
+ * it does nothing for lengths below IOSTREAM_READAHEAD_MIN. Skipping outside
+ * the window restarts the helper at the new offset.
+ * @param iostream
+ * @param len The number of bytes expected to be streamed from here on.
+ * @author Aryan Jassal
+ */
+void iostream_readahead(iostream_t* iostream, const size_t len);
+
+/**
+ * Maps the whole file into memory read-only, so reads decrypt straight out of
+ * the page cache without any read calls. The access pattern is passed on to the
+ * kernel to tune its read-ahead. Writing to a mapped stream drops the mapping,
+ * and the stream carries on with buffered IO. Empty files can't be mapped, and
+ * neither can any file on platforms without mmap, in which case the stream
+ * carries on with buffered IO.
+ * @param iostream
+ * @param access How the stream will move through the file.
+ * @returns True if the file was mapped, false otherwise
+ * @author Aryan Jassal
+ */
+bool iostream_map(iostream_t* iostream, const iostream_access_t access);
+
 /**
  * Reads data from a stream, decrypts it, and returns it in a cleartext buffer.
+ * Small reads are served from the window, which is refilled with a single read
+ * once the stream moves past it. Reads of at least a window are read and
+ * decrypted in-place in the output buffer instead. With the io_uring backend,
+ * reads of at least IOSTREAM_URING_MIN are split into blocks which are read
+ * ahead while the earlier ones are decrypted. Large reads are decrypted on the
+ * thread pool.
  * @param iostream
  * @param len The length of data to read.
  * @param data The output buffer containing the decrypted contents.
@@ -40,13 +211,52 @@ void iostream_init(iostream_t* iostream, FILE* fd, const aes_ctx_t* aes_ctx,
 void iostream_read(iostream_t* iostream, const size_t len, buf_t* data);
 
 /**
- * Writes data to a bin by encrypting it beforehand.
+ * Writes data to a bin by encrypting it beforehand. Small writes are encrypted
+ * into the window and only written out once the stream leaves it, or when the
+ * stream is flushed. Writes of at least a window are staged in a scratch buffer
+ * owned by the stream and written straight away, in the same call as whatever
+ * the window is still holding for the bytes right before them. With the
+ * io_uring backend, writes of at least IOSTREAM_URING_MIN are split into blocks
+ * which are encrypted while the earlier ones are written. Large writes are
+ * encrypted on the thread pool.
  * @param iostream
  * @param data The cleartext to write to file.
  * @author Aryan Jassal
  */
 void iostream_write(iostream_t* iostream, const buf_t* data);
 
+/**
+ * Writes several buffers one after another as a single record. Records smaller
+ * than the window are gathered in it like any other small write. Larger records
+ * are encrypted back to back into the scratch buffer and written with a single
+ * vectored write, along with whatever the window is still holding for the bytes
+ * right before them. Streams over a FILE write the buffers one at a time.
+ * @param iostream
+ * @param data The cleartext buffers, in the order they should be written.
+ * @param count The number of buffers.
+ * @author Aryan Jassal
+ */
+void iostream_writev(iostream_t* iostream, const buf_t** data,
+                     const size_t count);
+
+/**
+ * Writes out any data still waiting in the window, and cuts a direct stream
+ * back to its real length. This must be done before closing the file, unless
+ * the stream is freed first.
+ * @param iostream
+ * @author Aryan Jassal
+ */
+void iostream_flush(iostream_t* iostream);
+
+/**
+ * Cuts the file off at the current offset of the stream, dropping everything
+ * after it. Anything still waiting in the window is written out first. This is
+ * for rewriting a file in place, where the result is shorter than the original.
+ * @param iostream
+ * @author Aryan Jassal
+ */
+void iostream_truncate(iostream_t* iostream);
+
 /**
  * Skips a number of bytes forward in the iostream lazily. This method only
  * updates the offsets, so the next IO operation finalises the seek in the file.
@@ -57,8 +267,29 @@ void iostream_write(iostream_t* iostream, const buf_t* data);
 void iostream_skip(iostream_t* iostream, const size_t n);
 
 /**
- * Free the memory consumed by the db object. Note that this does not remove the
- * db from disk, but only free up the resources consumed by the open db.
+ * Moves the iostream to an offset in the cleartext, either forward or backward.
+ * The keystream of AES-CTR can be generated from any offset, so like skipping,
+ * this only updates the offsets. The window is kept, so going back to a record
+ * which was just read doesn't touch the file again.
+ * @param iostream
+ * @param offset The offset from the start of the encrypted data.
+ * @author Aryan Jassal
+ */
+void iostream_seek(iostream_t* iostream, const size_t offset);
+
+/**
+ * Gets the current offset of the iostream in the cleartext.
+ * @param iostream
+ * @returns The offset from the start of the encrypted data
+ * @author Aryan Jassal
+ */
+size_t iostream_tell(const iostream_t* iostream);
+
+/**
+ * Free the memory consumed by the iostream. This flushes pending writes, unmaps
+ * the file and stops the read-ahead helper if one was started. Note that this
+ * does not close the file, and the file must still be open if anything was
+ * written.
  * @param iostream
  * @author Aryan Jassal
  */
@@ -0,0 +1,59 @@
+/**
+ * A double-buffered pipeline for streaming a known amount of data. A producer
+ * thread fills one buffer, for example by reading and decrypting the next part
+ * of a bin, while the caller consumes the other one, so the file IO, the cipher
+ * and whatever the data is written to all run at the same time. The whole
+ * stream should then take about as long as its slowest stage, rather than the
+ * sum of all of them.
+ *
+ * Streams shorter than PIPELINE_MIN aren't worth a thread, and neither is any
+ * stream if the producer can't be started. In those cases the buffers are
+ * filled on the calling thread as they are asked for, so callers don't need to
+ * handle that themselves.
+ */
+
+#ifndef __CORE_PIPELINE_H__
+#define __CORE_PIPELINE_H__
+
+#include "core/buffer.h"
+#include "stddefs.h"
+
+/* Fills the buffer with the next len bytes, growing it if it is too small */
+typedef void (*pipeline_fill_t)(void* args, const size_t len, buf_t* data);
+
+typedef struct pipeline_t pipeline_t;
+
+/**
+ * Starts a pipeline over a stream. The fill function is called once for every
+ * chunk in stream order, and from the producer thread if there is one, so the
+ * arguments must not be touched by the caller until the pipeline is freed.
+ * @param fill The function which produces the data
+ * @param args The arguments passed to every call of the fill function
+ * @param len The total number of bytes in the stream
+ * @param chunk The largest number of bytes produced by each fill
+ * @returns The pipeline, which must be freed with pipeline_free()
+ * @author Aryan Jassal
+ */
+pipeline_t* pipeline_start(pipeline_fill_t fill, void* args, const size_t len,
+                           const size_t chunk);
+
+/**
+ * Gets the next chunk of the stream, waiting for the producer if it has fallen
+ * behind. The chunk stays valid until the next call, which hands its buffer
+ * back to the producer.
+ * @param pipeline
+ * @returns The next chunk, or NULL once the whole stream has been consumed
+ * @author Aryan Jassal
+ */
+const buf_t* pipeline_next(pipeline_t* pipeline);
+
+/**
+ * Stops the producer and frees the pipeline. The stream doesn't need to have
+ * been consumed fully, but the producer will finish the chunk it is working on
+ * before stopping.
+ * @param pipeline
+ * @author Aryan Jassal
+ */
+void pipeline_free(pipeline_t* pipeline);
+
+#endif
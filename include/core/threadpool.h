@@ -0,0 +1,39 @@
+/**
+ * A fixed pool of worker threads for splitting CPU-bound work, like encrypting
+ * large buffers, across cores. The pool is started on first use and lives
+ * until the program exits.
+ *
+ * The pool has one thread per online processor, including the calling thread,
+ * so a single-core machine never starts any workers. The number of threads can
+ * be overridden by setting the TRANSCODINE_THREADS environment variable, where
+ * a value of 1 disables the pool entirely.
+ */
+
+#ifndef __CORE_THREADPOOL_H__
+#define __CORE_THREADPOOL_H__
+
+#include "stddefs.h"
+
+typedef void (*threadpool_task_t)(void* args, const size_t index);
+
+/**
+ * Returns the number of threads which run tasks, including the calling thread.
+ * This starts the pool if it hasn't been started yet.
+ * @returns The number of threads, which is always at least one
+ * @author Aryan Jassal
+ */
+size_t threadpool_size();
+
+/**
+ * Runs a task once for each index from zero up to the count, spreading the
+ * indices over the pool. The calling thread takes part in the work, and this
+ * only returns after every index has been run. Batches from different threads
+ * are run one after another, so a task must not call this itself.
+ * @param task The function to run for each index
+ * @param args The arguments passed to every invocation of the task
+ * @param count The number of indices to run
+ * @author Aryan Jassal
+ */
+void threadpool_run(threadpool_task_t task, void* args, const size_t count);
+
+#endif
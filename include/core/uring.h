@@ -0,0 +1,99 @@
+/**
+ * A minimal wrapper around io_uring for keeping several reads or writes of one
+ * file in flight at once. Each ring owns a set of equally sized buffers, which
+ * are registered with the kernel along with the file, so the kernel doesn't
+ * need to map the memory or look up the file again for every request.
+ *
+ * Requests are always made against a buffer slot. A slot holds at most one
+ * request at a time, and the caller gets the slot back when its request
+ * completes. The ring talks to the kernel through raw system calls, so it
+ * doesn't need liburing. On kernels without io_uring, or where it has been
+ * disabled, rings can't be created and callers are expected to fall back to
+ * synchronous IO.
+ */
+
+#ifndef __CORE_URING_H__
+#define __CORE_URING_H__
+
+#include "stddefs.h"
+
+typedef struct uring_t uring_t;
+
+/**
+ * Checks if io_uring can be used on this system. The result is cached after
+ * the first check.
+ * @returns True if rings can be created, false otherwise
+ * @author Aryan Jassal
+ */
+bool uring_available();
+
+/**
+ * Creates a ring for a file, along with its registered buffers.
+ * @param fd The file descriptor to register
+ * @param slots The number of buffers, which is also the number of requests
+ * which can be in flight at once
+ * @param slot_size The size of each buffer
+ * @returns The ring, or NULL if it couldn't be set up
+ * @author Aryan Jassal
+ */
+uring_t* uring_create(const int fd, const size_t slots, const size_t slot_size);
+
+/**
+ * Gets the registered buffer for a slot.
+ * @param ring
+ * @param slot
+ * @returns The start of the buffer
+ * @author Aryan Jassal
+ */
+uint8_t* uring_buffer(const uring_t* ring, const size_t slot);
+
+/**
+ * Queues a read from the file into the buffer of a slot. The request is only
+ * sent to the kernel by uring_submit() or uring_wait().
+ * @param ring
+ * @param slot The slot to read into, which must not have a request in flight
+ * @param len The number of bytes to read, up to the slot size
+ * @param offset The file offset to read from
+ * @author Aryan Jassal
+ */
+void uring_read(uring_t* ring, const size_t slot, const size_t len,
+                const size_t offset);
+
+/**
+ * Queues a write of the buffer of a slot to the file. The request is only sent
+ * to the kernel by uring_submit() or uring_wait().
+ * @param ring
+ * @param slot The slot to write from, which must not have a request in flight
+ * @param len The number of bytes to write, up to the slot size
+ * @param offset The file offset to write to
+ * @author Aryan Jassal
+ */
+void uring_write(uring_t* ring, const size_t slot, const size_t len,
+                 const size_t offset);
+
+/**
+ * Sends all queued requests to the kernel without waiting for them.
+ * @param ring
+ * @author Aryan Jassal
+ */
+void uring_submit(uring_t* ring);
+
+/**
+ * Waits for the next request to complete, sending any queued requests first.
+ * Requests can complete in any order.
+ * @param ring
+ * @param slot The slot of the completed request
+ * @returns The number of bytes transferred, or a negative error number
+ * @author Aryan Jassal
+ */
+long uring_wait(uring_t* ring, size_t* slot);
+
+/**
+ * Frees the ring, waiting for any requests still in flight first. This does
+ * not close the file.
+ * @param ring
+ * @author Aryan Jassal
+ */
+void uring_free(uring_t* ring);
+
+#endif
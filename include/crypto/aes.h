@@ -11,6 +11,17 @@
  * for encryption/decryption of a bytestream. It does not require a stream,
  * rather just the encryption method as it is a symmetric XOR operation.
  *
+ * Two portable backends are provided. The reference backend follows the spec
+ * byte-by-byte and is kept around to validate the other backends against. The
+ * T-table backend merges SubBytes, ShiftRows, and MixColumns into four 32-bit
+ * table lookups per column, and is several times faster.
+ *
+ * On x86 processors with AES-NI, a hardware backend is used instead. Elsewhere,
+ * a bitsliced backend is used, which is slower than the T-tables but runs in
+ * constant time, as it never indexes memory using secret data. The backend is
+ * selected automatically at first use, and can be overridden by setting the
+ * TRANSCODINE_AES_BACKEND environment variable.
+ *
  * The whitepaper for the AES encryption protocol can be found at
  * https://csrc.nist.gov/files/pubs/fips/197/final/docs/fips-197.pdf.
  */
@@ -22,10 +33,38 @@
 #include "core/buffer.h"
 #include "stddefs.h"
 
+typedef enum {
+  AES_BACKEND_REFERENCE,
+  AES_BACKEND_TTABLE,
+  AES_BACKEND_AESNI,
+  AES_BACKEND_BITSLICE
+} aes_backend_t;
+
 typedef struct {
   uint8_t round_keys[(AES_ROUNDS + 1) * AES_KEY_SIZE];
+  uint32_t round_words[AES_NB * (AES_NR + 1)];
+  uint64_t sliced_keys[(AES_NR + 1) * AES_BITSLICE_WORDS];
 } aes_ctx_t;
 
+/**
+ * Selects the backend used by all subsequent AES operations. All the backends
+ * produce identical output and share the same key schedule layout, so this is
+ * only useful for testing and benchmarking. It must not be called while other
+ * threads are using AES.
+ * @param backend The backend to use
+ * @returns True if the backend was selected, false if it is unsupported
+ * @author Aryan Jassal
+ */
+bool aes_set_backend(const aes_backend_t backend);
+
+/**
+ * Returns the backend currently used by AES operations. The backend will be
+ * selected automatically if this is the first use.
+ * @returns The active backend
+ * @author Aryan Jassal
+ */
+aes_backend_t aes_get_backend();
+
 /**
  * Initialises the AES context by performing a key expansion routine. See
  * Section 5.2.2.
@@ -52,4 +91,18 @@ void aes_init(aes_ctx_t* ctx, const buf_t* key);
  */
 void aes_encrypt(const aes_ctx_t* ctx, const buf_t* in, buf_t* out);
 
+/**
+ * Encrypts a run of independent 16-byte blocks stored back-to-back in memory.
+ * Unlike aes_encrypt(), this skips all the buffer validation and dispatches to
+ * the backend only once, so it is intended for hot loops like keystream
+ * generation which already know their sizes.
+ * @param ctx An initialised AES context
+ * @param in The blocks to encrypt
+ * @param out The encrypted blocks. Can be the same as the input.
+ * @param blocks The number of blocks to encrypt
+ * @author Aryan Jassal
+ */
+void aes_encrypt_blocks(const aes_ctx_t* ctx, const uint8_t* in, uint8_t* out,
+                        const size_t blocks);
+
 #endif
@@ -0,0 +1,54 @@
+/**
+ * Constant-time AES-128 backend using bitslicing. Eight blocks are transposed
+ * so that each plane holds one bit position of every byte, and the S-box is
+ * evaluated as a boolean circuit over the planes. There are no table lookups
+ * or branches which depend on the key or the data, so this is safe to use on
+ * processors without AES-NI, where the T-tables would leak timing through the
+ * cache.
+ *
+ * The planes are built from plain 64-bit words, so this works on every platform
+ * without any intrinsics. A schedule expanded here uses the same byte layout as
+ * the other backends.
+ *
+ * The S-box circuit is the one by Boyar and Peralta, which can be found at
+ * https://eprint.iacr.org/2011/332.pdf.
+ */
+
+#ifndef __CRYPTO_AES_BITSLICE_H__
+#define __CRYPTO_AES_BITSLICE_H__
+
+#include "constants.h"
+#include "stddefs.h"
+
+/**
+ * Expands a 16-byte key into the full AES-128 key schedule without using any
+ * table lookups.
+ * @param key The 16-byte key
+ * @param round_keys The output schedule of AES_KEY_SCHEDULE_SIZE bytes
+ * @author Aryan Jassal
+ */
+void aes_bs_expand_key(const uint8_t* key, uint8_t* round_keys);
+
+/**
+ * Converts a key schedule into the bitsliced form, with every key bit
+ * broadcast across the blocks sharing a word.
+ * @param round_keys The expanded key schedule
+ * @param sliced_keys The output of (AES_NR + 1) * AES_BITSLICE_WORDS words
+ * @author Aryan Jassal
+ */
+void aes_bs_slice_keys(const uint8_t* round_keys, uint64_t* sliced_keys);
+
+/**
+ * Encrypts a run of 16-byte blocks, eight at a time. A trailing batch with
+ * fewer blocks still costs as much as a full one, so callers should batch
+ * blocks wherever they can.
+ * @param sliced_keys The bitsliced key schedule
+ * @param in The blocks to encrypt
+ * @param out The encrypted blocks. Can be the same as the input.
+ * @param blocks The number of blocks to encrypt
+ * @author Aryan Jassal
+ */
+void aes_bs_encrypt(const uint64_t* sliced_keys, const uint8_t* in,
+                    uint8_t* out, size_t blocks);
+
+#endif
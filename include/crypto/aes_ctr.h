@@ -20,7 +20,7 @@
  * urandom.
  *
  * @param ctx An initialised AES context
- * @param iv A 16-byte buffer tracking the counter. Will be mutated.
+ * @param iv A 16-byte buffer containing the initial counter. It isn't modified.
  * @param offset The offset of the cipher to start decryption from
  * @param input The input buffer
  * @param output The output buffer
@@ -29,6 +29,37 @@
 void aes_ctr_crypt(const aes_ctx_t* ctx, buf_t* iv, const size_t offset,
                    const buf_t* input, buf_t* output);
 
+/**
+ * Encrypts and decrypts a buffer in-place using a private key and a nonce/IV.
+ * This works exactly like aes_ctr_crypt(), but the output overwrites the input,
+ * so no second buffer needs to be allocated.
+ *
+ * @param ctx An initialised AES context
+ * @param iv A 16-byte buffer containing the initial counter
+ * @param offset The offset of the cipher to start decryption from
+ * @param data The data to transform. Its size and capacity remain the same.
+ * @author Aryan Jassal
+ */
+void aes_ctr_crypt_inplace(const aes_ctx_t* ctx, const buf_t* iv,
+                           const size_t offset, buf_t* data);
+
+/**
+ * Applies the keystream to raw memory, starting at the given offset into the
+ * stream. Every input byte is read before the matching output byte is written,
+ * so the input and output can point to the same memory.
+ *
+ * @param ctx An initialised AES context
+ * @param iv The 16-byte initial counter
+ * @param offset The offset of the cipher to start from
+ * @param in The data to transform
+ * @param out Where the transformed data is written
+ * @param len The number of bytes to transform
+ * @author Aryan Jassal
+ */
+void aes_ctr_transform(const aes_ctx_t* ctx, const uint8_t* iv,
+                       const size_t offset, const uint8_t* in, uint8_t* out,
+                       size_t len);
+
 /**
  * Alias of aes_ctr_crypt()
  *
@@ -40,7 +71,7 @@ void aes_ctr_crypt(const aes_ctx_t* ctx, buf_t* iv, const size_t offset,
  * urandom.
  *
  * @param ctx An initialised AES context
- * @param iv A 16-byte buffer tracking the counter. Will be mutated.
+ * @param iv A 16-byte buffer containing the initial counter. It isn't modified.
  * @param offset The offset of the cipher to start decryption from
  * @param input The input buffer
  * @param output The output buffer
@@ -60,7 +91,7 @@ void aes_ctr_encrypt(const aes_ctx_t* ctx, buf_t* iv, const size_t offset,
  * urandom.
  *
  * @param ctx An initialised AES context
- * @param iv A 16-byte buffer tracking the counter. Will be mutated.
+ * @param iv A 16-byte buffer containing the initial counter. It isn't modified.
  * @param offset The offset of the cipher to start decryption from
  * @param input The input buffer
  * @param output The output buffer
@@ -0,0 +1,59 @@
+/**
+ * Hardware AES-128 backend using the AES-NI instruction set on x86 processors.
+ * The round keys use exactly the same layout as the portable key schedule, so a
+ * context expanded by either backend can be used by the other.
+ *
+ * The functions here must only be called after aes_ni_available() has returned
+ * true. On other architectures, or with compilers which do not support the
+ * required intrinsics, aes_ni_available() always returns false and the rest of
+ * the functions will throw.
+ */
+
+#ifndef __CRYPTO_AES_NI_H__
+#define __CRYPTO_AES_NI_H__
+
+#include "constants.h"
+#include "stddefs.h"
+
+/**
+ * Checks if the processor supports the AES-NI instructions using cpuid.
+ * @returns True if AES-NI can be used, false otherwise
+ * @author Aryan Jassal
+ */
+bool aes_ni_available();
+
+/**
+ * Expands a 16-byte key into the full AES-128 key schedule using the
+ * AESKEYGENASSIST instruction.
+ * @param key The 16-byte key
+ * @param round_keys The output schedule of AES_KEY_SCHEDULE_SIZE bytes
+ * @author Aryan Jassal
+ */
+void aes_ni_expand_key(const uint8_t* key, uint8_t* round_keys);
+
+/**
+ * Encrypts a single 16-byte block.
+ * @param round_keys The expanded key schedule
+ * @param in The block to encrypt
+ * @param out The encrypted block. Can be the same as the input.
+ * @author Aryan Jassal
+ */
+void aes_ni_encrypt(const uint8_t* round_keys, const uint8_t* in,
+                    uint8_t* out);
+
+/**
+ * Runs AES-CTR over a number of whole blocks. Eight counter blocks are kept in
+ * flight at once to hide the latency of the AESENC instruction. The counter is
+ * treated as a 128-bit big-endian integer and is advanced past the last block
+ * processed.
+ * @param round_keys The expanded key schedule
+ * @param counter The 16-byte counter block. Will be mutated.
+ * @param in The input data
+ * @param out The output data. Can be the same as the input.
+ * @param blocks The number of 16-byte blocks to process
+ * @author Aryan Jassal
+ */
+void aes_ni_ctr(const uint8_t* round_keys, uint8_t* counter, const uint8_t* in,
+                uint8_t* out, size_t blocks);
+
+#endif
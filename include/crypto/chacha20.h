@@ -0,0 +1,66 @@
+/**
+ * ChaCha20 stream cipher, as described in RFC 8439. It only uses additions,
+ * rotations, and XORs, so it runs in constant time on every processor and is
+ * much faster than a software AES when there is no AES-NI.
+ *
+ * The 16-byte IV fills the last four words of the state. The first eight bytes
+ * are a little-endian 64-bit block counter, and the last eight are the nonce.
+ * This is the same layout as the 16-byte IV used by OpenSSL.
+ *
+ * Several blocks are generated at once using SSE2 or AVX2 when the processor
+ * supports them, with a portable version for everything else.
+ *
+ * @see https://www.rfc-editor.org/rfc/rfc8439
+ */
+
+#ifndef __CRYPTO_CHACHA20_H__
+#define __CRYPTO_CHACHA20_H__
+
+#include "constants.h"
+#include "core/buffer.h"
+#include "stddefs.h"
+
+typedef struct {
+  uint32_t key[CHACHA20_KEY_SIZE / 4];
+} chacha20_ctx_t;
+
+/**
+ * Initialises the context with a 32-byte key.
+ * @param ctx The context to initialise
+ * @param key A buffer containing CHACHA20_KEY_SIZE bytes
+ * @author Aryan Jassal
+ */
+void chacha20_init(chacha20_ctx_t* ctx, const buf_t* key);
+
+/**
+ * Applies the keystream to raw memory, starting at the given offset into the
+ * stream. Every input byte is read before the matching output byte is written,
+ * so the input and output can point to the same memory.
+ *
+ * @param ctx An initialised ChaCha20 context
+ * @param iv The 16-byte initial counter and nonce
+ * @param offset The offset of the cipher to start from
+ * @param in The data to transform
+ * @param out Where the transformed data is written
+ * @param len The number of bytes to transform
+ * @author Aryan Jassal
+ */
+void chacha20_transform(const chacha20_ctx_t* ctx, const uint8_t* iv,
+                        const size_t offset, const uint8_t* in, uint8_t* out,
+                        size_t len);
+
+/**
+ * Encrypts and decrypts a buffer. Like AES-CTR, encryption and decryption are
+ * the same operation.
+ *
+ * @param ctx An initialised ChaCha20 context
+ * @param iv A 16-byte buffer containing the initial counter and nonce
+ * @param offset The offset of the cipher to start from
+ * @param input The input buffer
+ * @param output The output buffer. Can be the same as the input buffer.
+ * @author Aryan Jassal
+ */
+void chacha20_crypt(const chacha20_ctx_t* ctx, const buf_t* iv,
+                    const size_t offset, const buf_t* input, buf_t* output);
+
+#endif
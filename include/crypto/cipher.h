@@ -0,0 +1,90 @@
+/**
+ * The stream ciphers which can encrypt a bin or a database. Both ciphers turn a
+ * key and a 16-byte IV into a keystream which can be entered at any offset, so
+ * callers like the iostream work the same way regardless of which one is used.
+ *
+ * AES-CTR is the default, and is the fastest on processors with AES-NI.
+ * ChaCha20 is faster on processors without any AES hardware, and never depends
+ * on lookup tables for speed.
+ */
+
+#ifndef __CRYPTO_CIPHER_H__
+#define __CRYPTO_CIPHER_H__
+
+#include "core/buffer.h"
+#include "crypto/aes.h"
+#include "crypto/chacha20.h"
+
+typedef enum { CIPHER_AES_CTR, CIPHER_CHACHA20 } cipher_t;
+
+typedef struct {
+  cipher_t type;
+  aes_ctx_t aes;
+  chacha20_ctx_t chacha20;
+} cipher_ctx_t;
+
+/**
+ * Initialises a cipher from a 16-byte key. AES uses the key directly, while
+ * ChaCha20 derives its 32-byte key from it using HMAC, so every cipher can be
+ * used with the keys already stored for the bins.
+ * @param ctx The cipher context to initialise
+ * @param type The cipher to use
+ * @param key A buffer containing AES_KEY_SIZE bytes
+ * @author Aryan Jassal
+ */
+void cipher_init(cipher_ctx_t* ctx, const cipher_t type, const buf_t* key);
+
+/**
+ * Applies the keystream to raw memory, starting at the given offset into the
+ * stream. This always runs on the calling thread, so it is safe to use from
+ * tasks running on the thread pool.
+ *
+ * @param ctx An initialised cipher context
+ * @param iv The 16-byte initial counter
+ * @param offset The offset of the cipher to start from
+ * @param in The data to transform
+ * @param out Where the transformed data is written. Can be the same as the
+ * input.
+ * @param len The number of bytes to transform
+ * @author Aryan Jassal
+ */
+void cipher_transform(const cipher_ctx_t* ctx, const uint8_t* iv,
+                      const size_t offset, const uint8_t* in, uint8_t* out,
+                      const size_t len);
+
+/**
+ * Works like cipher_transform(), but inputs larger than
+ * CIPHER_PARALLEL_THRESHOLD are split into slices which are transformed on the
+ * thread pool. Each slice starts on a block boundary, so the output is
+ * identical to the single-threaded version. The pool only runs one batch at a
+ * time, so this must never be called from a task running on the pool.
+ *
+ * @param ctx An initialised cipher context
+ * @param iv The 16-byte initial counter
+ * @param offset The offset of the cipher to start from
+ * @param in The data to transform
+ * @param out Where the transformed data is written. Can be the same as the
+ * input.
+ * @param len The number of bytes to transform
+ * @author Aryan Jassal
+ */
+void cipher_transform_parallel(const cipher_ctx_t* ctx, const uint8_t* iv,
+                               const size_t offset, const uint8_t* in,
+                               uint8_t* out, const size_t len);
+
+/**
+ * Encrypts and decrypts a buffer starting at the given offset into the stream.
+ * This works like cipher_transform(), but checks the buffers and grows the
+ * output buffer if needed.
+ *
+ * @param ctx An initialised cipher context
+ * @param iv A 16-byte buffer containing the initial counter
+ * @param offset The offset of the cipher to start from
+ * @param input The input buffer
+ * @param output The output buffer. Can be the same as the input buffer.
+ * @author Aryan Jassal
+ */
+void cipher_crypt(const cipher_ctx_t* ctx, const buf_t* iv, const size_t offset,
+                  const buf_t* input, buf_t* output);
+
+#endif
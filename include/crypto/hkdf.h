@@ -0,0 +1,52 @@
+/**
+ * HMAC-based key derivation, as described in RFC 5869. Unlike PBKDF2, HKDF is
+ * not designed to slow down guessing. It splits a secret which is already hard
+ * to guess, like the output of PBKDF2, into any number of independent keys for
+ * the cost of a few HMACs each. Each key is bound to a different label, so
+ * learning one of them says nothing about the others.
+ *
+ * @see https://www.rfc-editor.org/rfc/rfc5869
+ */
+
+#ifndef __CRYPTO_HKDF_H__
+#define __CRYPTO_HKDF_H__
+
+#include "core/buffer.h"
+
+/**
+ * Concentrates the entropy of the input key material into a 32-byte
+ * pseudorandom key. This can be skipped if the input is already uniformly
+ * random, like the output of PBKDF2.
+ * @param salt An optional salt. Set to NULL to use a zeroed salt.
+ * @param ikm The input key material
+ * @param prk The output pseudorandom key
+ * @author Aryan Jassal
+ */
+void hkdf_sha256_extract(const buf_t* salt, const buf_t* ikm, buf_t* prk);
+
+/**
+ * Expands a pseudorandom key into a key bound to a label. The output buffer is
+ * cleared before the key is written to it.
+ * @param prk A pseudorandom key of at least 32 bytes
+ * @param info The label which sets this key apart from others
+ * @param out The output key
+ * @param len The length of the output key, up to 255 * 32 bytes
+ * @author Aryan Jassal
+ */
+void hkdf_sha256_expand(const buf_t* prk, const buf_t* info, buf_t* out,
+                        const size_t len);
+
+/**
+ * Derives a key bound to a label by extracting then expanding the input key
+ * material.
+ * @param salt An optional salt. Set to NULL to use a zeroed salt.
+ * @param ikm The input key material
+ * @param info The label which sets this key apart from others
+ * @param out The output key
+ * @param len The length of the output key, up to 255 * 32 bytes
+ * @author Aryan Jassal
+ */
+void hkdf_sha256(const buf_t* salt, const buf_t* ikm, const buf_t* info,
+                 buf_t* out, const size_t len);
+
+#endif
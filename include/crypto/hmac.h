@@ -1,7 +1,20 @@
 #ifndef __CRYPTO_HMAC_H__
 #define __CRYPTO_HMAC_H__
 
+#include "constants.h"
 #include "core/buffer.h"
+#include "crypto/sha256.h"
+
+/**
+ * A keyed HMAC. The key only affects the first block of the inner and outer
+ * hashes, so the SHA256 states after those blocks are computed once by
+ * hmac_sha256_init() and every message under the key starts from them.
+ */
+typedef struct {
+  uint32_t inner[8];
+  uint32_t outer[8];
+  sha256_ctx_t sha;
+} hmac_sha256_ctx_t;
 
 /**
  * Returns a HMAC SHA256 hash of the input data based on a key. The key should
@@ -14,4 +27,60 @@
  */
 void hmac_sha256_hash(const buf_t* key, const buf_t* data, buf_t* out);
 
-#endif
\ No newline at end of file
+/**
+ * Initialises a HMAC context with a key and starts the first message. Every
+ * message must be finished using hmac_sha256_final().
+ * @param ctx Context (mutated in-place)
+ * @param key The security key
+ * @author Aryan Jassal
+ */
+void hmac_sha256_init(hmac_sha256_ctx_t* ctx, const buf_t* key);
+
+/**
+ * Starts a new message under the same key, without processing the key again.
+ * The previous message must have been finished using hmac_sha256_final().
+ * @param ctx An initialised context (mutated in-place)
+ * @author Aryan Jassal
+ */
+void hmac_sha256_reset(hmac_sha256_ctx_t* ctx);
+
+/**
+ * Adds data to the current message.
+ * @param ctx An initialised context (mutated in-place)
+ * @param data The data to add
+ * @author Aryan Jassal
+ */
+void hmac_sha256_update(hmac_sha256_ctx_t* ctx, const buf_t* data);
+
+/**
+ * Finishes the current message and writes out the 32-byte MAC. The key stays
+ * loaded, so hmac_sha256_reset() can start another message.
+ * @param ctx An initialised context (mutated in-place)
+ * @param out The output hash
+ * @author Aryan Jassal
+ */
+void hmac_sha256_final(hmac_sha256_ctx_t* ctx, buf_t* out);
+
+/**
+ * Computes the MAC of a single 32-byte message, like the digest of a previous
+ * HMAC, using exactly two compressions. This doesn't touch the current message
+ * of the context, so it can be used between the other calls.
+ * @param ctx An initialised context
+ * @param in The 32-byte message
+ * @param out The 32-byte MAC. Can be the same as the input.
+ * @author Aryan Jassal
+ */
+void hmac_sha256_hash_digest(const hmac_sha256_ctx_t* ctx, const uint8_t* in,
+                             uint8_t* out);
+
+/**
+ * Lays out a 32-byte message at the start of a block as the final block of a
+ * HMAC hash, with the padding for the key block in front of it. Callers which
+ * compress the block themselves, like the multi-buffer PBKDF2, start from the
+ * midstates of the context.
+ * @param block The 64-byte block, with the message in the first 32 bytes
+ * @author Aryan Jassal
+ */
+void hmac_sha256_pad_digest(uint8_t* block);
+
+#endif
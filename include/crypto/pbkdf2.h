@@ -3,8 +3,33 @@
 
 #include "core/buffer.h"
 
+/* A single derivation to be run by pbkdf2_hmac_sha256_hash_many() */
+typedef struct {
+  const buf_t* data;
+  const buf_t* salt;
+  size_t iterations;
+  buf_t* out;
+  size_t dklen;
+} pbkdf2_job_t;
+
 void pbkdf2_hmac_sha256_hash(const buf_t* data, const buf_t* salt,
                              const size_t iterations, buf_t* out,
                              const size_t dklen);
 
+/**
+ * Runs several independent derivations at once. The output of each job is
+ * identical to calling pbkdf2_hmac_sha256_hash() with the same arguments.
+ *
+ * Every block of every job is its own chain of HMAC iterations, and the chains
+ * are spread over the thread pool. When there are more chains than threads,
+ * each thread advances its chains in lockstep through the multi-buffer SHA256,
+ * unless the hardware SHA256 backend is active, as that is faster still.
+ *
+ * @param jobs The derivations to run
+ * @param count The number of jobs
+ * @author Aryan Jassal
+ */
+void pbkdf2_hmac_sha256_hash_many(const pbkdf2_job_t* jobs,
+                                  const size_t count);
+
 #endif
\ No newline at end of file
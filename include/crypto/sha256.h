@@ -4,6 +4,9 @@
  *
  * Note: the Gamma functions aren't formally in the spec, but it is a convention
  * use for message expansion rounds in SHA.
+ *
+ * On x86 processors with the SHA extensions, the compression function runs in
+ * hardware. Otherwise, the portable implementation is used.
  */
 
 #ifndef __CRYPTO_SHA256_H__
@@ -11,6 +14,9 @@
 
 #include "constants.h"
 #include "core/buffer.h"
+#include "stddefs.h"
+
+typedef enum { SHA256_BACKEND_PORTABLE, SHA256_BACKEND_SHANI } sha256_backend_t;
 
 typedef struct {
   uint64_t length;
@@ -22,6 +28,43 @@ typedef struct {
   uint8_t bytes[SHA256_HASH_SIZE];
 } sha256_hash_t;
 
+/* The round constants from Section 4.2.2, shared with the other backends */
+extern const uint32_t sha256_round_constants[64];
+
+/* The initial hash value from Section 5.3.3 */
+extern const uint32_t sha256_initial_state[8];
+
+/**
+ * Selects the backend used by all subsequent SHA256 operations. Both backends
+ * produce identical output, so this is only useful for testing and
+ * benchmarking. Don't switch backends while a context is in use on another
+ * thread.
+ * @param backend The backend to use
+ * @returns True if the backend was selected, false if it is unsupported
+ * @author Aryan Jassal
+ */
+bool sha256_set_backend(const sha256_backend_t backend);
+
+/**
+ * Returns the backend currently used by SHA256 operations. The backend will be
+ * selected automatically if this is the first use.
+ * @returns The active backend
+ * @author Aryan Jassal
+ */
+sha256_backend_t sha256_get_backend();
+
+/**
+ * Compresses whole 64-byte blocks directly into a state using the active
+ * backend. This skips the buffering and padding done by the context, so it is
+ * meant for callers which lay out their own blocks.
+ * @param state The eight state words. Will be mutated.
+ * @param blocks The message blocks
+ * @param count The number of 64-byte blocks to process
+ * @author Aryan Jassal
+ */
+void sha256_compress(uint32_t* state, const uint8_t* blocks,
+                     const size_t count);
+
 /**
  * Initialises or resets a SHA256 context.
  * @param ctx Context (mutated in-place)
@@ -0,0 +1,38 @@
+/**
+ * Multi-buffer SHA256 compression. Independent messages are hashed side by side
+ * with each SIMD lane holding the state of a different message, so several
+ * blocks are compressed for roughly the cost of one. This only helps when there
+ * are several unrelated hashes to compute at the same time, like the chains of
+ * separate PBKDF2 derivations.
+ *
+ * Up to four messages are compressed using SSE2, and up to eight using AVX2.
+ * On processors without either, or on other architectures, the messages are
+ * compressed one after another using sha256_compress().
+ */
+
+#ifndef __CRYPTO_SHA256_MB_H__
+#define __CRYPTO_SHA256_MB_H__
+
+#include "constants.h"
+#include "stddefs.h"
+
+/**
+ * Checks if the processor supports any of the SIMD kernels. If this returns
+ * false, sha256_mb_compress() still works but gives no speedup.
+ * @returns True if the messages can be compressed in parallel
+ * @author Aryan Jassal
+ */
+bool sha256_mb_available();
+
+/**
+ * Compresses one 64-byte block into each of the given states. Each state is
+ * independent and uses the same layout as a SHA256 context.
+ * @param states The eight state words for each lane. Will be mutated.
+ * @param blocks The message block for each lane
+ * @param lanes The number of lanes, up to SHA256_MB_LANES
+ * @author Aryan Jassal
+ */
+void sha256_mb_compress(uint32_t states[][8], const uint8_t* const blocks[],
+                        const size_t lanes);
+
+#endif
@@ -0,0 +1,36 @@
+/**
+ * Hardware SHA-256 compression using the Intel SHA extensions on x86
+ * processors. The state uses the same layout as the portable implementation,
+ * so a context can be moved between the two at any block boundary.
+ *
+ * The functions here must only be called after sha256_ni_available() has
+ * returned true. On other architectures, or with compilers which do not support
+ * the required intrinsics, sha256_ni_available() always returns false and the
+ * compression function will throw.
+ */
+
+#ifndef __CRYPTO_SHA256_NI_H__
+#define __CRYPTO_SHA256_NI_H__
+
+#include "constants.h"
+#include "stddefs.h"
+
+/**
+ * Checks if the processor supports the SHA extensions, along with the SSSE3 and
+ * SSE4.1 instructions used to shuffle the state, using cpuid.
+ * @returns True if the SHA extensions can be used, false otherwise
+ * @author Aryan Jassal
+ */
+bool sha256_ni_available();
+
+/**
+ * Compresses a number of whole 64-byte blocks into the state using the
+ * SHA256RNDS2, SHA256MSG1, and SHA256MSG2 instructions.
+ * @param state The eight state words. Will be mutated.
+ * @param blocks The message blocks
+ * @param count The number of 64-byte blocks to process
+ * @author Aryan Jassal
+ */
+void sha256_ni_compress(uint32_t* state, const uint8_t* blocks, size_t count);
+
+#endif
@@ -36,13 +36,14 @@
 
 #include "core/buffer.h"
 #include "core/iostream.h"
-#include "crypto/aes.h"
+#include "crypto/cipher.h"
 
 typedef struct {
   buf_t aes_iv;
-  aes_ctx_t aes_ctx;
+  cipher_ctx_t cipher;
   const char *encrypted_path;
   const char *working_path;
+  int fd;
 } db_t;
 
 typedef struct {
@@ -71,6 +72,16 @@ void db_init(db_t *db);
  */
 void db_derive_key(const buf_t *kek, buf_t *key);
 
+/**
+ * Re-encrypts a database created by a legacy agent under the key from
+ * db_derive_key(). This is a noop if the database doesn't exist or already
+ * uses the new key.
+ * @param kek The input KEK
+ * @param encrypted_path The location of the encrypted database state
+ * @author Aryan Jassal
+ */
+void db_migrate_key(const buf_t *kek, const char *encrypted_path);
+
 /**
  * Create an encrypted database at the specified location. In the beginning, the
  * database will be empty. This should only be run at bootstrap time. Do not use
@@ -95,7 +106,8 @@ void db_bootstrap(db_t *db, const buf_t *db_key, const char *encrypted_path);
 /**
  * Opens an encrypted database into a working path, then populates the in-memory
  * db object. The database state isn't affected and only updates once the
- * database is closed.
+ * database is closed. The working copy is kept open until then, and every
+ * operation on the database goes through that one descriptor.
  * @param db
  * @param db_key The key used to decrypt the database
  * @param encrypted_path The location of the encrypted database state
@@ -2,8 +2,22 @@
 #define __TYPEDEFS_H__
 
 #include "core/buffer.h"
+#include "stddefs.h"
 
+/**
+ * The password details stored on disk. The root key is derived from the
+ * password and the password salt, and the password hash and the key wrapping
+ * the KEK are both expanded from it. Agents set up before the root key existed
+ * use a legacy record, where the password hash and the key wrapping the KEK
+ * are separate derivations from the password and the KEK salt.
+ *
+ * The number of PBKDF2 iterations is picked when the password is set, so the
+ * root key takes about as long to derive on any host. Legacy records always
+ * use PBKDF2_ITERATIONS.
+ */
 typedef struct {
+  bool legacy;
+  uint64_t iterations;
   buf_t pass_salt;
   buf_t pass_hash;
   buf_t kek_salt;
@@ -1,17 +1,156 @@
 #include "auth/check.h"
 
 #include <stdio.h>
+#include <string.h>
 
 #include "auth/hash.h"
 #include "constants.h"
 #include "core/buffer.h"
 #include "crypto/xor.h"
+#include "db.h"
 #include "globals.h"
 #include "stddefs.h"
 #include "typedefs.h"
+#include "utils/cli.h"
 #include "utils/io.h"
 #include "utils/throw.h"
 
+/**
+ * Gets the path the auth details are staged at before they replace the real
+ * auth file.
+ * @param path An initialised buffer which receives the path
+ * @author Aryan Jassal
+ */
+static void auth_temp_path(buf_t* path) {
+  const char* auth_path = buf_to_cstr(&AUTH_DB_PATH);
+  buf_append(path, auth_path, strlen(auth_path));
+  buf_append(path, ".tmp", 4);
+  buf_write(path, 0);
+}
+
+/**
+ * Writes the auth details to a file without touching the real auth file.
+ * @param auth
+ * @param path
+ * @author Aryan Jassal
+ */
+static void write_auth_file(const auth_t* auth, const char* path) {
+  if (auth->legacy) throw("Cannot write legacy auth details");
+  FILE* file = fopen(path, "wb");
+  if (!file) throw("Failed to write to file");
+  fwrite(AUTH_MAGIC_VERSION, sizeof(uint8_t), AUTH_MAGIC_SIZE, file);
+  fwrite(&auth->iterations, sizeof(uint64_t), 1, file);
+  fwrite(auth->pass_salt.data, sizeof(uint8_t), auth->pass_salt.capacity, file);
+  fwrite(auth->pass_hash.data, sizeof(uint8_t), auth->pass_hash.capacity, file);
+  fwrite(auth->kek_hash.data, sizeof(uint8_t), auth->kek_hash.capacity, file);
+  if (fclose(file) != 0) throw("Failed to write to file");
+}
+
+/**
+ * Replaces the real auth file with the staged one in a single step.
+ * @param temp_path The path the auth details were staged at
+ * @author Aryan Jassal
+ */
+static void commit_auth(const buf_t* temp_path) {
+  if (rename(buf_to_cstr(temp_path), buf_to_cstr(&AUTH_DB_PATH)) != 0) {
+    remove(buf_to_cstr(temp_path));
+    throw("Failed to replace auth details");
+  }
+}
+
+/**
+ * Moves a legacy agent over to the current auth format. The root key of a
+ * legacy agent was derived from the KEK salt using the same parameters, so it
+ * carries over and the password doesn't need to be hashed again. This also
+ * means the iteration count isn't calibrated until the password is reset.
+ *
+ * The new record is staged in a temporary file, then the database is
+ * re-encrypted, and only then is the record renamed over the legacy one. The
+ * KEK is the same in both formats, and db_migrate_key() skips a database which
+ * already unlocks with the new key, so the agent can still log in and finish
+ * the migration if it is interrupted at any point.
+ * @param stored The legacy auth record
+ * @param root_key The root key derived from the KEK salt
+ * @param kek The unwrapped KEK
+ * @author Aryan Jassal
+ */
+static void migrate_auth(const auth_t* stored, const buf_t* root_key,
+                         const buf_t* kek) {
+  auth_t migrated;
+  auth_init(&migrated);
+  migrated.iterations = stored->iterations;
+  buf_copy(&migrated.pass_salt, &stored->kek_salt);
+  buf_t wrap_key;
+  buf_initf(&wrap_key, SHA256_HASH_SIZE);
+  expand_root_key(root_key, HKDF_LABEL_VERIFIER, &migrated.pass_hash);
+  expand_root_key(root_key, HKDF_LABEL_KEK_WRAP, &wrap_key);
+  xor_encrypt(kek, &wrap_key, &migrated.kek_hash);
+
+  buf_t temp_path;
+  buf_init(&temp_path, 32);
+  auth_temp_path(&temp_path);
+  write_auth_file(&migrated, buf_to_cstr(&temp_path));
+  db_migrate_key(kek, buf_to_cstr(&STATE_DB_PATH));
+  commit_auth(&temp_path);
+
+  buf_free(&temp_path);
+  buf_free(&wrap_key);
+  auth_free(&migrated);
+  debug("Migrated agent to the current auth format");
+}
+
+/**
+ * Checks a password against a legacy auth record. The KEK is always unwrapped
+ * on success, as it is needed to migrate the agent.
+ * @param stored The legacy auth record
+ * @param password The raw password
+ * @param kek The decrypted kek if needed. Set to NULL to ignore.
+ * @returns True if the password was correct, false otherwise
+ * @author Aryan Jassal
+ */
+static bool check_legacy_password(const auth_t* stored, const buf_t* password,
+                                  buf_t* kek) {
+  buf_t computed_hash, root_key;
+  buf_initf(&computed_hash, SHA256_HASH_SIZE);
+  buf_initf(&root_key, SHA256_HASH_SIZE);
+  pbkdf2_job_t jobs[2];
+  hash_password_job(&jobs[0], password, &stored->pass_salt, stored->iterations,
+                    &computed_hash);
+  hash_password_job(&jobs[1], password, &stored->kek_salt, stored->iterations,
+                    &root_key);
+  hash_passwords(jobs, 2);
+
+  bool result = buf_equal(&computed_hash, &stored->pass_hash);
+  if (result) {
+    buf_t unwrapped;
+    buf_initf(&unwrapped, KEK_SIZE);
+    xor_decrypt(&stored->kek_hash, &root_key, &unwrapped);
+    migrate_auth(stored, &root_key, &unwrapped);
+    if (kek != NULL) buf_copy(kek, &unwrapped);
+    buf_free(&unwrapped);
+  }
+
+  buf_free(&root_key);
+  buf_free(&computed_hash);
+  return result;
+}
+
+void auth_init(auth_t* auth) {
+  auth->legacy = false;
+  auth->iterations = PBKDF2_ITERATIONS;
+  buf_initf(&auth->pass_salt, PASSWORD_SALT_SIZE);
+  buf_initf(&auth->pass_hash, SHA256_HASH_SIZE);
+  buf_initf(&auth->kek_salt, PASSWORD_SALT_SIZE);
+  buf_initf(&auth->kek_hash, KEK_SIZE);
+}
+
+void auth_free(auth_t* auth) {
+  buf_free(&auth->kek_hash);
+  buf_free(&auth->kek_salt);
+  buf_free(&auth->pass_hash);
+  buf_free(&auth->pass_salt);
+}
+
 bool prompt_password(buf_t* kek) {
   if (!access(buf_to_cstr(&AUTH_DB_PATH))) throw("Agent not setup");
   buf_t password;
@@ -25,45 +164,49 @@ bool prompt_password(buf_t* kek) {
 bool check_password(buf_t* password, buf_t* kek) {
   /* Retrieve stored password details */
   auth_t stored;
-  buf_initf(&stored.pass_salt, PASSWORD_SALT_SIZE);
-  buf_initf(&stored.pass_hash, SHA256_HASH_SIZE);
-  buf_initf(&stored.kek_salt, PASSWORD_SALT_SIZE);
-  buf_initf(&stored.kek_hash, KEK_SIZE);
+  auth_init(&stored);
   read_auth(&stored);
+  if (stored.legacy) {
+    bool result = check_legacy_password(&stored, password, kek);
+    auth_free(&stored);
+    return result;
+  }
 
-  /* Compare against entered password */
-  buf_t computed_hash;
+  /*
+   * The password is only hashed once, into the root key. Both the password
+   * hash and the key wrapping the KEK are cheaply expanded from it.
+   */
+  buf_t root_key, computed_hash;
+  buf_initf(&root_key, SHA256_HASH_SIZE);
   buf_initf(&computed_hash, SHA256_HASH_SIZE);
-  hash_password(password, &stored.pass_salt, &computed_hash);
-  bool result = buf_equal(&computed_hash, &stored.pass_hash);
+  hash_password(password, &stored.pass_salt, stored.iterations, &root_key);
+  expand_root_key(&root_key, HKDF_LABEL_VERIFIER, &computed_hash);
 
-  /* Return the KEK if it is requested */
+  /* Compare against entered password, and return the KEK if requested */
+  bool result = buf_equal(&computed_hash, &stored.pass_hash);
   if (result && kek != NULL) {
-    buf_t root_key;
-    buf_initf(&root_key, SHA256_HASH_SIZE);
-    hash_password(password, &stored.kek_salt, &root_key);
-    xor_decrypt(&stored.kek_hash, &root_key, kek);
-    buf_free(&root_key);
+    buf_t wrap_key;
+    buf_initf(&wrap_key, SHA256_HASH_SIZE);
+    expand_root_key(&root_key, HKDF_LABEL_KEK_WRAP, &wrap_key);
+    xor_decrypt(&stored.kek_hash, &wrap_key, kek);
+    buf_free(&wrap_key);
   }
 
   /* Cleanup */
   buf_free(&computed_hash);
-  buf_free(&stored.kek_hash);
-  buf_free(&stored.kek_salt);
-  buf_free(&stored.pass_hash);
-  buf_free(&stored.pass_salt);
+  buf_free(&root_key);
+  auth_free(&stored);
 
   return result;
 }
 
 void write_auth(const auth_t* auth) {
-  FILE* file = fopen(buf_to_cstr(&AUTH_DB_PATH), "wb");
-  if (!file) throw("Failed to write to file");
-  fwrite(auth->pass_salt.data, sizeof(uint8_t), auth->pass_salt.capacity, file);
-  fwrite(auth->pass_hash.data, sizeof(uint8_t), auth->pass_hash.capacity, file);
-  fwrite(auth->kek_salt.data, sizeof(uint8_t), auth->kek_salt.capacity, file);
-  fwrite(auth->kek_hash.data, sizeof(uint8_t), auth->kek_hash.capacity, file);
-  fclose(file);
+  buf_t temp_path;
+  buf_init(&temp_path, 32);
+  auth_temp_path(&temp_path);
+  write_auth_file(auth, buf_to_cstr(&temp_path));
+  commit_auth(&temp_path);
+  buf_free(&temp_path);
 }
 
 void read_auth(auth_t* auth) {
@@ -75,14 +218,33 @@ void read_auth(auth_t* auth) {
   buf_clear(&auth->kek_salt);
   buf_clear(&auth->kek_hash);
 
+  /* Legacy records have no magic and start with the password salt instead */
+  uint8_t magic[AUTH_MAGIC_SIZE];
+  size_t read = fread(magic, sizeof(uint8_t), AUTH_MAGIC_SIZE, file);
+  auth->legacy = read != AUTH_MAGIC_SIZE ||
+                 memcmp(magic, AUTH_MAGIC_VERSION, AUTH_MAGIC_SIZE) != 0;
+  if (auth->legacy) {
+    fseek(file, 0, SEEK_SET);
+    auth->iterations = PBKDF2_ITERATIONS;
+  } else {
+    fread(&auth->iterations, sizeof(uint64_t), 1, file);
+    if (auth->iterations < PBKDF2_MIN_ITERATIONS ||
+        auth->iterations > PBKDF2_MAX_ITERATIONS) {
+      fclose(file);
+      throw("Invalid iteration count in auth details");
+    }
+  }
+
   fread(auth->pass_salt.data, sizeof(uint8_t), auth->pass_salt.capacity, file);
   auth->pass_salt.size = auth->pass_salt.capacity;
 
   fread(auth->pass_hash.data, sizeof(uint8_t), auth->pass_hash.capacity, file);
   auth->pass_hash.size = auth->pass_hash.capacity;
 
-  fread(auth->kek_salt.data, sizeof(uint8_t), auth->kek_salt.capacity, file);
-  auth->kek_salt.size = auth->kek_salt.capacity;
+  if (auth->legacy) {
+    fread(auth->kek_salt.data, sizeof(uint8_t), auth->kek_salt.capacity, file);
+    auth->kek_salt.size = auth->kek_salt.capacity;
+  }
 
   fread(auth->kek_hash.data, sizeof(uint8_t), auth->kek_hash.capacity, file);
   auth->kek_hash.size = auth->kek_hash.capacity;
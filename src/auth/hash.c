@@ -1,10 +1,98 @@
+/* For clock_gettime */
+#define _POSIX_C_SOURCE 200112L
+
 #include "auth/hash.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 #include "constants.h"
 #include "core/buffer.h"
+#include "crypto/hkdf.h"
 #include "crypto/pbkdf2.h"
+#include "stddefs.h"
+#include "utils/cli.h"
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void hash_password(const buf_t* password, const buf_t* salt,
+                   const size_t iterations, buf_t* hash) {
+  pbkdf2_hmac_sha256_hash(password, salt, iterations, hash, hash->capacity);
+}
+
+void hash_password_job(pbkdf2_job_t* job, const buf_t* password,
+                       const buf_t* salt, const size_t iterations,
+                       buf_t* hash) {
+  job->data = password;
+  job->salt = salt;
+  job->iterations = iterations;
+  job->out = hash;
+  job->dklen = hash->capacity;
+}
+
+void hash_passwords(const pbkdf2_job_t* jobs, const size_t count) {
+  pbkdf2_hmac_sha256_hash_many(jobs, count);
+}
+
+size_t calibrate_iterations() {
+  double target = KDF_TARGET_MS;
+  const char* forced = getenv("TRANSCODINE_KDF_TARGET_MS");
+  if (forced) {
+    long ms = strtol(forced, NULL, 10);
+    if (ms > 0) {
+      target = (double)ms;
+    } else {
+      warn("Invalid KDF target requested. Using the default.");
+    }
+  }
+
+  /*
+   * Hash a dummy password the same way as a real one, doubling the work until
+   * the run is long enough to time reliably, then scale it up to the target.
+   */
+  uint8_t dummy[SHA256_HASH_SIZE];
+  buf_t password, salt, hash;
+  memset(dummy, 0, sizeof(dummy));
+  buf_view(&password, dummy, sizeof(dummy));
+  buf_view(&salt, dummy, PASSWORD_SALT_SIZE);
+  buf_initf(&hash, SHA256_HASH_SIZE);
+
+  size_t probe = PBKDF2_MIN_ITERATIONS / 8;
+  double elapsed = 0;
+  while (true) {
+    double start = now_ms();
+    buf_clear(&hash);
+    hash_password(&password, &salt, probe, &hash);
+    elapsed = now_ms() - start;
+    if (elapsed >= KDF_CALIBRATION_MS || probe >= PBKDF2_MAX_ITERATIONS) break;
+    probe *= 2;
+  }
+  buf_free(&hash);
+
+  double scaled = probe * (target / (elapsed > 0 ? elapsed : 1e-3));
+  size_t iterations = PBKDF2_MAX_ITERATIONS;
+  if (scaled < PBKDF2_MAX_ITERATIONS) iterations = (size_t)scaled;
+  if (iterations < PBKDF2_MIN_ITERATIONS) iterations = PBKDF2_MIN_ITERATIONS;
+
+  /* Round down to keep the stored count tidy. The bounds are already round. */
+  iterations -= iterations % 1024;
+
+  char msg[64];
+  sprintf(msg, "Calibrated password hashing to %lu iterations",
+          (unsigned long)iterations);
+  debug(msg);
+  return iterations;
+}
 
-void hash_password(const buf_t* password, const buf_t* salt, buf_t* hash) {
-  pbkdf2_hmac_sha256_hash(password, salt, PBKDF2_ITERATIONS, hash,
-                          hash->capacity);
-}
\ No newline at end of file
+void expand_root_key(const buf_t* root_key, const char* label, buf_t* key) {
+  /* The root key comes out of PBKDF2, so it is already a pseudorandom key */
+  buf_t info;
+  buf_view(&info, (void*)label, strlen(label));
+  hkdf_sha256_expand(root_key, &info, key, SHA256_HASH_SIZE);
+}
@@ -0,0 +1,184 @@
+/* For syscall */
+#define _DEFAULT_SOURCE
+
+#include "auth/session.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "auth/check.h"
+#include "constants.h"
+#include "core/buffer.h"
+#include "db.h"
+#include "globals.h"
+#include "stddefs.h"
+#include "utils/cli.h"
+
+#ifdef __linux__
+
+#include <linux/keyctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * There are no libc wrappers for the keyring calls, and libkeyutils would be
+ * an extra dependency for three system calls.
+ */
+static long add_key(const char* type, const char* description,
+                    const void* payload, size_t len, long keyring) {
+  return syscall(SYS_add_key, type, description, payload, len, keyring);
+}
+
+static long keyctl(int operation, long arg2, long arg3, long arg4) {
+  return syscall(SYS_keyctl, operation, arg2, arg3, arg4, 0L);
+}
+
+#endif
+
+/**
+ * Gets the session timeout requested by the user.
+ * @returns The timeout in seconds, or 0 if sessions are disabled
+ * @author Aryan Jassal
+ */
+static long session_timeout() {
+  const char* timeout = getenv("TRANSCODINE_SESSION_TIMEOUT");
+  if (!timeout) return 0;
+  long seconds = strtol(timeout, NULL, 10);
+  if (seconds < 0) {
+    warn("Invalid session timeout requested. Sessions are disabled.");
+    return 0;
+  }
+  return seconds;
+}
+
+/**
+ * Names the session key after the auth file, so agents with different config
+ * directories don't share a session.
+ * @param description The resulting null-terminated key description
+ * @author Aryan Jassal
+ */
+static void session_description(buf_t* description) {
+  buf_clear(description);
+  buf_append(description, SESSION_KEY_PREFIX, strlen(SESSION_KEY_PREFIX));
+  buf_concat(description, &AUTH_DB_PATH);
+}
+
+/**
+ * Finds the session key for the current agent.
+ * @returns The key serial, or -1 if there is no usable session
+ * @author Aryan Jassal
+ */
+static long session_find() {
+#ifdef __linux__
+  buf_t description;
+  buf_init(&description, 64);
+  session_description(&description);
+  long key = keyctl(KEYCTL_SEARCH, KEY_SPEC_SESSION_KEYRING,
+                    (long)SESSION_KEY_TYPE, (long)buf_to_cstr(&description));
+  buf_free(&description);
+  return key;
+#else
+  return -1;
+#endif
+}
+
+/**
+ * Reads the database key from an active session.
+ * @param db_key The output database key
+ * @returns True if the key was read, false otherwise
+ * @author Aryan Jassal
+ */
+static bool session_load(buf_t* db_key) {
+#ifdef __linux__
+  long key = session_find();
+  if (key < 0) return false;
+  uint8_t payload[AES_KEY_SIZE];
+  long len = keyctl(KEYCTL_READ, key, (long)payload, sizeof(payload));
+  if (len != AES_KEY_SIZE) {
+    memset(payload, 0, sizeof(payload));
+    return false;
+  }
+  buf_clear(db_key);
+  buf_append(db_key, payload, AES_KEY_SIZE);
+  memset(payload, 0, sizeof(payload));
+  return true;
+#else
+  (void)db_key;
+  return false;
+#endif
+}
+
+/**
+ * Stores the database key in a new session which expires after a timeout.
+ * Failing to start a session isn't fatal, as the next command can still ask
+ * for the password.
+ * @param db_key
+ * @param timeout The number of seconds to keep the session for
+ * @author Aryan Jassal
+ */
+static void session_store(const buf_t* db_key, const long timeout) {
+#ifdef __linux__
+  /*
+   * Adding a key to a process without a session keyring would create a new
+   * keyring only for this process. Looking it up first without creating it
+   * falls back to the keyring shared by the sessions of the user, which is
+   * also where later commands will search.
+   */
+  long keyring = keyctl(KEYCTL_GET_KEYRING_ID, KEY_SPEC_SESSION_KEYRING, 0, 0);
+  if (keyring < 0) keyring = KEY_SPEC_USER_SESSION_KEYRING;
+
+  buf_t description;
+  buf_init(&description, 64);
+  session_description(&description);
+  long key = add_key(SESSION_KEY_TYPE, buf_to_cstr(&description),
+                     db_key->data, db_key->size, keyring);
+  buf_free(&description);
+  if (key < 0) {
+    warn("Failed to start a session. The password will be asked again.");
+    return;
+  }
+  if (keyctl(KEYCTL_SET_TIMEOUT, key, timeout, 0) < 0) {
+    keyctl(KEYCTL_REVOKE, key, 0, 0);
+    warn("Failed to set the session timeout. The session was not started.");
+    return;
+  }
+  debug("Started session");
+#else
+  (void)db_key;
+  (void)timeout;
+  warn("Sessions are only supported on Linux");
+#endif
+}
+
+bool prompt_db_key(buf_t* db_key) {
+  long timeout = session_timeout();
+  if (timeout > 0 && session_load(db_key)) {
+    debug("Using database key from session");
+    return true;
+  }
+
+  buf_t kek;
+  buf_initf(&kek, KEK_SIZE);
+  if (!prompt_password(&kek)) {
+    buf_free(&kek);
+    return false;
+  }
+  db_derive_key(&kek, db_key);
+  buf_free(&kek);
+
+  if (timeout > 0) session_store(db_key, timeout);
+  return true;
+}
+
+bool session_revoke() {
+#ifdef __linux__
+  long key = session_find();
+  if (key < 0) return false;
+  keyctl(KEYCTL_REVOKE, key, 0, 0);
+  keyctl(KEYCTL_UNLINK, key, KEY_SPEC_SESSION_KEYRING, 0);
+  debug("Revoked session");
+  return true;
+#else
+  return false;
+#endif
+}
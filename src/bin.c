@@ -1,12 +1,14 @@
 #include "bin.h"
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "constants.h"
 #include "core/buffer.h"
 #include "core/iostream.h"
-#include "crypto/aes.h"
+#include "core/pipeline.h"
+#include "crypto/cipher.h"
 #include "crypto/urandom.h"
 #include "stddefs.h"
 #include "utils/cli.h"
@@ -14,6 +16,17 @@
 #include "utils/system.h"
 #include "utils/throw.h"
 
+/**
+ * Reads and decrypts the next part of a stream for a pipeline.
+ * @param args The iostream to read from
+ * @param len
+ * @param data
+ * @author Aryan Jassal
+ */
+static void bin_fill_stream(void *args, const size_t len, buf_t *data) {
+  iostream_read((iostream_t *)args, len, data);
+}
+
 /**
  * Rotates the IV for a bin and re-encrypts it with the new IV. This is
  * important to run after modifying the data in a bin, as reusing old IV for
@@ -24,95 +37,76 @@
  */
 static void bin_rotate_iv(bin_t *bin, const buf_t *aes_key) {
   if (!bin || !aes_key) throw("Arguments cannot be NULL");
-  if (!access(bin->working_path)) throw("Bin must be open");
-
-  /* Prepare a temporary path for re-encrypting the file */
-  buf_t path;
-  buf_init(&path, 32);
-  tempfile(&path);
-
-  FILE *in = fopen(bin->working_path, "rb");
-  FILE *out = fopen(buf_to_cstr(&path), "wb+");
-  if (!in || !out) throw("Failed to open bin for IV rotation");
+  if (bin->fd < 0) throw("Bin must be open");
 
   /* Calculate the total file size to be encrypted */
-  fseek(in, 0, SEEK_END);
-  size_t file_size = ftell(in) - BIN_GLOBAL_HEADER_SIZE;
-  fseek(in, 0, SEEK_SET);
+  size_t file_size = iostream_file_size(bin->fd) - BIN_GLOBAL_HEADER_SIZE;
 
   /* Set up the new AES contexts */
   buf_t new_iv;
   buf_initf(&new_iv, AES_IV_SIZE);
   urandom(&new_iv, AES_IV_SIZE);
 
-  /* Copy the global header and update the IV in the header */
-  uint8_t header[BIN_GLOBAL_HEADER_SIZE];
-  freads(header, BIN_GLOBAL_HEADER_SIZE, in);
-  memcpy(header + BIN_MAGIC_SIZE + BIN_ID_SIZE, new_iv.data, AES_IV_SIZE);
-  fwrites(header, BIN_GLOBAL_HEADER_SIZE, out);
-
-  /* Initialise the iostream objects */
+  /* Initialise the iostream objects. Both run over the working copy, and each
+   * chunk is read before it is written back, so the reader always stays ahead
+   * of the writer. */
   iostream_t r, w;
-  iostream_init(&r, in, &bin->aes_ctx, &bin->aes_iv, BIN_GLOBAL_HEADER_SIZE);
-  iostream_init(&w, out, &bin->aes_ctx, &new_iv, BIN_GLOBAL_HEADER_SIZE);
-
-  /* Stream transcrypt the contents of the file */
+  iostream_init_fd(&r, bin->fd, &bin->cipher, &bin->aes_iv,
+                   BIN_GLOBAL_HEADER_SIZE);
+  iostream_init_fd(&w, bin->fd, &bin->cipher, &new_iv, BIN_GLOBAL_HEADER_SIZE);
+  iostream_readahead(&r, file_size);
+  iostream_readahead(&w, file_size);
+
+  /* Stream transcrypt the contents of the file. Large chunks let each chunk
+   * be decrypted and re-encrypted across all the cores. */
   buf_t block;
-  buf_initf(&block, READFILE_CHUNK);
+  buf_initf(&block, READFILE_BULK_CHUNK);
   size_t remaining = file_size;
   while (remaining > 0) {
     buf_clear(&block);
-    size_t chunk = remaining < READFILE_CHUNK ? remaining : READFILE_CHUNK;
+    size_t chunk =
+        remaining < READFILE_BULK_CHUNK ? remaining : READFILE_BULK_CHUNK;
     iostream_read(&r, chunk, &block);
     iostream_write(&w, &block);
     remaining -= chunk;
   }
   buf_free(&block);
-  fclose(in);
-  fclose(out);
+  iostream_free(&r);
+  iostream_free(&w);
 
-  /* Replace original file with re-encryted one */
-  fcopy(bin->working_path, buf_to_cstr(&path));
-  remove(buf_to_cstr(&path));
+  /* The new IV only goes into the header once all of the data has been
+   * rewritten. The header isn't encrypted, so it goes through a stream without
+   * a cipher. */
+  iostream_init_fd(&w, bin->fd, NULL, NULL, BIN_MAGIC_SIZE + BIN_ID_SIZE);
+  iostream_write(&w, &new_iv);
+  iostream_free(&w);
 
   /* Update bin state and cleanup */
   buf_copy(&bin->aes_iv, &new_iv);
-  iostream_free(&r);
-  iostream_free(&w);
   buf_free(&new_iv);
-  buf_free(&path);
   debug("Rotated IV for bin");
 }
 
 /**
- * Find a file by its name in a bin. Returns the location as a 64-bit signed
- * integer. The file path should not be null terminated, as the paths in the bin
- * aren't, and the find will fail.
- * @param bin
+ * Finds a file by its name using a stream which is already open over the bin,
+ * so the caller can carry on with the same stream. The stream is left right
+ * after the matching record, or right after the end marker if nothing matched.
+ * @param ios A stream over the encrypted contents of the bin
  * @param fq_path The path to search for
  * @return -1 if the file wasn't found, file location otherwise
  * @author Aryan Jassal
  */
-int64_t bin_find_file(const bin_t *bin, const buf_t *fq_path) {
-  if (!bin || !fq_path) throw("Arguments cannot be NULL");
-  if (!access(bin->working_path)) throw("Bin must be open");
-
-  FILE *bin_file = fopen(bin->working_path, "rb");
-  if (!bin_file) throw("Failed to open bin at working path");
-
+static int64_t bin_find_in(iostream_t *ios, const buf_t *fq_path) {
   int64_t location = -1;
-  iostream_t ios;
-  iostream_init(&ios, bin_file, &bin->aes_ctx, &bin->aes_iv,
-                BIN_GLOBAL_HEADER_SIZE);
-  iostream_skip(&ios, BIN_MAGIC_SIZE);
+  iostream_seek(ios, BIN_MAGIC_SIZE);
 
   while (true) {
-    int64_t record_start = ios.file_offset;
+    int64_t record_start = iostream_tell(ios) + BIN_GLOBAL_HEADER_SIZE;
 
     /* Check for entry type */
     buf_t type;
     buf_initf(&type, BIN_MAGIC_SIZE);
-    iostream_read(&ios, BIN_MAGIC_SIZE, &type);
+    iostream_read(ios, BIN_MAGIC_SIZE, &type);
     if (memcmp(type.data, BIN_MAGIC_END, BIN_MAGIC_SIZE) == 0) {
       buf_free(&type);
       break;
@@ -125,14 +119,14 @@ int64_t bin_find_file(const bin_t *bin, const buf_t *fq_path) {
     /* Read file header */
     buf_t header;
     buf_initf(&header, sizeof(size_t) * 2);
-    iostream_read(&ios, sizeof(size_t) * 2, &header);
+    iostream_read(ios, sizeof(size_t) * 2, &header);
     bin_header_t entry = *(bin_header_t *)header.data;
 
     /* Read path */
     buf_t path_data;
     buf_initf(&path_data, entry.path_len);
-    iostream_read(&ios, entry.path_len, &path_data);
-    iostream_skip(&ios, entry.data_len);
+    iostream_read(ios, entry.path_len, &path_data);
+    iostream_skip(ios, entry.data_len);
     buf_free(&header);
 
     /* Save the record position if the key matches and return */
@@ -159,10 +153,30 @@ int64_t bin_find_file(const bin_t *bin, const buf_t *fq_path) {
   }
   debug(buf_to_cstr(&msg));
   buf_free(&msg);
+  return location;
+}
+
+/**
+ * Find a file by its name in a bin. Returns the location as a 64-bit signed
+ * integer. The file path should not be null terminated, as the paths in the bin
+ * aren't, and the find will fail.
+ * @param bin
+ * @param fq_path The path to search for
+ * @return -1 if the file wasn't found, file location otherwise
+ * @author Aryan Jassal
+ */
+int64_t bin_find_file(const bin_t *bin, const buf_t *fq_path) {
+  if (!bin || !fq_path) throw("Arguments cannot be NULL");
+  if (bin->fd < 0) throw("Bin must be open");
+
+  iostream_t ios;
+  iostream_init_fd(&ios, bin->fd, &bin->cipher, &bin->aes_iv,
+                   BIN_GLOBAL_HEADER_SIZE);
+  iostream_map(&ios, IOSTREAM_RANDOM);
+  int64_t location = bin_find_in(&ios, fq_path);
 
   /* Cleanup and return results */
   iostream_free(&ios);
-  fclose(bin_file);
   return location;
 }
 
@@ -171,7 +185,9 @@ void bin_init(bin_t *bin) {
   buf_initf(&bin->aes_iv, AES_IV_SIZE);
   bin->encrypted_path = NULL;
   bin->working_path = NULL;
+  bin->fd = -1;
   memset(&bin->write_ctx, 0, sizeof(bin_filectx_t));
+  bin->write_ctx.ios.raw_fd = -1;
 }
 
 void bin_free(bin_t *bin) {
@@ -180,7 +196,7 @@ void bin_free(bin_t *bin) {
 }
 
 void bin_create(bin_t *bin, const buf_t *bin_id, buf_t *aes_key,
-                const char *encrypted_path) {
+                const cipher_t cipher, const char *encrypted_path) {
   if (!bin || !aes_key || !encrypted_path) throw("Argument cannot be NULL");
   if (access(encrypted_path)) throw("A file at that path already exists");
   if (bin_id->size != BIN_ID_SIZE) throw("Invalid buffer state");
@@ -193,8 +209,10 @@ void bin_create(bin_t *bin, const buf_t *bin_id, buf_t *aes_key,
   urandom(aes_key, AES_KEY_SIZE);
   bin->encrypted_path = encrypted_path;
 
-  /* Write global header */
-  fwrites(BIN_MAGIC_VERSION, BIN_MAGIC_SIZE, bin_file);
+  /* Write global header. The version also records the cipher being used. */
+  const char *version = cipher == CIPHER_CHACHA20 ? BIN_MAGIC_VERSION_CHACHA20
+                                                  : BIN_MAGIC_VERSION;
+  fwrites(version, BIN_MAGIC_SIZE, bin_file);
   fwrites(bin->id.data, bin->id.size, bin_file);
   fwrites(bin->aes_iv.data, bin->aes_iv.size, bin_file);
 
@@ -205,8 +223,8 @@ void bin_create(bin_t *bin, const buf_t *bin_id, buf_t *aes_key,
   buf_append(&cleartext, BIN_MAGIC_END, BIN_MAGIC_SIZE);
 
   /* Encrypt the data and write it to the file */
-  aes_ctx_t ctx;
-  aes_init(&ctx, aes_key);
+  cipher_ctx_t ctx;
+  cipher_init(&ctx, cipher, aes_key);
   iostream_t ios;
   iostream_init(&ios, bin_file, &ctx, &bin->aes_iv, BIN_GLOBAL_HEADER_SIZE);
   iostream_write(&ios, &cleartext);
@@ -227,6 +245,7 @@ void bin_meta(const char *encrypted_path, buf_t *meta) {
   fseek(bin_file, BIN_MAGIC_SIZE, SEEK_SET);
   freads(meta->data, meta->capacity, bin_file);
   meta->size = meta->capacity;
+  fclose(bin_file);
 }
 
 void bin_open(bin_t *bin, const buf_t *aes_key, const char *encrypted_path,
@@ -234,31 +253,46 @@ void bin_open(bin_t *bin, const buf_t *aes_key, const char *encrypted_path,
   if (!bin || !aes_key || !encrypted_path || !working_path) {
     throw("Arguments cannot be NULL");
   }
-  if (access(bin->working_path)) return debug("Bin already open");
-
-  /* Create a working copy of the bin file */
-  fcopy(working_path, encrypted_path);
-  FILE *bin_file = fopen(working_path, "rb");
-  if (!bin_file) throw("Failed to open bin at encrypted path");
+  if (bin->fd >= 0) return debug("Bin already open");
+
+  /* Create a working copy of the bin file, which stays open until closed */
+  int src = iostream_open(encrypted_path, O_RDONLY);
+  if (src < 0) throw("Failed to open bin at encrypted path");
+  bin->fd = iostream_open(working_path, O_RDWR | O_CREAT | O_TRUNC);
+  if (bin->fd < 0) {
+    iostream_close(src);
+    throw("Failed to create working bin");
+  }
+  iostream_copy(bin->fd, src);
+  iostream_close(src);
 
-  /* Check if the file is a valid bin file */
-  uint8_t header[BIN_GLOBAL_HEADER_SIZE];
-  freads(header, BIN_GLOBAL_HEADER_SIZE, bin_file);
-  if (memcmp(header, BIN_MAGIC_VERSION, BIN_MAGIC_SIZE) != 0) {
-    throw("File is not a database file");
+  /* Check if the file is a valid bin file and find the cipher it uses. The
+   * header isn't encrypted, so it goes through a stream without a cipher. */
+  buf_t header;
+  buf_initf(&header, BIN_GLOBAL_HEADER_SIZE);
+  iostream_t ios;
+  iostream_init_fd(&ios, bin->fd, NULL, NULL, 0);
+  iostream_read(&ios, BIN_GLOBAL_HEADER_SIZE, &header);
+  iostream_free(&ios);
+  cipher_t cipher = CIPHER_AES_CTR;
+  if (memcmp(header.data, BIN_MAGIC_VERSION_CHACHA20, BIN_MAGIC_SIZE) == 0) {
+    cipher = CIPHER_CHACHA20;
+  } else if (memcmp(header.data, BIN_MAGIC_VERSION, BIN_MAGIC_SIZE) != 0) {
+    throw("File is not a bin file");
   }
 
   /* Set bin state */
   bin->encrypted_path = encrypted_path;
   bin->working_path = working_path;
-  buf_append(&bin->id, header + BIN_MAGIC_SIZE, BIN_ID_SIZE);
-  buf_append(&bin->aes_iv, header + BIN_MAGIC_SIZE + BIN_ID_SIZE, AES_IV_SIZE);
-  aes_init(&bin->aes_ctx, aes_key);
+  buf_append(&bin->id, header.data + BIN_MAGIC_SIZE, BIN_ID_SIZE);
+  buf_append(&bin->aes_iv, header.data + BIN_MAGIC_SIZE + BIN_ID_SIZE,
+             AES_IV_SIZE);
+  cipher_init(&bin->cipher, cipher, aes_key);
+  buf_free(&header);
 
   /* Check if the unlock was successful */
-  iostream_t ios;
-  iostream_init(&ios, bin_file, &bin->aes_ctx, &bin->aes_iv,
-                BIN_GLOBAL_HEADER_SIZE);
+  iostream_init_fd(&ios, bin->fd, &bin->cipher, &bin->aes_iv,
+                   BIN_GLOBAL_HEADER_SIZE);
 
   buf_t magic;
   buf_init(&magic, BIN_MAGIC_SIZE);
@@ -271,42 +305,41 @@ void bin_open(bin_t *bin, const buf_t *aes_key, const char *encrypted_path,
   /* Cleanup */
   iostream_free(&ios);
   buf_free(&magic);
-  fclose(bin_file);
   debug("Opened bin");
 }
 
 void bin_close(bin_t *bin) {
-  if (!bin->working_path) return debug("Bin already closed");
-  if (bin->write_ctx.ios.fd != NULL) {
+  if (bin->fd < 0) return debug("Bin already closed");
+  if (bin->write_ctx.ios.raw_fd >= 0) {
     throw("Cannot close bin with open file descriptor");
   }
 
   /* Commit the changes from working path to main bin */
-  fcopy(bin->encrypted_path, bin->working_path);
+  iostream_replace(bin->encrypted_path, bin->fd);
+  iostream_close(bin->fd);
+  bin->fd = -1;
   remove(bin->working_path);
   bin->working_path = NULL;
 }
 
 bool bin_open_file(bin_t *bin, const buf_t *fq_path) {
   if (!bin || !fq_path) throw("Arguments cannot be NULL");
-  if (!access(bin->working_path)) return error("Bin is not open"), false;
-  if (bin->write_ctx.ios.fd != NULL) {
+  if (bin->fd < 0) return error("Bin is not open"), false;
+  if (bin->write_ctx.ios.raw_fd >= 0) {
     return error("A write operation is already running"), false;
   }
 
   /* Prepare for writing to bin */
-  if (bin_find_file(bin, fq_path) != -1) {
+  iostream_t *ios = &bin->write_ctx.ios;
+  iostream_init_fd(ios, bin->fd, &bin->cipher, &bin->aes_iv,
+                   BIN_GLOBAL_HEADER_SIZE);
+  if (bin_find_in(ios, fq_path) != -1) {
+    iostream_free(ios);
     return error("The file already exists in the bin"), false;
   }
-  FILE *bin_file = fopen(bin->working_path, "rb+");
-  if (!bin_file) throw("Failed to open bin");
 
-  /* Seek to the end of file to append new entry */
-  iostream_t *ios = &bin->write_ctx.ios;
-  iostream_init(ios, bin_file, &bin->aes_ctx, &bin->aes_iv,
-                BIN_GLOBAL_HEADER_SIZE);
-  fseek(bin_file, -BIN_MAGIC_SIZE, SEEK_END);
-  iostream_skip(ios, ftell(bin_file) - BIN_GLOBAL_HEADER_SIZE);
+  /* The search stops after the end marker, which the new entry overwrites */
+  iostream_seek(ios, iostream_tell(ios) - BIN_MAGIC_SIZE);
 
   /* Construct file header with placeholder data length */
   size_t data_len = 0;
@@ -315,8 +348,10 @@ bool bin_open_file(bin_t *bin, const buf_t *fq_path) {
   buf_append(&header, BIN_MAGIC_FILE, BIN_MAGIC_SIZE);
   buf_append(&header, &fq_path->size, sizeof(size_t));
   buf_append(&header, &data_len, sizeof(size_t));
-  iostream_write(ios, &header);
-  iostream_write(ios, fq_path);
+  const buf_t *record[2];
+  record[0] = &header;
+  record[1] = fq_path;
+  iostream_writev(ios, record, 2);
 
   /* Populate write context */
   bin->write_ctx.bytes_written = header.size + fq_path->size;
@@ -330,8 +365,8 @@ bool bin_open_file(bin_t *bin, const buf_t *fq_path) {
 
 void bin_write_file(bin_t *bin, const buf_t *data) {
   if (!bin || !data) throw("Arguments cannot be NULL");
-  if (!access(bin->working_path)) return error("Bin is not open");
-  if (bin->write_ctx.ios.fd == NULL) {
+  if (bin->fd < 0) return error("Bin is not open");
+  if (bin->write_ctx.ios.raw_fd < 0) {
     error("A write operation must be in progress");
     return;
   }
@@ -344,8 +379,8 @@ void bin_write_file(bin_t *bin, const buf_t *data) {
 
 void bin_close_file(bin_t *bin, buf_t *aes_key) {
   if (!bin) throw("Arguments cannot be NULL");
-  if (!access(bin->working_path)) return error("Bin is not open");
-  if (bin->write_ctx.ios.fd == NULL) {
+  if (bin->fd < 0) return error("Bin is not open");
+  if (bin->write_ctx.ios.raw_fd < 0) {
     error("A write operation must be in progress");
     return;
   }
@@ -356,34 +391,25 @@ void bin_close_file(bin_t *bin, buf_t *aes_key) {
   size_t data_len = bin->write_ctx.bytes_written - bin->write_ctx.header_size;
 
   /* Write end marker */
+  iostream_t *ios = &bin->write_ctx.ios;
   buf_t end;
   buf_view(&end, BIN_MAGIC_END, BIN_MAGIC_SIZE);
-  iostream_write(&bin->write_ctx.ios, &end);
-  fclose(bin->write_ctx.ios.fd);
-
-  /* Patch file header with correct data length */
-  FILE *bin_file = fopen(bin->working_path, "rb+");
-  if (!bin_file) throw("Failed to reopen bin for patching");
-
-  iostream_t ios;
-  iostream_init(&ios, bin_file, &bin->aes_ctx, &bin->aes_iv,
-                BIN_GLOBAL_HEADER_SIZE);
-  iostream_skip(&ios, header_offset - BIN_GLOBAL_HEADER_SIZE);
-  iostream_skip(&ios, BIN_MAGIC_SIZE + sizeof(size_t));
+  iostream_write(ios, &end);
 
+  /* Go back and patch the file header with the correct data length */
+  iostream_seek(ios, header_offset - BIN_GLOBAL_HEADER_SIZE + BIN_MAGIC_SIZE +
+                         sizeof(size_t));
   buf_t len_buf;
   buf_view(&len_buf, &data_len, sizeof(size_t));
 
   char msg[64];
   sprintf(msg, "Patching data_len=%lu at offset %zu", data_len,
-          ios.file_offset);
+          ios->file_offset);
   debug(msg);
-  iostream_write(&ios, &len_buf);
+  iostream_write(ios, &len_buf);
 
   /* Update bin state and cleanup */
-  fclose(bin_file);
-  iostream_free(&bin->write_ctx.ios);
-  iostream_free(&ios);
+  iostream_free(ios);
   bin->write_ctx.header_size = 0;
   bin->write_ctx.bytes_written = 0;
   debug("Closed virtual file");
@@ -394,14 +420,13 @@ void bin_close_file(bin_t *bin, buf_t *aes_key) {
 
 void bin_list_files(const bin_t *bin, buf_t *paths) {
   if (!bin || !paths) throw("Arguments cannot be NULL");
-  if (!access(bin->working_path)) return error("Bin is not open");
+  if (bin->fd < 0) return error("Bin is not open");
 
   /* Prepare for reading bin */
-  FILE *bin_file = fopen(bin->working_path, "rb");
-  if (!bin_file) throw("Failed to open bin file");
   iostream_t ios;
-  iostream_init(&ios, bin_file, &bin->aes_ctx, &bin->aes_iv,
-                BIN_GLOBAL_HEADER_SIZE);
+  iostream_init_fd(&ios, bin->fd, &bin->cipher, &bin->aes_iv,
+                   BIN_GLOBAL_HEADER_SIZE);
+  iostream_map(&ios, IOSTREAM_SEQUENTIAL);
   iostream_skip(&ios, BIN_MAGIC_SIZE);
 
   /* Keep reading entries until we encounter the end marker */
@@ -439,29 +464,26 @@ void bin_list_files(const bin_t *bin, buf_t *paths) {
 
   /* Cleanup */
   iostream_free(&ios);
-  fclose(bin_file);
 }
 
 bool bin_cat_file(const bin_t *bin, const buf_t *fq_path,
                   bin_stream_cb callback) {
   if (!bin || !fq_path) throw("Arguments cannot be NULL");
-  if (!access(bin->working_path)) return error("Bin is not open"), false;
+  if (bin->fd < 0) return error("Bin is not open"), false;
 
   /* Find the location of the header of the file we need */
-  int64_t offset = bin_find_file(bin, fq_path);
+  iostream_t ios;
+  iostream_init_fd(&ios, bin->fd, &bin->cipher, &bin->aes_iv,
+                   BIN_GLOBAL_HEADER_SIZE);
+  int64_t offset = bin_find_in(&ios, fq_path);
   if (offset == -1) {
+    iostream_free(&ios);
     debug("Failed to find file");
     return false;
   }
 
-  /* Prepare for reading file */
-  FILE *bin_file = fopen(bin->working_path, "rb");
-  if (!bin_file) throw("Failed to open bin file");
-  iostream_t ios;
-  iostream_init(&ios, bin_file, &bin->aes_ctx, &bin->aes_iv,
-                BIN_GLOBAL_HEADER_SIZE);
-  iostream_skip(&ios, offset - BIN_GLOBAL_HEADER_SIZE);
-  iostream_skip(&ios, BIN_MAGIC_SIZE);
+  /* Go back to the entry, which is usually still in the window */
+  iostream_seek(&ios, offset - BIN_GLOBAL_HEADER_SIZE + BIN_MAGIC_SIZE);
 
   /* Read entry header */
   buf_t header;
@@ -469,62 +491,51 @@ bool bin_cat_file(const bin_t *bin, const buf_t *fq_path,
   iostream_read(&ios, sizeof(size_t) * 2, &header);
   bin_header_t entry = *(bin_header_t *)header.data;
 
-  /* Skip path and stream the file contents via callback */
+  /* Skip path and stream the file contents via callback. The keystream for
+   * the contents is generated ahead, and the next chunk is read and decrypted
+   * while the callback is handling the current one. */
   iostream_skip(&ios, entry.path_len);
-  size_t remaining = entry.data_len;
-  buf_t cleartext;
-  buf_init(&cleartext, 32);
-  while (remaining > 0) {
-    size_t chunk = remaining < READFILE_CHUNK ? remaining : READFILE_CHUNK;
-    iostream_read(&ios, chunk, &cleartext);
-    callback(&cleartext);
-    remaining -= chunk;
-  }
+  iostream_readahead(&ios, entry.data_len);
+  pipeline_t *pipeline = pipeline_start(bin_fill_stream, &ios, entry.data_len,
+                                        READFILE_BULK_CHUNK);
+  const buf_t *cleartext;
+  while ((cleartext = pipeline_next(pipeline))) callback(cleartext);
+  pipeline_free(pipeline);
 
   /* Cleanup */
   buf_free(&header);
-  buf_free(&cleartext);
   iostream_free(&ios);
-  fclose(bin_file);
   return true;
 }
 
 bool bin_remove_file(bin_t *bin, const buf_t *fq_path, const buf_t *aes_key) {
   if (!bin || !fq_path) throw("Arguments cannot be NULL");
-  if (!access(bin->working_path)) return error("Bin is not open"), false;
+  if (bin->fd < 0) return error("Bin is not open"), false;
 
   /* Return if the file doesn't exist */
-  int64_t offset = bin_find_file(bin, fq_path);
+  iostream_t r, w;
+  iostream_init_fd(&r, bin->fd, &bin->cipher, &bin->aes_iv,
+                   BIN_GLOBAL_HEADER_SIZE);
+  int64_t offset = bin_find_in(&r, fq_path);
   if (offset == -1) {
+    iostream_free(&r);
     debug("File not found, nothing to remove");
     return false;
   }
 
-  /* Make a copy of the bin */
-  buf_t path;
-  buf_init(&path, 32);
-  tempfile(&path);
-  FILE *src = fopen(bin->working_path, "rb");
-  FILE *dst = fopen(buf_to_cstr(&path), "wb+");
-  if (!src || !dst) throw("Failed to open bin files");
-
-  /* Copy over the unencrypted header as-is */
-  uint8_t header[BIN_GLOBAL_HEADER_SIZE];
-  freads(header, BIN_GLOBAL_HEADER_SIZE, src);
-  fwrites(header, BIN_GLOBAL_HEADER_SIZE, dst);
-
-  /* Initialise iostreams to read data in the database */
-  iostream_t r, w;
-  iostream_init(&r, src, &bin->aes_ctx, &bin->aes_iv, BIN_GLOBAL_HEADER_SIZE);
-  iostream_init(&w, dst, &bin->aes_ctx, &bin->aes_iv, BIN_GLOBAL_HEADER_SIZE);
-
-  buf_t magic;
-  buf_init(&magic, BIN_MAGIC_SIZE);
-  iostream_read(&r, BIN_MAGIC_SIZE, &magic);
-  iostream_write(&w, &magic);
-  buf_free(&magic);
-
-  /* Ignore copying file if the path matches the one provided */
+  /* Everything before the file stays where it is, so only the records after it
+   * are moved back over it. The reader is always ahead of the writer, so the
+   * working copy can be rewritten in place. */
+  iostream_init_fd(&w, bin->fd, &bin->cipher, &bin->aes_iv,
+                   BIN_GLOBAL_HEADER_SIZE);
+  iostream_seek(&w, offset - BIN_GLOBAL_HEADER_SIZE);
+
+  /* Both streams run sequentially through the rest of the bin, so their
+   * keystream is generated ahead once for all of it */
+  size_t remaining = iostream_file_size(bin->fd) - BIN_GLOBAL_HEADER_SIZE -
+                     iostream_tell(&r);
+  iostream_readahead(&r, remaining);
+  iostream_readahead(&w, remaining);
   while (true) {
     buf_t type;
     buf_initf(&type, BIN_MAGIC_SIZE);
@@ -539,38 +550,26 @@ bool bin_remove_file(bin_t *bin, const buf_t *fq_path, const buf_t *aes_key) {
       throw("Invalid block");
     }
 
-    /* Extract header from bin */
+    /* Extract header and path from bin */
     buf_t header;
     buf_init(&header, sizeof(size_t) * 2);
     iostream_read(&r, sizeof(size_t) * 2, &header);
     bin_header_t entry = *(bin_header_t *)header.data;
-
-    /* Read path and skip data */
     buf_t fpath;
     buf_init(&fpath, entry.path_len);
     iostream_read(&r, entry.path_len, &fpath);
-
-    /* If we don't have a match, then copy the data. Otherwise, skip data chunk
-     */
-    if (!buf_equal(&fpath, fq_path)) {
-      iostream_write(&w, &type);
-      iostream_write(&w, &header);
-      iostream_write(&w, &fpath);
-
-      /* Stream file data */
-      size_t remaining = entry.data_len;
-      buf_t data;
-      buf_init(&data, 32);
-      while (remaining > 0) {
-        size_t chunk = remaining < READFILE_CHUNK ? remaining : READFILE_CHUNK;
-        iostream_read(&r, chunk, &data);
-        iostream_write(&w, &data);
-        remaining -= chunk;
-      }
-      buf_free(&data);
-    } else {
-      iostream_skip(&r, entry.data_len);
-    }
+    const buf_t *record[3];
+    record[0] = &type;
+    record[1] = &header;
+    record[2] = &fpath;
+    iostream_writev(&w, record, 3);
+
+    /* Stream file data, reading the next chunk while writing this one */
+    pipeline_t *pipeline = pipeline_start(bin_fill_stream, &r, entry.data_len,
+                                          READFILE_BULK_CHUNK);
+    const buf_t *data;
+    while ((data = pipeline_next(pipeline))) iostream_write(&w, data);
+    pipeline_free(pipeline);
 
     /* Cleanup for loop iterations */
     buf_free(&type);
@@ -578,16 +577,10 @@ bool bin_remove_file(bin_t *bin, const buf_t *fq_path, const buf_t *aes_key) {
     buf_free(&fpath);
   }
 
-  /* Cleanup */
+  /* Cut off what is left of the old end of the bin */
+  iostream_truncate(&w);
   iostream_free(&r);
   iostream_free(&w);
-  fclose(src);
-  fclose(dst);
-
-  /* Replace original file with updated one */
-  fcopy(bin->working_path, buf_to_cstr(&path));
-  remove(buf_to_cstr(&path));
-  buf_free(&path);
   debug("Removed file from bin");
 
   /* Rotate IV upon change to the contents */
@@ -596,13 +589,12 @@ bool bin_remove_file(bin_t *bin, const buf_t *fq_path, const buf_t *aes_key) {
 }
 
 void bin_hexdump(bin_t *bin) {
-  FILE *bin_file = fopen(bin->working_path, "rb");
-  if (!bin_file) throw("Failed to open bin file");
+  if (bin->fd < 0) return error("Bin is not open");
   iostream_t ios;
-  iostream_init(&ios, bin_file, &bin->aes_ctx, &bin->aes_iv,
-                BIN_GLOBAL_HEADER_SIZE);
+  iostream_init_fd(&ios, bin->fd, &bin->cipher, &bin->aes_iv,
+                   BIN_GLOBAL_HEADER_SIZE);
 
-  size_t size = fsize(bin->working_path);
+  size_t size = iostream_file_size(bin->fd);
   buf_t cleartext;
   buf_init(&cleartext, size);
   iostream_read(&ios, size - BIN_GLOBAL_HEADER_SIZE, &cleartext);
@@ -610,5 +602,4 @@ void bin_hexdump(bin_t *bin) {
 
   buf_free(&cleartext);
   iostream_free(&ios);
-  fclose(bin_file);
 }
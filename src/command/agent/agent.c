@@ -1,5 +1,6 @@
 #include "command/agent/agent.h"
 
+#include "command/agent/lock.h"
 #include "command/agent/reset.h"
 #include "command/agent/setup.h"
 #include "utils/args.h"
@@ -12,7 +13,12 @@ cmd_handler_t cmd_agent_reset =
     CMD_MKLEAF("reset", "Reset the password of your node", NULL,
                handler_agent_reset, DEFAULT_FLAGS, N_DEFAULT_FLAGS);
 
-cmd_handler_t* cmd_agent_commands[] = {&cmd_agent_setup, &cmd_agent_reset};
+cmd_handler_t cmd_agent_lock =
+    CMD_MKLEAF("lock", "End the current session of your node", NULL,
+               handler_agent_lock, DEFAULT_FLAGS, N_DEFAULT_FLAGS);
+
+cmd_handler_t* cmd_agent_commands[] = {&cmd_agent_setup, &cmd_agent_reset,
+                                       &cmd_agent_lock};
 
 const int num_agent_commands =
     sizeof(cmd_agent_commands) / sizeof(cmd_agent_commands[0]);
@@ -0,0 +1,47 @@
+#include "command/agent/lock.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "auth/session.h"
+#include "constants.h"
+#include "utils/args.h"
+#include "utils/cli.h"
+
+int handler_agent_lock(int argc, char* argv[], int flagc, char* flagv[],
+                       const char* path, cmd_handler_t* self) {
+  /* Flag handling */
+  int fi;
+  for (fi = 0; fi < flagc; ++fi) {
+    const char* flag = flagv[fi];
+
+    /* Help flag */
+    int ai;
+    for (ai = 0; ai < flag_help.num_aliases; ++ai) {
+      if (strcmp(flag, flag_help.aliases[ai]) == 0) {
+        print_help(HELP_REQUESTED, path, self, NULL);
+        return EXIT_OK;
+      }
+    }
+
+    /* Fail on extra flags */
+    print_help(HELP_INVALID_FLAGS, path, self, flag);
+    return EXIT_INVALID_FLAG;
+  }
+
+  /* Invalid usage */
+  if (argc > 0) {
+    print_help(HELP_INVALID_USAGE, path, self, NULL);
+    return EXIT_USAGE;
+  }
+
+  /* No arguments are expected, so we ignore this parameter */
+  (void)argv;
+
+  if (session_revoke()) {
+    printf("Agent locked\n");
+  } else {
+    printf("No active session\n");
+  }
+  return EXIT_OK;
+}
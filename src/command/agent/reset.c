@@ -5,6 +5,7 @@
 
 #include "auth/check.h"
 #include "auth/hash.h"
+#include "auth/session.h"
 #include "constants.h"
 #include "core/buffer.h"
 #include "crypto/xor.h"
@@ -15,52 +16,49 @@
 #include "utils/io.h"
 
 static void update_password(buf_t* old_password, buf_t* new_password) {
-  /* Being here means old password was correct */
+  /* Being here means old password was correct, and the agent was migrated */
   auth_t auth;
-  buf_initf(&auth.pass_salt, PASSWORD_SALT_SIZE);
-  buf_initf(&auth.pass_hash, SHA256_HASH_SIZE);
-  buf_initf(&auth.kek_salt, PASSWORD_SALT_SIZE);
-  buf_initf(&auth.kek_hash, KEK_SIZE);
+  auth_init(&auth);
   read_auth(&auth);
 
   /* Create new password and derive new RK */
   auth_t new_auth;
-  buf_initf(&new_auth.pass_salt, PASSWORD_SALT_SIZE);
-  buf_initf(&new_auth.pass_hash, SHA256_HASH_SIZE);
-  buf_initf(&new_auth.kek_salt, PASSWORD_SALT_SIZE);
-  buf_initf(&new_auth.kek_hash, KEK_SIZE);
+  auth_init(&new_auth);
   buf_copy(&new_auth.pass_salt, &auth.pass_salt);
-  buf_copy(&new_auth.kek_salt, &auth.kek_salt);
-  hash_password(new_password, &new_auth.pass_salt, &new_auth.pass_hash);
+  new_auth.iterations = calibrate_iterations();
 
-  /* Update KEK to reflect new password */
-  buf_t rk_old;
-  buf_t rk_new;
+  /* Derive both RKs together, then expand the keys from them */
+  buf_t rk_old, rk_new, wrap_old, wrap_new;
   buf_initf(&rk_old, SHA256_HASH_SIZE);
   buf_initf(&rk_new, SHA256_HASH_SIZE);
-  hash_password(old_password, &auth.kek_salt, &rk_old);
-  hash_password(new_password, &new_auth.kek_salt, &rk_new);
+  buf_initf(&wrap_old, SHA256_HASH_SIZE);
+  buf_initf(&wrap_new, SHA256_HASH_SIZE);
+  pbkdf2_job_t jobs[2];
+  hash_password_job(&jobs[0], old_password, &auth.pass_salt, auth.iterations,
+                    &rk_old);
+  hash_password_job(&jobs[1], new_password, &new_auth.pass_salt,
+                    new_auth.iterations, &rk_new);
+  hash_passwords(jobs, 2);
+  expand_root_key(&rk_old, HKDF_LABEL_KEK_WRAP, &wrap_old);
+  expand_root_key(&rk_new, HKDF_LABEL_KEK_WRAP, &wrap_new);
+  expand_root_key(&rk_new, HKDF_LABEL_VERIFIER, &new_auth.pass_hash);
 
   /* Re-encrypt KEK into the new auth object */
   buf_t kek;
   buf_initf(&kek, KEK_SIZE);
-  xor_decrypt(&auth.kek_hash, &rk_old, &kek);
-  xor_encrypt(&kek, &rk_new, &new_auth.kek_hash);
+  xor_decrypt(&auth.kek_hash, &wrap_old, &kek);
+  xor_encrypt(&kek, &wrap_new, &new_auth.kek_hash);
 
   /* Store new auth details */
   write_auth(&new_auth);
 
   /* Release resources */
-  buf_free(&auth.pass_hash);
-  buf_free(&auth.pass_salt);
-  buf_free(&auth.kek_hash);
-  buf_free(&auth.kek_salt);
-  buf_free(&new_auth.pass_hash);
-  buf_free(&new_auth.pass_salt);
-  buf_free(&new_auth.kek_hash);
-  buf_free(&new_auth.kek_salt);
+  auth_free(&auth);
+  auth_free(&new_auth);
   buf_free(&rk_old);
   buf_free(&rk_new);
+  buf_free(&wrap_old);
+  buf_free(&wrap_new);
   buf_free(&kek);
 }
 
@@ -126,6 +124,9 @@ int handler_agent_reset(int argc, char* argv[], int flagc, char* flagv[],
 
   update_password(&password_current, &password_new_1);
 
+  /* Sessions unlocked with the old password shouldn't outlive it */
+  session_revoke();
+
   buf_free(&password_current);
   buf_free(&password_new_1);
   buf_free(&password_new_2);
@@ -5,6 +5,7 @@
 
 #include "auth/check.h"
 #include "auth/hash.h"
+#include "auth/session.h"
 #include "constants.h"
 #include "core/buffer.h"
 #include "crypto/salt.h"
@@ -37,15 +38,17 @@ static void generate_salt(buf_t* salt) {
 static void save_password(buf_t* password) {
   /* Prepare a new auth token */
   auth_t auth;
-  buf_initf(&auth.pass_salt, PASSWORD_SALT_SIZE);
-  buf_initf(&auth.pass_hash, SHA256_HASH_SIZE);
-  buf_initf(&auth.kek_salt, PASSWORD_SALT_SIZE);
-  buf_initf(&auth.kek_hash, KEK_SIZE);
+  auth_init(&auth);
 
-  /* Generate password salt and hask */
+  /* Generate password salt and the RK, then expand the password hash */
+  buf_t root_key, wrap_key;
+  buf_initf(&root_key, SHA256_HASH_SIZE);
+  buf_initf(&wrap_key, SHA256_HASH_SIZE);
   generate_salt(&auth.pass_salt);
-  generate_salt(&auth.kek_salt);
-  hash_password(password, &auth.pass_salt, &auth.pass_hash);
+  auth.iterations = calibrate_iterations();
+  hash_password(password, &auth.pass_salt, auth.iterations, &root_key);
+  expand_root_key(&root_key, HKDF_LABEL_VERIFIER, &auth.pass_hash);
+  expand_root_key(&root_key, HKDF_LABEL_KEK_WRAP, &wrap_key);
 
   /* This is a new agent, so write the key encryption key */
   buf_t kek;
@@ -58,20 +61,15 @@ static void save_password(buf_t* password) {
     gen_pseudosalt(buf_to_cstr(&HOME_PATH), &kek);
   }
 
-  /* Encrypt KEK using RK */
-  buf_t root_key;
-  buf_initf(&root_key, SHA256_HASH_SIZE);
-  hash_password(password, &auth.kek_salt, &root_key);
-  xor_encrypt(&kek, &root_key, &auth.kek_hash);
+  /* Encrypt KEK using the key expanded from the RK */
+  xor_encrypt(&kek, &wrap_key, &auth.kek_hash);
 
   /* Write the auth stuff into a file on disk */
   write_auth(&auth);
   buf_free(&kek);
+  buf_free(&wrap_key);
   buf_free(&root_key);
-  buf_free(&auth.pass_salt);
-  buf_free(&auth.pass_hash);
-  buf_free(&auth.kek_salt);
-  buf_free(&auth.kek_hash);
+  auth_free(&auth);
 }
 
 int handler_agent_setup(int argc, char* argv[], int flagc, char* flagv[],
@@ -113,6 +111,9 @@ int handler_agent_setup(int argc, char* argv[], int flagc, char* flagv[],
   buf_init(&password, 32);
   readline("Enter new password > ", &password);
   save_password(&password);
+
+  /* A session left over from a previous agent at this path is now invalid */
+  session_revoke();
   buf_free(&password);
   printf("Agent setup complete!\n");
   return EXIT_OK;
@@ -8,9 +8,21 @@
 #include "command/bin/rm.h"
 #include "utils/args.h"
 
-cmd_handler_t cmd_bin_create =
-    CMD_MKLEAF("create", "Create a new bin", "<bin_name>", handler_bin_create,
-               DEFAULT_FLAGS, N_DEFAULT_FLAGS);
+/* Flag for creating bins encrypted with ChaCha20 instead of AES-CTR */
+const char* flag_chacha20_aliases[] = {"-c", "--chacha20"};
+const int num_flag_chacha20_aliases =
+    sizeof(flag_chacha20_aliases) / sizeof(flag_chacha20_aliases[0]);
+
+flag_handler_t flag_chacha20 = {flag_chacha20_aliases,
+                                num_flag_chacha20_aliases,
+                                "Encrypt the bin using ChaCha20", true};
+
+flag_handler_t* cmd_bin_create_flags[] = {&flag_help, &flag_chacha20};
+
+cmd_handler_t cmd_bin_create = CMD_MKLEAF(
+    "create", "Create a new bin", "<bin_name>", handler_bin_create,
+    cmd_bin_create_flags,
+    sizeof(cmd_bin_create_flags) / sizeof(cmd_bin_create_flags[0]));
 
 cmd_handler_t cmd_bin_rename =
     CMD_MKLEAF("rename", "Rename a bin", "<bin_name> <new_bin_name>",
@@ -3,10 +3,12 @@
 #include <stdio.h>
 #include <string.h>
 
-#include "auth/check.h"
+#include "auth/session.h"
 #include "bin.h"
+#include "command/bin/bin.h"
 #include "constants.h"
 #include "core/buffer.h"
+#include "crypto/cipher.h"
 #include "crypto/urandom.h"
 #include "db.h"
 #include "globals.h"
@@ -18,6 +20,7 @@
 int handler_bin_create(int argc, char* argv[], int flagc, char* flagv[],
                        const char* path, cmd_handler_t* self) {
   /* Flag handling */
+  cipher_t cipher = CIPHER_AES_CTR;
   int fi;
   for (fi = 0; fi < flagc; ++fi) {
     const char* flag = flagv[fi];
@@ -31,6 +34,16 @@ int handler_bin_create(int argc, char* argv[], int flagc, char* flagv[],
       }
     }
 
+    /* Cipher selection flag */
+    bool matched = false;
+    for (ai = 0; ai < flag_chacha20.num_aliases; ++ai) {
+      if (strcmp(flag, flag_chacha20.aliases[ai]) == 0) {
+        cipher = CIPHER_CHACHA20;
+        matched = true;
+      }
+    }
+    if (matched) continue;
+
     /* Fail on extra flags */
     print_help(HELP_INVALID_FLAGS, path, self, flag);
     return EXIT_INVALID_FLAG;
@@ -43,15 +56,12 @@ int handler_bin_create(int argc, char* argv[], int flagc, char* flagv[],
   }
 
   /* Authentication */
-  buf_t kek, db_key;
-  buf_initf(&kek, KEK_SIZE);
+  buf_t db_key;
   buf_initf(&db_key, AES_KEY_SIZE);
-  if (!prompt_password(&kek)) {
+  if (!prompt_db_key(&db_key)) {
     error("Incorrect password");
     return EXIT_INVALID_PASS;
   }
-  db_derive_key(&kek, &db_key);
-  buf_free(&kek);
 
   /* Database setup */
   buf_t db_path;
@@ -94,7 +104,7 @@ int handler_bin_create(int argc, char* argv[], int flagc, char* flagv[],
   /* Write the bin identifier to database */
   buf_t bin_id_ns;
   buf_view(&bin_id_ns, NAMESPACE_BIN_ID, strlen(NAMESPACE_BIN_ID));
-  bin_create(&bin, &bin_id, &aes_key, buf_to_cstr(&bin_path));
+  bin_create(&bin, &bin_id, &aes_key, cipher, buf_to_cstr(&bin_path));
   db_writens(&db, &bin_id_ns, &bin.id, &aes_key, &db_key);
   buf_free(&bin_id);
 
@@ -3,7 +3,7 @@
 #include <stdio.h>
 #include <string.h>
 
-#include "auth/check.h"
+#include "auth/session.h"
 #include "bin.h"
 #include "constants.h"
 #include "core/buffer.h"
@@ -48,15 +48,12 @@ int handler_bin_export(int argc, char* argv[], int flagc, char* flagv[],
   }
 
   /* Authentication */
-  buf_t kek, db_key;
-  buf_initf(&kek, KEK_SIZE);
+  buf_t db_key;
   buf_initf(&db_key, AES_KEY_SIZE);
-  if (!prompt_password(&kek)) {
+  if (!prompt_db_key(&db_key)) {
     error("Incorrect password");
     return EXIT_INVALID_PASS;
   }
-  db_derive_key(&kek, &db_key);
-  buf_free(&kek);
 
   /* Database setup */
   buf_t db_path;
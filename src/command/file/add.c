@@ -2,7 +2,7 @@
 
 #include <string.h>
 
-#include "auth/check.h"
+#include "auth/session.h"
 #include "bin.h"
 #include "constants.h"
 #include "core/buffer.h"
@@ -42,15 +42,12 @@ int handler_file_add(int argc, char* argv[], int flagc, char* flagv[],
   }
 
   /* Authentication */
-  buf_t kek, db_key;
-  buf_initf(&kek, KEK_SIZE);
+  buf_t db_key;
   buf_initf(&db_key, AES_KEY_SIZE);
-  if (!prompt_password(&kek)) {
+  if (!prompt_db_key(&db_key)) {
     error("Incorrect password");
     return EXIT_INVALID_PASS;
   }
-  db_derive_key(&kek, &db_key);
-  buf_free(&kek);
 
   /* Database setup */
   buf_t db_path;
@@ -109,7 +106,7 @@ int handler_file_add(int argc, char* argv[], int flagc, char* flagv[],
   buf_initf(&fq_path, strlen(argv[2]) + 1);
   buf_init(&bin_tpath, 32);
   tempfile(&bin_tpath);
-  buf_initf(&data, READFILE_CHUNK);
+  buf_initf(&data, READFILE_BULK_CHUNK);
   buf_append(&fq_path, argv[2], strlen(argv[2]));
   bin_open(&bin, &aes_key, buf_to_cstr(&bin_path), buf_to_cstr(&bin_tpath));
 
@@ -136,8 +133,10 @@ int handler_file_add(int argc, char* argv[], int flagc, char* flagv[],
     goto cleanup;
   }
 
+  /* Write in large chunks so each one is encrypted across all the cores */
   while (remaining > 0) {
-    size_t chunk = remaining < READFILE_CHUNK ? remaining : READFILE_CHUNK;
+    size_t chunk =
+        remaining < READFILE_BULK_CHUNK ? remaining : READFILE_BULK_CHUNK;
     freads(data.data, chunk, file);
     data.size = chunk;
     bin_write_file(&bin, &data);
@@ -2,7 +2,7 @@
 
 #include <string.h>
 
-#include "auth/check.h"
+#include "auth/session.h"
 #include "bin.h"
 #include "constants.h"
 #include "core/buffer.h"
@@ -44,12 +44,9 @@ int handler_file_cp(int argc, char* argv[], int flagc, char* flagv[],
   }
 
   /* Authentication */
-  buf_t kek, db_key;
-  buf_initf(&kek, KEK_SIZE);
+  buf_t db_key;
   buf_initf(&db_key, AES_KEY_SIZE);
-  if (!prompt_password(&kek)) return error("Incorrect password"), 1;
-  db_derive_key(&kek, &db_key);
-  buf_free(&kek);
+  if (!prompt_db_key(&db_key)) return error("Incorrect password"), 1;
 
   /* Database setup */
   buf_t db_path;
@@ -11,6 +11,13 @@
 
 static size_t in_use = 0;
 
+/* Buffers can be allocated by streams running on different threads */
+#if defined(__GNUC__)
+#define IN_USE_ADD(n) __sync_fetch_and_add(&in_use, (n))
+#else
+#define IN_USE_ADD(n) (in_use += (n))
+#endif
+
 void buf_resize(buf_t* buf, size_t new_capacity) {
   if (new_capacity == 0) throw("Initial capacity cannot be zero");
   if (buf->fixed) throw("Cannot resize fixed buffer");
@@ -25,7 +32,7 @@ void buf_init(buf_t* buf, size_t initial_capacity) {
   buf->data = (uint8_t*)malloc(initial_capacity);
   if (!buf->data) throw("Malloc failed");
 #ifdef DEBUG
-  in_use++;
+  IN_USE_ADD(1);
 #endif
   buf->size = 0;
   buf->capacity = initial_capacity;
@@ -37,7 +44,7 @@ void buf_initf(buf_t* buf, size_t initial_capacity) {
   buf->data = (uint8_t*)malloc(initial_capacity);
   if (!buf->data) throw("Malloc failed");
 #ifdef DEBUG
-  in_use++;
+  IN_USE_ADD(1);
 #endif
   buf->size = 0;
   buf->capacity = initial_capacity;
@@ -113,7 +120,7 @@ void buf_free(buf_t* buf) {
   if (buf->data) free(buf->data);
   buf->data = NULL;
 #ifdef DEBUG
-  in_use--;
+  IN_USE_ADD(-1);
 #endif
 }
 
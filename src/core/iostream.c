@@ -1,64 +1,1140 @@
+/**
+ * With read-ahead enabled, the keystream window is split into segments which
+ * are used as a ring. The helper fills segments in order of stream offset, and
+ * stays at most one window ahead of the oldest segment still being used by the
+ * stream. A segment is only handed to the stream once it has been filled, and
+ * only refilled once the stream has moved past it, so the keystream itself is
+ * read and written without holding the lock.
+ */
+
+/* For pread, pwrite, mmap, madvise, ftruncate and O_DIRECT */
+#define _GNU_SOURCE
+
 #include "core/iostream.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "constants.h"
 #include "core/buffer.h"
-#include "crypto/aes.h"
-#include "crypto/aes_ctr.h"
+#include "core/uring.h"
+#include "crypto/cipher.h"
+#include "utils/cli.h"
 #include "utils/system.h"
+#include "utils/throw.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define IOSTREAM_MMAP
+#include <sys/mman.h>
+#endif
+
+#if defined(__linux__) && defined(O_DIRECT)
+#define IOSTREAM_DIRECT
+#endif
+
+/* Marks the file position as unknown, so the next IO always seeks */
+#define IOSTREAM_UNKNOWN_OFFSET ((size_t)-1)
+
+static bool backend_selected = false;
+static iostream_backend_t active_backend = IOSTREAM_BACKEND_SYNC;
+
+struct iostream_readahead_t {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t filled;
+  pthread_cond_t released;
+  const cipher_ctx_t* cipher;
+  uint8_t iv[AES_IV_SIZE];
+  buf_t keystream;
+  size_t segment;
+  size_t origin;
+  size_t end;
+  size_t generation;
+  size_t next_fill;
+  size_t in_use;
+  bool stop;
+};
+
+/* XORs the keystream into the data a machine word at a time */
+static void xor_keystream(uint8_t* out, const uint8_t* in, const uint8_t* ks,
+                          size_t len) {
+  uint64_t a, b;
+  while (len >= sizeof(uint64_t)) {
+    memcpy(&a, in, sizeof(uint64_t));
+    memcpy(&b, ks, sizeof(uint64_t));
+    a ^= b;
+    memcpy(out, &a, sizeof(uint64_t));
+    in += sizeof(uint64_t);
+    ks += sizeof(uint64_t);
+    out += sizeof(uint64_t);
+    len -= sizeof(uint64_t);
+  }
+  while (len-- > 0) *out++ = *in++ ^ *ks++;
+}
+
+static void* readahead_worker(void* args) {
+  iostream_readahead_t* ra = (iostream_readahead_t*)args;
+  pthread_mutex_lock(&ra->lock);
+  while (true) {
+    /* Wait until there is a free segment which is still inside the stream */
+    while (!ra->stop &&
+           (ra->next_fill >= ra->in_use + IOSTREAM_READAHEAD_SEGMENTS ||
+            ra->origin + ra->next_fill * ra->segment >= ra->end)) {
+      pthread_cond_wait(&ra->released, &ra->lock);
+    }
+    if (ra->stop) break;
+
+    size_t index = ra->next_fill;
+    size_t generation = ra->generation;
+    size_t offset = ra->origin + index * ra->segment;
+    size_t len = ra->end - offset;
+    if (len > ra->segment) len = ra->segment;
+    uint8_t* slot = ra->keystream.data +
+                    (index % IOSTREAM_READAHEAD_SEGMENTS) * ra->segment;
+    pthread_mutex_unlock(&ra->lock);
+
+    /* The keystream is the cipher applied to zeroes */
+    memset(slot, 0, len);
+    cipher_transform_parallel(ra->cipher, ra->iv, offset, slot, slot, len);
+
+    /* Throw the segment away if the stream restarted the window meanwhile */
+    pthread_mutex_lock(&ra->lock);
+    if (generation == ra->generation) {
+      ra->next_fill++;
+      pthread_cond_signal(&ra->filled);
+    }
+  }
+  pthread_mutex_unlock(&ra->lock);
+  return NULL;
+}
+
+/**
+ * Applies the precomputed keystream to the data, waiting for the helper if it
+ * has fallen behind. Returns the number of bytes transformed, which can be
+ * less than requested if the data runs past the end of the read-ahead.
+ */
+static size_t readahead_apply(iostream_readahead_t* ra, size_t offset,
+                              const uint8_t* in, uint8_t* out, size_t len) {
+  size_t done = 0;
+  pthread_mutex_lock(&ra->lock);
+  while (done < len && offset < ra->end) {
+    /* Restart the window if the stream has jumped outside of it */
+    if (offset < ra->origin ||
+        (offset - ra->origin) / ra->segment < ra->in_use ||
+        (offset - ra->origin) / ra->segment > ra->next_fill) {
+      ra->generation++;
+      ra->origin = offset;
+      ra->next_fill = 0;
+      ra->in_use = 0;
+    }
+
+    /* Release every segment before this one back to the helper */
+    size_t index = (offset - ra->origin) / ra->segment;
+    if (index > ra->in_use) ra->in_use = index;
+    pthread_cond_signal(&ra->released);
+    while (ra->next_fill <= index) pthread_cond_wait(&ra->filled, &ra->lock);
+
+    size_t start = offset - ra->origin - index * ra->segment;
+    size_t chunk = ra->segment - start;
+    if (chunk > len - done) chunk = len - done;
+    if (chunk > ra->end - offset) chunk = ra->end - offset;
+    const uint8_t* ks = ra->keystream.data +
+                        (index % IOSTREAM_READAHEAD_SEGMENTS) * ra->segment +
+                        start;
+    pthread_mutex_unlock(&ra->lock);
+
+    xor_keystream(out + done, in + done, ks, chunk);
+    offset += chunk;
+    done += chunk;
+    pthread_mutex_lock(&ra->lock);
+  }
+  pthread_mutex_unlock(&ra->lock);
+  return done;
+}
+
+/* Transforms data at a stream offset, preferring the read-ahead */
+static void iostream_transform_at(iostream_t* iostream, const size_t offset,
+                                  const uint8_t* in, uint8_t* out,
+                                  const size_t len) {
+  if (!iostream->cipher) {
+    if (in != out) memcpy(out, in, len);
+    return;
+  }
+
+  size_t done = 0;
+  if (iostream->readahead) {
+    done = readahead_apply(iostream->readahead, offset, in, out, len);
+  }
+  if (done < len) {
+    cipher_transform_parallel(iostream->cipher, iostream->counter.data,
+                              offset + done, in + done, out + done,
+                              len - done);
+  }
+}
+
+/* Transforms data at the current stream offset */
+static void iostream_transform(iostream_t* iostream, const uint8_t* in,
+                               uint8_t* out, const size_t len) {
+  iostream_transform_at(iostream, iostream->stream_offset, in, out, len);
+}
+
+static void select_backend() {
+  iostream_backend_t backend = IOSTREAM_BACKEND_SYNC;
+  backend_selected = true;
+
+  const char* forced = getenv("TRANSCODINE_IO_BACKEND");
+  if (!forced) {
+    if (uring_available()) backend = IOSTREAM_BACKEND_URING;
+  } else if (strcmp(forced, "sync") == 0) {
+    backend = IOSTREAM_BACKEND_SYNC;
+  } else if (strcmp(forced, "uring") == 0) {
+    if (uring_available()) {
+      backend = IOSTREAM_BACKEND_URING;
+    } else {
+      warn("io_uring is not available on this system");
+    }
+  } else {
+    warn("Unknown IO backend requested. Selecting automatically.");
+    if (uring_available()) backend = IOSTREAM_BACKEND_URING;
+  }
+  active_backend = backend;
+
+  if (backend == IOSTREAM_BACKEND_URING) {
+    debug("Using io_uring IO backend");
+  } else {
+    debug("Using synchronous IO backend");
+  }
+}
+
+/* Reads until the buffer is full or the file ends, returning the bytes read */
+static size_t pread_full(const int fd, uint8_t* data, const size_t len,
+                         const size_t offset) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t read = pread(fd, data + done, len - done, (off_t)(offset + done));
+    if (read < 0 && errno == EINTR) continue;
+    if (read < 0) throw("Failed to read bytes");
+    if (read == 0) break;
+    done += read;
+  }
+  return done;
+}
+
+static void pwrite_full(const int fd, const uint8_t* data, const size_t len,
+                        const size_t offset) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t written =
+        pwrite(fd, data + done, len - done, (off_t)(offset + done));
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) throw("Failed to write bytes");
+    done += written;
+  }
+}
+
+/* Writes a list of buffers back to back, carrying on after partial writes */
+static void pwritev_full(const int fd, struct iovec* iov, int count,
+                         size_t offset) {
+  while (count > 0) {
+    ssize_t written = pwritev(fd, iov, count, (off_t)offset);
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) throw("Failed to write bytes");
+    offset += written;
+    while (count > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (uint8_t*)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+}
+
+#ifdef IOSTREAM_DIRECT
+
+/* Checks once if the user asked for direct IO */
+static bool direct_requested() {
+  static bool checked = false;
+  static bool requested = false;
+  if (!checked) {
+    const char* direct = getenv("TRANSCODINE_DIRECT_IO");
+    requested = direct && strcmp(direct, "1") == 0;
+    if (requested) debug("Using direct IO for bulk streams");
+    checked = true;
+  }
+  return requested;
+}
+
+/* Rounds an offset down to the start of its block */
+static size_t direct_floor(const size_t offset) {
+  return offset & ~(size_t)(IOSTREAM_DIRECT_ALIGN - 1);
+}
+
+/* Rounds an offset up to the start of the next block */
+static size_t direct_ceil(const size_t offset) {
+  return direct_floor(offset + IOSTREAM_DIRECT_ALIGN - 1);
+}
+
+/* Gets the aligned buffer of a direct stream, allocated on first use */
+static uint8_t* direct_buffer(iostream_t* iostream) {
+  if (!iostream->direct_buffer) {
+    void* buffer;
+    if (posix_memalign(&buffer, IOSTREAM_DIRECT_ALIGN,
+                       IOSTREAM_DIRECT_CHUNK) != 0) {
+      throw("Malloc failed");
+    }
+    iostream->direct_buffer = buffer;
+  }
+  return iostream->direct_buffer;
+}
+
+/**
+ * Reads whole blocks at an aligned offset. A read which ends inside a block
+ * has hit the end of the file, as the next one couldn't be aligned anyway.
+ */
+static size_t direct_read(const int fd, uint8_t* data, const size_t len,
+                          const size_t offset) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t read = pread(fd, data + done, len - done, (off_t)(offset + done));
+    if (read < 0 && errno == EINTR) continue;
+    if (read < 0) throw("Failed to read bytes");
+    done += read;
+    if (read == 0 || done % IOSTREAM_DIRECT_ALIGN != 0) break;
+  }
+  return done;
+}
+
+/**
+ * Places the current contents of a block at an aligned spot in the buffer, so
+ * the bytes around a partial write are written back unchanged. Blocks past the
+ * end of the file are zeroes, and blocks still held in the buffer from the last
+ * IO are moved instead of being read again.
+ */
+static void direct_keep(iostream_t* iostream, const size_t block,
+                        const size_t at) {
+  uint8_t* out = iostream->direct_buffer + at;
+  if (block >= iostream->direct_size) {
+    memset(out, 0, IOSTREAM_DIRECT_ALIGN);
+  } else if (block >= iostream->direct_cache_offset &&
+             block + IOSTREAM_DIRECT_ALIGN <=
+                 iostream->direct_cache_offset + iostream->direct_cache_len) {
+    memmove(out,
+            iostream->direct_buffer + (block - iostream->direct_cache_offset),
+            IOSTREAM_DIRECT_ALIGN);
+  } else {
+    size_t read =
+        direct_read(iostream->raw_fd, out, IOSTREAM_DIRECT_ALIGN, block);
+    memset(out + read, 0, IOSTREAM_DIRECT_ALIGN - read);
+  }
+}
+
+/**
+ * Reads from a direct stream. The buffer is always filled as far as it goes,
+ * so the blocks around the end of one read are still there for the next.
+ * @returns The number of bytes read, which is only short at the end of file
+ */
+static size_t direct_pread(iostream_t* iostream, uint8_t* data, size_t len,
+                           const size_t offset) {
+  if (offset >= iostream->direct_size) return 0;
+  if (len > iostream->direct_size - offset) {
+    len = iostream->direct_size - offset;
+  }
+  uint8_t* buffer = direct_buffer(iostream);
+  size_t done = 0;
+  while (done < len) {
+    size_t pos = offset + done;
+    if (pos < iostream->direct_cache_offset ||
+        pos >= iostream->direct_cache_offset + iostream->direct_cache_len) {
+      size_t start = direct_floor(pos);
+      size_t span = direct_ceil(iostream->direct_size) - start;
+      if (span > IOSTREAM_DIRECT_CHUNK) span = IOSTREAM_DIRECT_CHUNK;
+      iostream->direct_cache_offset = start;
+      iostream->direct_cache_len =
+          direct_read(iostream->raw_fd, buffer, span, start);
+      if (iostream->direct_cache_len <= pos - start) break;
+    }
+
+    size_t at = pos - iostream->direct_cache_offset;
+    size_t n = iostream->direct_cache_len - at;
+    if (n > len - done) n = len - done;
+    memcpy(data + done, buffer + at, n);
+    done += n;
+  }
+  return done;
+}
+
+/**
+ * Writes to a direct stream, a buffer at a time. The file is padded to the end
+ * of the last block written, which is cut off again by iostream_flush().
+ */
+static void direct_pwrite(iostream_t* iostream, const uint8_t* data,
+                          const size_t len, const size_t offset) {
+  uint8_t* buffer = direct_buffer(iostream);
+  size_t end = offset + len;
+  size_t done = 0;
+  while (done < len) {
+    size_t pos = offset + done;
+    size_t start = direct_floor(pos);
+    size_t span = direct_ceil(end) - start;
+    if (span > IOSTREAM_DIRECT_CHUNK) span = IOSTREAM_DIRECT_CHUNK;
+    size_t n = span - (pos - start);
+    if (n > len - done) n = len - done;
+
+    /* Keep the bytes of the partial blocks which aren't being written */
+    size_t tail = start + span - IOSTREAM_DIRECT_ALIGN;
+    bool head = pos > start;
+    if (head) direct_keep(iostream, start, 0);
+    iostream->direct_cache_len = 0;
+    if (pos + n < start + span && !(head && tail == start)) {
+      direct_keep(iostream, tail, span - IOSTREAM_DIRECT_ALIGN);
+    }
+
+    memcpy(buffer + (pos - start), data + done, n);
+    pwrite_full(iostream->raw_fd, buffer, span, start);
+    iostream->direct_cache_offset = start;
+    iostream->direct_cache_len = span;
+    if (start + span > iostream->direct_size && start + span > end) {
+      iostream->direct_padded = true;
+    }
+    done += n;
+  }
+  if (end > iostream->direct_size) iostream->direct_size = end;
+}
+
+#endif
+
+/**
+ * Moves the file to an offset, unless it is already there. Switching between
+ * reading and writing always seeks, as stdio requires it.
+ */
+static void iostream_seek_fd(iostream_t* iostream, const size_t offset,
+                             const bool writing) {
+  if (iostream->fd_offset == offset && iostream->fd_writing == writing) return;
+  fseek(iostream->fd, offset, SEEK_SET);
+  iostream->fd_offset = offset;
+  iostream->fd_writing = writing;
+}
+
+/* Gets the descriptor behind the stream */
+static int iostream_fileno(const iostream_t* iostream) {
+  return iostream->fd ? fileno(iostream->fd) : iostream->raw_fd;
+}
+
+/**
+ * Reads from the file at an offset. Streams over a raw descriptor read it
+ * without moving the shared file position.
+ * @returns The number of bytes read, which is only short at the end of file
+ */
+static size_t iostream_pread(iostream_t* iostream, uint8_t* data,
+                             const size_t len, const size_t offset) {
+  if (iostream->fd) {
+    iostream_seek_fd(iostream, offset, false);
+    size_t read = fread(data, sizeof(uint8_t), len, iostream->fd);
+    iostream->fd_offset += read;
+    return read;
+  }
+#ifdef IOSTREAM_DIRECT
+  if (iostream->direct) return direct_pread(iostream, data, len, offset);
+#endif
+  return pread_full(iostream->raw_fd, data, len, offset);
+}
+
+/**
+ * Writes to the file at an offset. Streams over a raw descriptor write it
+ * without moving the shared file position.
+ */
+static void iostream_pwrite(iostream_t* iostream, const uint8_t* data,
+                            const size_t len, const size_t offset) {
+  if (iostream->fd) {
+    iostream_seek_fd(iostream, offset, true);
+    fwrites(data, len, iostream->fd);
+    iostream->fd_offset += len;
+    return;
+  }
+#ifdef IOSTREAM_DIRECT
+  if (iostream->direct) return direct_pwrite(iostream, data, len, offset);
+#endif
+  pwrite_full(iostream->raw_fd, data, len, offset);
+}
+
+/**
+ * Writes a list of buffers to the file at an offset with a single call where
+ * possible. Streams over a FILE write them one at a time through stdio, so its
+ * buffers and file position stay in step with the file.
+ */
+static void iostream_pwritev(iostream_t* iostream, struct iovec* iov,
+                             const int count, const size_t offset) {
+#ifdef IOSTREAM_DIRECT
+  if (iostream->direct) {
+    size_t at = offset;
+    int i;
+    for (i = 0; i < count; ++i) {
+      direct_pwrite(iostream, iov[i].iov_base, iov[i].iov_len, at);
+      at += iov[i].iov_len;
+    }
+    return;
+  }
+#endif
+  if (iostream->fd) {
+    size_t at = offset;
+    int i;
+    for (i = 0; i < count; ++i) {
+      iostream_pwrite(iostream, iov[i].iov_base, iov[i].iov_len, at);
+      at += iov[i].iov_len;
+    }
+    return;
+  }
+  pwritev_full(iostream->raw_fd, iov, count, offset);
+}
+
+/**
+ * Sets up the ring the first time the stream does bulk IO, if the io_uring
+ * backend is in use. A stream which fails to set one up doesn't try again.
+ * @returns True if the stream has a ring, false otherwise
+ */
+static bool iostream_uring(iostream_t* iostream) {
+  if (iostream->uring) return true;
+  if (iostream->uring_failed ||
+      iostream_get_backend() != IOSTREAM_BACKEND_URING) {
+    return false;
+  }
+  iostream->uring = uring_create(iostream_fileno(iostream),
+                                 IOSTREAM_URING_DEPTH, IOSTREAM_URING_BLOCK);
+  if (!iostream->uring) {
+    iostream->uring_failed = true;
+    debug("Failed to set up io_uring, using synchronous IO");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * The ring bypasses stdio, so anything stdio still holds must reach the file
+ * first. Once the stream has gone back over what it wrote, stdio could be
+ * holding bytes for the same part of the file as the ring.
+ */
+static void iostream_uring_sync(iostream_t* iostream) {
+  if (iostream->fd && iostream->fd_writing) fflush(iostream->fd);
+}
+
+/* Gets the length of a block of a bulk transfer through the ring */
+static size_t uring_block_len(const size_t len, const size_t block) {
+  size_t start = block * IOSTREAM_URING_BLOCK;
+  return len - start < IOSTREAM_URING_BLOCK ? len - start
+                                            : IOSTREAM_URING_BLOCK;
+}
 
-void iostream_init(iostream_t* iostream, FILE* fd, const aes_ctx_t* aes_ctx,
+/**
+ * Reads a large chunk through the ring. Every slot is kept busy reading the
+ * next blocks, while the blocks which have landed are decrypted in order.
+ */
+static void iostream_uring_read(iostream_t* iostream, uint8_t* out,
+                                const size_t len) {
+  uring_t* ring = iostream->uring;
+  bool ready[IOSTREAM_URING_DEPTH];
+  size_t blocks = (len + IOSTREAM_URING_BLOCK - 1) / IOSTREAM_URING_BLOCK;
+  size_t queued, decrypted;
+  iostream_uring_sync(iostream);
+  for (queued = 0; queued < blocks && queued < IOSTREAM_URING_DEPTH;
+       ++queued) {
+    ready[queued] = false;
+    uring_read(ring, queued, uring_block_len(len, queued),
+               iostream->file_offset + queued * IOSTREAM_URING_BLOCK);
+  }
+  uring_submit(ring);
+
+  for (decrypted = 0; decrypted < blocks; ++decrypted) {
+    /* Block n always goes through slot n modulo the depth */
+    size_t slot = decrypted % IOSTREAM_URING_DEPTH;
+    while (!ready[slot]) {
+      size_t done;
+      long result = uring_wait(ring, &done);
+      if (result < 0) throw("Failed to read bytes");
+
+      /* Blocks in flight always belong to the next round of slots */
+      size_t block = decrypted + (done + IOSTREAM_URING_DEPTH - slot) %
+                                     IOSTREAM_URING_DEPTH;
+      size_t want = uring_block_len(len, block);
+      size_t offset = iostream->file_offset + block * IOSTREAM_URING_BLOCK;
+      if ((size_t)result < want &&
+          pread_full(iostream_fileno(iostream),
+                     uring_buffer(ring, done) + result, want - result,
+                     offset + result) != want - result) {
+        throw("Unexpected EOF");
+      }
+      ready[done] = true;
+    }
+
+    size_t start = decrypted * IOSTREAM_URING_BLOCK;
+    iostream_transform_at(iostream, iostream->stream_offset + start,
+                          uring_buffer(ring, slot), out + start,
+                          uring_block_len(len, decrypted));
+    ready[slot] = false;
+    if (queued < blocks) {
+      uring_read(ring, slot, uring_block_len(len, queued),
+                 iostream->file_offset + queued * IOSTREAM_URING_BLOCK);
+      uring_submit(ring);
+      queued++;
+    }
+  }
+}
+
+/**
+ * Writes a large chunk through the ring. Each block is encrypted into a free
+ * slot while the blocks before it are still being written.
+ */
+static void iostream_uring_write(iostream_t* iostream, const uint8_t* in,
+                                 const size_t len) {
+  uring_t* ring = iostream->uring;
+  bool busy[IOSTREAM_URING_DEPTH];
+  size_t owner[IOSTREAM_URING_DEPTH];
+  size_t blocks = (len + IOSTREAM_URING_BLOCK - 1) / IOSTREAM_URING_BLOCK;
+  size_t in_flight = 0, block, slot;
+  iostream_uring_sync(iostream);
+  for (slot = 0; slot < IOSTREAM_URING_DEPTH; ++slot) busy[slot] = false;
+
+  for (block = 0; block <= blocks; ++block) {
+    /* Wait for the slot of this block, or for everything after the last */
+    slot = block % IOSTREAM_URING_DEPTH;
+    while (block < blocks ? busy[slot] : in_flight > 0) {
+      size_t done;
+      long result = uring_wait(ring, &done);
+      if (result < 0) throw("Failed to write bytes");
+      size_t want = uring_block_len(len, owner[done]);
+      size_t offset =
+          iostream->file_offset + owner[done] * IOSTREAM_URING_BLOCK;
+      if ((size_t)result < want) {
+        pwrite_full(iostream_fileno(iostream),
+                    uring_buffer(ring, done) + result, want - result,
+                    offset + result);
+      }
+      busy[done] = false;
+      in_flight--;
+    }
+    if (block == blocks) break;
+
+    size_t start = block * IOSTREAM_URING_BLOCK;
+    size_t n = uring_block_len(len, block);
+    iostream_transform_at(iostream, iostream->stream_offset + start,
+                          in + start, uring_buffer(ring, slot), n);
+    uring_write(ring, slot, n, iostream->file_offset + start);
+    uring_submit(ring);
+    busy[slot] = true;
+    owner[slot] = block;
+    in_flight++;
+  }
+
+  /* The file position stdio knows about can no longer be trusted */
+  iostream->fd_offset = IOSTREAM_UNKNOWN_OFFSET;
+}
+
+/* Writes out the part of the window which has been written to */
+static void iostream_flush_window(iostream_t* iostream) {
+  if (iostream->dirty_end == iostream->dirty_start) return;
+  size_t len = iostream->dirty_end - iostream->dirty_start;
+  iostream_pwrite(iostream, iostream->window.data + iostream->dirty_start, len,
+                  iostream->window_offset + iostream->dirty_start);
+  iostream->dirty_start = 0;
+  iostream->dirty_end = 0;
+}
+
+/**
+ * Writes ciphertext for the current offset. If the window is still holding
+ * written bytes which lead straight up to it, both go out in the same call.
+ */
+static void iostream_write_staged(iostream_t* iostream, const uint8_t* data,
+                                  const size_t len) {
+  struct iovec iov[2];
+  int count = 0;
+  size_t offset = iostream->file_offset;
+  if (iostream->dirty_end != iostream->dirty_start &&
+      iostream->window_offset + iostream->dirty_end == offset) {
+    iov[count].iov_base = iostream->window.data + iostream->dirty_start;
+    iov[count].iov_len = iostream->dirty_end - iostream->dirty_start;
+    offset -= iov[count].iov_len;
+    iostream->dirty_start = 0;
+    iostream->dirty_end = 0;
+    count++;
+  } else {
+    iostream_flush_window(iostream);
+  }
+  iov[count].iov_base = (void*)data;
+  iov[count].iov_len = len;
+  count++;
+  iostream_pwritev(iostream, iov, count, offset);
+}
+
+/* Drops the window if a write at the current offset left it stale */
+static void iostream_drop_window(iostream_t* iostream, const size_t len) {
+  if (iostream->window_offset < iostream->file_offset + len &&
+      iostream->file_offset < iostream->window_offset + iostream->window.size) {
+    iostream->window.size = 0;
+  }
+}
+
+/* Gets the scratch buffer with room for a write, allocating it on first use */
+static uint8_t* iostream_scratch(iostream_t* iostream, const size_t len) {
+  buf_t* scratch = &iostream->scratch;
+  if (!scratch->data) buf_init(scratch, len);
+  if (scratch->capacity < len) buf_resize(scratch, len);
+  return scratch->data;
+}
+
+/* Checks if the byte at the current file offset is held in the window */
+static bool iostream_in_window(const iostream_t* iostream) {
+  return iostream->file_offset >= iostream->window_offset &&
+         iostream->file_offset - iostream->window_offset <
+             iostream->window.size;
+}
+
+/* Refills the window with the ciphertext starting at the current offset */
+static void iostream_fill(iostream_t* iostream) {
+  iostream_flush_window(iostream);
+  if (!iostream->window.data) {
+    buf_initf(&iostream->window, IOSTREAM_WINDOW_SIZE);
+  }
+  iostream->window_offset = iostream->file_offset;
+  iostream->window.size =
+      iostream_pread(iostream, iostream->window.data,
+                     iostream->window.capacity, iostream->file_offset);
+  if (iostream->window.size == 0) throw("Unexpected EOF");
+}
+
+#ifdef IOSTREAM_MMAP
+
+/* Maps the first bytes of the file, hinting at how the stream will use them */
+static bool iostream_mmap_file(iostream_t* iostream, const size_t size) {
+  void* map =
+      mmap(NULL, size, PROT_READ, MAP_SHARED, iostream_fileno(iostream), 0);
+  if (map == MAP_FAILED) return false;
+  madvise(map, size,
+          iostream->map_access == IOSTREAM_SEQUENTIAL ? MADV_SEQUENTIAL
+                                                      : MADV_RANDOM);
+  iostream->map = map;
+  iostream->map_size = size;
+  return true;
+}
+
+static void iostream_unmap(iostream_t* iostream) {
+  munmap(iostream->map, iostream->map_size);
+  iostream->map = NULL;
+}
+
+#endif
+
+bool iostream_set_backend(const iostream_backend_t backend) {
+  if (backend == IOSTREAM_BACKEND_URING && !uring_available()) return false;
+  backend_selected = true;
+  active_backend = backend;
+  return true;
+}
+
+iostream_backend_t iostream_get_backend() {
+  if (!backend_selected) select_backend();
+  return active_backend;
+}
+
+void iostream_init(iostream_t* iostream, FILE* fd, const cipher_ctx_t* cipher,
                    const buf_t* iv, const size_t offset) {
   buf_initf(&iostream->counter, AES_IV_SIZE);
-  buf_copy(&iostream->counter, iv);
+  if (iv) buf_copy(&iostream->counter, iv);
+  iostream->scratch.data = NULL;
+  iostream->window.data = NULL;
+  iostream->window.size = 0;
+  iostream->window_offset = 0;
+  iostream->dirty_start = 0;
+  iostream->dirty_end = 0;
+  iostream->fd_offset = IOSTREAM_UNKNOWN_OFFSET;
+  iostream->fd_writing = false;
+  iostream->map = NULL;
+  iostream->map_size = 0;
+  iostream->map_access = IOSTREAM_SEQUENTIAL;
+  iostream->uring = NULL;
+  iostream->uring_failed = false;
+  iostream->direct = false;
+  iostream->direct_buffer = NULL;
+  iostream->direct_size = 0;
+  iostream->direct_cache_offset = 0;
+  iostream->direct_cache_len = 0;
+  iostream->direct_padded = false;
   iostream->fd = fd;
-  iostream->aes_ctx = aes_ctx;
+  iostream->raw_fd = -1;
+  iostream->cipher = cipher;
   iostream->file_offset = offset;
   iostream->stream_offset = 0;
+  iostream->readahead = NULL;
+}
+
+void iostream_init_fd(iostream_t* iostream, const int fd,
+                      const cipher_ctx_t* cipher, const buf_t* iv,
+                      const size_t offset) {
+  iostream_init(iostream, NULL, cipher, iv, offset);
+  iostream->raw_fd = fd;
+#ifdef IOSTREAM_DIRECT
+  /* Direct IO only works in blocks, and io_uring would need aligned blocks */
+  struct stat st;
+  int flags = fcntl(fd, F_GETFL);
+  if (flags >= 0 && (flags & O_DIRECT) && fstat(fd, &st) == 0) {
+    iostream->direct = true;
+    iostream->direct_size = st.st_size;
+    iostream->uring_failed = true;
+  }
+#endif
+}
+
+int iostream_open(const char* path, const int flags) {
+#ifdef IOSTREAM_DIRECT
+  if (direct_requested()) {
+    int fd = open(path, flags | O_DIRECT, 0666);
+    if (fd >= 0 || errno != EINVAL) return fd;
+    debug("Direct IO is not supported for this file");
+  }
+#endif
+  return open(path, flags, 0666);
+}
+
+void iostream_close(const int fd) {
+  if (close(fd) != 0) throw("Failed to close file");
+}
+
+size_t iostream_file_size(const int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) throw("Failed to get file size");
+  return st.st_size;
+}
+
+void iostream_copy(const int dst, const int src) {
+  iostream_t r, w;
+  iostream_init_fd(&r, src, NULL, NULL, 0);
+  iostream_init_fd(&w, dst, NULL, NULL, 0);
+
+  buf_t block;
+  buf_initf(&block, READFILE_BULK_CHUNK);
+  size_t remaining = iostream_file_size(src);
+  while (remaining > 0) {
+    size_t chunk =
+        remaining < READFILE_BULK_CHUNK ? remaining : READFILE_BULK_CHUNK;
+    iostream_read(&r, chunk, &block);
+    iostream_write(&w, &block);
+    remaining -= chunk;
+  }
+  iostream_truncate(&w);
+  buf_free(&block);
+  iostream_free(&r);
+  iostream_free(&w);
+}
+
+void iostream_replace(const char* path, const int src) {
+  /* Keep the temporary file on the same filesystem so the rename is atomic */
+  buf_t tmp_path;
+  buf_init(&tmp_path, 32);
+  buf_append(&tmp_path, path, strlen(path));
+  buf_append(&tmp_path, ".tmp", 4);
+  buf_write(&tmp_path, 0);
+
+  int dst = iostream_open(buf_to_cstr(&tmp_path), O_RDWR | O_CREAT | O_TRUNC);
+  if (dst < 0) throw("Failed to create temporary file");
+  iostream_copy(dst, src);
+  if (fsync(dst) != 0) throw("Failed to sync temporary file");
+  iostream_close(dst);
+  if (rename(buf_to_cstr(&tmp_path), path) != 0) {
+    remove(buf_to_cstr(&tmp_path));
+    throw("Failed to replace file");
+  }
+  buf_free(&tmp_path);
+}
+
+void iostream_readahead(iostream_t* iostream, const size_t len) {
+  if (!iostream->cipher || iostream->readahead) return;
+  if (len < IOSTREAM_READAHEAD_MIN) return;
+
+  /* Never generate more keystream than the stream is expected to use */
+  size_t window = len < IOSTREAM_READAHEAD_WINDOW ? len
+                                                  : IOSTREAM_READAHEAD_WINDOW;
+  iostream_readahead_t* ra = malloc(sizeof(iostream_readahead_t));
+  if (!ra) throw("Malloc failed");
+  ra->cipher = iostream->cipher;
+  memcpy(ra->iv, iostream->counter.data, AES_IV_SIZE);
+  ra->segment = (window + IOSTREAM_READAHEAD_SEGMENTS - 1) /
+                IOSTREAM_READAHEAD_SEGMENTS;
+  buf_initf(&ra->keystream, ra->segment * IOSTREAM_READAHEAD_SEGMENTS);
+  ra->origin = iostream->stream_offset;
+  ra->end = iostream->stream_offset + len;
+  ra->generation = 0;
+  ra->next_fill = 0;
+  ra->in_use = 0;
+  ra->stop = false;
+  pthread_mutex_init(&ra->lock, NULL);
+  pthread_cond_init(&ra->filled, NULL);
+  pthread_cond_init(&ra->released, NULL);
+
+  /* Carry on without read-ahead if the helper can't be started */
+  if (pthread_create(&ra->thread, NULL, readahead_worker, ra) != 0) {
+    warn("Failed to start read-ahead thread");
+    pthread_cond_destroy(&ra->released);
+    pthread_cond_destroy(&ra->filled);
+    pthread_mutex_destroy(&ra->lock);
+    buf_free(&ra->keystream);
+    free(ra);
+    return;
+  }
+  iostream->readahead = ra;
+}
+
+bool iostream_map(iostream_t* iostream, const iostream_access_t access) {
+#ifdef IOSTREAM_MMAP
+  if (iostream->map) return true;
+  if (iostream->direct) return false;
+  int fd = iostream_fileno(iostream);
+  iostream->map_access = access;
+
+  /* Anything written so far has to reach the file before it is mapped */
+  iostream_flush(iostream);
+  if (iostream->fd && (fcntl(fd, F_GETFL) & O_ACCMODE) != O_RDONLY) {
+    fflush(iostream->fd);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) return false;
+  if (!iostream_mmap_file(iostream, st.st_size)) {
+    debug("Failed to map file, using buffered IO");
+    return false;
+  }
+
+  /* Reads come from the mapping from now on, so the window would go stale */
+  iostream->window.size = 0;
+  iostream->fd_offset = IOSTREAM_UNKNOWN_OFFSET;
+  return true;
+#else
+  (void)iostream;
+  (void)access;
+  return false;
+#endif
 }
 
 void iostream_free(iostream_t* iostream) {
+  if (iostream->fd || iostream->raw_fd >= 0) iostream_flush(iostream);
+#ifdef IOSTREAM_MMAP
+  if (iostream->map) iostream_unmap(iostream);
+#endif
+  if (iostream->uring) {
+    uring_free(iostream->uring);
+    iostream->uring = NULL;
+  }
+  iostream_readahead_t* ra = iostream->readahead;
+  if (ra) {
+    pthread_mutex_lock(&ra->lock);
+    ra->stop = true;
+    pthread_cond_signal(&ra->released);
+    pthread_mutex_unlock(&ra->lock);
+    pthread_join(ra->thread, NULL);
+    pthread_cond_destroy(&ra->released);
+    pthread_cond_destroy(&ra->filled);
+    pthread_mutex_destroy(&ra->lock);
+    buf_free(&ra->keystream);
+    free(ra);
+    iostream->readahead = NULL;
+  }
+  free(iostream->direct_buffer);
+  iostream->direct_buffer = NULL;
   buf_free(&iostream->counter);
+  if (iostream->scratch.data) buf_free(&iostream->scratch);
+  if (iostream->window.data) buf_free(&iostream->window);
   iostream->fd = NULL;
+  iostream->raw_fd = -1;
 }
 
 void iostream_read(iostream_t* iostream, const size_t len, buf_t* data) {
-  /* Read ciphertext */
-  buf_t cipher;
-  buf_init(&cipher, len);
-  fseek(iostream->fd, iostream->file_offset, SEEK_SET);
-  freads(cipher.data, len, iostream->fd);
-  cipher.size = len;
+  if (data->capacity < len) buf_resize(data, len);
+
+  /* Decrypt straight out of the mapping */
+  if (iostream->map) {
+    if (iostream->file_offset > iostream->map_size ||
+        len > iostream->map_size - iostream->file_offset) {
+      throw("Unexpected EOF");
+    }
+    iostream_transform(iostream, iostream->map + iostream->file_offset,
+                       data->data, len);
+    iostream->file_offset += len;
+    iostream->stream_offset += len;
+    data->size = len;
+    return;
+  }
 
-  /* Decrypt data to the output buffer */
-  aes_ctr_crypt(iostream->aes_ctx, &iostream->counter, iostream->stream_offset,
-                &cipher, data);
+  size_t done = 0;
+  while (done < len) {
+    size_t n = len - done;
+    uint8_t* out = data->data + done;
+    if (iostream_in_window(iostream)) {
+      /* Decrypt as much as the window holds straight into the output */
+      size_t start = iostream->file_offset - iostream->window_offset;
+      if (n > iostream->window.size - start) n = iostream->window.size - start;
+      iostream_transform(iostream, iostream->window.data + start, out, n);
+    } else if (n >= IOSTREAM_WINDOW_SIZE) {
+      /* Read large chunks straight into the output and decrypt them there */
+      iostream_flush_window(iostream);
+      if (n >= IOSTREAM_URING_MIN && iostream_uring(iostream)) {
+        iostream_uring_read(iostream, out, n);
+      } else {
+        if (iostream_pread(iostream, out, n, iostream->file_offset) != n) {
+          throw("Unexpected EOF");
+        }
+        iostream_transform(iostream, out, out, n);
+      }
+    } else {
+      iostream_fill(iostream);
+      continue;
+    }
 
-  /* Update iostream state and clean up resource */
-  iostream->file_offset += cipher.size;
-  iostream->stream_offset += cipher.size;
-  buf_free(&cipher);
+    /* Update iostream state */
+    iostream->file_offset += n;
+    iostream->stream_offset += n;
+    done += n;
+  }
+  data->size = len;
 }
 
 void iostream_write(iostream_t* iostream, const buf_t* data) {
-  /* Encrypt the cleartext to write to the bin */
-  buf_t cipher;
-  buf_init(&cipher, data->size);
-  aes_ctr_crypt(iostream->aes_ctx, &iostream->counter, iostream->stream_offset,
-                data, &cipher);
+#ifdef IOSTREAM_MMAP
+  /* The mapping is read-only, so writes go back to buffered IO */
+  if (iostream->map) iostream_unmap(iostream);
+#endif
+
+  size_t done = 0;
+  while (done < data->size) {
+    size_t n = data->size - done;
+    const uint8_t* in = data->data + done;
+    if (n >= IOSTREAM_WINDOW_SIZE) {
+      if (n >= IOSTREAM_URING_MIN && iostream_uring(iostream)) {
+        iostream_flush_window(iostream);
+        iostream_uring_write(iostream, in, n);
+      } else {
+        uint8_t* ciphertext = iostream_scratch(iostream, n);
+        iostream_transform(iostream, in, ciphertext, n);
+        iostream_write_staged(iostream, ciphertext, n);
+      }
+      iostream_drop_window(iostream, n);
+    } else {
+      /*
+       * The window must hold every byte up to the write, so start a new one
+       * if the write would leave a gap or go past the end.
+       */
+      if (!iostream->window.data) {
+        buf_initf(&iostream->window, IOSTREAM_WINDOW_SIZE);
+      }
+      if (iostream->file_offset < iostream->window_offset ||
+          iostream->file_offset >
+              iostream->window_offset + iostream->window.size ||
+          iostream->file_offset >=
+              iostream->window_offset + iostream->window.capacity) {
+        iostream_flush_window(iostream);
+        iostream->window_offset = iostream->file_offset;
+        iostream->window.size = 0;
+      }
 
-  /* Write the encrypted data to the bin */
-  fseek(iostream->fd, iostream->file_offset, SEEK_SET);
-  fwrite(cipher.data, sizeof(uint8_t), cipher.size, iostream->fd);
+      /* Encrypt into the window and mark it to be written out later */
+      size_t start = iostream->file_offset - iostream->window_offset;
+      if (n > iostream->window.capacity - start) {
+        n = iostream->window.capacity - start;
+      }
+      iostream_transform(iostream, in, iostream->window.data + start, n);
+      if (iostream->dirty_end == iostream->dirty_start) {
+        iostream->dirty_start = start;
+        iostream->dirty_end = start + n;
+      } else {
+        if (start < iostream->dirty_start) iostream->dirty_start = start;
+        if (start + n > iostream->dirty_end) iostream->dirty_end = start + n;
+      }
+      if (start + n > iostream->window.size) iostream->window.size = start + n;
+    }
 
-  /* Update iostream state and clean up resources */
-  iostream->file_offset += cipher.size;
-  iostream->stream_offset += cipher.size;
-  buf_free(&cipher);
+    /* Update iostream state */
+    iostream->file_offset += n;
+    iostream->stream_offset += n;
+    done += n;
+  }
+}
+
+void iostream_writev(iostream_t* iostream, const buf_t** data,
+                     const size_t count) {
+  size_t total = 0, i;
+  for (i = 0; i < count; ++i) total += data[i]->size;
+
+#ifdef IOSTREAM_MMAP
+  if (iostream->map) iostream_unmap(iostream);
+#endif
+
+  /* Small records are gathered in the window anyway, and streams over a FILE
+   * have to go through stdio */
+  if (total < IOSTREAM_WINDOW_SIZE || iostream->fd) {
+    for (i = 0; i < count; ++i) iostream_write(iostream, data[i]);
+    return;
+  }
+
+  /* Encrypt every part back to back, then write them out together */
+  uint8_t* ciphertext = iostream_scratch(iostream, total);
+  size_t offset = 0;
+  for (i = 0; i < count; ++i) {
+    iostream_transform_at(iostream, iostream->stream_offset + offset,
+                          data[i]->data, ciphertext + offset, data[i]->size);
+    offset += data[i]->size;
+  }
+  iostream_write_staged(iostream, ciphertext, total);
+  iostream_drop_window(iostream, total);
+  iostream->file_offset += total;
+  iostream->stream_offset += total;
+}
+
+void iostream_flush(iostream_t* iostream) {
+  iostream_flush_window(iostream);
+#ifdef IOSTREAM_DIRECT
+  if (iostream->direct_padded) {
+    if (ftruncate(iostream->raw_fd, iostream->direct_size) != 0) {
+      throw("Failed to truncate direct stream");
+    }
+    iostream->direct_padded = false;
+  }
+#endif
+}
+
+void iostream_truncate(iostream_t* iostream) {
+#ifdef IOSTREAM_MMAP
+  if (iostream->map) iostream_unmap(iostream);
+#endif
+  iostream_flush_window(iostream);
+  if (iostream->fd) fflush(iostream->fd);
+  if (ftruncate(iostream_fileno(iostream), iostream->file_offset) != 0) {
+    throw("Failed to truncate file");
+  }
+
+  /* Nothing past the new end can be served from memory any more */
+  iostream->window.size = 0;
+  iostream->direct_size = iostream->file_offset;
+  iostream->direct_cache_len = 0;
+  iostream->direct_padded = false;
 }
 
 void iostream_skip(iostream_t* iostream, const size_t n) {
   iostream->file_offset += n;
   iostream->stream_offset += n;
 }
+
+void iostream_seek(iostream_t* iostream, const size_t offset) {
+  /* The counter block is derived from the stream offset on every transform */
+  iostream->file_offset =
+      iostream->file_offset - iostream->stream_offset + offset;
+  iostream->stream_offset = offset;
+}
+
+size_t iostream_tell(const iostream_t* iostream) {
+  return iostream->stream_offset;
+}
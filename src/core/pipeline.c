@@ -0,0 +1,146 @@
+/**
+ * The chunks are numbered in stream order, and chunk n always lives in buffer
+ * n % PIPELINE_DEPTH. The producer may only fill a chunk once the consumer has
+ * released the chunk which used that buffer before it, and the consumer may
+ * only take a chunk once the producer has filled it. Each buffer is owned by
+ * exactly one side at a time, so the data itself is used without the lock.
+ */
+
+#include "core/pipeline.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "constants.h"
+#include "core/buffer.h"
+#include "stddefs.h"
+#include "utils/cli.h"
+#include "utils/throw.h"
+
+struct pipeline_t {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t filled;
+  pthread_cond_t released;
+  pipeline_fill_t fill;
+  void* args;
+  buf_t buffers[PIPELINE_DEPTH];
+  size_t len;
+  size_t chunk;
+  size_t count;
+  size_t produced;
+  size_t consumed;
+  size_t released_count;
+  bool threaded;
+  bool stop;
+};
+
+/* Gets the length of a chunk, which is only short at the end of the stream */
+static size_t chunk_len(const pipeline_t* pipeline, const size_t index) {
+  size_t offset = index * pipeline->chunk;
+  size_t len = pipeline->len - offset;
+  return len < pipeline->chunk ? len : pipeline->chunk;
+}
+
+static void* producer(void* args) {
+  pipeline_t* pipeline = (pipeline_t*)args;
+  pthread_mutex_lock(&pipeline->lock);
+  while (pipeline->produced < pipeline->count) {
+    /* Wait for the consumer to hand back the buffer for the next chunk */
+    size_t index = pipeline->produced;
+    while (!pipeline->stop &&
+           index >= pipeline->released_count + PIPELINE_DEPTH) {
+      pthread_cond_wait(&pipeline->released, &pipeline->lock);
+    }
+    if (pipeline->stop) break;
+    pthread_mutex_unlock(&pipeline->lock);
+
+    buf_t* buffer = &pipeline->buffers[index % PIPELINE_DEPTH];
+    pipeline->fill(pipeline->args, chunk_len(pipeline, index), buffer);
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->produced++;
+    pthread_cond_signal(&pipeline->filled);
+  }
+  pthread_mutex_unlock(&pipeline->lock);
+  return NULL;
+}
+
+pipeline_t* pipeline_start(pipeline_fill_t fill, void* args, const size_t len,
+                           const size_t chunk) {
+  if (!fill || chunk == 0) throw("Invalid pipeline arguments");
+  pipeline_t* pipeline = malloc(sizeof(pipeline_t));
+  if (!pipeline) throw("Malloc failed");
+  pipeline->fill = fill;
+  pipeline->args = args;
+  pipeline->len = len;
+  pipeline->chunk = chunk;
+  pipeline->count = (len + chunk - 1) / chunk;
+  pipeline->produced = 0;
+  pipeline->consumed = 0;
+  pipeline->released_count = 0;
+  pipeline->threaded = false;
+  pipeline->stop = false;
+
+  /* The buffers grow to the size of a chunk when they are first filled */
+  size_t i;
+  for (i = 0; i < PIPELINE_DEPTH; ++i) buf_init(&pipeline->buffers[i], 32);
+  if (len < PIPELINE_MIN) return pipeline;
+
+  pthread_mutex_init(&pipeline->lock, NULL);
+  pthread_cond_init(&pipeline->filled, NULL);
+  pthread_cond_init(&pipeline->released, NULL);
+
+  /* Carry on filling the buffers inline if the producer can't be started */
+  if (pthread_create(&pipeline->thread, NULL, producer, pipeline) != 0) {
+    warn("Failed to start pipeline thread");
+    pthread_cond_destroy(&pipeline->released);
+    pthread_cond_destroy(&pipeline->filled);
+    pthread_mutex_destroy(&pipeline->lock);
+    return pipeline;
+  }
+  pipeline->threaded = true;
+  return pipeline;
+}
+
+const buf_t* pipeline_next(pipeline_t* pipeline) {
+  size_t index = pipeline->consumed;
+  if (!pipeline->threaded) {
+    if (index >= pipeline->count) return NULL;
+    buf_t* buffer = &pipeline->buffers[0];
+    pipeline->fill(pipeline->args, chunk_len(pipeline, index), buffer);
+    pipeline->consumed++;
+    return buffer;
+  }
+
+  /* Hand the previous chunk back before waiting on the next one */
+  pthread_mutex_lock(&pipeline->lock);
+  pipeline->released_count = index;
+  pthread_cond_signal(&pipeline->released);
+  if (index >= pipeline->count) {
+    pthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+  }
+  while (pipeline->produced <= index) {
+    pthread_cond_wait(&pipeline->filled, &pipeline->lock);
+  }
+  pthread_mutex_unlock(&pipeline->lock);
+  pipeline->consumed++;
+  return &pipeline->buffers[index % PIPELINE_DEPTH];
+}
+
+void pipeline_free(pipeline_t* pipeline) {
+  if (pipeline->threaded) {
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->stop = true;
+    pthread_cond_signal(&pipeline->released);
+    pthread_mutex_unlock(&pipeline->lock);
+    pthread_join(pipeline->thread, NULL);
+    pthread_cond_destroy(&pipeline->released);
+    pthread_cond_destroy(&pipeline->filled);
+    pthread_mutex_destroy(&pipeline->lock);
+  }
+  size_t i;
+  for (i = 0; i < PIPELINE_DEPTH; ++i) buf_free(&pipeline->buffers[i]);
+  free(pipeline);
+}
@@ -0,0 +1,116 @@
+/**
+ * The workers sleep on a condition variable until a batch is posted, and then
+ * claim indices from a shared counter until the batch runs dry. Indices are
+ * handed out one at a time, so uneven tasks still balance across the threads.
+ * Only one batch is in flight at a time, which keeps the bookkeeping down to a
+ * handful of variables guarded by a single lock.
+ */
+
+#include "core/threadpool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "stddefs.h"
+#include "utils/cli.h"
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;
+static size_t pool_size = 1;
+
+/* The batch currently being run. Guarded by pool_lock. */
+static threadpool_task_t batch_task = NULL;
+static void* batch_args = NULL;
+static size_t batch_count = 0;
+static size_t batch_next = 0;
+static size_t batch_pending = 0;
+
+/* Runs indices from the current batch until none are left to claim */
+static void drain() {
+  while (batch_next < batch_count) {
+    threadpool_task_t task = batch_task;
+    void* args = batch_args;
+    size_t index = batch_next++;
+
+    pthread_mutex_unlock(&pool_lock);
+    task(args, index);
+    pthread_mutex_lock(&pool_lock);
+
+    if (--batch_pending == 0) pthread_cond_signal(&work_done);
+  }
+}
+
+static void* worker(void* unused) {
+  (void)unused;
+  pthread_mutex_lock(&pool_lock);
+  while (true) {
+    while (batch_next >= batch_count) {
+      pthread_cond_wait(&work_ready, &pool_lock);
+    }
+    drain();
+  }
+  return NULL;
+}
+
+static void start_pool() {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t threads = cpus > 0 ? (size_t)cpus : 1;
+
+  const char* forced = getenv("TRANSCODINE_THREADS");
+  if (forced) {
+    long n = strtol(forced, NULL, 10);
+    if (n > 0) {
+      threads = (size_t)n;
+    } else {
+      warn("Invalid thread count requested. Selecting automatically.");
+    }
+  }
+  if (threads > THREADPOOL_MAX_THREADS) threads = THREADPOOL_MAX_THREADS;
+
+  /* The calling thread counts towards the pool, so start one less worker */
+  size_t started = 1;
+  while (started < threads) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, worker, NULL) != 0) {
+      warn("Failed to start a worker thread");
+      break;
+    }
+    pthread_detach(thread);
+    started++;
+  }
+  pool_size = started;
+  debug("Started thread pool");
+}
+
+size_t threadpool_size() {
+  pthread_once(&pool_once, start_pool);
+  return pool_size;
+}
+
+void threadpool_run(threadpool_task_t task, void* args, const size_t count) {
+  /* Don't bother waking the workers if there is nothing to share */
+  if (count <= 1 || threadpool_size() == 1) {
+    size_t i;
+    for (i = 0; i < count; ++i) task(args, i);
+    return;
+  }
+
+  pthread_mutex_lock(&batch_lock);
+  pthread_mutex_lock(&pool_lock);
+  batch_task = task;
+  batch_args = args;
+  batch_count = count;
+  batch_next = 0;
+  batch_pending = count;
+  pthread_cond_broadcast(&work_ready);
+
+  drain();
+  while (batch_pending > 0) pthread_cond_wait(&work_done, &pool_lock);
+  pthread_mutex_unlock(&pool_lock);
+  pthread_mutex_unlock(&batch_lock);
+}
@@ -0,0 +1,317 @@
+/**
+ * The submission and completion queues are shared with the kernel through
+ * memory mapped from the ring descriptor. This process is the only producer of
+ * submissions and the only consumer of completions, so each side only needs to
+ * publish its own index with release ordering and read the index of the kernel
+ * with acquire ordering.
+ */
+
+/* For syscall, mmap and MAP_ANONYMOUS */
+#define _DEFAULT_SOURCE
+
+#include "core/uring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stddefs.h"
+#include "utils/throw.h"
+
+#if defined(__linux__) && defined(__GNUC__)
+#define URING_SUPPORTED
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#ifdef URING_SUPPORTED
+
+struct uring_t {
+  int ring_fd;
+  size_t slots;
+  size_t slot_size;
+  uint8_t* buffers;
+  size_t queued;
+  size_t in_flight;
+
+  void* sq_ring;
+  size_t sq_ring_size;
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+
+  void* cq_ring;
+  size_t cq_ring_size;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+};
+
+/*
+ * There are no libc wrappers for the io_uring calls, and liburing would be an
+ * extra dependency for three system calls.
+ */
+static long io_uring_setup(unsigned entries, struct io_uring_params* params) {
+  return syscall(SYS_io_uring_setup, entries, params);
+}
+
+static long io_uring_enter(int fd, unsigned submit, unsigned complete,
+                           unsigned flags) {
+  return syscall(SYS_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+static long io_uring_register(int fd, unsigned opcode, const void* arg,
+                              unsigned count) {
+  return syscall(SYS_io_uring_register, fd, opcode, arg, count);
+}
+
+static void* map_ring(const int fd, const size_t size, const off_t offset) {
+  void* map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, offset);
+  return map == MAP_FAILED ? NULL : map;
+}
+
+/* Maps the queues shared with the kernel */
+static bool map_queues(uring_t* ring, const struct io_uring_params* params) {
+  ring->sq_ring_size =
+      params->sq_off.array + params->sq_entries * sizeof(unsigned);
+  ring->cq_ring_size = params->cq_off.cqes +
+                       params->cq_entries * sizeof(struct io_uring_cqe);
+
+  /* Newer kernels map both rings at once */
+  if (params->features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_ring_size > ring->sq_ring_size) {
+      ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->cq_ring_size = 0;
+  }
+  ring->sq_ring =
+      map_ring(ring->ring_fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+  if (!ring->sq_ring) return false;
+  if (ring->cq_ring_size == 0) {
+    ring->cq_ring = ring->sq_ring;
+  } else {
+    ring->cq_ring =
+        map_ring(ring->ring_fd, ring->cq_ring_size, IORING_OFF_CQ_RING);
+    if (!ring->cq_ring) return false;
+  }
+  ring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = map_ring(ring->ring_fd, ring->sqes_size, IORING_OFF_SQES);
+  if (!ring->sqes) return false;
+
+  uint8_t* sq = ring->sq_ring;
+  uint8_t* cq = ring->cq_ring;
+  ring->sq_head = (unsigned*)(sq + params->sq_off.head);
+  ring->sq_tail = (unsigned*)(sq + params->sq_off.tail);
+  ring->sq_mask = (unsigned*)(sq + params->sq_off.ring_mask);
+  ring->sq_array = (unsigned*)(sq + params->sq_off.array);
+  ring->cq_head = (unsigned*)(cq + params->cq_off.head);
+  ring->cq_tail = (unsigned*)(cq + params->cq_off.tail);
+  ring->cq_mask = (unsigned*)(cq + params->cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)(cq + params->cq_off.cqes);
+  return true;
+}
+
+/* Registers the buffers and the file, so requests can use them directly */
+static bool register_ring(uring_t* ring, const int fd) {
+  struct iovec* iov = malloc(ring->slots * sizeof(struct iovec));
+  if (!iov) throw("Malloc failed");
+  size_t i;
+  for (i = 0; i < ring->slots; ++i) {
+    iov[i].iov_base = uring_buffer(ring, i);
+    iov[i].iov_len = ring->slot_size;
+  }
+  long result = io_uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS, iov,
+                                  ring->slots);
+  free(iov);
+  if (result < 0) return false;
+  return io_uring_register(ring->ring_fd, IORING_REGISTER_FILES, &fd, 1) >= 0;
+}
+
+static void queue(uring_t* ring, const int opcode, const size_t slot,
+                  const size_t len, const size_t offset) {
+  if (slot >= ring->slots || len > ring->slot_size) {
+    throw("Request doesn't fit in the ring");
+  }
+
+  /* There is a submission entry for every slot, so the queue can't be full */
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe* sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode = opcode;
+  sqe->flags = IOSQE_FIXED_FILE;
+  sqe->fd = 0;
+  sqe->off = offset;
+  sqe->addr = (unsigned long)uring_buffer(ring, slot);
+  sqe->len = len;
+  sqe->buf_index = slot;
+  sqe->user_data = slot;
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->queued++;
+}
+
+bool uring_available() {
+  static bool checked = false;
+  static bool available = false;
+  if (!checked) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    long fd = io_uring_setup(1, &params);
+    if (fd >= 0) close(fd);
+    available = fd >= 0;
+    checked = true;
+  }
+  return available;
+}
+
+uring_t* uring_create(const int fd, const size_t slots,
+                      const size_t slot_size) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  long ring_fd = io_uring_setup(slots, &params);
+  if (ring_fd < 0) return NULL;
+
+  uring_t* ring = calloc(1, sizeof(uring_t));
+  if (!ring) throw("Malloc failed");
+  ring->ring_fd = (int)ring_fd;
+  ring->slots = slots;
+  ring->slot_size = slot_size;
+
+  /* Page-aligned buffers keep the kernel from splitting requests */
+  ring->buffers = mmap(NULL, slots * slot_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring->buffers == MAP_FAILED) {
+    ring->buffers = NULL;
+    uring_free(ring);
+    return NULL;
+  }
+  if (!map_queues(ring, &params) || !register_ring(ring, fd)) {
+    uring_free(ring);
+    return NULL;
+  }
+  return ring;
+}
+
+uint8_t* uring_buffer(const uring_t* ring, const size_t slot) {
+  return ring->buffers + slot * ring->slot_size;
+}
+
+void uring_read(uring_t* ring, const size_t slot, const size_t len,
+                const size_t offset) {
+  queue(ring, IORING_OP_READ_FIXED, slot, len, offset);
+}
+
+void uring_write(uring_t* ring, const size_t slot, const size_t len,
+                 const size_t offset) {
+  queue(ring, IORING_OP_WRITE_FIXED, slot, len, offset);
+}
+
+void uring_submit(uring_t* ring) {
+  while (ring->queued > 0) {
+    long submitted = io_uring_enter(ring->ring_fd, ring->queued, 0, 0);
+    if (submitted < 0 && errno == EINTR) continue;
+    if (submitted < 0) throw("Failed to submit IO requests");
+    ring->queued -= submitted;
+    ring->in_flight += submitted;
+  }
+}
+
+long uring_wait(uring_t* ring, size_t* slot) {
+  uring_submit(ring);
+  while (true) {
+    unsigned head = *ring->cq_head;
+    if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+      *slot = cqe->user_data;
+      long result = cqe->res;
+      __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+      ring->in_flight--;
+      return result;
+    }
+    if (ring->in_flight == 0) throw("No IO requests in flight");
+    if (io_uring_enter(ring->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+        errno != EINTR) {
+      throw("Failed to wait for IO requests");
+    }
+  }
+}
+
+void uring_free(uring_t* ring) {
+  /* The kernel could still be using the buffers */
+  if (ring->sqes) {
+    size_t slot;
+    while (ring->queued > 0 || ring->in_flight > 0) uring_wait(ring, &slot);
+  }
+
+  if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_size);
+  if (ring->buffers) munmap(ring->buffers, ring->slots * ring->slot_size);
+  close(ring->ring_fd);
+  free(ring);
+}
+
+#else
+
+struct uring_t {
+  int unused;
+};
+
+bool uring_available() { return false; }
+
+uring_t* uring_create(const int fd, const size_t slots,
+                      const size_t slot_size) {
+  (void)fd;
+  (void)slots;
+  (void)slot_size;
+  return NULL;
+}
+
+uint8_t* uring_buffer(const uring_t* ring, const size_t slot) {
+  (void)ring;
+  (void)slot;
+  throw("io_uring is not supported on this platform");
+  return NULL;
+}
+
+void uring_read(uring_t* ring, const size_t slot, const size_t len,
+                const size_t offset) {
+  (void)ring;
+  (void)slot;
+  (void)len;
+  (void)offset;
+  throw("io_uring is not supported on this platform");
+}
+
+void uring_write(uring_t* ring, const size_t slot, const size_t len,
+                 const size_t offset) {
+  (void)ring;
+  (void)slot;
+  (void)len;
+  (void)offset;
+  throw("io_uring is not supported on this platform");
+}
+
+void uring_submit(uring_t* ring) { (void)ring; }
+
+long uring_wait(uring_t* ring, size_t* slot) {
+  (void)ring;
+  (void)slot;
+  throw("io_uring is not supported on this platform");
+  return -1;
+}
+
+void uring_free(uring_t* ring) { (void)ring; }
+
+#endif
@@ -4,15 +4,31 @@
  * example of buffers being the interface between the different functions or
  * modules and that each module needs to figure out if buffers are more
  * efficient for their use case or not.
+ *
+ * The T-tables are derived from the S-box the first time a key is expanded
+ * instead of being hardcoded, which keeps this file readable. Each table entry
+ * holds the MixColumns column produced by a single S-box output, so a full
+ * round becomes sixteen lookups and XORs.
+ *
+ * The backend is picked the first time a key is expanded. AES-NI is preferred
+ * if cpuid reports it, but only after it passes a known-answer test. Otherwise,
+ * the bitsliced backend is used as it doesn't leak timing through the cache.
+ * Setting TRANSCODINE_AES_BACKEND to "reference", "ttable", "aesni", or
+ * "bitslice" overrides the automatic choice.
  */
 
 #include "crypto/aes.h"
 
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "constants.h"
 #include "core/buffer.h"
+#include "crypto/aes_bitslice.h"
+#include "crypto/aes_ni.h"
 #include "stddefs.h"
+#include "utils/cli.h"
 #include "utils/throw.h"
 
 /* Rijndael S-box */
@@ -89,15 +105,119 @@ static void add_round_key(uint8_t* state, const uint8_t* round_key) {
   for (i = 0; i < 16; ++i) { state[i] ^= round_key[i]; }
 }
 
-void aes_init(aes_ctx_t* ctx, const buf_t* key) {
-  if (!ctx || !key) { throw("NULL parameters provided"); }
-  if (key->size != AES_KEY_SIZE || key->capacity != AES_KEY_SIZE ||
-      !key->data) {
-    throw("Buffer state is invalid");
+/* Combined SubBytes, ShiftRows, and MixColumns tables */
+static uint32_t te0[256], te1[256], te2[256], te3[256];
+
+/* The tables and the backend are set up together, the first time AES is used.
+ * CTR transforms run blocks on pool workers, so both are published through
+ * pthread_once rather than a plain flag. */
+static pthread_once_t backend_once = PTHREAD_ONCE_INIT;
+static aes_backend_t active_backend = AES_BACKEND_TTABLE;
+
+static uint32_t ror32(uint32_t x, int r) { return (x >> r) | (x << (32 - r)); }
+
+static uint32_t load_u32_be(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void store_u32_be(uint8_t* p, uint32_t v) {
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+static void init_tables() {
+  int i;
+  for (i = 0; i < 256; ++i) {
+    uint8_t s = sbox[i];
+    uint8_t s2 = xtime(s);
+    uint8_t s3 = s2 ^ s;
+    uint32_t w = ((uint32_t)s2 << 24) | ((uint32_t)s << 16) |
+                 ((uint32_t)s << 8) | (uint32_t)s3;
+    te0[i] = w;
+    te1[i] = ror32(w, 8);
+    te2[i] = ror32(w, 16);
+    te3[i] = ror32(w, 24);
+  }
+}
+
+static void encrypt_reference(const aes_ctx_t* ctx, const uint8_t* in,
+                              uint8_t* out) {
+  uint8_t state[AES_BLOCK_SIZE];
+  memcpy(state, in, AES_BLOCK_SIZE);
+
+  add_round_key(state, ctx->round_keys);
+
+  int round;
+  for (round = 1; round < AES_NR; ++round) {
+    sub_bytes(state);
+    shift_rows(state);
+    mix_columns(state);
+    add_round_key(state, ctx->round_keys + AES_BLOCK_SIZE * round);
+  }
+
+  sub_bytes(state);
+  shift_rows(state);
+  add_round_key(state, ctx->round_keys + AES_BLOCK_SIZE * AES_NR);
+
+  memcpy(out, state, AES_BLOCK_SIZE);
+}
+
+static void encrypt_ttable(const aes_ctx_t* ctx, const uint8_t* in,
+                           uint8_t* out) {
+  const uint32_t* rk = ctx->round_words;
+  uint32_t s0 = load_u32_be(in) ^ rk[0];
+  uint32_t s1 = load_u32_be(in + 4) ^ rk[1];
+  uint32_t s2 = load_u32_be(in + 8) ^ rk[2];
+  uint32_t s3 = load_u32_be(in + 12) ^ rk[3];
+  uint32_t t0, t1, t2, t3;
+
+  int round;
+  for (round = 1; round < AES_NR; ++round) {
+    rk += AES_NB;
+    t0 = te0[s0 >> 24] ^ te1[(s1 >> 16) & 0xff] ^ te2[(s2 >> 8) & 0xff] ^
+         te3[s3 & 0xff] ^ rk[0];
+    t1 = te0[s1 >> 24] ^ te1[(s2 >> 16) & 0xff] ^ te2[(s3 >> 8) & 0xff] ^
+         te3[s0 & 0xff] ^ rk[1];
+    t2 = te0[s2 >> 24] ^ te1[(s3 >> 16) & 0xff] ^ te2[(s0 >> 8) & 0xff] ^
+         te3[s1 & 0xff] ^ rk[2];
+    t3 = te0[s3 >> 24] ^ te1[(s0 >> 16) & 0xff] ^ te2[(s1 >> 8) & 0xff] ^
+         te3[s2 & 0xff] ^ rk[3];
+    s0 = t0;
+    s1 = t1;
+    s2 = t2;
+    s3 = t3;
   }
 
-  uint8_t* w = ctx->round_keys;
-  memcpy(w, key->data, key->size);
+  /* The last round has no MixColumns, so only the S-box is used */
+  rk += AES_NB;
+  t0 = ((uint32_t)sbox[s0 >> 24] << 24) ^
+       ((uint32_t)sbox[(s1 >> 16) & 0xff] << 16) ^
+       ((uint32_t)sbox[(s2 >> 8) & 0xff] << 8) ^ (uint32_t)sbox[s3 & 0xff] ^
+       rk[0];
+  t1 = ((uint32_t)sbox[s1 >> 24] << 24) ^
+       ((uint32_t)sbox[(s2 >> 16) & 0xff] << 16) ^
+       ((uint32_t)sbox[(s3 >> 8) & 0xff] << 8) ^ (uint32_t)sbox[s0 & 0xff] ^
+       rk[1];
+  t2 = ((uint32_t)sbox[s2 >> 24] << 24) ^
+       ((uint32_t)sbox[(s3 >> 16) & 0xff] << 16) ^
+       ((uint32_t)sbox[(s0 >> 8) & 0xff] << 8) ^ (uint32_t)sbox[s1 & 0xff] ^
+       rk[2];
+  t3 = ((uint32_t)sbox[s3 >> 24] << 24) ^
+       ((uint32_t)sbox[(s0 >> 16) & 0xff] << 16) ^
+       ((uint32_t)sbox[(s1 >> 8) & 0xff] << 8) ^ (uint32_t)sbox[s2 & 0xff] ^
+       rk[3];
+
+  store_u32_be(out, t0);
+  store_u32_be(out + 4, t1);
+  store_u32_be(out + 8, t2);
+  store_u32_be(out + 12, t3);
+}
+
+static void expand_key_portable(const uint8_t* key, uint8_t* w) {
+  memcpy(w, key, AES_KEY_SIZE);
 
   int i = 1;
   uint8_t temp[4];
@@ -134,6 +254,122 @@ void aes_init(aes_ctx_t* ctx, const buf_t* key) {
   }
 }
 
+/**
+ * Expands the key using the given backend. Every backend shares the same byte
+ * layout, so the word form used by the T-tables and the bitsliced form are
+ * always derived as well.
+ */
+static void expand_key(aes_ctx_t* ctx, const uint8_t* key,
+                       const aes_backend_t backend) {
+  switch (backend) {
+    case AES_BACKEND_AESNI: aes_ni_expand_key(key, ctx->round_keys); break;
+    case AES_BACKEND_BITSLICE: aes_bs_expand_key(key, ctx->round_keys); break;
+    default: expand_key_portable(key, ctx->round_keys); break;
+  }
+
+  /* Pack the schedule into big-endian words for the T-table backend */
+  int pos;
+  for (pos = 0; pos < AES_NB * (AES_NR + 1); ++pos) {
+    ctx->round_words[pos] = load_u32_be(&ctx->round_keys[pos * 4]);
+  }
+  aes_bs_slice_keys(ctx->round_keys, ctx->sliced_keys);
+}
+
+static void encrypt_block(const aes_ctx_t* ctx, const uint8_t* in,
+                          uint8_t* out, const aes_backend_t backend) {
+  switch (backend) {
+    case AES_BACKEND_REFERENCE: encrypt_reference(ctx, in, out); break;
+    case AES_BACKEND_AESNI: aes_ni_encrypt(ctx->round_keys, in, out); break;
+    case AES_BACKEND_BITSLICE:
+      aes_bs_encrypt(ctx->sliced_keys, in, out, 1);
+      break;
+    default: encrypt_ttable(ctx, in, out); break;
+  }
+}
+
+/**
+ * Runs the FIPS-197 Appendix C.1 vector through a backend, including its key
+ * expansion, to confirm that it actually works on this machine.
+ */
+static bool self_test(const aes_backend_t backend) {
+  static const uint8_t expected[AES_BLOCK_SIZE] = {
+      0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+      0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a};
+  uint8_t key[AES_KEY_SIZE], block[AES_BLOCK_SIZE];
+  aes_ctx_t ctx;
+
+  int i;
+  for (i = 0; i < AES_BLOCK_SIZE; ++i) {
+    key[i] = (uint8_t)i;
+    block[i] = (uint8_t)((i << 4) | i);
+  }
+  expand_key(&ctx, key, backend);
+  encrypt_block(&ctx, block, block, backend);
+  return memcmp(block, expected, AES_BLOCK_SIZE) == 0;
+}
+
+static void select_backend() {
+  aes_backend_t backend = AES_BACKEND_BITSLICE;
+  init_tables();
+
+  const char* forced = getenv("TRANSCODINE_AES_BACKEND");
+  if (!forced) {
+    if (aes_ni_available()) backend = AES_BACKEND_AESNI;
+  } else if (strcmp(forced, "reference") == 0) {
+    backend = AES_BACKEND_REFERENCE;
+  } else if (strcmp(forced, "ttable") == 0) {
+    backend = AES_BACKEND_TTABLE;
+  } else if (strcmp(forced, "bitslice") == 0) {
+    backend = AES_BACKEND_BITSLICE;
+  } else if (strcmp(forced, "aesni") == 0) {
+    if (aes_ni_available()) {
+      backend = AES_BACKEND_AESNI;
+    } else {
+      warn("AES-NI is not supported on this processor");
+    }
+  } else {
+    warn("Unknown AES backend requested. Selecting automatically.");
+    if (aes_ni_available()) backend = AES_BACKEND_AESNI;
+  }
+
+  /* Never trust a backend which can't reproduce the spec */
+  if (!self_test(backend)) {
+    warn("AES backend failed self-test. Falling back to a slower one.");
+    backend = backend == AES_BACKEND_AESNI ? AES_BACKEND_BITSLICE
+                                           : AES_BACKEND_REFERENCE;
+  }
+  active_backend = backend;
+
+  switch (backend) {
+    case AES_BACKEND_REFERENCE: debug("Using reference AES backend"); break;
+    case AES_BACKEND_AESNI: debug("Using AES-NI backend"); break;
+    case AES_BACKEND_BITSLICE: debug("Using bitsliced AES backend"); break;
+    default: debug("Using T-table AES backend"); break;
+  }
+}
+
+bool aes_set_backend(const aes_backend_t backend) {
+  if (backend == AES_BACKEND_AESNI && !aes_ni_available()) return false;
+  /* Select first, so the first use can't replace this choice later */
+  pthread_once(&backend_once, select_backend);
+  active_backend = backend;
+  return true;
+}
+
+aes_backend_t aes_get_backend() {
+  pthread_once(&backend_once, select_backend);
+  return active_backend;
+}
+
+void aes_init(aes_ctx_t* ctx, const buf_t* key) {
+  if (!ctx || !key) { throw("NULL parameters provided"); }
+  if (key->size != AES_KEY_SIZE || key->capacity != AES_KEY_SIZE ||
+      !key->data) {
+    throw("Buffer state is invalid");
+  }
+  expand_key(ctx, key->data, aes_get_backend());
+}
+
 void aes_encrypt(const aes_ctx_t* ctx, const buf_t* in, buf_t* out) {
   if (in->size != AES_BLOCK_SIZE || in->capacity != AES_BLOCK_SIZE) {
     throw("In buffer state is invalid");
@@ -143,23 +379,23 @@ void aes_encrypt(const aes_ctx_t* ctx, const buf_t* in, buf_t* out) {
     throw("Out buffer state is invalid");
   }
 
-  uint8_t state[AES_BLOCK_SIZE];
-  memcpy(state, in->data, AES_BLOCK_SIZE);
+  encrypt_block(ctx, in->data, out->data, aes_get_backend());
+  out->size = AES_BLOCK_SIZE;
+}
 
-  add_round_key(state, ctx->round_keys);
+void aes_encrypt_blocks(const aes_ctx_t* ctx, const uint8_t* in, uint8_t* out,
+                        const size_t blocks) {
+  aes_backend_t backend = aes_get_backend();
 
-  int round;
-  for (round = 1; round < AES_NR; ++round) {
-    sub_bytes(state);
-    shift_rows(state);
-    mix_columns(state);
-    add_round_key(state, ctx->round_keys + AES_BLOCK_SIZE * round);
+  /* The bitsliced backend only pays off when it gets whole groups of blocks */
+  if (backend == AES_BACKEND_BITSLICE) {
+    aes_bs_encrypt(ctx->sliced_keys, in, out, blocks);
+    return;
   }
 
-  sub_bytes(state);
-  shift_rows(state);
-  add_round_key(state, ctx->round_keys + AES_BLOCK_SIZE * AES_NR);
-
-  memcpy(out->data, state, AES_BLOCK_SIZE);
-  out->size = AES_BLOCK_SIZE;
+  size_t i;
+  for (i = 0; i < blocks; ++i) {
+    encrypt_block(ctx, in + i * AES_BLOCK_SIZE, out + i * AES_BLOCK_SIZE,
+                  backend);
+  }
 }
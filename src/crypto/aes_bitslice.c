@@ -0,0 +1,462 @@
+/**
+ * The eight blocks are split into two groups of four, and each group is held
+ * in eight 64-bit words. Word b of a group holds bit b of all sixty-four bytes
+ * in the group, with the bit for row r, column c, and block k at index
+ * r * 16 + c * 4 + k.
+ *
+ * With this layout, ShiftRows becomes a rotation within each 16-bit row, and
+ * rotating a whole word by 16 bits lines up the next row of every column for
+ * MixColumns. AddRoundKey is a plain XOR with a key schedule which has every
+ * key bit broadcast across the four blocks.
+ *
+ * Moving between bytes and planes is done by swapping bits between words and
+ * then within words, which is far cheaper than moving one bit at a time.
+ *
+ * Both groups go through exactly the same operations, so with GCC and Clang
+ * they are kept side by side in a 128-bit vector. This compiles down to SSE2
+ * or NEON where available, and to pairs of plain 64-bit operations elsewhere.
+ * Other compilers fall back to encrypting one group at a time.
+ */
+
+#include "crypto/aes_bitslice.h"
+
+#include <string.h>
+
+#include "constants.h"
+#include "stddefs.h"
+
+/* Number of blocks packed into each group of words */
+#define AES_BS_GROUP_BLOCKS 4
+
+#if defined(__GNUC__)
+typedef uint64_t bs_word_t __attribute__((vector_size(16)));
+#define AES_BS_LANES 2
+#define BS_LANE(w, l) ((w)[l])
+#else
+typedef uint64_t bs_word_t;
+#define AES_BS_LANES 1
+#define BS_LANE(w, l) (w)
+#endif
+
+/* Number of blocks encrypted by a single pass through the rounds */
+#define AES_BS_BLOCKS (AES_BS_GROUP_BLOCKS * AES_BS_LANES)
+
+/* Round constant */
+static const uint8_t rcon[11] = {0x00, 0x01, 0x02, 0x04, 0x08, 0x10,
+                                 0x20, 0x40, 0x80, 0x1B, 0x36};
+
+static uint64_t load_u64_le(const uint8_t* p) {
+  uint64_t v = 0;
+  int i;
+  for (i = 7; i >= 0; --i) v = (v << 8) | p[i];
+  return v;
+}
+
+static void store_u64_le(uint8_t* p, uint64_t v) {
+  int i;
+  for (i = 0; i < 8; ++i) {
+    p[i] = (uint8_t)v;
+    v >>= 8;
+  }
+}
+
+/* Exchanges the bits selected by the mask with the bits n positions above */
+static uint64_t delta_swap(uint64_t x, const uint64_t mask, const int n) {
+  uint64_t t = ((x >> n) ^ x) & mask;
+  return x ^ t ^ (t << n);
+}
+
+/* Exchanges the low and high bits of each pair between two words */
+static void swap_bits(uint64_t* x, uint64_t* y, const uint64_t low_mask,
+                      const int n) {
+  uint64_t a = *x, b = *y;
+  *x = (a & low_mask) | ((b & low_mask) << n);
+  *y = ((a >> n) & low_mask) | (b & ~low_mask);
+}
+
+/**
+ * Swaps the word index with the low three bits of the bit index across eight
+ * words, so bit 8u + v of word i ends up as bit 8u + i of word v. This is its
+ * own inverse.
+ */
+static void ortho(uint64_t* q) {
+  swap_bits(&q[0], &q[1], 0x5555555555555555ul, 1);
+  swap_bits(&q[2], &q[3], 0x5555555555555555ul, 1);
+  swap_bits(&q[4], &q[5], 0x5555555555555555ul, 1);
+  swap_bits(&q[6], &q[7], 0x5555555555555555ul, 1);
+
+  swap_bits(&q[0], &q[2], 0x3333333333333333ul, 2);
+  swap_bits(&q[1], &q[3], 0x3333333333333333ul, 2);
+  swap_bits(&q[4], &q[6], 0x3333333333333333ul, 2);
+  swap_bits(&q[5], &q[7], 0x3333333333333333ul, 2);
+
+  swap_bits(&q[0], &q[4], 0x0f0f0f0f0f0f0f0ful, 4);
+  swap_bits(&q[1], &q[5], 0x0f0f0f0f0f0f0f0ful, 4);
+  swap_bits(&q[2], &q[6], 0x0f0f0f0f0f0f0f0ful, 4);
+  swap_bits(&q[3], &q[7], 0x0f0f0f0f0f0f0f0ful, 4);
+}
+
+/**
+ * Loading the two halves of each block as words and running ortho() leaves
+ * the bit for row r, column c, and block k at index 32 * (c & 1) + 8r +
+ * 4 * (c >> 1) + k. Three swaps of index bits move it to r * 16 + c * 4 + k.
+ */
+static uint64_t to_row_major(uint64_t x) {
+  x = delta_swap(x, 0x00000000ffff0000ul, 16);
+  x = delta_swap(x, 0x0000ff000000ff00ul, 8);
+  return delta_swap(x, 0x00f000f000f000f0ul, 4);
+}
+
+static uint64_t from_row_major(uint64_t x) {
+  x = delta_swap(x, 0x00f000f000f000f0ul, 4);
+  x = delta_swap(x, 0x0000ff000000ff00ul, 8);
+  return delta_swap(x, 0x00000000ffff0000ul, 16);
+}
+
+/* Slices up to four blocks into a group, padding the rest with zeros */
+static void load_group(const uint8_t* in, const size_t blocks, uint64_t* q) {
+  size_t k;
+  for (k = 0; k < AES_BS_GROUP_BLOCKS; ++k) {
+    if (k < blocks) {
+      q[k] = load_u64_le(in + k * AES_BLOCK_SIZE);
+      q[k + 4] = load_u64_le(in + k * AES_BLOCK_SIZE + 8);
+    } else {
+      q[k] = 0;
+      q[k + 4] = 0;
+    }
+  }
+  ortho(q);
+
+  int i;
+  for (i = 0; i < 8; ++i) q[i] = to_row_major(q[i]);
+}
+
+static void store_group(uint64_t* q, uint8_t* out, const size_t blocks) {
+  int i;
+  for (i = 0; i < 8; ++i) q[i] = from_row_major(q[i]);
+  ortho(q);
+
+  size_t k;
+  for (k = 0; k < blocks; ++k) {
+    store_u64_le(out + k * AES_BLOCK_SIZE, q[k]);
+    store_u64_le(out + k * AES_BLOCK_SIZE + 8, q[k + 4]);
+  }
+}
+
+/**
+ * Boyar-Peralta S-box circuit over eight planes, with q[0] holding the least
+ * significant bit. Only 32 of its gates are ANDs, and the rest are XORs.
+ */
+static void sub_bytes(bs_word_t* q) {
+  bs_word_t x0, x1, x2, x3, x4, x5, x6, x7;
+  bs_word_t y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14, y15,
+      y16, y17, y18, y19, y20, y21;
+  bs_word_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14,
+      z15, z16, z17;
+  bs_word_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14,
+      t15, t16, t17, t18, t19, t20, t21, t22, t23, t24, t25, t26, t27, t28, t29,
+      t30, t31, t32, t33, t34, t35, t36, t37, t38, t39, t40, t41, t42, t43, t44,
+      t45, t46, t47, t48, t49, t50, t51, t52, t53, t54, t55, t56, t57, t58, t59,
+      t60, t61, t62, t63, t64, t65, t66, t67;
+  bs_word_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+  x0 = q[7];
+  x1 = q[6];
+  x2 = q[5];
+  x3 = q[4];
+  x4 = q[3];
+  x5 = q[2];
+  x6 = q[1];
+  x7 = q[0];
+
+  /* Top linear transformation */
+  y14 = x3 ^ x5;
+  y13 = x0 ^ x6;
+  y9 = x0 ^ x3;
+  y8 = x0 ^ x5;
+  t0 = x1 ^ x2;
+  y1 = t0 ^ x7;
+  y4 = y1 ^ x3;
+  y12 = y13 ^ y14;
+  y2 = y1 ^ x0;
+  y5 = y1 ^ x6;
+  y3 = y5 ^ y8;
+  t1 = x4 ^ y12;
+  y15 = t1 ^ x5;
+  y20 = t1 ^ x1;
+  y6 = y15 ^ x7;
+  y10 = y15 ^ t0;
+  y11 = y20 ^ y9;
+  y7 = x7 ^ y11;
+  y17 = y10 ^ y11;
+  y19 = y10 ^ y8;
+  y16 = t0 ^ y11;
+  y21 = y13 ^ y16;
+  y18 = x0 ^ y16;
+
+  /* Non-linear section */
+  t2 = y12 & y15;
+  t3 = y3 & y6;
+  t4 = t3 ^ t2;
+  t5 = y4 & x7;
+  t6 = t5 ^ t2;
+  t7 = y13 & y16;
+  t8 = y5 & y1;
+  t9 = t8 ^ t7;
+  t10 = y2 & y7;
+  t11 = t10 ^ t7;
+  t12 = y9 & y11;
+  t13 = y14 & y17;
+  t14 = t13 ^ t12;
+  t15 = y8 & y10;
+  t16 = t15 ^ t12;
+  t17 = t4 ^ t14;
+  t18 = t6 ^ t16;
+  t19 = t9 ^ t14;
+  t20 = t11 ^ t16;
+  t21 = t17 ^ y20;
+  t22 = t18 ^ y19;
+  t23 = t19 ^ y21;
+  t24 = t20 ^ y18;
+
+  t25 = t21 ^ t22;
+  t26 = t21 & t23;
+  t27 = t24 ^ t26;
+  t28 = t25 & t27;
+  t29 = t28 ^ t22;
+  t30 = t23 ^ t24;
+  t31 = t22 ^ t26;
+  t32 = t31 & t30;
+  t33 = t32 ^ t24;
+  t34 = t23 ^ t33;
+  t35 = t27 ^ t33;
+  t36 = t24 & t35;
+  t37 = t36 ^ t34;
+  t38 = t27 ^ t36;
+  t39 = t29 & t38;
+  t40 = t25 ^ t39;
+
+  t41 = t40 ^ t37;
+  t42 = t29 ^ t33;
+  t43 = t29 ^ t40;
+  t44 = t33 ^ t37;
+  t45 = t42 ^ t41;
+  z0 = t44 & y15;
+  z1 = t37 & y6;
+  z2 = t33 & x7;
+  z3 = t43 & y16;
+  z4 = t40 & y1;
+  z5 = t29 & y7;
+  z6 = t42 & y11;
+  z7 = t45 & y17;
+  z8 = t41 & y10;
+  z9 = t44 & y12;
+  z10 = t37 & y3;
+  z11 = t33 & y4;
+  z12 = t43 & y13;
+  z13 = t40 & y5;
+  z14 = t29 & y2;
+  z15 = t42 & y9;
+  z16 = t45 & y14;
+  z17 = t41 & y8;
+
+  /* Bottom linear transformation */
+  t46 = z15 ^ z16;
+  t47 = z10 ^ z11;
+  t48 = z5 ^ z13;
+  t49 = z9 ^ z10;
+  t50 = z2 ^ z12;
+  t51 = z2 ^ z5;
+  t52 = z7 ^ z8;
+  t53 = z0 ^ z3;
+  t54 = z6 ^ z7;
+  t55 = z16 ^ z17;
+  t56 = z12 ^ t48;
+  t57 = t50 ^ t53;
+  t58 = z4 ^ t46;
+  t59 = z3 ^ t54;
+  t60 = t46 ^ t57;
+  t61 = z14 ^ t57;
+  t62 = t52 ^ t58;
+  t63 = t49 ^ t58;
+  t64 = z4 ^ t59;
+  t65 = t61 ^ t62;
+  t66 = z1 ^ t63;
+  s0 = t59 ^ t63;
+  s6 = t56 ^ ~t62;
+  s7 = t48 ^ ~t60;
+  t67 = t64 ^ t65;
+  s3 = t53 ^ t66;
+  s4 = t51 ^ t66;
+  s5 = t47 ^ t65;
+  s1 = t64 ^ ~s3;
+  s2 = t55 ^ ~t67;
+
+  q[7] = s0;
+  q[6] = s1;
+  q[5] = s2;
+  q[4] = s3;
+  q[3] = s4;
+  q[2] = s5;
+  q[1] = s6;
+  q[0] = s7;
+}
+
+static void shift_rows(bs_word_t* q) {
+  int i;
+  for (i = 0; i < 8; ++i) {
+    bs_word_t x = q[i];
+    /* Each row is rotated right by four bits, or one column, per row index */
+    q[i] = (x & 0x000000000000fffful) | ((x >> 4) & 0x000000000fff0000ul) |
+           ((x << 12) & 0x00000000f0000000ul) |
+           ((x >> 8) & 0x000000ff00000000ul) |
+           ((x << 8) & 0x0000ff0000000000ul) |
+           ((x >> 12) & 0x000f000000000000ul) |
+           ((x << 4) & 0xfff0000000000000ul);
+  }
+}
+
+static bs_word_t rotr64(const bs_word_t x, const int n) {
+  return (x >> n) | (x << (64 - n));
+}
+
+/**
+ * Every output row is 2a[r] ^ 3a[r+1] ^ a[r+2] ^ a[r+3], which is rewritten as
+ * xtime(a[r] ^ a[r+1]) ^ a[r+1] ^ a[r+2] ^ a[r+3]. Rotating a word by 16 bits
+ * gives a[r+1] for every column at once, and xtime is a shuffle of planes.
+ */
+static void mix_columns(bs_word_t* q) {
+  bs_word_t t[8], rest[8];
+  int i;
+  for (i = 0; i < 8; ++i) {
+    bs_word_t next = rotr64(q[i], 16);
+    t[i] = q[i] ^ next;
+    rest[i] = next ^ rotr64(t[i], 32);
+  }
+  q[0] = rest[0] ^ t[7];
+  q[1] = rest[1] ^ t[0] ^ t[7];
+  q[2] = rest[2] ^ t[1];
+  q[3] = rest[3] ^ t[2] ^ t[7];
+  q[4] = rest[4] ^ t[3] ^ t[7];
+  q[5] = rest[5] ^ t[4];
+  q[6] = rest[6] ^ t[5];
+  q[7] = rest[7] ^ t[6];
+}
+
+static void add_round_key(bs_word_t* q, const uint64_t* sliced_key) {
+  int i;
+  for (i = 0; i < AES_BITSLICE_WORDS; ++i) q[i] ^= sliced_key[i];
+}
+
+static void encrypt_planes(const uint64_t* sliced_keys, bs_word_t* q) {
+  add_round_key(q, sliced_keys);
+
+  int round;
+  for (round = 1; round <= AES_NR; ++round) {
+    sub_bytes(q);
+    shift_rows(q);
+    /* The last round has no MixColumns */
+    if (round != AES_NR) mix_columns(q);
+    add_round_key(q, sliced_keys + round * AES_BITSLICE_WORDS);
+  }
+}
+
+/* SubWord without any lookups, running the circuit with one byte per lane */
+static void sub_word(uint8_t* word) {
+  bs_word_t q[8];
+  int bit, i, l;
+  for (bit = 0; bit < 8; ++bit) {
+    uint64_t plane = 0;
+    for (i = 0; i < 4; ++i) plane |= (uint64_t)((word[i] >> bit) & 1) << i;
+    for (l = 0; l < AES_BS_LANES; ++l) BS_LANE(q[bit], l) = plane;
+  }
+  sub_bytes(q);
+  for (i = 0; i < 4; ++i) {
+    word[i] = 0;
+    for (bit = 0; bit < 8; ++bit) {
+      word[i] |= (uint8_t)(((BS_LANE(q[bit], 0) >> i) & 1) << bit);
+    }
+  }
+}
+
+void aes_bs_expand_key(const uint8_t* key, uint8_t* round_keys) {
+  memcpy(round_keys, key, AES_KEY_SIZE);
+
+  int i = 1;
+  uint8_t temp[4];
+
+  int pos;
+  for (pos = AES_NK; pos < AES_NB * (AES_NR + 1); ++pos) {
+    memcpy(temp, &round_keys[(pos - 1) * 4], 4);
+
+    if (pos % AES_NK == 0) {
+      /* RotWord */
+      uint8_t t = temp[0];
+      temp[0] = temp[1];
+      temp[1] = temp[2];
+      temp[2] = temp[3];
+      temp[3] = t;
+
+      sub_word(temp);
+      temp[0] ^= rcon[i++];
+    }
+
+    uint8_t* w_prev_nk = &round_keys[(pos - AES_NK) * 4];
+    uint8_t* w_current = &round_keys[pos * 4];
+    w_current[0] = w_prev_nk[0] ^ temp[0];
+    w_current[1] = w_prev_nk[1] ^ temp[1];
+    w_current[2] = w_prev_nk[2] ^ temp[2];
+    w_current[3] = w_prev_nk[3] ^ temp[3];
+  }
+}
+
+void aes_bs_slice_keys(const uint8_t* round_keys, uint64_t* sliced_keys) {
+  int round, pos, bit;
+  for (round = 0; round <= AES_NR; ++round) {
+    const uint8_t* rk = round_keys + round * AES_BLOCK_SIZE;
+    uint64_t* sk = sliced_keys + round * AES_BITSLICE_WORDS;
+    memset(sk, 0, AES_BITSLICE_WORDS * sizeof(uint64_t));
+    for (pos = 0; pos < AES_BLOCK_SIZE; ++pos) {
+      /* Bytes are stored column by column, so the row is the low bits */
+      int shift = (pos & 3) * 16 + (pos >> 2) * 4;
+      for (bit = 0; bit < 8; ++bit) {
+        /* Broadcast the key bit to all four blocks without branching */
+        uint64_t mask = (uint64_t)0 - (uint64_t)((rk[pos] >> bit) & 1);
+        sk[bit] |= (mask & 0xf) << shift;
+      }
+    }
+  }
+}
+
+void aes_bs_encrypt(const uint64_t* sliced_keys, const uint8_t* in,
+                    uint8_t* out, size_t blocks) {
+  uint64_t groups[AES_BS_LANES][8];
+  bs_word_t q[8];
+  int i, l;
+  while (blocks > 0) {
+    size_t n = blocks < AES_BS_BLOCKS ? blocks : AES_BS_BLOCKS;
+
+    /* Lanes past the end of the input are encrypted as padding */
+    for (l = 0; l < AES_BS_LANES; ++l) {
+      size_t skip = l * AES_BS_GROUP_BLOCKS;
+      size_t count = n > skip ? n - skip : 0;
+      if (count > AES_BS_GROUP_BLOCKS) count = AES_BS_GROUP_BLOCKS;
+      load_group(in + skip * AES_BLOCK_SIZE, count, groups[l]);
+      for (i = 0; i < 8; ++i) BS_LANE(q[i], l) = groups[l][i];
+    }
+
+    encrypt_planes(sliced_keys, q);
+
+    for (l = 0; l < AES_BS_LANES; ++l) {
+      size_t skip = l * AES_BS_GROUP_BLOCKS;
+      size_t count = n > skip ? n - skip : 0;
+      if (count > AES_BS_GROUP_BLOCKS) count = AES_BS_GROUP_BLOCKS;
+      for (i = 0; i < 8; ++i) groups[l][i] = BS_LANE(q[i], l);
+      store_group(groups[l], out + skip * AES_BLOCK_SIZE, count);
+    }
+
+    in += n * AES_BLOCK_SIZE;
+    out += n * AES_BLOCK_SIZE;
+    blocks -= n;
+  }
+}
@@ -4,83 +4,140 @@
 
 #include "constants.h"
 #include "crypto/aes.h"
+#include "crypto/aes_ni.h"
 #include "stddefs.h"
 #include "utils/throw.h"
 
-/* Increment a 128-bit big-endian counter by N blocks */
-static void increment_counter_by(uint8_t counter[AES_BLOCK_SIZE], uint64_t n) {
-  uint64_t carry = 0;
+/**
+ * The 128-bit big-endian counter is kept as two native 64-bit halves while
+ * generating keystream. Incrementing then only touches the low half, with a
+ * rare carry into the high half, instead of walking the counter byte-by-byte.
+ */
+static uint64_t load_u64_be(const uint8_t* p) {
+  uint64_t v = 0;
   int i;
-  for (i = AES_BLOCK_SIZE - 1; i >= 0 && (n || carry); --i) {
-    uint64_t sum = (uint64_t)counter[i] + (n & 0xff) + carry;
-    counter[i] = (uint8_t)sum;
-    carry = sum >> 8;
-    n >>= 8;
+  for (i = 0; i < 8; ++i) v = (v << 8) | p[i];
+  return v;
+}
+
+static void store_u64_be(uint8_t* p, uint64_t v) {
+  int i;
+  for (i = 7; i >= 0; --i) {
+    p[i] = (uint8_t)v;
+    v >>= 8;
   }
 }
 
-void aes_ctr_crypt(const aes_ctx_t* ctx, buf_t* iv, const size_t offset,
-                   const buf_t* input, buf_t* output) {
-  if (!ctx || !iv || !input || !output) throw("Arguments cannot be NULL");
-  if (iv->size != AES_BLOCK_SIZE || !iv->data) throw("Invalid IV buffer");
-  if (!output->data) throw("Output buffer must be initialised");
-  if (input->size == 0) throw("Input data size cannot be zero");
-  if (input->size == 0) return;
-  if (output->capacity < input->size) buf_resize(output, input->size);
+/* Writes consecutive counter blocks and advances the counter past them */
+static void fill_counters(uint8_t* blocks, const size_t n, uint64_t* hi,
+                          uint64_t* lo) {
+  size_t i;
+  for (i = 0; i < n; ++i) {
+    store_u64_be(blocks + i * AES_BLOCK_SIZE, *hi);
+    store_u64_be(blocks + i * AES_BLOCK_SIZE + 8, *lo);
+    if (++(*lo) == 0) ++(*hi);
+  }
+}
 
+/* XORs the keystream into the data a machine word at a time */
+static void xor_keystream(uint8_t* out, const uint8_t* in, const uint8_t* ks,
+                          size_t len) {
+  uint64_t a, b;
+  while (len >= sizeof(uint64_t)) {
+    memcpy(&a, in, sizeof(uint64_t));
+    memcpy(&b, ks, sizeof(uint64_t));
+    a ^= b;
+    memcpy(out, &a, sizeof(uint64_t));
+    in += sizeof(uint64_t);
+    ks += sizeof(uint64_t);
+    out += sizeof(uint64_t);
+    len -= sizeof(uint64_t);
+  }
+  while (len-- > 0) *out++ = *in++ ^ *ks++;
+}
+
+void aes_ctr_transform(const aes_ctx_t* ctx, const uint8_t* iv,
+                       const size_t offset, const uint8_t* in, uint8_t* out,
+                       size_t remaining) {
   /* Calculate offset alignment */
   uint64_t block_index = offset / AES_BLOCK_SIZE;
   uint64_t block_offset = offset % AES_BLOCK_SIZE;
 
   /* Initialize counter to IV + block_index */
-  uint8_t counter[AES_BLOCK_SIZE];
-  memcpy(counter, iv->data, AES_BLOCK_SIZE);
-  increment_counter_by(counter, block_index);
-
-  uint8_t keystream[AES_BLOCK_SIZE];
-  buf_t keystream_buf;
-  buf_view(&keystream_buf, keystream, AES_BLOCK_SIZE);
+  uint64_t hi = load_u64_be(iv);
+  uint64_t lo = load_u64_be(iv + 8);
+  lo += block_index;
+  if (lo < block_index) ++hi;
 
-  size_t input_pos = 0;
-  size_t output_pos = 0;
+  uint8_t keystream[AES_CTR_BATCH_BLOCKS * AES_BLOCK_SIZE];
 
   /* If we start mid-block, handle partial first block */
   if (block_offset != 0) {
-    buf_t in;
-    buf_view(&in, counter, sizeof(counter));
-    aes_encrypt(ctx, &in, &keystream_buf);
+    fill_counters(keystream, 1, &hi, &lo);
+    aes_encrypt_blocks(ctx, keystream, keystream, 1);
 
     size_t first_chunk = AES_BLOCK_SIZE - block_offset;
-    if (first_chunk > input->size) first_chunk = input->size;
+    if (first_chunk > remaining) first_chunk = remaining;
+    xor_keystream(out, in, keystream + block_offset, first_chunk);
+    in += first_chunk;
+    out += first_chunk;
+    remaining -= first_chunk;
+  }
 
-    size_t i;
-    for (i = 0; i < first_chunk; ++i) {
-      output->data[output_pos++] =
-          input->data[input_pos++] ^ keystream[block_offset + i];
+  /* Hand all the whole blocks to the pipelined kernel if we have AES-NI */
+  if (aes_get_backend() == AES_BACKEND_AESNI) {
+    size_t blocks = remaining / AES_BLOCK_SIZE;
+    if (blocks > 0) {
+      uint8_t counter[AES_BLOCK_SIZE];
+      store_u64_be(counter, hi);
+      store_u64_be(counter + 8, lo);
+      aes_ni_ctr(ctx->round_keys, counter, in, out, blocks);
+      hi = load_u64_be(counter);
+      lo = load_u64_be(counter + 8);
+      in += blocks * AES_BLOCK_SIZE;
+      out += blocks * AES_BLOCK_SIZE;
+      remaining -= blocks * AES_BLOCK_SIZE;
     }
-
-    increment_counter_by(counter, 1);
   }
 
-  /* Process remaining full blocks */
-  while (input_pos < input->size) {
-    buf_t in;
-    buf_view(&in, counter, sizeof(counter));
-    aes_encrypt(ctx, &in, &keystream_buf);
+  /* Generate the keystream for several blocks at once for the rest */
+  while (remaining > 0) {
+    size_t blocks = (remaining + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+    if (blocks > AES_CTR_BATCH_BLOCKS) blocks = AES_CTR_BATCH_BLOCKS;
+    fill_counters(keystream, blocks, &hi, &lo);
+    aes_encrypt_blocks(ctx, keystream, keystream, blocks);
+
+    size_t chunk = blocks * AES_BLOCK_SIZE;
+    if (chunk > remaining) chunk = remaining;
+    xor_keystream(out, in, keystream, chunk);
+    in += chunk;
+    out += chunk;
+    remaining -= chunk;
+  }
+}
 
-    size_t remaining = input->size - input_pos;
-    size_t block_len = remaining < AES_BLOCK_SIZE ? remaining : AES_BLOCK_SIZE;
+void aes_ctr_crypt(const aes_ctx_t* ctx, buf_t* iv, const size_t offset,
+                   const buf_t* input, buf_t* output) {
+  if (!ctx || !iv || !input || !output) throw("Arguments cannot be NULL");
+  if (iv->size != AES_BLOCK_SIZE || !iv->data) throw("Invalid IV buffer");
+  if (!output->data) throw("Output buffer must be initialised");
+  if (input->size == 0) throw("Input data size cannot be zero");
+  if (output->capacity < input->size) buf_resize(output, input->size);
 
-    size_t i;
-    for (i = 0; i < block_len; ++i) {
-      output->data[output_pos++] = input->data[input_pos++] ^ keystream[i];
-    }
+  aes_ctr_transform(ctx, iv->data, offset, input->data, output->data,
+                    input->size);
+  output->size = input->size;
+}
 
-    /* Only increment if there's more data that would need another block */
-    if (input_pos < input->size) increment_counter_by(counter, 1);
-  }
+void aes_ctr_crypt_inplace(const aes_ctx_t* ctx, const buf_t* iv,
+                           const size_t offset, buf_t* data) {
+  if (!ctx || !iv || !data) throw("Arguments cannot be NULL");
+  if (iv->size != AES_BLOCK_SIZE || !iv->data) throw("Invalid IV buffer");
+  if (!data->data) throw("Data buffer must be initialised");
+  if (data->size == 0) throw("Input data size cannot be zero");
 
-  output->size = output_pos;
+  aes_ctr_transform(ctx, iv->data, offset, data->data, data->data,
+                    data->size);
 }
 
 void aes_ctr_encrypt(const aes_ctx_t* ctx, buf_t* iv, const size_t offset,
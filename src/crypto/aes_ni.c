@@ -0,0 +1,185 @@
+/**
+ * The intrinsics are enabled per-function using the target attribute instead
+ * of passing -maes to the whole build. This keeps the rest of the program
+ * runnable on processors without AES-NI, as the compiler can't sneak these
+ * instructions into any other code.
+ *
+ * @see https://www.intel.com/content/dam/doc/white-paper/advanced-encryption-standard-new-instructions-set-paper.pdf
+ */
+
+#include "crypto/aes_ni.h"
+
+#include "constants.h"
+#include "stddefs.h"
+#include "utils/throw.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+#define AES_NI_TARGET __attribute__((target("aes,sse2")))
+
+/* Number of counter blocks encrypted in parallel */
+#define AES_NI_LANES 8
+
+static uint64_t load_u64_be(const uint8_t* p) {
+  uint64_t v = 0;
+  int i;
+  for (i = 0; i < 8; ++i) v = (v << 8) | p[i];
+  return v;
+}
+
+static void store_u64_be(uint8_t* p, uint64_t v) {
+  int i;
+  for (i = 7; i >= 0; --i) {
+    p[i] = (uint8_t)v;
+    v >>= 8;
+  }
+}
+
+bool aes_ni_available() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+  return (ecx & bit_AES) && (edx & bit_SSE2);
+}
+
+AES_NI_TARGET static __m128i expand_step(__m128i key, __m128i assist) {
+  __m128i tmp;
+  assist = _mm_shuffle_epi32(assist, 0xff);
+  tmp = _mm_slli_si128(key, 4);
+  key = _mm_xor_si128(key, tmp);
+  tmp = _mm_slli_si128(tmp, 4);
+  key = _mm_xor_si128(key, tmp);
+  tmp = _mm_slli_si128(tmp, 4);
+  key = _mm_xor_si128(key, tmp);
+  return _mm_xor_si128(key, assist);
+}
+
+/* The round constant must be an immediate, so each step is spelt out */
+#define EXPAND_ROUND(i, rcon)                                         \
+  k = expand_step(k, _mm_aeskeygenassist_si128(k, rcon));             \
+  _mm_storeu_si128((__m128i*)(round_keys + (i) * AES_BLOCK_SIZE), k)
+
+AES_NI_TARGET void aes_ni_expand_key(const uint8_t* key, uint8_t* round_keys) {
+  __m128i k = _mm_loadu_si128((const __m128i*)key);
+  _mm_storeu_si128((__m128i*)round_keys, k);
+  EXPAND_ROUND(1, 0x01);
+  EXPAND_ROUND(2, 0x02);
+  EXPAND_ROUND(3, 0x04);
+  EXPAND_ROUND(4, 0x08);
+  EXPAND_ROUND(5, 0x10);
+  EXPAND_ROUND(6, 0x20);
+  EXPAND_ROUND(7, 0x40);
+  EXPAND_ROUND(8, 0x80);
+  EXPAND_ROUND(9, 0x1b);
+  EXPAND_ROUND(10, 0x36);
+}
+
+#undef EXPAND_ROUND
+
+AES_NI_TARGET static void load_schedule(const uint8_t* round_keys,
+                                        __m128i rk[AES_NR + 1]) {
+  int i;
+  for (i = 0; i <= AES_NR; ++i) {
+    rk[i] = _mm_loadu_si128((const __m128i*)(round_keys + i * AES_BLOCK_SIZE));
+  }
+}
+
+AES_NI_TARGET void aes_ni_encrypt(const uint8_t* round_keys, const uint8_t* in,
+                                  uint8_t* out) {
+  __m128i rk[AES_NR + 1];
+  load_schedule(round_keys, rk);
+
+  __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*)in), rk[0]);
+  int round;
+  for (round = 1; round < AES_NR; ++round) b = _mm_aesenc_si128(b, rk[round]);
+  b = _mm_aesenclast_si128(b, rk[AES_NR]);
+  _mm_storeu_si128((__m128i*)out, b);
+}
+
+/* Builds a counter block from the two native halves of the counter */
+AES_NI_TARGET static __m128i make_counter(uint64_t hi, uint64_t lo) {
+  return _mm_set_epi64x((long long)__builtin_bswap64(lo),
+                        (long long)__builtin_bswap64(hi));
+}
+
+AES_NI_TARGET void aes_ni_ctr(const uint8_t* round_keys, uint8_t* counter,
+                              const uint8_t* in, uint8_t* out, size_t blocks) {
+  __m128i rk[AES_NR + 1];
+  load_schedule(round_keys, rk);
+
+  /* Track the counter as two native halves so incrementing is cheap */
+  uint64_t hi = load_u64_be(counter);
+  uint64_t lo = load_u64_be(counter + 8);
+  __m128i b[AES_NI_LANES];
+  int i, round;
+
+  /* Interleave the rounds across lanes to keep the AES unit busy */
+  while (blocks >= AES_NI_LANES) {
+    for (i = 0; i < AES_NI_LANES; ++i) {
+      b[i] = _mm_xor_si128(make_counter(hi, lo), rk[0]);
+      if (++lo == 0) ++hi;
+    }
+    for (round = 1; round < AES_NR; ++round) {
+      for (i = 0; i < AES_NI_LANES; ++i) {
+        b[i] = _mm_aesenc_si128(b[i], rk[round]);
+      }
+    }
+    for (i = 0; i < AES_NI_LANES; ++i) {
+      b[i] = _mm_aesenclast_si128(b[i], rk[AES_NR]);
+      __m128i data = _mm_loadu_si128((const __m128i*)in + i);
+      _mm_storeu_si128((__m128i*)out + i, _mm_xor_si128(data, b[i]));
+    }
+    in += AES_NI_LANES * AES_BLOCK_SIZE;
+    out += AES_NI_LANES * AES_BLOCK_SIZE;
+    blocks -= AES_NI_LANES;
+  }
+
+  /* Finish off the tail one block at a time */
+  while (blocks > 0) {
+    __m128i k = _mm_xor_si128(make_counter(hi, lo), rk[0]);
+    if (++lo == 0) ++hi;
+    for (round = 1; round < AES_NR; ++round) k = _mm_aesenc_si128(k, rk[round]);
+    k = _mm_aesenclast_si128(k, rk[AES_NR]);
+    __m128i data = _mm_loadu_si128((const __m128i*)in);
+    _mm_storeu_si128((__m128i*)out, _mm_xor_si128(data, k));
+    in += AES_BLOCK_SIZE;
+    out += AES_BLOCK_SIZE;
+    blocks--;
+  }
+
+  store_u64_be(counter, hi);
+  store_u64_be(counter + 8, lo);
+}
+
+#else
+
+bool aes_ni_available() { return false; }
+
+void aes_ni_expand_key(const uint8_t* key, uint8_t* round_keys) {
+  (void)key;
+  (void)round_keys;
+  throw("AES-NI is not supported on this platform");
+}
+
+void aes_ni_encrypt(const uint8_t* round_keys, const uint8_t* in,
+                    uint8_t* out) {
+  (void)round_keys;
+  (void)in;
+  (void)out;
+  throw("AES-NI is not supported on this platform");
+}
+
+void aes_ni_ctr(const uint8_t* round_keys, uint8_t* counter, const uint8_t* in,
+                uint8_t* out, size_t blocks) {
+  (void)round_keys;
+  (void)counter;
+  (void)in;
+  (void)out;
+  (void)blocks;
+  throw("AES-NI is not supported on this platform");
+}
+
+#endif
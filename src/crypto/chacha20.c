@@ -0,0 +1,375 @@
+/**
+ * The vector kernels keep one state word per register, with each lane holding
+ * the same word of a different block. Every quarter round then works on four
+ * or eight blocks at once without any shuffling, and the blocks are only
+ * transposed back into byte order once the rounds are done.
+ *
+ * Like the AES-NI backend, the intrinsics are enabled per-function using the
+ * target attribute, so the rest of the program still runs on processors
+ * without these extensions.
+ */
+
+#include "crypto/chacha20.h"
+
+#include <string.h>
+
+#include "constants.h"
+#include "core/buffer.h"
+#include "stddefs.h"
+#include "utils/throw.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHACHA20_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#define CHACHA20_ROUNDS 20
+
+typedef enum {
+  CHACHA20_IMPL_PORTABLE,
+  CHACHA20_IMPL_SSE2,
+  CHACHA20_IMPL_AVX2
+} chacha20_impl_t;
+
+static chacha20_impl_t impl = CHACHA20_IMPL_PORTABLE;
+
+/* "expand 32-byte k" as four little-endian words */
+static const uint32_t sigma[4] = {0x61707865, 0x3320646e, 0x79622d32,
+                                  0x6b206574};
+
+static uint32_t load_u32_le(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static void store_u32_le(uint8_t* p, const uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t rotl32(const uint32_t x, const int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+#define QUARTER_ROUND(a, b, c, d) \
+  a += b;                         \
+  d = rotl32(d ^ a, 16);          \
+  c += d;                         \
+  b = rotl32(b ^ c, 12);          \
+  a += b;                         \
+  d = rotl32(d ^ a, 8);           \
+  c += d;                         \
+  b = rotl32(b ^ c, 7)
+
+/* Generates the 64-byte keystream block for the counter in the state */
+static void block_portable(const uint32_t* state, uint8_t* keystream) {
+  uint32_t x[16];
+  int i;
+  memcpy(x, state, sizeof(x));
+  for (i = 0; i < CHACHA20_ROUNDS; i += 2) {
+    QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+    QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+    QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+    QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+    QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+    QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+    QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+    QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+  }
+  for (i = 0; i < 16; ++i) store_u32_le(keystream + i * 4, x[i] + state[i]);
+}
+
+#undef QUARTER_ROUND
+
+#ifdef CHACHA20_X86
+
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+#define ROTL_SSE2(x, n) \
+  _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+
+#define QUARTER_ROUND_SSE2(a, b, c, d) \
+  a = _mm_add_epi32(a, b);             \
+  d = _mm_xor_si128(d, a);             \
+  d = ROTL_SSE2(d, 16);                \
+  c = _mm_add_epi32(c, d);             \
+  b = _mm_xor_si128(b, c);             \
+  b = ROTL_SSE2(b, 12);                \
+  a = _mm_add_epi32(a, b);             \
+  d = _mm_xor_si128(d, a);             \
+  d = ROTL_SSE2(d, 8);                 \
+  c = _mm_add_epi32(c, d);             \
+  b = _mm_xor_si128(b, c);             \
+  b = ROTL_SSE2(b, 7)
+
+/* Encrypts four consecutive blocks, starting from the counter in the state */
+SSE2_TARGET static void blocks_sse2(const uint32_t* state, const uint8_t* in,
+                                    uint8_t* out) {
+  uint64_t counter = (uint64_t)state[12] | ((uint64_t)state[13] << 32);
+  __m128i s[16], x[16];
+  int i, j;
+
+  for (i = 0; i < 16; ++i) s[i] = _mm_set1_epi32((int)state[i]);
+  s[12] = _mm_setr_epi32((int)(uint32_t)counter, (int)(uint32_t)(counter + 1),
+                         (int)(uint32_t)(counter + 2),
+                         (int)(uint32_t)(counter + 3));
+  s[13] = _mm_setr_epi32(
+      (int)(uint32_t)(counter >> 32), (int)(uint32_t)((counter + 1) >> 32),
+      (int)(uint32_t)((counter + 2) >> 32),
+      (int)(uint32_t)((counter + 3) >> 32));
+  for (i = 0; i < 16; ++i) x[i] = s[i];
+
+  for (i = 0; i < CHACHA20_ROUNDS; i += 2) {
+    QUARTER_ROUND_SSE2(x[0], x[4], x[8], x[12]);
+    QUARTER_ROUND_SSE2(x[1], x[5], x[9], x[13]);
+    QUARTER_ROUND_SSE2(x[2], x[6], x[10], x[14]);
+    QUARTER_ROUND_SSE2(x[3], x[7], x[11], x[15]);
+    QUARTER_ROUND_SSE2(x[0], x[5], x[10], x[15]);
+    QUARTER_ROUND_SSE2(x[1], x[6], x[11], x[12]);
+    QUARTER_ROUND_SSE2(x[2], x[7], x[8], x[13]);
+    QUARTER_ROUND_SSE2(x[3], x[4], x[9], x[14]);
+  }
+  for (i = 0; i < 16; ++i) x[i] = _mm_add_epi32(x[i], s[i]);
+
+  /* Transpose each group of four words back into the four blocks */
+  for (i = 0; i < 4; ++i) {
+    __m128i t0 = _mm_unpacklo_epi32(x[i * 4], x[i * 4 + 1]);
+    __m128i t1 = _mm_unpackhi_epi32(x[i * 4], x[i * 4 + 1]);
+    __m128i t2 = _mm_unpacklo_epi32(x[i * 4 + 2], x[i * 4 + 3]);
+    __m128i t3 = _mm_unpackhi_epi32(x[i * 4 + 2], x[i * 4 + 3]);
+    __m128i b[4];
+    b[0] = _mm_unpacklo_epi64(t0, t2);
+    b[1] = _mm_unpackhi_epi64(t0, t2);
+    b[2] = _mm_unpacklo_epi64(t1, t3);
+    b[3] = _mm_unpackhi_epi64(t1, t3);
+    for (j = 0; j < 4; ++j) {
+      const size_t at = j * CHACHA20_BLOCK_SIZE + i * 16;
+      __m128i data = _mm_loadu_si128((const __m128i*)(in + at));
+      _mm_storeu_si128((__m128i*)(out + at), _mm_xor_si128(data, b[j]));
+    }
+  }
+}
+
+#undef QUARTER_ROUND_SSE2
+#undef ROTL_SSE2
+
+#define ROTL_AVX2(x, n) \
+  _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+/* Rotations by whole bytes are done with a single byte shuffle instead */
+#define QUARTER_ROUND_AVX2(a, b, c, d)   \
+  a = _mm256_add_epi32(a, b);            \
+  d = _mm256_xor_si256(d, a);            \
+  d = _mm256_shuffle_epi8(d, rot16);     \
+  c = _mm256_add_epi32(c, d);            \
+  b = _mm256_xor_si256(b, c);            \
+  b = ROTL_AVX2(b, 12);                  \
+  a = _mm256_add_epi32(a, b);            \
+  d = _mm256_xor_si256(d, a);            \
+  d = _mm256_shuffle_epi8(d, rot8);      \
+  c = _mm256_add_epi32(c, d);            \
+  b = _mm256_xor_si256(b, c);            \
+  b = ROTL_AVX2(b, 7)
+
+/* Encrypts eight consecutive blocks, starting from the counter in the state */
+AVX2_TARGET static void blocks_avx2(const uint32_t* state, const uint8_t* in,
+                                    uint8_t* out) {
+  const __m256i rot16 = _mm256_setr_epi8(
+      2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13, 2, 3, 0, 1, 6, 7,
+      4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+  const __m256i rot8 = _mm256_setr_epi8(
+      3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14, 3, 0, 1, 2, 7, 4,
+      5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+  uint64_t counter = (uint64_t)state[12] | ((uint64_t)state[13] << 32);
+  uint32_t lo[8], hi[8];
+  __m256i s[16], x[16], b[4][4];
+  int i, j;
+
+  for (i = 0; i < 8; ++i) {
+    lo[i] = (uint32_t)(counter + i);
+    hi[i] = (uint32_t)((counter + i) >> 32);
+  }
+  for (i = 0; i < 16; ++i) s[i] = _mm256_set1_epi32((int)state[i]);
+  s[12] = _mm256_loadu_si256((const __m256i*)lo);
+  s[13] = _mm256_loadu_si256((const __m256i*)hi);
+  for (i = 0; i < 16; ++i) x[i] = s[i];
+
+  for (i = 0; i < CHACHA20_ROUNDS; i += 2) {
+    QUARTER_ROUND_AVX2(x[0], x[4], x[8], x[12]);
+    QUARTER_ROUND_AVX2(x[1], x[5], x[9], x[13]);
+    QUARTER_ROUND_AVX2(x[2], x[6], x[10], x[14]);
+    QUARTER_ROUND_AVX2(x[3], x[7], x[11], x[15]);
+    QUARTER_ROUND_AVX2(x[0], x[5], x[10], x[15]);
+    QUARTER_ROUND_AVX2(x[1], x[6], x[11], x[12]);
+    QUARTER_ROUND_AVX2(x[2], x[7], x[8], x[13]);
+    QUARTER_ROUND_AVX2(x[3], x[4], x[9], x[14]);
+  }
+  for (i = 0; i < 16; ++i) x[i] = _mm256_add_epi32(x[i], s[i]);
+
+  /**
+   * Transpose within each 128-bit half, like the SSE2 kernel. The low halves
+   * then hold 16 bytes of blocks 0-3 and the high halves hold blocks 4-7.
+   */
+  for (i = 0; i < 4; ++i) {
+    __m256i t0 = _mm256_unpacklo_epi32(x[i * 4], x[i * 4 + 1]);
+    __m256i t1 = _mm256_unpackhi_epi32(x[i * 4], x[i * 4 + 1]);
+    __m256i t2 = _mm256_unpacklo_epi32(x[i * 4 + 2], x[i * 4 + 3]);
+    __m256i t3 = _mm256_unpackhi_epi32(x[i * 4 + 2], x[i * 4 + 3]);
+    b[i][0] = _mm256_unpacklo_epi64(t0, t2);
+    b[i][1] = _mm256_unpackhi_epi64(t0, t2);
+    b[i][2] = _mm256_unpacklo_epi64(t1, t3);
+    b[i][3] = _mm256_unpackhi_epi64(t1, t3);
+  }
+
+  /* Pair up the halves so each store covers 32 contiguous bytes of a block */
+  for (j = 0; j < 4; ++j) {
+    __m256i k[4];
+    const uint8_t* src[4];
+    uint8_t* dst[4];
+    k[0] = _mm256_permute2x128_si256(b[0][j], b[1][j], 0x20);
+    k[1] = _mm256_permute2x128_si256(b[2][j], b[3][j], 0x20);
+    k[2] = _mm256_permute2x128_si256(b[0][j], b[1][j], 0x31);
+    k[3] = _mm256_permute2x128_si256(b[2][j], b[3][j], 0x31);
+    src[0] = in + j * CHACHA20_BLOCK_SIZE;
+    src[1] = src[0] + 32;
+    src[2] = in + (j + 4) * CHACHA20_BLOCK_SIZE;
+    src[3] = src[2] + 32;
+    dst[0] = out + j * CHACHA20_BLOCK_SIZE;
+    dst[1] = dst[0] + 32;
+    dst[2] = out + (j + 4) * CHACHA20_BLOCK_SIZE;
+    dst[3] = dst[2] + 32;
+    for (i = 0; i < 4; ++i) {
+      __m256i data = _mm256_loadu_si256((const __m256i*)src[i]);
+      _mm256_storeu_si256((__m256i*)dst[i], _mm256_xor_si256(data, k[i]));
+    }
+  }
+}
+
+#undef QUARTER_ROUND_AVX2
+#undef ROTL_AVX2
+
+#endif
+
+/* XORs the keystream into the data a machine word at a time */
+static void xor_keystream(uint8_t* out, const uint8_t* in, const uint8_t* ks,
+                          size_t len) {
+  uint64_t a, b;
+  while (len >= sizeof(uint64_t)) {
+    memcpy(&a, in, sizeof(uint64_t));
+    memcpy(&b, ks, sizeof(uint64_t));
+    a ^= b;
+    memcpy(out, &a, sizeof(uint64_t));
+    in += sizeof(uint64_t);
+    ks += sizeof(uint64_t);
+    out += sizeof(uint64_t);
+    len -= sizeof(uint64_t);
+  }
+  while (len-- > 0) *out++ = *in++ ^ *ks++;
+}
+
+static void set_counter(uint32_t* state, const uint64_t counter) {
+  state[12] = (uint32_t)counter;
+  state[13] = (uint32_t)(counter >> 32);
+}
+
+void chacha20_init(chacha20_ctx_t* ctx, const buf_t* key) {
+  if (!ctx || !key) throw("Arguments cannot be NULL");
+  if (key->size != CHACHA20_KEY_SIZE || !key->data) throw("Invalid key buffer");
+
+  int i;
+  for (i = 0; i < CHACHA20_KEY_SIZE / 4; ++i) {
+    ctx->key[i] = load_u32_le(key->data + i * 4);
+  }
+
+#ifdef CHACHA20_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    impl = CHACHA20_IMPL_AVX2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    impl = CHACHA20_IMPL_SSE2;
+  }
+#endif
+}
+
+void chacha20_transform(const chacha20_ctx_t* ctx, const uint8_t* iv,
+                        const size_t offset, const uint8_t* in, uint8_t* out,
+                        size_t remaining) {
+  uint32_t state[16];
+  memcpy(state, sigma, sizeof(sigma));
+  memcpy(state + 4, ctx->key, sizeof(ctx->key));
+  state[14] = load_u32_le(iv + 8);
+  state[15] = load_u32_le(iv + 12);
+
+  /* Skip ahead to the block containing the offset */
+  uint64_t counter = ((uint64_t)load_u32_le(iv) |
+                      ((uint64_t)load_u32_le(iv + 4) << 32)) +
+                     offset / CHACHA20_BLOCK_SIZE;
+  size_t block_offset = offset % CHACHA20_BLOCK_SIZE;
+  uint8_t keystream[CHACHA20_BLOCK_SIZE];
+
+  /* If we start mid-block, handle partial first block */
+  if (block_offset != 0) {
+    set_counter(state, counter++);
+    block_portable(state, keystream);
+
+    size_t first_chunk = CHACHA20_BLOCK_SIZE - block_offset;
+    if (first_chunk > remaining) first_chunk = remaining;
+    xor_keystream(out, in, keystream + block_offset, first_chunk);
+    in += first_chunk;
+    out += first_chunk;
+    remaining -= first_chunk;
+  }
+
+#ifdef CHACHA20_X86
+  if (impl == CHACHA20_IMPL_AVX2) {
+    while (remaining >= 8 * CHACHA20_BLOCK_SIZE) {
+      set_counter(state, counter);
+      blocks_avx2(state, in, out);
+      counter += 8;
+      in += 8 * CHACHA20_BLOCK_SIZE;
+      out += 8 * CHACHA20_BLOCK_SIZE;
+      remaining -= 8 * CHACHA20_BLOCK_SIZE;
+    }
+  }
+  if (impl != CHACHA20_IMPL_PORTABLE) {
+    while (remaining >= 4 * CHACHA20_BLOCK_SIZE) {
+      set_counter(state, counter);
+      blocks_sse2(state, in, out);
+      counter += 4;
+      in += 4 * CHACHA20_BLOCK_SIZE;
+      out += 4 * CHACHA20_BLOCK_SIZE;
+      remaining -= 4 * CHACHA20_BLOCK_SIZE;
+    }
+  }
+#endif
+
+  /* Finish off the tail one block at a time */
+  while (remaining > 0) {
+    set_counter(state, counter++);
+    block_portable(state, keystream);
+
+    size_t chunk = CHACHA20_BLOCK_SIZE;
+    if (chunk > remaining) chunk = remaining;
+    xor_keystream(out, in, keystream, chunk);
+    in += chunk;
+    out += chunk;
+    remaining -= chunk;
+  }
+}
+
+void chacha20_crypt(const chacha20_ctx_t* ctx, const buf_t* iv,
+                    const size_t offset, const buf_t* input, buf_t* output) {
+  if (!ctx || !iv || !input || !output) throw("Arguments cannot be NULL");
+  if (iv->size != CHACHA20_IV_SIZE || !iv->data) throw("Invalid IV buffer");
+  if (!output->data) throw("Output buffer must be initialised");
+  if (input->size == 0) throw("Input data size cannot be zero");
+  if (output->capacity < input->size) buf_resize(output, input->size);
+
+  chacha20_transform(ctx, iv->data, offset, input->data, output->data,
+                     input->size);
+  output->size = input->size;
+}
@@ -0,0 +1,125 @@
+#include "crypto/cipher.h"
+
+#include <string.h>
+
+#include "constants.h"
+#include "core/buffer.h"
+#include "core/threadpool.h"
+#include "crypto/aes.h"
+#include "crypto/aes_ctr.h"
+#include "crypto/chacha20.h"
+#include "crypto/hmac.h"
+#include "stddefs.h"
+#include "utils/throw.h"
+
+/* A block size shared by both ciphers, so slices never split a block */
+#define CIPHER_SLICE_ALIGN CHACHA20_BLOCK_SIZE
+
+/* A buffer being transformed by the pool, split into block-aligned slices */
+typedef struct {
+  const cipher_ctx_t* ctx;
+  const uint8_t* iv;
+  size_t offset;
+  const uint8_t* in;
+  uint8_t* out;
+  size_t len;
+  size_t lead;
+  size_t slice;
+} cipher_job_t;
+
+void cipher_transform(const cipher_ctx_t* ctx, const uint8_t* iv,
+                      const size_t offset, const uint8_t* in, uint8_t* out,
+                      const size_t len) {
+  switch (ctx->type) {
+    case CIPHER_AES_CTR:
+      aes_ctr_transform(&ctx->aes, iv, offset, in, out, len);
+      break;
+    case CIPHER_CHACHA20:
+      chacha20_transform(&ctx->chacha20, iv, offset, in, out, len);
+      break;
+    default:
+      throw("Unknown cipher");
+  }
+}
+
+/**
+ * Every slice after the first starts on a block boundary of the keystream, so
+ * no block is generated twice. The first slice absorbs the unaligned lead-in.
+ */
+static void transform_slice(void* args, const size_t index) {
+  const cipher_job_t* job = (const cipher_job_t*)args;
+  size_t start = index == 0 ? 0 : job->lead + index * job->slice;
+  size_t end = job->lead + (index + 1) * job->slice;
+  if (end > job->len) end = job->len;
+  cipher_transform(job->ctx, job->iv, job->offset + start, job->in + start,
+                   job->out + start, end - start);
+}
+
+void cipher_transform_parallel(const cipher_ctx_t* ctx, const uint8_t* iv,
+                               const size_t offset, const uint8_t* in,
+                               uint8_t* out, const size_t len) {
+  size_t threads;
+  if (len < CIPHER_PARALLEL_THRESHOLD || (threads = threadpool_size()) == 1) {
+    cipher_transform(ctx, iv, offset, in, out, len);
+    return;
+  }
+
+  cipher_job_t job;
+  job.ctx = ctx;
+  job.iv = iv;
+  job.offset = offset;
+  job.in = in;
+  job.out = out;
+  job.len = len;
+  job.lead = (CIPHER_SLICE_ALIGN - offset % CIPHER_SLICE_ALIGN) %
+             CIPHER_SLICE_ALIGN;
+
+  /* Give each thread one slice, but never make the slices too small */
+  size_t slice = (len - job.lead + threads - 1) / threads;
+  if (slice < CIPHER_PARALLEL_SLICE) slice = CIPHER_PARALLEL_SLICE;
+  job.slice = (slice + CIPHER_SLICE_ALIGN - 1) / CIPHER_SLICE_ALIGN *
+              CIPHER_SLICE_ALIGN;
+
+  size_t slices = (len - job.lead + job.slice - 1) / job.slice;
+  threadpool_run(transform_slice, &job, slices);
+}
+
+/* Stretches the bin key to the 32 bytes needed by ChaCha20 */
+static void init_chacha20(chacha20_ctx_t* ctx, const buf_t* key) {
+  buf_t label, derived;
+  buf_view(&label, CHACHA20_KEY_LABEL, strlen(CHACHA20_KEY_LABEL));
+  buf_initf(&derived, CHACHA20_KEY_SIZE);
+  hmac_sha256_hash(key, &label, &derived);
+  chacha20_init(ctx, &derived);
+  buf_free(&derived);
+}
+
+void cipher_init(cipher_ctx_t* ctx, const cipher_t type, const buf_t* key) {
+  if (!ctx || !key) throw("Arguments cannot be NULL");
+  if (key->size != AES_KEY_SIZE || !key->data) throw("Invalid key buffer");
+
+  ctx->type = type;
+  switch (type) {
+    case CIPHER_AES_CTR:
+      aes_init(&ctx->aes, key);
+      break;
+    case CIPHER_CHACHA20:
+      init_chacha20(&ctx->chacha20, key);
+      break;
+    default:
+      throw("Unknown cipher");
+  }
+}
+
+void cipher_crypt(const cipher_ctx_t* ctx, const buf_t* iv, const size_t offset,
+                  const buf_t* input, buf_t* output) {
+  if (!ctx || !iv || !input || !output) throw("Arguments cannot be NULL");
+  if (iv->size != AES_IV_SIZE || !iv->data) throw("Invalid IV buffer");
+  if (!output->data) throw("Output buffer must be initialised");
+  if (input->size == 0) throw("Input data size cannot be zero");
+  if (output->capacity < input->size) buf_resize(output, input->size);
+
+  cipher_transform(ctx, iv->data, offset, input->data, output->data,
+                   input->size);
+  output->size = input->size;
+}
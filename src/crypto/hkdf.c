@@ -0,0 +1,66 @@
+#include "crypto/hkdf.h"
+
+#include <string.h>
+
+#include "constants.h"
+#include "core/buffer.h"
+#include "crypto/hmac.h"
+#include "stddefs.h"
+#include "utils/throw.h"
+
+void hkdf_sha256_extract(const buf_t* salt, const buf_t* ikm, buf_t* prk) {
+  if (!ikm || !prk) throw("Arguments cannot be NULL");
+
+  /* A missing salt is treated as a block of zeroes as long as a hash */
+  uint8_t zeroes[SHA256_HASH_SIZE];
+  buf_t zero_salt;
+  if (!salt) {
+    memset(zeroes, 0, SHA256_HASH_SIZE);
+    buf_view(&zero_salt, zeroes, SHA256_HASH_SIZE);
+    salt = &zero_salt;
+  }
+  hmac_sha256_hash(salt, ikm, prk);
+}
+
+void hkdf_sha256_expand(const buf_t* prk, const buf_t* info, buf_t* out,
+                        const size_t len) {
+  if (!prk || !info || !out) throw("Arguments cannot be NULL");
+  if (prk->size < SHA256_HASH_SIZE) throw("Pseudorandom key is too short");
+  if (len > 255 * SHA256_HASH_SIZE) throw("Requested key is too long");
+
+  /* T(i) = HMAC(PRK, T(i - 1) || info || i), with T(0) being empty */
+  uint8_t T[SHA256_HASH_SIZE];
+  uint8_t counter = 0;
+  buf_t T_view, counter_view;
+  buf_view(&T_view, T, SHA256_HASH_SIZE);
+  buf_view(&counter_view, &counter, 1);
+
+  hmac_sha256_ctx_t ctx;
+  hmac_sha256_init(&ctx, prk);
+  buf_clear(out);
+  size_t remlen = len;
+  while (remlen > 0) {
+    if (counter++ > 0) {
+      hmac_sha256_reset(&ctx);
+      hmac_sha256_update(&ctx, &T_view);
+    }
+    hmac_sha256_update(&ctx, info);
+    hmac_sha256_update(&ctx, &counter_view);
+    hmac_sha256_final(&ctx, &T_view);
+
+    size_t to_copy = remlen < SHA256_HASH_SIZE ? remlen : SHA256_HASH_SIZE;
+    buf_append(out, T, to_copy);
+    remlen -= to_copy;
+  }
+  memset(T, 0, SHA256_HASH_SIZE);
+  memset(&ctx, 0, sizeof(ctx));
+}
+
+void hkdf_sha256(const buf_t* salt, const buf_t* ikm, const buf_t* info,
+                 buf_t* out, const size_t len) {
+  buf_t prk;
+  buf_initf(&prk, SHA256_HASH_SIZE);
+  hkdf_sha256_extract(salt, ikm, &prk);
+  hkdf_sha256_expand(&prk, info, out, len);
+  buf_free(&prk);
+}
@@ -5,13 +5,38 @@
 #include "constants.h"
 #include "crypto/sha256.h"
 #include "stddefs.h"
+#include "utils/throw.h"
+
+static void write_u32_be(uint8_t* out, uint32_t val) {
+  out[0] = (uint8_t)(val >> 24);
+  out[1] = (uint8_t)(val >> 16);
+  out[2] = (uint8_t)(val >> 8);
+  out[3] = (uint8_t)(val);
+}
+
+static void store_digest(const uint32_t* state, uint8_t* out) {
+  int i;
+  for (i = 0; i < 8; ++i) write_u32_be(out + 4 * i, state[i]);
+}
+
+/* Starts a SHA256 context as if the key block had already been hashed */
+static void resume(sha256_ctx_t* sha, const uint32_t* midstate) {
+  sha256_init(sha);
+  memcpy(sha->state, midstate, sizeof(sha->state));
+  sha->length = SHA256_BLOCK_SIZE * 8;
+}
 
 void hmac_sha256_hash(const buf_t* key, const buf_t* data, buf_t* out) {
-  uint8_t k_ipad[SHA256_BLOCK_SIZE];
-  uint8_t k_opad[SHA256_BLOCK_SIZE];
+  hmac_sha256_ctx_t ctx;
+  hmac_sha256_init(&ctx, key);
+  hmac_sha256_update(&ctx, data);
+  hmac_sha256_final(&ctx, out);
+}
+
+void hmac_sha256_init(hmac_sha256_ctx_t* ctx, const buf_t* key) {
+  if (!ctx || !key) throw("Arguments cannot be NULL");
   uint8_t keybuf[SHA256_BLOCK_SIZE];
-  sha256_hash_t inner_hash, final_hash;
-  sha256_ctx_t context;
+  uint8_t pad[SHA256_BLOCK_SIZE];
 
   /* Step 1: Normalize key to block size */
   memset(keybuf, 0, SHA256_BLOCK_SIZE);
@@ -23,31 +48,67 @@ void hmac_sha256_hash(const buf_t* key, const buf_t* data, buf_t* out) {
     memcpy(keybuf, key->data, key->size);
   }
 
-  /* Step 2: Compute k_ipad and k_opad */
+  /* Step 2: Hash k_ipad and k_opad once for every message */
   int i;
-  for (i = 0; i < SHA256_BLOCK_SIZE; ++i) {
-    k_ipad[i] = keybuf[i] ^ 0x36;
-    k_opad[i] = keybuf[i] ^ 0x5c;
-  }
+  for (i = 0; i < SHA256_BLOCK_SIZE; ++i) pad[i] = keybuf[i] ^ 0x36;
+  memcpy(ctx->inner, sha256_initial_state, sizeof(ctx->inner));
+  sha256_compress(ctx->inner, pad, 1);
+  for (i = 0; i < SHA256_BLOCK_SIZE; ++i) pad[i] = keybuf[i] ^ 0x5c;
+  memcpy(ctx->outer, sha256_initial_state, sizeof(ctx->outer));
+  sha256_compress(ctx->outer, pad, 1);
+  memset(keybuf, 0, SHA256_BLOCK_SIZE);
+  memset(pad, 0, SHA256_BLOCK_SIZE);
+
+  resume(&ctx->sha, ctx->inner);
+}
+
+void hmac_sha256_reset(hmac_sha256_ctx_t* ctx) {
+  if (!ctx) throw("Arguments cannot be NULL");
+  resume(&ctx->sha, ctx->inner);
+}
+
+void hmac_sha256_update(hmac_sha256_ctx_t* ctx, const buf_t* data) {
+  if (!ctx || !data) throw("Arguments cannot be NULL");
+  sha256_update(&ctx->sha, data);
+}
+
+void hmac_sha256_final(hmac_sha256_ctx_t* ctx, buf_t* out) {
+  if (!ctx || !out) throw("Arguments cannot be NULL");
 
   /* Step 3: Inner hash = SHA256(k_ipad || data) */
-  sha256_init(&context);
-  buf_t ipad_buf;
-  buf_view(&ipad_buf, k_ipad, SHA256_BLOCK_SIZE);
-  sha256_update(&context, &ipad_buf);
-  sha256_update(&context, data);
-  sha256_finalize(&context, &inner_hash);
+  sha256_hash_t inner_hash, final_hash;
+  sha256_finalize(&ctx->sha, &inner_hash);
 
   /* Step 4: Outer hash = SHA256(k_opad || inner_hash) */
-  sha256_init(&context);
-  buf_t opad_buf;
   buf_t inner_buf;
-  buf_view(&opad_buf, k_opad, SHA256_BLOCK_SIZE);
   buf_view(&inner_buf, inner_hash.bytes, SHA256_HASH_SIZE);
-  sha256_update(&context, &opad_buf);
-  sha256_update(&context, &inner_buf);
-  sha256_finalize(&context, &final_hash);
+  resume(&ctx->sha, ctx->outer);
+  sha256_update(&ctx->sha, &inner_buf);
+  sha256_finalize(&ctx->sha, &final_hash);
 
   buf_clear(out);
   buf_append(out, final_hash.bytes, SHA256_HASH_SIZE);
-}
\ No newline at end of file
+}
+
+void hmac_sha256_pad_digest(uint8_t* block) {
+  memset(block + SHA256_HASH_SIZE, 0, SHA256_BLOCK_SIZE - SHA256_HASH_SIZE);
+  block[SHA256_HASH_SIZE] = 0x80;
+  write_u32_be(block + SHA256_BLOCK_SIZE - 4,
+               (SHA256_BLOCK_SIZE + SHA256_HASH_SIZE) * 8);
+}
+
+void hmac_sha256_hash_digest(const hmac_sha256_ctx_t* ctx, const uint8_t* in,
+                             uint8_t* out) {
+  uint32_t state[8];
+  uint8_t block[SHA256_BLOCK_SIZE];
+
+  memcpy(block, in, SHA256_HASH_SIZE);
+  hmac_sha256_pad_digest(block);
+  memcpy(state, ctx->inner, sizeof(state));
+  sha256_compress(state, block, 1);
+
+  store_digest(state, block);
+  memcpy(state, ctx->outer, sizeof(state));
+  sha256_compress(state, block, 1);
+  store_digest(state, out);
+}
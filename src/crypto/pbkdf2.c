@@ -1,11 +1,36 @@
 #include "crypto/pbkdf2.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "constants.h"
 #include "core/buffer.h"
+#include "core/threadpool.h"
 #include "crypto/hmac.h"
+#include "crypto/sha256.h"
+#include "crypto/sha256_mb.h"
 #include "stddefs.h"
+#include "utils/throw.h"
+
+/*
+ * From the second iteration onwards, every HMAC hashes the previous 32-byte U
+ * under the same key. Starting from the midstates cached in the HMAC context,
+ * each iteration is then exactly two compressions of a single block.
+ */
+typedef struct {
+  const hmac_sha256_ctx_t* hmac;
+  uint8_t block[SHA256_BLOCK_SIZE];
+  uint8_t T[SHA256_HASH_SIZE];
+  size_t remaining;
+} pbkdf2_chain_t;
+
+/* The chains of a call, split into contiguous groups which run on the pool */
+typedef struct {
+  pbkdf2_chain_t* chains;
+  size_t count;
+  size_t groups;
+  bool lockstep;
+} pbkdf2_batch_t;
 
 static void write_u32_be(uint8_t out[4], uint32_t val) {
   out[0] = (uint8_t)(val >> 24);
@@ -14,50 +39,191 @@ static void write_u32_be(uint8_t out[4], uint32_t val) {
   out[3] = (uint8_t)(val);
 }
 
+static void store_digest(const uint32_t* state, uint8_t* out) {
+  int i;
+  for (i = 0; i < 8; ++i) write_u32_be(out + 4 * i, state[i]);
+}
+
+/* Runs the first iteration and prepares the chain for the rest */
+static void init_chain(pbkdf2_chain_t* chain, hmac_sha256_ctx_t* hmac,
+                       const pbkdf2_job_t* job, const uint32_t index) {
+  /* U1 = HMAC(Password, Salt || INT(i)) */
+  uint8_t block_index[4];
+  buf_t index_view, U_view;
+  write_u32_be(block_index, index);
+  buf_view(&index_view, block_index, sizeof(block_index));
+  buf_view(&U_view, chain->block, SHA256_HASH_SIZE);
+  if (index > 1) hmac_sha256_reset(hmac);
+  hmac_sha256_update(hmac, job->salt);
+  hmac_sha256_update(hmac, &index_view);
+  hmac_sha256_final(hmac, &U_view);
+
+  memcpy(chain->T, chain->block, SHA256_HASH_SIZE);
+  hmac_sha256_pad_digest(chain->block);
+  chain->hmac = hmac;
+  chain->remaining = job->iterations > 1 ? job->iterations - 1 : 0;
+}
+
+/**
+ * Runs the remaining iterations of a chain on its own. The chain is worked on
+ * in a local copy, as neighbouring chains may be running on other threads.
+ */
+static void run_chain(pbkdf2_chain_t* chain) {
+  pbkdf2_chain_t local = *chain;
+  int k;
+  for (; local.remaining > 0; --local.remaining) {
+    hmac_sha256_hash_digest(local.hmac, local.block, local.block);
+    for (k = 0; k < SHA256_HASH_SIZE; ++k) local.T[k] ^= local.block[k];
+  }
+  *chain = local;
+}
+
+/* Runs one more iteration of every chain in the lanes */
+static void step_chains(pbkdf2_chain_t** lanes, const size_t count) {
+  uint32_t states[SHA256_MB_LANES][8];
+  uint8_t inner[SHA256_MB_LANES][SHA256_BLOCK_SIZE];
+  const uint8_t* blocks[SHA256_MB_LANES] = {NULL};
+  size_t i;
+
+  /* Inner hash of the previous U */
+  for (i = 0; i < count; ++i) {
+    memcpy(states[i], lanes[i]->hmac->inner, sizeof(states[i]));
+    blocks[i] = lanes[i]->block;
+  }
+  sha256_mb_compress(states, blocks, count);
+
+  /* Outer hash of the inner digest gives the next U */
+  for (i = 0; i < count; ++i) {
+    store_digest(states[i], inner[i]);
+    hmac_sha256_pad_digest(inner[i]);
+    memcpy(states[i], lanes[i]->hmac->outer, sizeof(states[i]));
+    blocks[i] = inner[i];
+  }
+  sha256_mb_compress(states, blocks, count);
+
+  for (i = 0; i < count; ++i) {
+    pbkdf2_chain_t* chain = lanes[i];
+    store_digest(states[i], chain->block);
+    int k;
+    for (k = 0; k < SHA256_HASH_SIZE; ++k) chain->T[k] ^= chain->block[k];
+    chain->remaining--;
+  }
+}
+
+/**
+ * Keeps up to SHA256_MB_LANES chains in flight, and hands a lane to the next
+ * chain as soon as one finishes so no lane idles while there is work left.
+ * Like run_chain(), the chains in flight are local copies.
+ */
+static void run_chains_lockstep(pbkdf2_chain_t* chains, const size_t count) {
+  pbkdf2_chain_t local[SHA256_MB_LANES];
+  pbkdf2_chain_t* origin[SHA256_MB_LANES];
+  pbkdf2_chain_t* lanes[SHA256_MB_LANES];
+  size_t active = 0, next = 0;
+  while (true) {
+    /* Write back finished chains and close the gaps they leave */
+    size_t i, kept = 0;
+    for (i = 0; i < active; ++i) {
+      if (local[i].remaining == 0) {
+        *origin[i] = local[i];
+        continue;
+      }
+      if (kept != i) {
+        local[kept] = local[i];
+        origin[kept] = origin[i];
+      }
+      kept++;
+    }
+    active = kept;
+
+    for (; active < SHA256_MB_LANES && next < count; ++next) {
+      if (chains[next].remaining == 0) continue;
+      local[active] = chains[next];
+      origin[active++] = &chains[next];
+    }
+    if (active == 0) break;
+    for (i = 0; i < active; ++i) lanes[i] = &local[i];
+    step_chains(lanes, active);
+  }
+}
+
+static void run_group(void* args, const size_t index) {
+  const pbkdf2_batch_t* batch = (const pbkdf2_batch_t*)args;
+  size_t start = index * batch->count / batch->groups;
+  size_t end = (index + 1) * batch->count / batch->groups;
+  if (batch->lockstep && end - start > 1) {
+    run_chains_lockstep(batch->chains + start, end - start);
+    return;
+  }
+  for (; start < end; ++start) run_chain(&batch->chains[start]);
+}
+
 void pbkdf2_hmac_sha256_hash(const buf_t* data, const buf_t* salt,
                              const size_t iterations, buf_t* out,
                              const size_t dklen) {
-  uint32_t block_count = (dklen + SHA256_HASH_SIZE - 1) / SHA256_HASH_SIZE;
-  uint8_t U[SHA256_HASH_SIZE];
-  uint8_t T[SHA256_HASH_SIZE];
-  uint8_t block_index[4];
-  size_t remlen = dklen;
-
-  /* Heap buffer for Salt || INT(i) */
-  buf_t salt_plus_counter;
-  buf_init(&salt_plus_counter, salt->size + sizeof(uint32_t));
-
-  /* Heap buffer to temporarily store HMAC output before copying to U */
-  /* Initialize once outside the loops */
-  buf_t U_view;
-  buf_view(&U_view, U, SHA256_HASH_SIZE);
-
-  uint32_t i;
-  for (i = 1; i <= block_count; ++i) {
-    /* Salt || INT(i) */
-    buf_clear(&salt_plus_counter);
-    buf_append(&salt_plus_counter, salt->data, salt->size);
-    write_u32_be(block_index, i);
-    buf_append(&salt_plus_counter, block_index, sizeof(block_index));
-
-    /* U1 = HMAC(Password, Salt || INT(i)) */
-    hmac_sha256_hash(data, &salt_plus_counter, &U_view);
-    memcpy(T, U, SHA256_HASH_SIZE);
-
-    /* U2 to Uc */
-    size_t j;
-    for (j = 1; j < iterations; ++j) {
-      /* Data is only written to output after processing, avoiding data
-       * corruption */
-      hmac_sha256_hash(data, &U_view, &U_view);
-      int k;
-      for (k = 0; k < SHA256_HASH_SIZE; ++k) T[k] ^= U[k];
+  pbkdf2_job_t job;
+  job.data = data;
+  job.salt = salt;
+  job.iterations = iterations;
+  job.out = out;
+  job.dklen = dklen;
+  pbkdf2_hmac_sha256_hash_many(&job, 1);
+}
+
+void pbkdf2_hmac_sha256_hash_many(const pbkdf2_job_t* jobs,
+                                  const size_t count) {
+  if (!jobs) throw("Arguments cannot be NULL");
+
+  /* Every output block of every job is a separate chain */
+  size_t total = 0, i;
+  for (i = 0; i < count; ++i) {
+    total += (jobs[i].dklen + SHA256_HASH_SIZE - 1) / SHA256_HASH_SIZE;
+  }
+  if (total == 0) return;
+  pbkdf2_chain_t* chains = malloc(total * sizeof(pbkdf2_chain_t));
+  hmac_sha256_ctx_t* keys = malloc(count * sizeof(hmac_sha256_ctx_t));
+  if (!chains || !keys) throw("Malloc failed");
+
+  /* The key is processed once per job and shared by all of its blocks */
+  size_t c = 0;
+  for (i = 0; i < count; ++i) {
+    uint32_t block_count =
+        (jobs[i].dklen + SHA256_HASH_SIZE - 1) / SHA256_HASH_SIZE;
+    uint32_t b;
+    if (block_count == 0) continue;
+    hmac_sha256_init(&keys[i], jobs[i].data);
+    for (b = 1; b <= block_count; ++b) {
+      init_chain(&chains[c++], &keys[i], &jobs[i], b);
     }
+  }
 
-    /* Append result block */
-    size_t to_copy = (remlen < SHA256_HASH_SIZE) ? remlen : SHA256_HASH_SIZE;
-    buf_append(out, T, to_copy);
-    remlen -= to_copy;
+  /*
+   * Independent chains are spread over the pool first, as a whole core beats
+   * a SIMD lane. Chains beyond that share their thread's SIMD lanes, but only
+   * with the portable backend, as SHA-NI compresses a single block faster than
+   * the vector kernels compress a block per lane.
+   */
+  pbkdf2_batch_t batch;
+  batch.chains = chains;
+  batch.count = total;
+  batch.groups = threadpool_size();
+  if (batch.groups > total) batch.groups = total;
+  batch.lockstep = sha256_get_backend() != SHA256_BACKEND_SHANI &&
+                   sha256_mb_available();
+  threadpool_run(run_group, &batch, batch.groups);
+
+  /* Append each block of output in order */
+  c = 0;
+  for (i = 0; i < count; ++i) {
+    size_t remlen = jobs[i].dklen;
+    while (remlen > 0) {
+      size_t to_copy = remlen < SHA256_HASH_SIZE ? remlen : SHA256_HASH_SIZE;
+      buf_append(jobs[i].out, chains[c++].T, to_copy);
+      remlen -= to_copy;
+    }
   }
-  buf_free(&salt_plus_counter);
+  memset(chains, 0, total * sizeof(pbkdf2_chain_t));
+  memset(keys, 0, count * sizeof(hmac_sha256_ctx_t));
+  free(chains);
+  free(keys);
 }
@@ -6,15 +6,24 @@
  * use for message expansion rounds in SHA. Read the formal specification for
  * more details on this implementation.
  *
+ * The compression function is picked the first time a context is initialised.
+ * The SHA extensions are used if cpuid reports them and they pass a
+ * known-answer test, otherwise the portable code below is used. Setting
+ * TRANSCODINE_SHA256_BACKEND to "portable" or "shani" overrides the choice.
+ *
  * @see https://github.com/h5p9sl/hmac_sha256
  * @see https://github.com/B-Con/crypto-algorithms
  */
 
 #include "crypto/sha256.h"
 
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "constants.h"
+#include "crypto/sha256_ni.h"
+#include "utils/cli.h"
 #include "utils/throw.h"
 
 /**
@@ -24,7 +33,7 @@
  *
  * @see Section 6.2.2
  */
-static const uint32_t K[64] = {
+const uint32_t sha256_round_constants[64] = {
     0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul, 0x3956c25bul,
     0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul, 0xd807aa98ul, 0x12835b01ul,
     0x243185beul, 0x550c7dc3ul, 0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul,
@@ -39,6 +48,15 @@ static const uint32_t K[64] = {
     0x682e6ff3ul, 0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul,
     0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul};
 
+const uint32_t sha256_initial_state[8] = {
+    0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul,
+    0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+/* PBKDF2 hashes on pool workers, so the backend is published through
+ * pthread_once rather than a plain flag */
+static pthread_once_t backend_once = PTHREAD_ONCE_INIT;
+static sha256_backend_t active_backend = SHA256_BACKEND_PORTABLE;
+
 /**
  * Ch (Choice): Conditional bit selector.
  * For each bit position: if x == 1, take bit from y; else from z.
@@ -104,24 +122,24 @@ static uint32_t Gamma1(uint32_t x) {
 /**
  * Reads a 32-bit value from the buffer and converts it into big-endian form.
  */
-static uint32_t read_u32_be(uint8_t* buf, size_t offset) {
+static uint32_t read_u32_be(const uint8_t* buf, size_t offset) {
   return ((uint32_t)buf[offset + 0] << 24) | ((uint32_t)buf[offset + 1] << 16) |
          ((uint32_t)buf[offset + 2] << 8) | ((uint32_t)buf[offset + 3]);
 }
 
-static void transform(sha256_ctx_t* ctx, const buf_t* buffer) {
+static void transform(uint32_t* state, const uint8_t* block) {
   uint32_t S[8];
   uint32_t W[64];
   int t;
 
   /* Copy state into S */
-  memcpy(S, ctx->state, sizeof(S));
+  memcpy(S, state, sizeof(S));
 
   /*
-   * Copy the buffer into W[0..15]. We can't use memcpy here as the data needs
+   * Copy the block into W[0..15]. We can't use memcpy here as the data needs
    * to be converted from little-endian to big-endian.
    */
-  for (t = 0; t < 16; ++t) { W[t] = read_u32_be(buffer->data, 4 * t); }
+  for (t = 0; t < 16; ++t) { W[t] = read_u32_be(block, 4 * t); }
 
   /* Fill W[16..63] here, as it needs separate data than first 15 entries */
   for (; t < 64; ++t) {
@@ -130,7 +148,8 @@ static void transform(sha256_ctx_t* ctx, const buf_t* buffer) {
 
   /* Main compression loop for mixing and message scheduling */
   for (t = 0; t < 64; ++t) {
-    uint32_t t0 = S[7] + Sigma1(S[4]) + Ch(S[4], S[5], S[6]) + K[t] + W[t];
+    uint32_t t0 = S[7] + Sigma1(S[4]) + Ch(S[4], S[5], S[6]) +
+                  sha256_round_constants[t] + W[t];
     uint32_t t1 = Sigma0(S[0]) + Maj(S[0], S[1], S[2]);
 
     S[7] = S[6];
@@ -144,24 +163,102 @@ static void transform(sha256_ctx_t* ctx, const buf_t* buffer) {
   }
 
   /* Feed-forward */
-  for (t = 0; t < 8; ++t) { ctx->state[t] += S[t]; }
+  for (t = 0; t < 8; ++t) { state[t] += S[t]; }
+}
+
+/* Compresses whole blocks into the state using the given backend */
+static void compress(uint32_t* state, const uint8_t* blocks, size_t count,
+                     const sha256_backend_t backend) {
+  if (backend == SHA256_BACKEND_SHANI) {
+    sha256_ni_compress(state, blocks, count);
+    return;
+  }
+  for (; count > 0; --count, blocks += SHA256_BLOCK_SIZE) {
+    transform(state, blocks);
+  }
+}
+
+/**
+ * Hashes the padded message "abc" from the examples in the spec using a
+ * backend, to confirm that it actually works on this machine.
+ */
+static bool self_test(const sha256_backend_t backend) {
+  static const uint32_t expected[8] = {
+      0xba7816bful, 0x8f01cfeaul, 0x414140deul, 0x5dae2223ul,
+      0xb00361a3ul, 0x96177a9cul, 0xb410ff61ul, 0xf20015adul};
+  uint32_t state[8];
+  uint8_t block[SHA256_BLOCK_SIZE];
+
+  memcpy(state, sha256_initial_state, sizeof(state));
+  memset(block, 0, SHA256_BLOCK_SIZE);
+  memcpy(block, "abc", 3);
+  block[3] = 0x80;
+  block[63] = 24;
+  compress(state, block, 1, backend);
+  return memcmp(state, expected, sizeof(state)) == 0;
+}
+
+static void select_backend() {
+  sha256_backend_t backend = SHA256_BACKEND_PORTABLE;
+
+  const char* forced = getenv("TRANSCODINE_SHA256_BACKEND");
+  if (!forced) {
+    if (sha256_ni_available()) backend = SHA256_BACKEND_SHANI;
+  } else if (strcmp(forced, "portable") == 0) {
+    backend = SHA256_BACKEND_PORTABLE;
+  } else if (strcmp(forced, "shani") == 0) {
+    if (sha256_ni_available()) {
+      backend = SHA256_BACKEND_SHANI;
+    } else {
+      warn("SHA extensions are not supported on this processor");
+    }
+  } else {
+    warn("Unknown SHA256 backend requested. Selecting automatically.");
+    if (sha256_ni_available()) backend = SHA256_BACKEND_SHANI;
+  }
+
+  /* Never trust a backend which can't reproduce the spec */
+  if (backend != SHA256_BACKEND_PORTABLE && !self_test(backend)) {
+    warn("SHA256 backend failed self-test. Falling back to portable one.");
+    backend = SHA256_BACKEND_PORTABLE;
+  }
+  active_backend = backend;
+
+  if (backend == SHA256_BACKEND_SHANI) {
+    debug("Using SHA-NI SHA256 backend");
+  } else {
+    debug("Using portable SHA256 backend");
+  }
+}
+
+bool sha256_set_backend(const sha256_backend_t backend) {
+  if (backend == SHA256_BACKEND_SHANI && !sha256_ni_available()) return false;
+  /* Select first, so the first use can't replace this choice later */
+  pthread_once(&backend_once, select_backend);
+  active_backend = backend;
+  return true;
+}
+
+sha256_backend_t sha256_get_backend() {
+  pthread_once(&backend_once, select_backend);
+  return active_backend;
+}
+
+void sha256_compress(uint32_t* state, const uint8_t* blocks,
+                     const size_t count) {
+  pthread_once(&backend_once, select_backend);
+  compress(state, blocks, count, active_backend);
 }
 
 void sha256_init(sha256_ctx_t* ctx) {
+  pthread_once(&backend_once, select_backend);
   ctx->length = 0;
 
   buf_init(&ctx->buf, 64);
   ctx->buf.fixed = true;
 
   /* Initialise the state with constants from Section 5.3.3 */
-  ctx->state[0] = 0x6a09e667ul;
-  ctx->state[1] = 0xbb67ae85ul;
-  ctx->state[2] = 0x3c6ef372ul;
-  ctx->state[3] = 0xa54ff53aul;
-  ctx->state[4] = 0x510e527ful;
-  ctx->state[5] = 0x9b05688cul;
-  ctx->state[6] = 0x1f83d9abul;
-  ctx->state[7] = 0x5be0cd19ul;
+  memcpy(ctx->state, sha256_initial_state, sizeof(ctx->state));
 }
 
 void sha256_update(sha256_ctx_t* ctx, const buf_t* buffer) {
@@ -170,6 +267,15 @@ void sha256_update(sha256_ctx_t* ctx, const buf_t* buffer) {
 
   /* Process all available input data in the buffer */
   while (offset < bufsize) {
+    /* Compress whole blocks straight from the input without copying them */
+    if (ctx->buf.size == 0 && bufsize - offset >= SHA256_BLOCK_SIZE) {
+      size_t blocks = (bufsize - offset) / SHA256_BLOCK_SIZE;
+      compress(ctx->state, buffer->data + offset, blocks, active_backend);
+      ctx->length += (uint64_t)blocks * SHA256_BLOCK_SIZE * 8;
+      offset += blocks * SHA256_BLOCK_SIZE;
+      continue;
+    }
+
     size_t ctx_space = SHA256_BLOCK_SIZE - ctx->buf.size;
     size_t buf_remaining = bufsize - offset;
     size_t to_copy = (buf_remaining < ctx_space) ? buf_remaining : ctx_space;
@@ -178,7 +284,7 @@ void sha256_update(sha256_ctx_t* ctx, const buf_t* buffer) {
 
     /* If the internal buffer is now full, then process it */
     if (ctx->buf.size == SHA256_BLOCK_SIZE) {
-      transform(ctx, &ctx->buf);
+      compress(ctx->state, ctx->buf.data, 1, active_backend);
       ctx->length += SHA256_BLOCK_SIZE * 8;
       buf_clear(&ctx->buf);
     }
@@ -190,7 +296,7 @@ void sha256_update(sha256_ctx_t* ctx, const buf_t* buffer) {
 
 void sha256_finalize(sha256_ctx_t* ctx, sha256_hash_t* digest) {
   if (ctx->buf.size == SHA256_BLOCK_SIZE) {
-    transform(ctx, &ctx->buf);
+    compress(ctx->state, ctx->buf.data, 1, active_backend);
     ctx->length += SHA256_BLOCK_SIZE * 8;
     buf_clear(&ctx->buf);
   }
@@ -203,7 +309,7 @@ void sha256_finalize(sha256_ctx_t* ctx, sha256_hash_t* digest) {
   if (ctx->buf.size > 56) {
     while (ctx->buf.size < 64) { ctx->buf.data[ctx->buf.size++] = 0; }
 
-    transform(ctx, &ctx->buf);
+    compress(ctx->state, ctx->buf.data, 1, active_backend);
     buf_clear(&ctx->buf);
   }
 
@@ -221,7 +327,7 @@ void sha256_finalize(sha256_ctx_t* ctx, sha256_hash_t* digest) {
   ctx->buf.data[63] = ctx->length & 0xff;
 
   /* One more transform because the spec says so */
-  transform(ctx, &ctx->buf);
+  compress(ctx->state, ctx->buf.data, 1, active_backend);
 
   /* Copy output to digest */
   int i;
@@ -0,0 +1,258 @@
+/**
+ * The kernels keep one working variable per register, with each lane holding
+ * the same variable of a different message. The rounds are the ones from the
+ * spec, only applied to every lane at once. The message words are gathered
+ * into lanes up front, and the state is moved in and out of lanes once per
+ * block.
+ *
+ * SIMD lanes that aren't given a message still do the work, so the SSE2 kernel
+ * is used for four messages or less to avoid wasting half of every AVX2
+ * instruction. Like the other vector code, the intrinsics are enabled
+ * per-function using the target attribute.
+ */
+
+#include "crypto/sha256_mb.h"
+
+#include "constants.h"
+#include "crypto/sha256.h"
+#include "stddefs.h"
+#include "utils/throw.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA256_MB_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#ifdef SHA256_MB_X86
+
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+#define SSE2_LANES 4
+#define AVX2_LANES 8
+
+static uint32_t load_u32_be(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+#define ROTR_SSE2(x, n) \
+  _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - (n)))
+#define ROTR_AVX2(x, n) \
+  _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+/**
+ * Spreads the message words and state of each message across the lanes. Lanes
+ * without a message reuse the first one, and their results are thrown away.
+ */
+static void gather(uint32_t states[][8], const uint8_t* const blocks[],
+                   const size_t lanes, const size_t width, uint32_t* w,
+                   uint32_t* s) {
+  size_t t, j;
+  for (j = 0; j < width; ++j) {
+    size_t lane = j < lanes ? j : 0;
+    for (t = 0; t < 16; ++t) {
+      w[t * width + j] = load_u32_be(blocks[lane] + 4 * t);
+    }
+    for (t = 0; t < 8; ++t) s[t * width + j] = states[lane][t];
+  }
+}
+
+static void scatter(uint32_t states[][8], const size_t lanes,
+                    const size_t width, const uint32_t* s) {
+  size_t t, j;
+  for (j = 0; j < lanes; ++j) {
+    for (t = 0; t < 8; ++t) states[j][t] = s[t * width + j];
+  }
+}
+
+SSE2_TARGET static void compress_sse2(uint32_t states[][8],
+                                      const uint8_t* const blocks[],
+                                      const size_t lanes) {
+  uint32_t w_in[16 * SSE2_LANES], s_in[8 * SSE2_LANES];
+  __m128i w[64], s[8], a, b, c, d, e, f, g, h;
+  int t;
+
+  gather(states, blocks, lanes, SSE2_LANES, w_in, s_in);
+  for (t = 0; t < 16; ++t) {
+    w[t] = _mm_loadu_si128((const __m128i*)(w_in + t * SSE2_LANES));
+  }
+  for (t = 0; t < 8; ++t) {
+    s[t] = _mm_loadu_si128((const __m128i*)(s_in + t * SSE2_LANES));
+  }
+
+  /* Message schedule, using the Gamma functions from the portable version */
+  for (t = 16; t < 64; ++t) {
+    __m128i x = w[t - 15], y = w[t - 2];
+    __m128i g0 = _mm_xor_si128(_mm_xor_si128(ROTR_SSE2(x, 7), ROTR_SSE2(x, 18)),
+                               _mm_srli_epi32(x, 3));
+    __m128i g1 = _mm_xor_si128(
+        _mm_xor_si128(ROTR_SSE2(y, 17), ROTR_SSE2(y, 19)),
+        _mm_srli_epi32(y, 10));
+    w[t] = _mm_add_epi32(_mm_add_epi32(g1, w[t - 7]),
+                         _mm_add_epi32(g0, w[t - 16]));
+  }
+
+  a = s[0];
+  b = s[1];
+  c = s[2];
+  d = s[3];
+  e = s[4];
+  f = s[5];
+  g = s[6];
+  h = s[7];
+  for (t = 0; t < 64; ++t) {
+    __m128i s1 = _mm_xor_si128(_mm_xor_si128(ROTR_SSE2(e, 6), ROTR_SSE2(e, 11)),
+                               ROTR_SSE2(e, 25));
+    __m128i ch = _mm_xor_si128(g, _mm_and_si128(e, _mm_xor_si128(f, g)));
+    __m128i t0 = _mm_add_epi32(
+        _mm_add_epi32(h, s1),
+        _mm_add_epi32(
+            ch, _mm_add_epi32(
+                    w[t], _mm_set1_epi32((int)sha256_round_constants[t]))));
+    __m128i s0 = _mm_xor_si128(_mm_xor_si128(ROTR_SSE2(a, 2), ROTR_SSE2(a, 13)),
+                               ROTR_SSE2(a, 22));
+    __m128i maj = _mm_or_si128(_mm_and_si128(_mm_or_si128(a, b), c),
+                               _mm_and_si128(a, b));
+    h = g;
+    g = f;
+    f = e;
+    e = _mm_add_epi32(d, t0);
+    d = c;
+    c = b;
+    b = a;
+    a = _mm_add_epi32(t0, _mm_add_epi32(s0, maj));
+  }
+
+  /* Feed-forward */
+  s[0] = _mm_add_epi32(s[0], a);
+  s[1] = _mm_add_epi32(s[1], b);
+  s[2] = _mm_add_epi32(s[2], c);
+  s[3] = _mm_add_epi32(s[3], d);
+  s[4] = _mm_add_epi32(s[4], e);
+  s[5] = _mm_add_epi32(s[5], f);
+  s[6] = _mm_add_epi32(s[6], g);
+  s[7] = _mm_add_epi32(s[7], h);
+  for (t = 0; t < 8; ++t) {
+    _mm_storeu_si128((__m128i*)(s_in + t * SSE2_LANES), s[t]);
+  }
+  scatter(states, lanes, SSE2_LANES, s_in);
+}
+
+AVX2_TARGET static void compress_avx2(uint32_t states[][8],
+                                      const uint8_t* const blocks[],
+                                      const size_t lanes) {
+  uint32_t w_in[16 * AVX2_LANES], s_in[8 * AVX2_LANES];
+  __m256i w[64], s[8], a, b, c, d, e, f, g, h;
+  int t;
+
+  gather(states, blocks, lanes, AVX2_LANES, w_in, s_in);
+  for (t = 0; t < 16; ++t) {
+    w[t] = _mm256_loadu_si256((const __m256i*)(w_in + t * AVX2_LANES));
+  }
+  for (t = 0; t < 8; ++t) {
+    s[t] = _mm256_loadu_si256((const __m256i*)(s_in + t * AVX2_LANES));
+  }
+
+  for (t = 16; t < 64; ++t) {
+    __m256i x = w[t - 15], y = w[t - 2];
+    __m256i g0 = _mm256_xor_si256(
+        _mm256_xor_si256(ROTR_AVX2(x, 7), ROTR_AVX2(x, 18)),
+        _mm256_srli_epi32(x, 3));
+    __m256i g1 = _mm256_xor_si256(
+        _mm256_xor_si256(ROTR_AVX2(y, 17), ROTR_AVX2(y, 19)),
+        _mm256_srli_epi32(y, 10));
+    w[t] = _mm256_add_epi32(_mm256_add_epi32(g1, w[t - 7]),
+                            _mm256_add_epi32(g0, w[t - 16]));
+  }
+
+  a = s[0];
+  b = s[1];
+  c = s[2];
+  d = s[3];
+  e = s[4];
+  f = s[5];
+  g = s[6];
+  h = s[7];
+  for (t = 0; t < 64; ++t) {
+    __m256i s1 = _mm256_xor_si256(
+        _mm256_xor_si256(ROTR_AVX2(e, 6), ROTR_AVX2(e, 11)), ROTR_AVX2(e, 25));
+    __m256i ch =
+        _mm256_xor_si256(g, _mm256_and_si256(e, _mm256_xor_si256(f, g)));
+    __m256i t0 = _mm256_add_epi32(
+        _mm256_add_epi32(h, s1),
+        _mm256_add_epi32(
+            ch, _mm256_add_epi32(
+                    w[t], _mm256_set1_epi32((int)sha256_round_constants[t]))));
+    __m256i s0 = _mm256_xor_si256(
+        _mm256_xor_si256(ROTR_AVX2(a, 2), ROTR_AVX2(a, 13)), ROTR_AVX2(a, 22));
+    __m256i maj = _mm256_or_si256(
+        _mm256_and_si256(_mm256_or_si256(a, b), c), _mm256_and_si256(a, b));
+    h = g;
+    g = f;
+    f = e;
+    e = _mm256_add_epi32(d, t0);
+    d = c;
+    c = b;
+    b = a;
+    a = _mm256_add_epi32(t0, _mm256_add_epi32(s0, maj));
+  }
+
+  s[0] = _mm256_add_epi32(s[0], a);
+  s[1] = _mm256_add_epi32(s[1], b);
+  s[2] = _mm256_add_epi32(s[2], c);
+  s[3] = _mm256_add_epi32(s[3], d);
+  s[4] = _mm256_add_epi32(s[4], e);
+  s[5] = _mm256_add_epi32(s[5], f);
+  s[6] = _mm256_add_epi32(s[6], g);
+  s[7] = _mm256_add_epi32(s[7], h);
+  for (t = 0; t < 8; ++t) {
+    _mm256_storeu_si256((__m256i*)(s_in + t * AVX2_LANES), s[t]);
+  }
+  scatter(states, lanes, AVX2_LANES, s_in);
+}
+
+static bool has_sse2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2") != 0;
+}
+
+static bool has_avx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+}
+
+#endif
+
+bool sha256_mb_available() {
+#ifdef SHA256_MB_X86
+  return has_sse2();
+#else
+  return false;
+#endif
+}
+
+void sha256_mb_compress(uint32_t states[][8], const uint8_t* const blocks[],
+                        const size_t lanes) {
+  if (lanes > SHA256_MB_LANES) throw("Too many lanes for multi-buffer SHA256");
+
+#ifdef SHA256_MB_X86
+  if (lanes > SSE2_LANES && has_avx2()) {
+    compress_avx2(states, blocks, lanes);
+    return;
+  }
+  if (lanes > 1 && has_sse2()) {
+    size_t done = 0;
+    while (done < lanes) {
+      size_t count = lanes - done < SSE2_LANES ? lanes - done : SSE2_LANES;
+      compress_sse2(states + done, blocks + done, count);
+      done += count;
+    }
+    return;
+  }
+#endif
+
+  size_t i;
+  for (i = 0; i < lanes; ++i) sha256_compress(states[i], blocks[i], 1);
+}
@@ -0,0 +1,147 @@
+/**
+ * The SHA extensions keep the working variables in two registers, ordered as
+ * ABEF and CDGH, instead of the ABCD and EFGH order used by the state. The
+ * state is shuffled into that form once per call rather than once per block.
+ *
+ * Each SHA256RNDS2 instruction performs two rounds, and the message schedule
+ * is expanded four words at a time using SHA256MSG1 and SHA256MSG2. Like the
+ * AES-NI backend, the intrinsics are enabled per-function using the target
+ * attribute.
+ *
+ * @see https://www.intel.com/content/www/us/en/developer/articles/technical/intel-sha-extensions.html
+ */
+
+#include "crypto/sha256_ni.h"
+
+#include "constants.h"
+#include "crypto/sha256.h"
+#include "stddefs.h"
+#include "utils/throw.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SHA_NI_TARGET __attribute__((target("sha,ssse3,sse4.1")))
+
+static const uint32_t* const K = sha256_round_constants;
+
+/* Four rounds using the message words in msg and the constants from group i */
+#define ROUNDS(i, msg)                                                      \
+  do {                                                                      \
+    __m128i wk = _mm_add_epi32(                                             \
+        msg, _mm_loadu_si128((const __m128i*)(K + 4 * (i))));              \
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);                           \
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0e)); \
+  } while (0)
+
+/**
+ * Finishes the next four message words. The next group must already hold the
+ * SHA256MSG1 result of the group four back.
+ */
+#define SCHEDULE(next, cur, prev)                               \
+  do {                                                         \
+    next = _mm_add_epi32(next, _mm_alignr_epi8(cur, prev, 4)); \
+    next = _mm_sha256msg2_epu32(next, cur);                    \
+  } while (0)
+
+bool sha256_ni_available() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+  if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) return false;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+  return (ebx & bit_SHA) != 0;
+}
+
+SHA_NI_TARGET void sha256_ni_compress(uint32_t* state, const uint8_t* blocks,
+                                      size_t count) {
+  const __m128i mask =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bll, 0x0405060700010203ll);
+
+  /* Rearrange the state from ABCD EFGH into ABEF CDGH */
+  __m128i abcd = _mm_loadu_si128((const __m128i*)state);
+  __m128i efgh = _mm_loadu_si128((const __m128i*)(state + 4));
+  abcd = _mm_shuffle_epi32(abcd, 0xb1);
+  efgh = _mm_shuffle_epi32(efgh, 0x1b);
+  __m128i abef = _mm_alignr_epi8(abcd, efgh, 8);
+  __m128i cdgh = _mm_blend_epi16(efgh, abcd, 0xf0);
+
+  while (count-- > 0) {
+    __m128i abef_saved = abef, cdgh_saved = cdgh;
+
+    /* The message words are big-endian */
+    __m128i m0 = _mm_shuffle_epi8(
+        _mm_loadu_si128((const __m128i*)(blocks + 0)), mask);
+    __m128i m1 = _mm_shuffle_epi8(
+        _mm_loadu_si128((const __m128i*)(blocks + 16)), mask);
+    __m128i m2 = _mm_shuffle_epi8(
+        _mm_loadu_si128((const __m128i*)(blocks + 32)), mask);
+    __m128i m3 = _mm_shuffle_epi8(
+        _mm_loadu_si128((const __m128i*)(blocks + 48)), mask);
+
+    ROUNDS(0, m0);
+    ROUNDS(1, m1);
+    m0 = _mm_sha256msg1_epu32(m0, m1);
+    ROUNDS(2, m2);
+    m1 = _mm_sha256msg1_epu32(m1, m2);
+    ROUNDS(3, m3);
+    SCHEDULE(m0, m3, m2);
+    m2 = _mm_sha256msg1_epu32(m2, m3);
+    ROUNDS(4, m0);
+    SCHEDULE(m1, m0, m3);
+    m3 = _mm_sha256msg1_epu32(m3, m0);
+    ROUNDS(5, m1);
+    SCHEDULE(m2, m1, m0);
+    m0 = _mm_sha256msg1_epu32(m0, m1);
+    ROUNDS(6, m2);
+    SCHEDULE(m3, m2, m1);
+    m1 = _mm_sha256msg1_epu32(m1, m2);
+    ROUNDS(7, m3);
+    SCHEDULE(m0, m3, m2);
+    m2 = _mm_sha256msg1_epu32(m2, m3);
+    ROUNDS(8, m0);
+    SCHEDULE(m1, m0, m3);
+    m3 = _mm_sha256msg1_epu32(m3, m0);
+    ROUNDS(9, m1);
+    SCHEDULE(m2, m1, m0);
+    m0 = _mm_sha256msg1_epu32(m0, m1);
+    ROUNDS(10, m2);
+    SCHEDULE(m3, m2, m1);
+    m1 = _mm_sha256msg1_epu32(m1, m2);
+    ROUNDS(11, m3);
+    SCHEDULE(m0, m3, m2);
+    m2 = _mm_sha256msg1_epu32(m2, m3);
+    ROUNDS(12, m0);
+    SCHEDULE(m1, m0, m3);
+    m3 = _mm_sha256msg1_epu32(m3, m0);
+    ROUNDS(13, m1);
+    SCHEDULE(m2, m1, m0);
+    ROUNDS(14, m2);
+    SCHEDULE(m3, m2, m1);
+    ROUNDS(15, m3);
+
+    abef = _mm_add_epi32(abef, abef_saved);
+    cdgh = _mm_add_epi32(cdgh, cdgh_saved);
+    blocks += SHA256_BLOCK_SIZE;
+  }
+
+  /* Put the state back into ABCD EFGH order */
+  __m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+  __m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+  _mm_storeu_si128((__m128i*)state, _mm_blend_epi16(feba, dchg, 0xf0));
+  _mm_storeu_si128((__m128i*)(state + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+
+#else
+
+bool sha256_ni_available() { return false; }
+
+void sha256_ni_compress(uint32_t* state, const uint8_t* blocks, size_t count) {
+  (void)state;
+  (void)blocks;
+  (void)count;
+  throw("SHA extensions are not supported on this platform");
+}
+
+#endif
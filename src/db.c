@@ -1,12 +1,14 @@
 #include "db.h"
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "constants.h"
 #include "core/buffer.h"
 #include "core/iostream.h"
-#include "crypto/aes.h"
+#include "crypto/cipher.h"
+#include "crypto/hkdf.h"
 #include "crypto/pbkdf2.h"
 #include "crypto/urandom.h"
 #include "stddefs.h"
@@ -19,100 +21,80 @@
  * Rotates the IV for the database and re-encrypts it with the new IV. This is
  * important to run after modifying the data as reusing an old IV for different
  * data is a security vulnerability.
+ *
+ * The database is read using its current cipher, so passing a different key
+ * here re-encrypts the database under that key.
  * @param db
  * @param db_key
  * @author Aryan Jassal
  */
 static void db_rotate_iv(db_t* db, const buf_t* db_key) {
   if (!db || !db_key) throw("Arguments cannot be NULL");
-  if (!db->working_path) throw("Database must be open");
-
-  /* Prepare a temporary path for re-encrypting the file */
-  buf_t path;
-  buf_init(&path, 32);
-  tempfile(&path);
-
-  FILE* in = fopen(db->working_path, "rb");
-  FILE* out = fopen(buf_to_cstr(&path), "wb+");
-  if (!in || !out) throw("Failed to open database for IV rotation");
+  if (db->fd < 0) throw("Database must be open");
 
   /* Calculate the total file size to be encrypted */
-  fseek(in, 0, SEEK_END);
-  size_t file_size = ftell(in) - DB_GLOBAL_HEADER_SIZE;
-  fseek(in, 0, SEEK_SET);
+  size_t file_size = iostream_file_size(db->fd) - DB_GLOBAL_HEADER_SIZE;
 
   /* Set up the new AES contexts */
   buf_t new_iv;
   buf_initf(&new_iv, AES_IV_SIZE);
   urandom(&new_iv, AES_IV_SIZE);
-  aes_ctx_t ctx_new;
-  aes_init(&ctx_new, db_key);
+  cipher_ctx_t ctx_new;
+  cipher_init(&ctx_new, CIPHER_AES_CTR, db_key);
 
-  /* Copy the global header and update the IV in the header */
-  uint8_t header[DB_GLOBAL_HEADER_SIZE];
-  freads(header, DB_GLOBAL_HEADER_SIZE, in);
-  memcpy(header + DB_MAGIC_SIZE, new_iv.data, AES_IV_SIZE);
-  fwrites(header, DB_GLOBAL_HEADER_SIZE, out);
-
-  /* Initialise the iostream objects */
+  /* Initialise the iostream objects. Each chunk is read before it is written
+   * back, so the working copy can be re-encrypted in place. */
   iostream_t r, w;
-  iostream_init(&r, in, &db->aes_ctx, &db->aes_iv, DB_GLOBAL_HEADER_SIZE);
-  iostream_init(&w, out, &ctx_new, &new_iv, DB_GLOBAL_HEADER_SIZE);
+  iostream_init_fd(&r, db->fd, &db->cipher, &db->aes_iv, DB_GLOBAL_HEADER_SIZE);
+  iostream_init_fd(&w, db->fd, &ctx_new, &new_iv, DB_GLOBAL_HEADER_SIZE);
 
   /* Stream transcrypt the contents of the file */
   buf_t block;
-  buf_initf(&block, READFILE_CHUNK);
+  buf_initf(&block, READFILE_BULK_CHUNK);
   size_t remaining = file_size;
   while (remaining > 0) {
-    size_t chunk = remaining < READFILE_CHUNK ? remaining : READFILE_CHUNK;
+    size_t chunk =
+        remaining < READFILE_BULK_CHUNK ? remaining : READFILE_BULK_CHUNK;
     iostream_read(&r, chunk, &block);
     iostream_write(&w, &block);
     remaining -= chunk;
   }
   buf_free(&block);
-  fclose(in);
-  fclose(out);
+  iostream_free(&r);
+  iostream_free(&w);
 
-  /* Replace original file with re-encryted one */
-  fcopy(db->working_path, buf_to_cstr(&path));
-  remove(buf_to_cstr(&path));
+  /* The new IV only goes into the header once all of the data has been
+   * rewritten. The header isn't encrypted, so it goes through a stream without
+   * a cipher. */
+  iostream_init_fd(&w, db->fd, NULL, NULL, DB_MAGIC_SIZE);
+  iostream_write(&w, &new_iv);
+  iostream_free(&w);
 
   /* Update database state and cleanup */
   buf_copy(&db->aes_iv, &new_iv);
-  iostream_free(&r);
-  iostream_free(&w);
   buf_free(&new_iv);
-  buf_free(&path);
   debug("Rotated IV for database");
 }
 
 /**
- * Find the location of a particular entry containing the desired key.
- * @param db
+ * Find the location of a particular entry using a stream which is already open
+ * over the database, so the caller can carry on with the same stream.
+ * @param ios A stream over the encrypted contents of the database
  * @param key
  * @return -1 if the key wasn't found, file offset otherwise
  * @author Aryan Jassal
  */
-static int64_t db_find_entry(const db_t* db, const buf_t* key) {
-  if (!db || !key) throw("Arguments cannot be NULL");
-  if (!db->working_path) throw("Database must be open");
-
-  FILE* db_file = fopen(db->working_path, "rb");
-  if (!db_file) throw("Failed to open working database");
-
+static int64_t db_find_in(iostream_t* ios, const buf_t* key) {
   int64_t location = -1;
-  iostream_t ios;
-  iostream_init(&ios, db_file, &db->aes_ctx, &db->aes_iv,
-                DB_GLOBAL_HEADER_SIZE);
-  iostream_skip(&ios, DB_MAGIC_SIZE);
+  iostream_seek(ios, DB_MAGIC_SIZE);
 
   while (true) {
-    int64_t entry_start = ios.file_offset;
+    int64_t entry_start = iostream_tell(ios) + DB_GLOBAL_HEADER_SIZE;
 
     /* Validate entry type */
     buf_t type;
     buf_initf(&type, DB_MAGIC_SIZE);
-    iostream_read(&ios, DB_MAGIC_SIZE, &type);
+    iostream_read(ios, DB_MAGIC_SIZE, &type);
     if (memcmp(type.data, DB_MAGIC_END, DB_MAGIC_SIZE) == 0) {
       buf_free(&type);
       break;
@@ -125,14 +107,14 @@ static int64_t db_find_entry(const db_t* db, const buf_t* key) {
     /* Read file header */
     buf_t header;
     buf_initf(&header, sizeof(size_t) * 2);
-    iostream_read(&ios, sizeof(size_t) * 2, &header);
+    iostream_read(ios, sizeof(size_t) * 2, &header);
     db_entry_t entry = *(db_entry_t*)header.data;
 
     /* Read key */
     buf_t read_key;
     buf_initf(&read_key, entry.key_len);
-    iostream_read(&ios, entry.key_len, &read_key);
-    iostream_skip(&ios, entry.data_len);
+    iostream_read(ios, entry.key_len, &read_key);
+    iostream_skip(ios, entry.data_len);
 
     /* Save the entry position if the key matches and return */
     if (buf_equal(&read_key, key)) {
@@ -147,9 +129,28 @@ static int64_t db_find_entry(const db_t* db, const buf_t* key) {
     buf_free(&read_key);
   }
 
+  return location;
+}
+
+/**
+ * Find the location of a particular entry containing the desired key.
+ * @param db
+ * @param key
+ * @return -1 if the key wasn't found, file offset otherwise
+ * @author Aryan Jassal
+ */
+static int64_t db_find_entry(const db_t* db, const buf_t* key) {
+  if (!db || !key) throw("Arguments cannot be NULL");
+  if (db->fd < 0) throw("Database must be open");
+
+  iostream_t ios;
+  iostream_init_fd(&ios, db->fd, &db->cipher, &db->aes_iv,
+                   DB_GLOBAL_HEADER_SIZE);
+  iostream_map(&ios, IOSTREAM_RANDOM);
+  int64_t location = db_find_in(&ios, key);
+
   /* Cleanup and return results */
   iostream_free(&ios);
-  fclose(db_file);
   return location;
 }
 
@@ -167,18 +168,111 @@ static void db_ns_key(const buf_t* key, const buf_t* namespace, buf_t* ns_key) {
   buf_concat(ns_key, key);
 }
 
-void db_derive_key(const buf_t* kek, buf_t* db_key) {
+/**
+ * Derives the database key used by legacy agents, which ran the random KEK
+ * through PBKDF2 with a fixed salt. Only needed to migrate them.
+ * @param kek
+ * @param db_key
+ * @author Aryan Jassal
+ */
+static void db_derive_legacy_key(const buf_t* kek, buf_t* db_key) {
   buf_t salt;
   buf_init(&salt, 16);
-  buf_append(&salt, "aes-key-edb", strlen("aes-key-edb"));
+  buf_append(&salt, DB_LEGACY_KEY_SALT, strlen(DB_LEGACY_KEY_SALT));
   pbkdf2_hmac_sha256_hash(kek, &salt, PBKDF2_ITERATIONS, db_key, AES_KEY_SIZE);
   buf_free(&salt);
 }
 
+/**
+ * Checks if a key unlocks the database without opening it.
+ * @param db_key
+ * @param encrypted_path
+ * @return True if the key decrypts the magic block, false otherwise
+ * @author Aryan Jassal
+ */
+static bool db_unlocks(const buf_t* db_key, const char* encrypted_path) {
+  FILE* db_file = fopen(encrypted_path, "rb");
+  if (!db_file) throw("Failed to open database");
+
+  uint8_t version[DB_MAGIC_SIZE];
+  freads(version, DB_MAGIC_SIZE, db_file);
+  if (memcmp(version, DB_MAGIC_VERSION, DB_MAGIC_SIZE) != 0) {
+    throw("File is not a database file");
+  }
+  buf_t iv;
+  buf_initf(&iv, AES_IV_SIZE);
+  freads(iv.data, AES_IV_SIZE, db_file);
+  iv.size = AES_IV_SIZE;
+
+  cipher_ctx_t cipher;
+  cipher_init(&cipher, CIPHER_AES_CTR, db_key);
+  iostream_t ios;
+  iostream_init(&ios, db_file, &cipher, &iv, DB_GLOBAL_HEADER_SIZE);
+  buf_t magic;
+  buf_initf(&magic, DB_MAGIC_SIZE);
+  iostream_read(&ios, DB_MAGIC_SIZE, &magic);
+  bool unlocked = memcmp(magic.data, DB_MAGIC_UNLOCKED, DB_MAGIC_SIZE) == 0;
+
+  iostream_free(&ios);
+  buf_free(&magic);
+  buf_free(&iv);
+  fclose(db_file);
+  return unlocked;
+}
+
+void db_derive_key(const buf_t* kek, buf_t* db_key) {
+  /*
+   * The KEK is random, so it can't be guessed any faster than the key it
+   * derives. Stretching it only slows down every command. It is extracted
+   * first, as the KEK falls back to a pseudo salt without urandom. The key
+   * comes from the KEK rather than the password's root key, so resetting the
+   * password only re-wraps the KEK instead of re-encrypting the database.
+   */
+  buf_t info;
+  buf_view(&info, HKDF_LABEL_DB_KEY, strlen(HKDF_LABEL_DB_KEY));
+  hkdf_sha256(NULL, kek, &info, db_key, AES_KEY_SIZE);
+}
+
+void db_migrate_key(const buf_t* kek, const char* encrypted_path) {
+  if (!kek || !encrypted_path) throw("Arguments cannot be NULL");
+  if (!access(encrypted_path)) return;
+
+  buf_t db_key;
+  buf_initf(&db_key, AES_KEY_SIZE);
+  db_derive_key(kek, &db_key);
+
+  /* A previous migration may have been interrupted after this step */
+  if (db_unlocks(&db_key, encrypted_path)) {
+    buf_free(&db_key);
+    return;
+  }
+
+  buf_t legacy_key, working_path;
+  buf_initf(&legacy_key, AES_KEY_SIZE);
+  buf_init(&working_path, 32);
+  db_derive_legacy_key(kek, &legacy_key);
+  tempfile(&working_path);
+
+  /* Rotating the IV with the new key re-encrypts the database under it */
+  db_t db;
+  db_init(&db);
+  db_open(&db, &legacy_key, encrypted_path, buf_to_cstr(&working_path));
+  db_rotate_iv(&db, &db_key);
+  cipher_init(&db.cipher, CIPHER_AES_CTR, &db_key);
+  db_close(&db);
+  db_free(&db);
+
+  buf_free(&working_path);
+  buf_free(&legacy_key);
+  buf_free(&db_key);
+  debug("Migrated database to the new key");
+}
+
 void db_init(db_t* db) {
   buf_initf(&db->aes_iv, AES_IV_SIZE);
   db->encrypted_path = NULL;
   db->working_path = NULL;
+  db->fd = -1;
 }
 
 void db_free(db_t* db) {
@@ -208,8 +302,8 @@ void db_create(db_t* db, const buf_t* db_key, const char* encrypted_path) {
   buf_append(&cleartext, DB_MAGIC_END, DB_MAGIC_SIZE);
 
   /* Encrypt the data and write it to the file */
-  aes_ctx_t ctx;
-  aes_init(&ctx, db_key);
+  cipher_ctx_t ctx;
+  cipher_init(&ctx, CIPHER_AES_CTR, db_key);
   iostream_t ios;
   iostream_init(&ios, db_file, &ctx, &db->aes_iv, DB_GLOBAL_HEADER_SIZE);
   iostream_write(&ios, &cleartext);
@@ -222,18 +316,18 @@ void db_create(db_t* db, const buf_t* db_key, const char* encrypted_path) {
 }
 
 void db_hexdump(const db_t* db) {
-  /* Open the db file */
-  FILE* db_file = fopen(db->working_path, "rb");
-  fseek(db_file, 0, SEEK_END);
-  size_t size = ftell(db_file) - DB_GLOBAL_HEADER_SIZE;
-  fseek(db_file, 0, SEEK_SET);
+  if (db->fd < 0) throw("Database is not open");
+  size_t size = iostream_file_size(db->fd) - DB_GLOBAL_HEADER_SIZE;
 
-  /* Prepare to read db */
+  /* Prepare to read db. The header isn't encrypted, so it is read as it is. */
   buf_t file;
   buf_init(&file, DB_GLOBAL_HEADER_SIZE);
-  file.size = fread(file.data, 1, DB_GLOBAL_HEADER_SIZE, db_file);
   iostream_t io;
-  iostream_init(&io, db_file, &db->aes_ctx, &db->aes_iv, DB_GLOBAL_HEADER_SIZE);
+  iostream_init_fd(&io, db->fd, NULL, NULL, 0);
+  iostream_read(&io, DB_GLOBAL_HEADER_SIZE, &file);
+  iostream_free(&io);
+  iostream_init_fd(&io, db->fd, &db->cipher, &db->aes_iv,
+                   DB_GLOBAL_HEADER_SIZE);
 
   /* Read data */
   buf_t block;
@@ -248,7 +342,7 @@ void db_hexdump(const db_t* db) {
 
   /* Cleanup */
   buf_free(&block);
-  fclose(db_file);
+  iostream_free(&io);
   hexdump(file.data, file.size);
   buf_free(&file);
 }
@@ -267,31 +361,41 @@ void db_open(db_t* db, const buf_t* db_key, const char* encrypted_path,
   if (!db || !db_key || !encrypted_path || !working_path) {
     throw("Arguments cannot be NULL");
   }
-  if (!access(encrypted_path)) throw("Database must be created before opening");
-
-  /* Create a working copy of the database file */
-  fcopy(working_path, encrypted_path);
-  FILE* db_file = fopen(working_path, "rb");
-  if (!db_file) throw("Failed to open working file");
+  if (db->fd >= 0) throw("Database is already open");
+
+  /* Create a working copy of the database, which stays open until closed */
+  int src = iostream_open(encrypted_path, O_RDONLY);
+  if (src < 0) throw("Database must be created before opening");
+  db->fd = iostream_open(working_path, O_RDWR | O_CREAT | O_TRUNC);
+  if (db->fd < 0) {
+    iostream_close(src);
+    throw("Failed to open working file");
+  }
+  iostream_copy(db->fd, src);
+  iostream_close(src);
 
   /* Check if the file is a valid database file */
-  uint8_t version[DB_MAGIC_SIZE];
-  freads(version, DB_MAGIC_SIZE, db_file);
-  if (memcmp(version, DB_MAGIC_VERSION, DB_MAGIC_SIZE) != 0) {
+  buf_t header;
+  buf_initf(&header, DB_GLOBAL_HEADER_SIZE);
+  iostream_t ios;
+  iostream_init_fd(&ios, db->fd, NULL, NULL, 0);
+  iostream_read(&ios, DB_GLOBAL_HEADER_SIZE, &header);
+  iostream_free(&ios);
+  if (memcmp(header.data, DB_MAGIC_VERSION, DB_MAGIC_SIZE) != 0) {
     throw("File is not a database file");
   }
 
   /* Set database state */
-  freads(db->aes_iv.data, AES_IV_SIZE, db_file);
+  memcpy(db->aes_iv.data, header.data + DB_MAGIC_SIZE, AES_IV_SIZE);
   db->aes_iv.size = AES_IV_SIZE;
   db->encrypted_path = encrypted_path;
   db->working_path = working_path;
-  aes_init(&db->aes_ctx, db_key);
+  cipher_init(&db->cipher, CIPHER_AES_CTR, db_key);
+  buf_free(&header);
 
   /* Check if the unlock was successful */
-  iostream_t ios;
-  iostream_init(&ios, db_file, &db->aes_ctx, &db->aes_iv,
-                DB_GLOBAL_HEADER_SIZE);
+  iostream_init_fd(&ios, db->fd, &db->cipher, &db->aes_iv,
+                   DB_GLOBAL_HEADER_SIZE);
 
   buf_t magic;
   buf_initf(&magic, DB_MAGIC_SIZE);
@@ -304,16 +408,17 @@ void db_open(db_t* db, const buf_t* db_key, const char* encrypted_path,
   /* Cleanup */
   iostream_free(&ios);
   buf_free(&magic);
-  fclose(db_file);
   debug("Database opened");
 }
 
 void db_close(db_t* db) {
   if (!db) throw("Arguments cannot be NULL");
-  if (!access(db->working_path)) throw("Database is already closed");
+  if (db->fd < 0) throw("Database is already closed");
 
   /* Commit changes from working path to main file */
-  fcopy(db->encrypted_path, db->working_path);
+  iostream_replace(db->encrypted_path, db->fd);
+  iostream_close(db->fd);
+  db->fd = -1;
   remove(db->working_path);
   db->working_path = NULL;
   debug("Database closed");
@@ -321,20 +426,23 @@ void db_close(db_t* db) {
 
 bool db_read(db_t* db, const buf_t* key, buf_t* value) {
   if (!db || !key || !value) throw("Arguments cannot be NULL");
-  if (!access(db->working_path)) throw("Database is not open");
-
-  /* Return early if the key does not exist */
-  int64_t offset = db_find_entry(db, key);
-  if (offset == -1) return false;
+  if (db->fd < 0) throw("Database is not open");
 
   /* Prepare for reading file */
-  FILE* db_file = fopen(db->working_path, "rb");
-  if (!db_file) throw("Failed to open working database");
-
   iostream_t ios;
-  iostream_init(&ios, db_file, &db->aes_ctx, &db->aes_iv,
-                DB_GLOBAL_HEADER_SIZE);
-  iostream_skip(&ios, offset - DB_GLOBAL_HEADER_SIZE + DB_MAGIC_SIZE);
+  iostream_init_fd(&ios, db->fd, &db->cipher, &db->aes_iv,
+                   DB_GLOBAL_HEADER_SIZE);
+  iostream_map(&ios, IOSTREAM_RANDOM);
+
+  /* Return early if the key does not exist */
+  int64_t offset = db_find_in(&ios, key);
+  if (offset == -1) {
+    iostream_free(&ios);
+    return false;
+  }
+
+  /* Go back to the entry with the same stream */
+  iostream_seek(&ios, offset - DB_GLOBAL_HEADER_SIZE + DB_MAGIC_SIZE);
 
   /* Read the entry at specific offset */
   buf_t header;
@@ -348,25 +456,20 @@ bool db_read(db_t* db, const buf_t* key, buf_t* value) {
   /* Cleanup */
   buf_free(&header);
   iostream_free(&ios);
-  fclose(db_file);
   return true;
 }
 
 void db_write(db_t* db, const buf_t* key, const buf_t* value,
               const buf_t* db_key) {
   if (!db || !key || !db_key) throw("Arguments cannot be NULL");
-  if (!access(db->working_path)) throw("Database is not open");
+  if (db->fd < 0) throw("Database is not open");
 
-  /* Prepare for writing file */
-  FILE* db_file = fopen(db->working_path, "rb+");
-  if (!db_file) throw("Failed to open working database");
-
-  /* Seek to the end of file to append new entry */
+  /* Seek to the end marker to append new entry */
   iostream_t ios;
-  iostream_init(&ios, db_file, &db->aes_ctx, &db->aes_iv,
-                DB_GLOBAL_HEADER_SIZE);
-  fseek(db_file, -DB_MAGIC_SIZE, SEEK_END);
-  iostream_skip(&ios, ftell(db_file) - DB_GLOBAL_HEADER_SIZE);
+  iostream_init_fd(&ios, db->fd, &db->cipher, &db->aes_iv,
+                   DB_GLOBAL_HEADER_SIZE);
+  iostream_seek(&ios, iostream_file_size(db->fd) - DB_MAGIC_SIZE -
+                          DB_GLOBAL_HEADER_SIZE);
 
   /* If the value is NULL, write a 0 */
   buf_t v;
@@ -383,23 +486,22 @@ void db_write(db_t* db, const buf_t* key, const buf_t* value,
   buf_append(&header, DB_MAGIC_FILE, DB_MAGIC_SIZE);
   buf_append(&header, &key->size, sizeof(size_t));
   buf_append(&header, &v.size, sizeof(size_t));
-  iostream_write(&ios, &header);
-  iostream_write(&ios, key);
-  iostream_write(&ios, &v);
-  buf_free(&header);
-  buf_free(&v);
 
-  /* Write end marker */
+  /* The entry and the new end marker go out as a single record */
   buf_t end;
-  buf_initf(&end, DB_MAGIC_SIZE);
-  buf_append(&end, DB_MAGIC_END, DB_MAGIC_SIZE);
-  iostream_write(&ios, &end);
-  buf_free(&end);
+  buf_view(&end, DB_MAGIC_END, DB_MAGIC_SIZE);
+  const buf_t* record[4];
+  record[0] = &header;
+  record[1] = key;
+  record[2] = &v;
+  record[3] = &end;
+  iostream_writev(&ios, record, 4);
+  buf_free(&header);
+  buf_free(&v);
   debug("Wrote entry to database");
 
   /* Cleanup */
   iostream_free(&ios);
-  fclose(db_file);
 
   /* Rotate the IV for security */
   db_rotate_iv(db, db_key);
@@ -407,47 +509,31 @@ void db_write(db_t* db, const buf_t* key, const buf_t* value,
 
 bool db_has(db_t* db, const buf_t* key) {
   if (!db || !key) throw("Arguments cannot be NULL");
-  if (!access(db->working_path)) throw("Database is not open");
+  if (db->fd < 0) throw("Database is not open");
   if (db_find_entry(db, key) == -1) return false;
   return true;
 }
 
 void db_remove(db_t* db, const buf_t* key, const buf_t* db_key) {
   if (!db || !key || !db_key) throw("Arguments cannot be NULL");
-  if (!access(db->working_path)) throw("Database is not open");
+  if (db->fd < 0) throw("Database is not open");
 
   /* Return early if the key doesn't exist */
-  int64_t offset = db_find_entry(db, key);
+  iostream_t r, w;
+  iostream_init_fd(&r, db->fd, &db->cipher, &db->aes_iv,
+                   DB_GLOBAL_HEADER_SIZE);
+  int64_t offset = db_find_in(&r, key);
   if (offset == -1) {
+    iostream_free(&r);
     debug("Key doesn't exist");
     return;
   }
 
-  /* Make a copy of the database */
-  buf_t path;
-  buf_init(&path, 32);
-  tempfile(&path);
-  FILE* src = fopen(db->working_path, "rb");
-  FILE* dst = fopen(buf_to_cstr(&path), "wb+");
-  if (!src || !dst) throw("Failed to open database files");
-
-  /* Copy over the unencrypted header as-is */
-  uint8_t header[DB_GLOBAL_HEADER_SIZE];
-  freads(header, DB_GLOBAL_HEADER_SIZE, src);
-  fwrites(header, DB_GLOBAL_HEADER_SIZE, dst);
-
-  /* Initialise iostreams to read data in the database */
-  iostream_t r, w;
-  iostream_init(&r, src, &db->aes_ctx, &db->aes_iv, DB_GLOBAL_HEADER_SIZE);
-  iostream_init(&w, dst, &db->aes_ctx, &db->aes_iv, DB_GLOBAL_HEADER_SIZE);
-
-  buf_t magic;
-  buf_initf(&magic, DB_MAGIC_SIZE);
-  iostream_read(&r, DB_MAGIC_SIZE, &magic);
-  iostream_write(&w, &magic);
-  buf_free(&magic);
-
-  /* Ignore copying entry if the key matches the one provided */
+  /* Move every entry after the removed one back over it. The reader is always
+   * ahead of the writer, so the working copy can be rewritten in place. */
+  iostream_init_fd(&w, db->fd, &db->cipher, &db->aes_iv,
+                   DB_GLOBAL_HEADER_SIZE);
+  iostream_seek(&w, offset - DB_GLOBAL_HEADER_SIZE);
   while (true) {
     buf_t type;
     buf_initf(&type, DB_MAGIC_SIZE);
@@ -467,20 +553,18 @@ void db_remove(db_t* db, const buf_t* key, const buf_t* db_key) {
     iostream_read(&r, sizeof(size_t) * 2, &header);
     db_entry_t entry = *(db_entry_t*)header.data;
 
-    /* Check if the key matches the one provided */
+    /* Copy the entry over */
     buf_t k, v;
     buf_initf(&k, entry.key_len);
     buf_initf(&v, entry.data_len);
     iostream_read(&r, entry.key_len, &k);
     iostream_read(&r, entry.data_len, &v);
-
-    /* If we don't have a match, then copy the data. Otherwise, noop */
-    if (!buf_equal(key, &k)) {
-      iostream_write(&w, &type);
-      iostream_write(&w, &header);
-      iostream_write(&w, &k);
-      iostream_write(&w, &v);
-    }
+    const buf_t* record[4];
+    record[0] = &type;
+    record[1] = &header;
+    record[2] = &k;
+    record[3] = &v;
+    iostream_writev(&w, record, 4);
 
     /* Cleaup for loop iteration */
     buf_free(&k);
@@ -489,16 +573,10 @@ void db_remove(db_t* db, const buf_t* key, const buf_t* db_key) {
     buf_free(&type);
   }
 
-  /* Cleanup */
+  /* Cut off what is left of the old end of the database */
+  iostream_truncate(&w);
   iostream_free(&r);
   iostream_free(&w);
-  fclose(src);
-  fclose(dst);
-
-  /* Replace original file with updated one */
-  fcopy(db->working_path, buf_to_cstr(&path));
-  remove(buf_to_cstr(&path));
-  buf_free(&path);
   debug("Removed key from database");
 
   /* Rotate the IV upon change to the contents */
@@ -545,16 +623,15 @@ void db_removens(db_t* db, const buf_t* namespace, const buf_t* key,
 void db_iter_init(db_iter_t* it, db_t* db) {
   it->db = db;
   it->finished = false;
-  FILE* db_file = fopen(db->working_path, "rb");
-  iostream_init(&it->ios, db_file, &db->aes_ctx, &db->aes_iv,
-                DB_GLOBAL_HEADER_SIZE);
+  iostream_init_fd(&it->ios, db->fd, &db->cipher, &db->aes_iv,
+                   DB_GLOBAL_HEADER_SIZE);
+  iostream_map(&it->ios, IOSTREAM_SEQUENTIAL);
   iostream_skip(&it->ios, DB_MAGIC_SIZE);
 }
 
 void db_iter_free(db_iter_t* it) {
   it->db = NULL;
   it->finished = true;
-  fclose(it->ios.fd);
   iostream_free(&it->ios);
 }
 
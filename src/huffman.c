@@ -5,8 +5,10 @@
 #include <string.h>
 
 #include "constants.h"
+#include "core/buffer.h"
 #include "core/list.h"
 #include "core/map.h"
+#include "core/pipeline.h"
 #include "stddefs.h"
 #include "utils/cli.h"
 #include "utils/io.h"
@@ -106,6 +108,13 @@ static bool huffman_exists(const char *path) {
   return (memcmp(footer, HUFFMAN_MAGIC_END, HUFFMAN_MAGIC_SIZE) == 0);
 }
 
+/* Reads the next part of an input file for a pipeline */
+static void huffman_fill_file(void *args, const size_t len, buf_t *data) {
+  if (data->capacity < len) buf_resize(data, len);
+  freads(data->data, len, (FILE *)args);
+  data->size = len;
+}
+
 static huffman_dnode_t *new_node(void) {
   huffman_dnode_t *n = calloc(1, sizeof(*n));
   n->symbol = -1;
@@ -116,7 +125,6 @@ bool huffman_compress(const map_t *input_files, const char *output_path) {
   /* Frequency count */
   size_t freq[256] = {0};
   size_t total = 0;
-  uint8_t chunk[READFILE_CHUNK];
   bool processed = false;
   list_node_t *node = input_files->entries.head;
   do {
@@ -132,19 +140,16 @@ bool huffman_compress(const map_t *input_files, const char *output_path) {
     FILE *in = fopen(path, "rb");
     if (!in) throw("Failed to open input file");
 
-    /* Calculate frequency density */
-    size_t remaining = fsize(path);
-    while (remaining > 0) {
-      /* Read chunk from file */
-      size_t bsize = remaining < READFILE_CHUNK ? remaining : READFILE_CHUNK;
-      freads(chunk, bsize, in);
-      remaining -= bsize;
-      total += bsize;
-
-      /* Calculate frequency density */
+    /* Calculate frequency density while the next chunk is being read */
+    pipeline_t *pipeline =
+        pipeline_start(huffman_fill_file, in, fsize(path), READFILE_BULK_CHUNK);
+    const buf_t *chunk;
+    while ((chunk = pipeline_next(pipeline))) {
       size_t i;
-      for (i = 0; i < bsize; ++i) freq[chunk[i]]++;
+      for (i = 0; i < chunk->size; ++i) freq[chunk->data[i]]++;
+      total += chunk->size;
     }
+    pipeline_free(pipeline);
 
     fclose(in);
     buf_free(&map_node.key);
@@ -232,20 +237,16 @@ bool huffman_compress(const map_t *input_files, const char *output_path) {
 
     size_t bitcnt = 0;
     size_t cbytes = 0;
-    size_t remaining = size;
     uint8_t bitbuf = 0;
-    uint8_t block[READFILE_CHUNK];
-    while (remaining > 0) {
-      /* Read data from file */
-      size_t chunk = remaining < READFILE_CHUNK ? remaining : READFILE_CHUNK;
-      remaining -= chunk;
-      freads(block, chunk, in);
-
-      /* Huffman-transform the bits */
+    pipeline_t *pipeline =
+        pipeline_start(huffman_fill_file, in, size, READFILE_BULK_CHUNK);
+    const buf_t *block;
+    while ((block = pipeline_next(pipeline))) {
+      /* Huffman-transform the bits while the next chunk is being read */
       size_t i;
       int64_t j;
-      for (i = 0; i < chunk; ++i) {
-        uint8_t b = block[i];
+      for (i = 0; i < block->size; ++i) {
+        uint8_t b = block->data[i];
         uint32_t bits = table[b].code_bits;
         uint8_t len = table[b].code_len;
         for (j = len - 1; j >= 0; --j) {
@@ -259,6 +260,7 @@ bool huffman_compress(const map_t *input_files, const char *output_path) {
         }
       }
     }
+    pipeline_free(pipeline);
     fclose(in);
 
     /* Pad the partial byte buffer and write it as well */
@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Cross-platform compatibility
+#ifdef _WIN32
+    #include <windows.h>
+    #define PLATFORM_NAME "Windows"
+#else
+    #include <unistd.h>
+    #define PLATFORM_NAME "Unix"
+#endif
+
+#include "core/buffer.h"
+#include "crypto/aes.h"
+#include "crypto/aes_ctr.h"
+#include "stddefs.h"
+#include "test_framework.h"
+
+// Constants for testing
+#define NUM_BACKENDS 4
+#define MAX_TEST_DATA_SIZE 4096
+#define NUM_TEST_BLOCKS 37
+#define NUM_WRAP_BLOCKS 8
+
+static const aes_backend_t backends[NUM_BACKENDS] = {
+    AES_BACKEND_REFERENCE,
+    AES_BACKEND_TTABLE,
+    AES_BACKEND_AESNI,
+    AES_BACKEND_BITSLICE
+};
+
+static const char *backend_names[NUM_BACKENDS] = {
+    "reference",
+    "T-table",
+    "AES-NI",
+    "bitsliced"
+};
+
+// Helper function to convert a hex string to binary
+void hex_to_bin(const char *hex, uint8_t *out, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        sscanf(&hex[i * 2], "%02hhx", &out[i]);
+    }
+}
+
+// Helper function to fill a buffer with a repeatable pattern
+void create_test_data(uint8_t *data, size_t size, uint8_t seed) {
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)(i * 31 + seed);
+    }
+}
+
+// Helper function to initialise an AES context from raw key bytes
+void init_ctx(aes_ctx_t *ctx, uint8_t *key) {
+    buf_t key_buf;
+    buf_view(&key_buf, key, AES_KEY_SIZE);
+    aes_init(ctx, &key_buf);
+}
+
+// Helper function to write the big-endian 128-bit counter block hi || lo
+void store_counter(uint8_t *block, uint64_t hi, uint64_t lo) {
+    for (int i = 7; i >= 0; i--) {
+        block[i] = (uint8_t)hi;
+        block[i + 8] = (uint8_t)lo;
+        hi >>= 8;
+        lo >>= 8;
+    }
+}
+
+// Test AES-128 against the known-answer vectors from FIPS-197
+void test_aes_known_answer() {
+    printf("\n=== Testing AES known answers ===\n");
+
+    // Appendix B and Appendix C.1 of FIPS-197
+    struct {
+        const char *key_hex;
+        const char *plaintext_hex;
+        const char *ciphertext_hex;
+    } test_vectors[] = {
+        {
+            "2b7e151628aed2a6abf7158809cf4f3c",
+            "3243f6a8885a308d313198a2e0370734",
+            "3925841d02dc09fbdc118597196a0b32"
+        },
+        {
+            "000102030405060708090a0b0c0d0e0f",
+            "00112233445566778899aabbccddeeff",
+            "69c4e0d86a7b0430d8cdb78070b4c55a"
+        }
+    };
+    size_t num_vectors = sizeof(test_vectors) / sizeof(test_vectors[0]);
+
+    for (int b = 0; b < NUM_BACKENDS; b++) {
+        if (!aes_set_backend(backends[b])) {
+            printf("Skipping unsupported backend: %s\n", backend_names[b]);
+            continue;
+        }
+        printf("Testing backend: %s\n", backend_names[b]);
+
+        for (size_t i = 0; i < num_vectors; i++) {
+            uint8_t key[AES_KEY_SIZE];
+            uint8_t plaintext[AES_BLOCK_SIZE];
+            uint8_t expected[AES_BLOCK_SIZE];
+            uint8_t ciphertext[AES_BLOCK_SIZE];
+            hex_to_bin(test_vectors[i].key_hex, key, AES_KEY_SIZE);
+            hex_to_bin(test_vectors[i].plaintext_hex, plaintext, AES_BLOCK_SIZE);
+            hex_to_bin(test_vectors[i].ciphertext_hex, expected, AES_BLOCK_SIZE);
+
+            aes_ctx_t ctx;
+            init_ctx(&ctx, key);
+
+            // Single block through the buffer interface
+            buf_t in, out;
+            buf_view(&in, plaintext, AES_BLOCK_SIZE);
+            buf_view(&out, ciphertext, AES_BLOCK_SIZE);
+            aes_encrypt(&ctx, &in, &out);
+            ASSERT_EQUAL_MEM(expected, ciphertext, AES_BLOCK_SIZE,
+                            "Ciphertext should match the FIPS-197 vector");
+
+            // The same block repeated through the batched interface
+            uint8_t blocks[4 * AES_BLOCK_SIZE];
+            for (int j = 0; j < 4; j++) {
+                memcpy(blocks + j * AES_BLOCK_SIZE, plaintext, AES_BLOCK_SIZE);
+            }
+            aes_encrypt_blocks(&ctx, blocks, blocks, 4);
+            for (int j = 0; j < 4; j++) {
+                ASSERT_EQUAL_MEM(expected, blocks + j * AES_BLOCK_SIZE,
+                                AES_BLOCK_SIZE,
+                                "Every batched block should match the vector");
+            }
+        }
+    }
+
+    aes_set_backend(AES_BACKEND_REFERENCE);
+    TEST_PASS();
+}
+
+// Test that every backend gives the same output as the reference
+void test_aes_backends_agree() {
+    printf("\n=== Testing AES backend equality ===\n");
+
+    uint8_t key[AES_KEY_SIZE];
+    uint8_t iv[AES_BLOCK_SIZE];
+    uint8_t plaintext[MAX_TEST_DATA_SIZE];
+    create_test_data(key, AES_KEY_SIZE, 0x5a);
+    create_test_data(iv, AES_BLOCK_SIZE, 0xc3);
+    create_test_data(plaintext, MAX_TEST_DATA_SIZE, 0x11);
+
+    // Compute the expected output with the reference backend
+    aes_set_backend(AES_BACKEND_REFERENCE);
+    aes_ctx_t ctx;
+    init_ctx(&ctx, key);
+
+    uint8_t expected_blocks[NUM_TEST_BLOCKS * AES_BLOCK_SIZE];
+    uint8_t expected_ctr[MAX_TEST_DATA_SIZE];
+    aes_encrypt_blocks(&ctx, plaintext, expected_blocks, NUM_TEST_BLOCKS);
+    aes_ctr_transform(&ctx, iv, 0, plaintext, expected_ctr, MAX_TEST_DATA_SIZE);
+
+    for (int b = 1; b < NUM_BACKENDS; b++) {
+        if (!aes_set_backend(backends[b])) {
+            printf("Skipping unsupported backend: %s\n", backend_names[b]);
+            continue;
+        }
+        printf("Testing backend: %s\n", backend_names[b]);
+
+        // The key schedule is expanded for the selected backend
+        aes_ctx_t backend_ctx;
+        init_ctx(&backend_ctx, key);
+
+        uint8_t blocks[NUM_TEST_BLOCKS * AES_BLOCK_SIZE];
+        aes_encrypt_blocks(&backend_ctx, plaintext, blocks, NUM_TEST_BLOCKS);
+        ASSERT_EQUAL_MEM(expected_blocks, blocks, sizeof(blocks),
+                        "Block encryption should match the reference backend");
+
+        uint8_t ctr[MAX_TEST_DATA_SIZE];
+        aes_ctr_transform(&backend_ctx, iv, 0, plaintext, ctr,
+                          MAX_TEST_DATA_SIZE);
+        ASSERT_EQUAL_MEM(expected_ctr, ctr, MAX_TEST_DATA_SIZE,
+                        "CTR keystream should match the reference backend");
+    }
+
+    aes_set_backend(AES_BACKEND_REFERENCE);
+    TEST_PASS();
+}
+
+// Test CTR mode starting at offsets which aren't on a block boundary
+void test_aes_ctr_unaligned_offsets() {
+    printf("\n=== Testing AES-CTR unaligned offsets ===\n");
+
+    const size_t offsets[] = {1, 7, 15, 16, 17, 31, 100, 1000, 2049};
+    const size_t lengths[] = {1, 5, 15, 16, 17, 33, 257, 1024};
+    size_t num_offsets = sizeof(offsets) / sizeof(offsets[0]);
+    size_t num_lengths = sizeof(lengths) / sizeof(lengths[0]);
+
+    uint8_t key[AES_KEY_SIZE];
+    uint8_t iv[AES_BLOCK_SIZE];
+    uint8_t plaintext[MAX_TEST_DATA_SIZE];
+    create_test_data(key, AES_KEY_SIZE, 0x21);
+    create_test_data(iv, AES_BLOCK_SIZE, 0x42);
+    create_test_data(plaintext, MAX_TEST_DATA_SIZE, 0x84);
+
+    for (int b = 0; b < NUM_BACKENDS; b++) {
+        if (!aes_set_backend(backends[b])) {
+            printf("Skipping unsupported backend: %s\n", backend_names[b]);
+            continue;
+        }
+        printf("Testing backend: %s\n", backend_names[b]);
+
+        aes_ctx_t ctx;
+        init_ctx(&ctx, key);
+
+        // Encrypting from the start gives the expected stream for every slice
+        uint8_t expected[MAX_TEST_DATA_SIZE];
+        aes_ctr_transform(&ctx, iv, 0, plaintext, expected, MAX_TEST_DATA_SIZE);
+
+        for (size_t i = 0; i < num_offsets; i++) {
+            for (size_t j = 0; j < num_lengths; j++) {
+                size_t offset = offsets[i];
+                size_t len = lengths[j];
+                if (offset + len > MAX_TEST_DATA_SIZE) continue;
+
+                uint8_t slice[MAX_TEST_DATA_SIZE];
+                aes_ctr_transform(&ctx, iv, offset, plaintext + offset, slice,
+                                  len);
+                ASSERT_EQUAL_MEM(expected + offset, slice, len,
+                                "Slice should match the stream from offset 0");
+            }
+        }
+
+        // Decrypting a slice in place gives back the plaintext
+        uint8_t data[MAX_TEST_DATA_SIZE];
+        memcpy(data, expected, MAX_TEST_DATA_SIZE);
+        aes_ctr_transform(&ctx, iv, 13, data + 13, data + 13, 1000);
+        ASSERT_EQUAL_MEM(plaintext + 13, data + 13, 1000,
+                        "In-place decryption should restore the plaintext");
+    }
+
+    aes_set_backend(AES_BACKEND_REFERENCE);
+    TEST_PASS();
+}
+
+// Test that the counter carries into the high 64 bits when the low half wraps
+void test_aes_ctr_counter_wrap() {
+    printf("\n=== Testing AES-CTR counter wrap ===\n");
+
+    const uint64_t iv_hi = 0x0123456789abcdefULL;
+    const size_t data_len = NUM_WRAP_BLOCKS * AES_BLOCK_SIZE - 3;
+
+    // The counter wraps after the first block, and also after three blocks
+    const uint64_t iv_lows[] = {
+        0xffffffffffffffffULL,
+        0xfffffffffffffffdULL
+    };
+    const size_t offsets[] = {0, 5, 16, 21, 50};
+    size_t num_lows = sizeof(iv_lows) / sizeof(iv_lows[0]);
+    size_t num_offsets = sizeof(offsets) / sizeof(offsets[0]);
+
+    uint8_t key[AES_KEY_SIZE];
+    uint8_t plaintext[NUM_WRAP_BLOCKS * AES_BLOCK_SIZE];
+    create_test_data(key, AES_KEY_SIZE, 0x99);
+    create_test_data(plaintext, sizeof(plaintext), 0x33);
+
+    for (size_t l = 0; l < num_lows; l++) {
+        uint8_t iv[AES_BLOCK_SIZE];
+        store_counter(iv, iv_hi, iv_lows[l]);
+
+        // Build the reference keystream from explicit counter blocks
+        aes_set_backend(AES_BACKEND_REFERENCE);
+        aes_ctx_t ref_ctx;
+        init_ctx(&ref_ctx, key);
+
+        uint8_t expected[NUM_WRAP_BLOCKS * AES_BLOCK_SIZE];
+        uint64_t hi = iv_hi;
+        uint64_t lo = iv_lows[l];
+        for (size_t i = 0; i < NUM_WRAP_BLOCKS; i++) {
+            uint8_t counter[AES_BLOCK_SIZE];
+            uint8_t keystream[AES_BLOCK_SIZE];
+            buf_t in, out;
+            store_counter(counter, hi, lo);
+            buf_view(&in, counter, AES_BLOCK_SIZE);
+            buf_view(&out, keystream, AES_BLOCK_SIZE);
+            aes_encrypt(&ref_ctx, &in, &out);
+            for (size_t j = 0; j < AES_BLOCK_SIZE; j++) {
+                expected[i * AES_BLOCK_SIZE + j] =
+                    plaintext[i * AES_BLOCK_SIZE + j] ^ keystream[j];
+            }
+            if (++lo == 0) hi++;
+        }
+
+        for (int b = 0; b < NUM_BACKENDS; b++) {
+            if (!aes_set_backend(backends[b])) continue;
+            printf("Testing backend %s with low counter %016llx\n",
+                   backend_names[b], (unsigned long long)iv_lows[l]);
+
+            aes_ctx_t ctx;
+            init_ctx(&ctx, key);
+
+            for (size_t i = 0; i < num_offsets; i++) {
+                size_t offset = offsets[i];
+                uint8_t ciphertext[NUM_WRAP_BLOCKS * AES_BLOCK_SIZE];
+                aes_ctr_transform(&ctx, iv, offset, plaintext + offset,
+                                  ciphertext, data_len - offset);
+                ASSERT_EQUAL_MEM(expected + offset, ciphertext,
+                                data_len - offset,
+                                "Counter should carry into the high half");
+            }
+        }
+    }
+
+    aes_set_backend(AES_BACKEND_REFERENCE);
+    TEST_PASS();
+}
+
+int main() {
+    printf("=== AES Test Suite ===\n");
+    printf("Platform: %s\n", PLATFORM_NAME);
+
+    TEST_SUITE_BEGIN();
+
+    test_aes_known_answer();
+    test_aes_backends_agree();
+    test_aes_ctr_unaligned_offsets();
+    test_aes_ctr_counter_wrap();
+
+    TEST_SUITE_END();
+}
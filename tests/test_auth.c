@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Cross-platform compatibility
+#ifdef _WIN32
+    #include <windows.h>
+    #define PLATFORM_NAME "Windows"
+    #define SETENV(name, value) _putenv_s(name, value)
+    #define REMOVE_DIR_COMMAND "rmdir /s /q \"%s\""
+#else
+    #define PLATFORM_NAME "Unix"
+    #define SETENV(name, value) setenv(name, value, 1)
+    #define REMOVE_DIR_COMMAND "rm -rf %s"
+#endif
+
+#include "auth/check.h"
+#include "constants.h"
+#include "core/buffer.h"
+#include "crypto/pbkdf2.h"
+#include "crypto/xor.h"
+#include "db.h"
+#include "globals.h"
+#include "stddefs.h"
+#include "typedefs.h"
+#include "utils/setup.h"
+#include "test_framework.h"
+
+// Test constants
+#define TEST_DIR "transcodine_auth_test"
+#define TEST_PASSWORD "legacy-password"
+#define TEST_DB_KEY "bin-id:legacy"
+#define TEST_DB_VALUE "still readable after migration"
+#define MAX_PATH_LENGTH 512
+
+// Global variables for paths
+char test_dir_path[MAX_PATH_LENGTH];
+char working_path[MAX_PATH_LENGTH + 16];
+
+// Helper function to fill a buffer with a repeatable pattern
+void create_test_data(uint8_t *data, size_t size, uint8_t seed) {
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)(i * 31 + seed);
+    }
+}
+
+// Helper function to remove the test agent
+void remove_test_dir() {
+    char command[MAX_PATH_LENGTH + 32];
+    sprintf(command, REMOVE_DIR_COMMAND, test_dir_path);
+    system(command);
+}
+
+// Helper function to write an auth record the way agents used to before the
+// root key existed: the password hash and the key wrapping the KEK are
+// separate PBKDF2 derivations, with no magic or iteration count in front
+void write_legacy_auth(const buf_t *password, const buf_t *kek) {
+    uint8_t pass_salt_data[PASSWORD_SALT_SIZE];
+    uint8_t kek_salt_data[PASSWORD_SALT_SIZE];
+    create_test_data(pass_salt_data, PASSWORD_SALT_SIZE, 0x10);
+    create_test_data(kek_salt_data, PASSWORD_SALT_SIZE, 0x20);
+
+    buf_t pass_salt, kek_salt, pass_hash, root_key, kek_hash;
+    buf_view(&pass_salt, pass_salt_data, PASSWORD_SALT_SIZE);
+    buf_view(&kek_salt, kek_salt_data, PASSWORD_SALT_SIZE);
+    buf_init(&pass_hash, SHA256_HASH_SIZE);
+    buf_init(&root_key, SHA256_HASH_SIZE);
+    buf_init(&kek_hash, KEK_SIZE);
+
+    pbkdf2_hmac_sha256_hash(password, &pass_salt, PBKDF2_ITERATIONS,
+                            &pass_hash, SHA256_HASH_SIZE);
+    pbkdf2_hmac_sha256_hash(password, &kek_salt, PBKDF2_ITERATIONS,
+                            &root_key, SHA256_HASH_SIZE);
+    xor_encrypt(kek, &root_key, &kek_hash);
+
+    FILE *file = fopen(buf_to_cstr(&AUTH_DB_PATH), "wb");
+    if (!file) {
+        fprintf(stderr, "Error: Could not create legacy auth file\n");
+        exit(1);
+    }
+    fwrite(pass_salt.data, 1, pass_salt.size, file);
+    fwrite(pass_hash.data, 1, pass_hash.size, file);
+    fwrite(kek_salt.data, 1, kek_salt.size, file);
+    fwrite(kek_hash.data, 1, kek_hash.size, file);
+    fclose(file);
+
+    buf_free(&kek_hash);
+    buf_free(&root_key);
+    buf_free(&pass_hash);
+}
+
+// Helper function to create a state database under the legacy database key,
+// which was stretched from the KEK with PBKDF2
+void write_legacy_db(const buf_t *kek) {
+    buf_t salt, legacy_key, key, value;
+    buf_view(&salt, DB_LEGACY_KEY_SALT, strlen(DB_LEGACY_KEY_SALT));
+    buf_init(&legacy_key, AES_KEY_SIZE);
+    pbkdf2_hmac_sha256_hash(kek, &salt, PBKDF2_ITERATIONS, &legacy_key,
+                            AES_KEY_SIZE);
+
+    db_t db;
+    db_init(&db);
+    db_create(&db, &legacy_key, buf_to_cstr(&STATE_DB_PATH));
+    db_free(&db);
+
+    db_init(&db);
+    db_open(&db, &legacy_key, buf_to_cstr(&STATE_DB_PATH), working_path);
+    buf_view(&key, TEST_DB_KEY, strlen(TEST_DB_KEY));
+    buf_view(&value, TEST_DB_VALUE, strlen(TEST_DB_VALUE));
+    db_write(&db, &key, &value, &legacy_key);
+    db_close(&db);
+    db_free(&db);
+
+    buf_free(&legacy_key);
+}
+
+// Test that a legacy agent is migrated on login and keeps its data
+void test_legacy_migration() {
+    printf("\n=== Testing legacy auth migration ===\n");
+
+    uint8_t kek_data[KEK_SIZE];
+    create_test_data(kek_data, KEK_SIZE, 0x5e);
+
+    buf_t password, kek;
+    buf_view(&password, TEST_PASSWORD, strlen(TEST_PASSWORD));
+    buf_view(&kek, kek_data, KEK_SIZE);
+
+    printf("Writing legacy agent\n");
+    write_legacy_auth(&password, &kek);
+    write_legacy_db(&kek);
+
+    auth_t auth;
+    auth_init(&auth);
+    read_auth(&auth);
+    ASSERT_TRUE(auth.legacy, "Record should be read as a legacy record");
+
+    // A wrong password must not unlock or migrate anything
+    buf_t wrong_password;
+    buf_view(&wrong_password, "wrong-password", 14);
+    ASSERT_FALSE(check_password(&wrong_password, NULL),
+                "Wrong password should be rejected");
+    read_auth(&auth);
+    ASSERT_TRUE(auth.legacy, "Record should stay legacy after a failed login");
+
+    // Logging in migrates the agent and hands back the same KEK
+    printf("Logging in to the legacy agent\n");
+    buf_t unwrapped;
+    buf_initf(&unwrapped, KEK_SIZE);
+    ASSERT_TRUE(check_password(&password, &unwrapped),
+               "Legacy password should be accepted");
+    ASSERT_EQUAL_MEM(kek_data, unwrapped.data, KEK_SIZE,
+                    "Unwrapped KEK should match the original");
+
+    read_auth(&auth);
+    ASSERT_FALSE(auth.legacy, "Record should be migrated after login");
+    ASSERT_TRUE(auth.iterations == PBKDF2_ITERATIONS,
+               "Migrated record should keep the legacy iteration count");
+
+    FILE *file = fopen(buf_to_cstr(&AUTH_DB_PATH), "rb");
+    ASSERT_NOT_NULL(file, "Migrated record should be readable");
+    char magic[AUTH_MAGIC_SIZE];
+    size_t read = fread(magic, 1, AUTH_MAGIC_SIZE, file);
+    fclose(file);
+    ASSERT_EQUAL_SIZE((size_t)AUTH_MAGIC_SIZE, read, "Migrated record should have a magic");
+    ASSERT_EQUAL_MEM(AUTH_MAGIC_VERSION, magic, AUTH_MAGIC_SIZE,
+                    "Migrated record should start with the current magic");
+
+    // The database now opens with the key derived from the KEK using HKDF
+    printf("Opening the migrated database\n");
+    buf_t db_key, key, value;
+    buf_initf(&db_key, AES_KEY_SIZE);
+    db_derive_key(&unwrapped, &db_key);
+
+    db_t db;
+    db_init(&db);
+    db_open(&db, &db_key, buf_to_cstr(&STATE_DB_PATH), working_path);
+    buf_view(&key, TEST_DB_KEY, strlen(TEST_DB_KEY));
+    buf_init(&value, 32);
+    ASSERT_TRUE(db_read(&db, &key, &value), "Entry should survive the migration");
+    ASSERT_EQUAL_SIZE(strlen(TEST_DB_VALUE), value.size,
+                     "Entry should keep its length");
+    ASSERT_EQUAL_MEM(TEST_DB_VALUE, value.data, value.size,
+                    "Entry should keep its value");
+    db_close(&db);
+    db_free(&db);
+
+    // Later logins use the current format directly
+    buf_t again;
+    buf_initf(&again, KEK_SIZE);
+    ASSERT_TRUE(check_password(&password, &again),
+               "Password should be accepted after the migration");
+    ASSERT_EQUAL_MEM(kek_data, again.data, KEK_SIZE,
+                    "KEK should be unchanged after the migration");
+    ASSERT_FALSE(check_password(&wrong_password, NULL),
+                "Wrong password should still be rejected");
+
+    buf_free(&again);
+    buf_free(&value);
+    buf_free(&db_key);
+    buf_free(&unwrapped);
+    auth_free(&auth);
+    TEST_PASS();
+}
+
+int main() {
+    printf("=== Auth Test Suite ===\n");
+    printf("Platform: %s\n", PLATFORM_NAME);
+
+    // Use a separate agent so the test doesn't touch the real configuration
+    #ifdef _WIN32
+        char *temp_dir = getenv("TEMP");
+        sprintf(test_dir_path, "%s\\%s", temp_dir ? temp_dir : ".", TEST_DIR);
+        sprintf(working_path, "%s\\working.db", test_dir_path);
+    #else
+        sprintf(test_dir_path, "/tmp/%s", TEST_DIR);
+        sprintf(working_path, "%s/working.db", test_dir_path);
+    #endif
+    remove_test_dir();
+    SETENV("TRANSCODINE_CONFIG_PATH", test_dir_path);
+    setup();
+
+    TEST_SUITE_BEGIN();
+
+    test_legacy_migration();
+
+    teardown();
+    remove_test_dir();
+
+    TEST_SUITE_END();
+}
@@ -28,6 +28,10 @@
 #define TEST_BIN_NAME "test.bin"
 #define TEST_FILE_NAME "test_file.txt"
 #define TEST_FILE_CONTENT "This is test content for Transcodine bin testing."
+#define TEST_CONFIG_DIR "config"
+#define TEST_PASSWORD "test-password"
+#define CHACHA_BIN_NAME "chacha"
+#define CHACHA_VIRTUAL_PATH "/docs/test_file.txt"
 #define MAX_PATH_LENGTH 512
 #define MAX_CMD_LENGTH 1024
 #define MAX_CONTENT_LENGTH 1024
@@ -38,6 +42,8 @@ char test_bin_path[MAX_PATH_LENGTH];
 char test_file_path[MAX_PATH_LENGTH];
 char ls_output_path[MAX_PATH_LENGTH];
 char cat_output_path[MAX_PATH_LENGTH];
+char config_dir_path[MAX_PATH_LENGTH];
+char get_output_path[MAX_PATH_LENGTH];
 char transcodine_path[MAX_PATH_LENGTH];
 
 // Function to initialize paths
@@ -56,6 +62,8 @@ void initialize_paths() {
         sprintf(test_file_path, "%s\\%s", test_dir_path, TEST_FILE_NAME);
         sprintf(ls_output_path, "%s\\ls_output.txt", test_dir_path);
         sprintf(cat_output_path, "%s\\cat_output.txt", test_dir_path);
+        sprintf(config_dir_path, "%s\\%s", test_dir_path, TEST_CONFIG_DIR);
+        sprintf(get_output_path, "%s\\get_output.txt", test_dir_path);
         sprintf(transcodine_path, "..\\transcodine.exe");
     #else
         sprintf(test_dir_path, "/tmp/%s", TEST_DIR);
@@ -63,6 +71,8 @@ void initialize_paths() {
         sprintf(test_file_path, "%s/%s", test_dir_path, TEST_FILE_NAME);
         sprintf(ls_output_path, "%s/ls_output.txt", test_dir_path);
         sprintf(cat_output_path, "%s/cat_output.txt", test_dir_path);
+        sprintf(config_dir_path, "%s/%s", test_dir_path, TEST_CONFIG_DIR);
+        sprintf(get_output_path, "%s/get_output.txt", test_dir_path);
         sprintf(transcodine_path, "../transcodine");
     #endif
     
@@ -122,6 +132,10 @@ void cleanup_test_environment() {
         UNLINK(cat_output_path);
     }
     
+    if (file_exists(get_output_path)) {
+        UNLINK(get_output_path);
+    }
+    
     // Remove test directory
     RMDIR(test_dir_path);
     printf("Removed test directory: %s\n", test_dir_path);
@@ -380,6 +394,89 @@ void test_bin_error_handling() {
     TEST_PASS();
 }
 
+// Test a round trip through a bin encrypted with ChaCha20
+void test_bin_chacha20_round_trip() {
+    char command[MAX_CMD_LENGTH];
+    int result;
+    
+    // Use a separate agent so the test doesn't touch the real configuration
+    #ifdef _WIN32
+        _putenv_s("TRANSCODINE_CONFIG_PATH", config_dir_path);
+    #else
+        setenv("TRANSCODINE_CONFIG_PATH", config_dir_path, 1);
+    #endif
+    
+    // Every command reads the password from stdin
+    #ifdef _WIN32
+        sprintf(command, "echo %s| \"%s\" agent setup", TEST_PASSWORD, transcodine_path);
+    #else
+        sprintf(command, "printf '%s\\n' | %s agent setup", TEST_PASSWORD, transcodine_path);
+    #endif
+    
+    result = execute_command(command);
+    ASSERT_EQUAL_INT(0, result, "Agent setup should succeed");
+    
+    #ifdef _WIN32
+        sprintf(command, "echo %s| \"%s\" bin create %s --chacha20", TEST_PASSWORD, transcodine_path, CHACHA_BIN_NAME);
+    #else
+        sprintf(command, "printf '%s\\n' | %s bin create %s --chacha20", TEST_PASSWORD, transcodine_path, CHACHA_BIN_NAME);
+    #endif
+    
+    result = execute_command(command);
+    ASSERT_EQUAL_INT(0, result, "Creating a ChaCha20 bin should succeed");
+    
+    // The bin header should carry the ChaCha20 magic
+    #ifdef _WIN32
+        sprintf(command, "findstr /m ARCHC-64 \"%s\\bins\\*\" > nul", config_dir_path);
+    #else
+        sprintf(command, "grep -q ARCHC-64 %s/bins/*", config_dir_path);
+    #endif
+    
+    result = execute_command(command);
+    ASSERT_EQUAL_INT(0, result, "Bin should be marked as a ChaCha20 bin");
+    
+    #ifdef _WIN32
+        sprintf(command, "echo %s| \"%s\" file add %s \"%s\" %s", TEST_PASSWORD, transcodine_path, CHACHA_BIN_NAME, test_file_path, CHACHA_VIRTUAL_PATH);
+    #else
+        sprintf(command, "printf '%s\\n' | %s file add %s %s %s", TEST_PASSWORD, transcodine_path, CHACHA_BIN_NAME, test_file_path, CHACHA_VIRTUAL_PATH);
+    #endif
+    
+    result = execute_command(command);
+    ASSERT_EQUAL_INT(0, result, "Adding a file to the ChaCha20 bin should succeed");
+    
+    #ifdef _WIN32
+        sprintf(command, "echo %s| \"%s\" file get %s %s \"%s\"", TEST_PASSWORD, transcodine_path, CHACHA_BIN_NAME, CHACHA_VIRTUAL_PATH, get_output_path);
+    #else
+        sprintf(command, "printf '%s\\n' | %s file get %s %s %s", TEST_PASSWORD, transcodine_path, CHACHA_BIN_NAME, CHACHA_VIRTUAL_PATH, get_output_path);
+    #endif
+    
+    result = execute_command(command);
+    ASSERT_EQUAL_INT(0, result, "Getting the file from the ChaCha20 bin should succeed");
+    ASSERT_TRUE(file_exists(get_output_path), "Output file should exist");
+    
+    // The file should come back exactly as it went in
+    FILE *output = fopen(get_output_path, "rb");
+    ASSERT_NOT_NULL(output, "Output file should be readable");
+    
+    char content[MAX_CONTENT_LENGTH] = {0};
+    size_t bytes_read = fread(content, 1, sizeof(content) - 1, output);
+    fclose(output);
+    
+    ASSERT_EQUAL_SIZE(strlen(TEST_FILE_CONTENT), bytes_read, "Retrieved file should have the original size");
+    ASSERT_EQUAL_MEM(TEST_FILE_CONTENT, content, bytes_read, "Retrieved content should match original content");
+    
+    // Remove the agent and its bins
+    #ifdef _WIN32
+        sprintf(command, "rmdir /s /q \"%s\"", config_dir_path);
+    #else
+        sprintf(command, "rm -rf %s", config_dir_path);
+    #endif
+    
+    execute_command(command);
+    
+    TEST_PASS();
+}
+
 // Main test function
 int main() {
     TEST_SUITE_BEGIN();
@@ -396,6 +493,7 @@ int main() {
     test_bin_cat();
     test_bin_rm();
     test_bin_error_handling();
+    test_bin_chacha20_round_trip();
     
     printf("Cleaning up test environment...\n");
     cleanup_test_environment();
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Cross-platform compatibility
+#ifdef _WIN32
+    #include <windows.h>
+    #define PLATFORM_NAME "Windows"
+#else
+    #include <unistd.h>
+    #define PLATFORM_NAME "Unix"
+#endif
+
+#include "core/buffer.h"
+#include "crypto/chacha20.h"
+#include "stddefs.h"
+#include "test_framework.h"
+
+// Constants for testing
+#define MAX_TEST_DATA_SIZE 4096
+
+// The key used by most of the vectors in RFC 8439
+#define RFC_KEY_HEX \
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+
+// Helper function to convert a hex string to binary
+void hex_to_bin(const char *hex, uint8_t *out, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        sscanf(&hex[i * 2], "%02hhx", &out[i]);
+    }
+}
+
+// Helper function to fill a buffer with a repeatable pattern
+void create_test_data(uint8_t *data, size_t size, uint8_t seed) {
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)(i * 31 + seed);
+    }
+}
+
+// Helper function to initialise a ChaCha20 context from a hex key
+void init_ctx(chacha20_ctx_t *ctx, const char *key_hex) {
+    uint8_t key[CHACHA20_KEY_SIZE];
+    buf_t key_buf;
+    hex_to_bin(key_hex, key, CHACHA20_KEY_SIZE);
+    buf_view(&key_buf, key, CHACHA20_KEY_SIZE);
+    chacha20_init(ctx, &key_buf);
+}
+
+// Test the keystream against the vectors from RFC 8439
+void test_chacha20_keystream() {
+    printf("\n=== Testing ChaCha20 keystream ===\n");
+
+    // The IV is the 32-bit block counter followed by the 96-bit nonce from the
+    // RFC. Both are little-endian, so this is the same as the IV layout here.
+    struct {
+        const char *name;
+        const char *key_hex;
+        const char *iv_hex;
+        const char *keystream_hex;
+    } test_vectors[] = {
+        {
+            "Section 2.3.2",
+            RFC_KEY_HEX,
+            "01000000000000090000004a00000000",
+            "10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+            "d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e"
+        },
+        {
+            "Appendix A.1 #1",
+            "0000000000000000000000000000000000000000000000000000000000000000",
+            "00000000000000000000000000000000",
+            "76b8e0ada0f13d90405d6ae55386bd28bdd219b8a08ded1aa836efcc8b770dc7"
+            "da41597c5157488d7724e03fb8d84a376a43b8f41518a11cc387b669b2ee6586"
+        }
+    };
+
+    for (size_t i = 0; i < sizeof(test_vectors) / sizeof(test_vectors[0]); i++) {
+        printf("Test vector: %s\n", test_vectors[i].name);
+
+        chacha20_ctx_t ctx;
+        init_ctx(&ctx, test_vectors[i].key_hex);
+
+        uint8_t iv[CHACHA20_IV_SIZE];
+        uint8_t expected[CHACHA20_BLOCK_SIZE];
+        hex_to_bin(test_vectors[i].iv_hex, iv, CHACHA20_IV_SIZE);
+        hex_to_bin(test_vectors[i].keystream_hex, expected,
+                   CHACHA20_BLOCK_SIZE);
+
+        // Encrypting zeroes gives the keystream itself
+        uint8_t keystream[CHACHA20_BLOCK_SIZE];
+        memset(keystream, 0, CHACHA20_BLOCK_SIZE);
+        chacha20_transform(&ctx, iv, 0, keystream, keystream,
+                           CHACHA20_BLOCK_SIZE);
+        ASSERT_EQUAL_MEM(expected, keystream, CHACHA20_BLOCK_SIZE,
+                        "Keystream should match the RFC 8439 vector");
+    }
+
+    TEST_PASS();
+}
+
+// Test encryption against the example from Section 2.4.2 of RFC 8439
+void test_chacha20_encryption() {
+    printf("\n=== Testing ChaCha20 encryption ===\n");
+
+    const char *plaintext =
+        "Ladies and Gentlemen of the class of '99: If I could offer you only "
+        "one tip for the future, sunscreen would be it.";
+    const char *ciphertext_hex =
+        "6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0b"
+        "f91b65c5524733ab8f593dabcd62b3571639d624e65152ab8f530c359f0861d8"
+        "07ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab7793736"
+        "5af90bbf74a35be6b40b8eedf2785e42874d";
+    size_t len = strlen(plaintext);
+
+    chacha20_ctx_t ctx;
+    init_ctx(&ctx, RFC_KEY_HEX);
+
+    uint8_t expected[MAX_TEST_DATA_SIZE];
+    hex_to_bin(ciphertext_hex, expected, len);
+
+    // The example starts at block 1
+    uint8_t iv[CHACHA20_IV_SIZE];
+    hex_to_bin("01000000000000000000004a00000000", iv, CHACHA20_IV_SIZE);
+
+    buf_t iv_buf, input, output;
+    buf_view(&iv_buf, iv, CHACHA20_IV_SIZE);
+    buf_view(&input, (void *)plaintext, len);
+    buf_init(&output, len);
+    chacha20_crypt(&ctx, &iv_buf, 0, &input, &output);
+    ASSERT_EQUAL_SIZE(len, output.size, "Ciphertext should be as long as the input");
+    ASSERT_EQUAL_MEM(expected, output.data, len,
+                    "Ciphertext should match the RFC 8439 example");
+
+    // Starting one block into the stream from block 0 reaches the same counter
+    uint8_t ciphertext[MAX_TEST_DATA_SIZE];
+    hex_to_bin("00000000000000000000004a00000000", iv, CHACHA20_IV_SIZE);
+    chacha20_transform(&ctx, iv, CHACHA20_BLOCK_SIZE, (const uint8_t *)plaintext,
+                       ciphertext, len);
+    ASSERT_EQUAL_MEM(expected, ciphertext, len,
+                    "Offset should advance the block counter");
+
+    // Decryption is the same operation
+    chacha20_transform(&ctx, iv, CHACHA20_BLOCK_SIZE, ciphertext, ciphertext,
+                       len);
+    ASSERT_EQUAL_MEM(plaintext, ciphertext, len,
+                    "Decryption should restore the plaintext");
+
+    buf_free(&output);
+    TEST_PASS();
+}
+
+// Test that unaligned slices match the stream generated in one call
+void test_chacha20_offsets() {
+    printf("\n=== Testing ChaCha20 offsets ===\n");
+
+    chacha20_ctx_t ctx;
+    init_ctx(&ctx, RFC_KEY_HEX);
+
+    // The counter carries into its high word a few blocks into the stream
+    uint8_t iv[CHACHA20_IV_SIZE];
+    hex_to_bin("fdffffff000000000001020304050607", iv, CHACHA20_IV_SIZE);
+
+    uint8_t plaintext[MAX_TEST_DATA_SIZE];
+    uint8_t expected[MAX_TEST_DATA_SIZE];
+    create_test_data(plaintext, MAX_TEST_DATA_SIZE, 0x17);
+    chacha20_transform(&ctx, iv, 0, plaintext, expected, MAX_TEST_DATA_SIZE);
+
+    // Single bytes always go through the portable block function, while the
+    // bulk call above uses the SIMD kernels where they are available
+    uint8_t bytes[MAX_TEST_DATA_SIZE];
+    for (size_t i = 0; i < MAX_TEST_DATA_SIZE; i++) {
+        chacha20_transform(&ctx, iv, i, plaintext + i, bytes + i, 1);
+    }
+    ASSERT_EQUAL_MEM(expected, bytes, MAX_TEST_DATA_SIZE,
+                    "Byte-by-byte encryption should match the bulk stream");
+
+    const size_t offsets[] = {1, 63, 64, 65, 200, 511, 1000, 2047};
+    const size_t lengths[] = {1, 7, 64, 65, 513, 1024};
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        for (size_t j = 0; j < sizeof(lengths) / sizeof(lengths[0]); j++) {
+            size_t offset = offsets[i];
+            size_t len = lengths[j];
+
+            uint8_t slice[MAX_TEST_DATA_SIZE];
+            chacha20_transform(&ctx, iv, offset, plaintext + offset, slice,
+                               len);
+            ASSERT_EQUAL_MEM(expected + offset, slice, len,
+                            "Slice should match the stream from offset 0");
+        }
+    }
+
+    TEST_PASS();
+}
+
+int main() {
+    printf("=== ChaCha20 Test Suite ===\n");
+    printf("Platform: %s\n", PLATFORM_NAME);
+
+    TEST_SUITE_BEGIN();
+
+    test_chacha20_keystream();
+    test_chacha20_encryption();
+    test_chacha20_offsets();
+
+    TEST_SUITE_END();
+}
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Cross-platform compatibility
+#ifdef _WIN32
+    #include <windows.h>
+    #define PLATFORM_NAME "Windows"
+#else
+    #include <unistd.h>
+    #define PLATFORM_NAME "Unix"
+#endif
+
+#include "core/buffer.h"
+#include "crypto/hkdf.h"
+#include "stddefs.h"
+#include "test_framework.h"
+
+// Constants for testing
+#define MAX_TEST_DATA_SIZE 128
+#define PRK_SIZE 32
+
+// Helper function to convert a hex string to binary
+void hex_to_bin(const char *hex, uint8_t *out, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        sscanf(&hex[i * 2], "%02hhx", &out[i]);
+    }
+}
+
+// Helper function to fill a buffer with consecutive bytes
+void fill_range(uint8_t *data, size_t size, uint8_t start) {
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)(start + i);
+    }
+}
+
+// Test HKDF-SHA256 against the test cases from Appendix A of RFC 5869
+void test_hkdf_known_answer() {
+    printf("\n=== Testing HKDF known answers ===\n");
+
+    struct {
+        const char *name;
+        uint8_t ikm[MAX_TEST_DATA_SIZE];
+        size_t ikm_len;
+        uint8_t salt[MAX_TEST_DATA_SIZE];
+        size_t salt_len;
+        uint8_t info[MAX_TEST_DATA_SIZE];
+        size_t info_len;
+        size_t okm_len;
+        const char *prk_hex;
+        const char *okm_hex;
+    } test_vectors[3];
+
+    // Test Case 1: basic test case
+    test_vectors[0].name = "Test Case 1";
+    memset(test_vectors[0].ikm, 0x0b, 22);
+    test_vectors[0].ikm_len = 22;
+    fill_range(test_vectors[0].salt, 13, 0x00);
+    test_vectors[0].salt_len = 13;
+    fill_range(test_vectors[0].info, 10, 0xf0);
+    test_vectors[0].info_len = 10;
+    test_vectors[0].okm_len = 42;
+    test_vectors[0].prk_hex =
+        "077709362c2e32df0ddc3f0dc47bba6390b6c73bb50f9c3122ec844ad7c2b3e5";
+    test_vectors[0].okm_hex =
+        "3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf"
+        "34007208d5b887185865";
+
+    // Test Case 2: longer inputs and outputs
+    test_vectors[1].name = "Test Case 2";
+    fill_range(test_vectors[1].ikm, 80, 0x00);
+    test_vectors[1].ikm_len = 80;
+    fill_range(test_vectors[1].salt, 80, 0x60);
+    test_vectors[1].salt_len = 80;
+    fill_range(test_vectors[1].info, 80, 0xb0);
+    test_vectors[1].info_len = 80;
+    test_vectors[1].okm_len = 82;
+    test_vectors[1].prk_hex =
+        "06a6b88c5853361a06104c9ceb35b45cef760014904671014a193f40c15fc244";
+    test_vectors[1].okm_hex =
+        "b11e398dc80327a1c8e7f78c596a49344f012eda2d4efad8a050cc4c19afa97c"
+        "59045a99cac7827271cb41c65e590e09da3275600c2f09b8367793a9aca3db71"
+        "cc30c58179ec3e87c14c01d5c1f3434f1d87";
+
+    // Test Case 3: zero-length salt and info
+    test_vectors[2].name = "Test Case 3";
+    memset(test_vectors[2].ikm, 0x0b, 22);
+    test_vectors[2].ikm_len = 22;
+    test_vectors[2].salt_len = 0;
+    test_vectors[2].info_len = 0;
+    test_vectors[2].okm_len = 42;
+    test_vectors[2].prk_hex =
+        "19ef24a32c717b167f33a91d6f648bdf96596776afdb6377ac434c1c293ccb04";
+    test_vectors[2].okm_hex =
+        "8da4e775a563c18f715f802a063c5a31b8a11f5c5ee1879ec3454e5f3c738d2d"
+        "9d201395faa4b61a96c8";
+
+    for (size_t i = 0; i < sizeof(test_vectors) / sizeof(test_vectors[0]); i++) {
+        printf("Test vector: %s\n", test_vectors[i].name);
+
+        uint8_t expected_prk[PRK_SIZE];
+        uint8_t expected_okm[MAX_TEST_DATA_SIZE];
+        hex_to_bin(test_vectors[i].prk_hex, expected_prk, PRK_SIZE);
+        hex_to_bin(test_vectors[i].okm_hex, expected_okm,
+                   test_vectors[i].okm_len);
+
+        buf_t ikm, salt, info, prk, okm;
+        buf_view(&ikm, test_vectors[i].ikm, test_vectors[i].ikm_len);
+        buf_view(&salt, test_vectors[i].salt, test_vectors[i].salt_len);
+        buf_view(&info, test_vectors[i].info, test_vectors[i].info_len);
+        buf_init(&prk, PRK_SIZE);
+        buf_init(&okm, test_vectors[i].okm_len);
+
+        // Each step separately
+        hkdf_sha256_extract(&salt, &ikm, &prk);
+        ASSERT_EQUAL_MEM(expected_prk, prk.data, PRK_SIZE,
+                        "PRK should match the RFC 5869 vector");
+
+        hkdf_sha256_expand(&prk, &info, &okm, test_vectors[i].okm_len);
+        ASSERT_EQUAL_SIZE(test_vectors[i].okm_len, okm.size,
+                         "OKM should have the requested length");
+        ASSERT_EQUAL_MEM(expected_okm, okm.data, test_vectors[i].okm_len,
+                        "OKM should match the RFC 5869 vector");
+
+        // Both steps in one call
+        hkdf_sha256(&salt, &ikm, &info, &okm, test_vectors[i].okm_len);
+        ASSERT_EQUAL_MEM(expected_okm, okm.data, test_vectors[i].okm_len,
+                        "One-shot OKM should match the RFC 5869 vector");
+
+        // A missing salt is the same as a zero-length one
+        if (test_vectors[i].salt_len == 0) {
+            hkdf_sha256(NULL, &ikm, &info, &okm, test_vectors[i].okm_len);
+            ASSERT_EQUAL_MEM(expected_okm, okm.data, test_vectors[i].okm_len,
+                            "NULL salt should match the RFC 5869 vector");
+        }
+
+        buf_free(&okm);
+        buf_free(&prk);
+    }
+
+    TEST_PASS();
+}
+
+int main() {
+    printf("=== HKDF Test Suite ===\n");
+    printf("Platform: %s\n", PLATFORM_NAME);
+
+    TEST_SUITE_BEGIN();
+
+    test_hkdf_known_answer();
+
+    TEST_SUITE_END();
+}
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Cross-platform compatibility
+#ifdef _WIN32
+    #include <windows.h>
+    #define PLATFORM_NAME "Windows"
+#else
+    #include <unistd.h>
+    #define PLATFORM_NAME "Unix"
+#endif
+
+#include "core/buffer.h"
+#include "crypto/hmac.h"
+#include "crypto/sha256.h"
+#include "stddefs.h"
+#include "test_framework.h"
+
+// Constants for testing
+#define MAX_TEST_DATA_SIZE 256
+#define NUM_VECTORS 6
+
+// The test cases from Section 4 of RFC 4231, leaving out the truncated one
+typedef struct {
+    const char *name;
+    uint8_t key[MAX_TEST_DATA_SIZE];
+    size_t key_len;
+    uint8_t data[MAX_TEST_DATA_SIZE];
+    size_t data_len;
+    uint8_t expected[SHA256_HASH_SIZE];
+} hmac_vector_t;
+
+static hmac_vector_t vectors[NUM_VECTORS];
+
+// Helper function to convert a hex string to binary
+void hex_to_bin(const char *hex, uint8_t *out, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        sscanf(&hex[i * 2], "%02hhx", &out[i]);
+    }
+}
+
+// Helper function to fill in one of the RFC 4231 test cases
+void set_vector(hmac_vector_t *vector, const char *name, const uint8_t *key,
+                size_t key_len, const char *data, size_t data_len,
+                const char *expected_hex) {
+    vector->name = name;
+    memcpy(vector->key, key, key_len);
+    vector->key_len = key_len;
+    memcpy(vector->data, data, data_len);
+    vector->data_len = data_len;
+    hex_to_bin(expected_hex, vector->expected, SHA256_HASH_SIZE);
+}
+
+// Build the test vectors, expanding the repeated bytes from the RFC
+void init_vectors() {
+    uint8_t key[MAX_TEST_DATA_SIZE];
+    char data[MAX_TEST_DATA_SIZE];
+
+    memset(key, 0x0b, 20);
+    set_vector(&vectors[0], "Test Case 1", key, 20, "Hi There", 8,
+               "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7");
+
+    set_vector(&vectors[1], "Test Case 2", (const uint8_t *)"Jefe", 4,
+               "what do ya want for nothing?", 28,
+               "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+
+    memset(key, 0xaa, 20);
+    memset(data, 0xdd, 50);
+    set_vector(&vectors[2], "Test Case 3", key, 20, data, 50,
+               "773ea91e36800e46854db8ebd09181a72959098b3ef8c122d9635514ced565fe");
+
+    for (int i = 0; i < 25; i++) key[i] = (uint8_t)(i + 1);
+    memset(data, 0xcd, 50);
+    set_vector(&vectors[3], "Test Case 4", key, 25, data, 50,
+               "82558a389a443c0ea4cc819899f2083a85f0faa3e578f8077a2e3ff46729665b");
+
+    // Keys longer than a block are hashed first
+    memset(key, 0xaa, 131);
+    const char *data6 = "Test Using Larger Than Block-Size Key - Hash Key First";
+    set_vector(&vectors[4], "Test Case 6", key, 131, data6, strlen(data6),
+               "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54");
+
+    const char *data7 =
+        "This is a test using a larger than block-size key and a larger than "
+        "block-size data. The key needs to be hashed before being used by the "
+        "HMAC algorithm.";
+    set_vector(&vectors[5], "Test Case 7", key, 131, data7, strlen(data7),
+               "9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2");
+}
+
+// Test the one-shot HMAC against RFC 4231
+void test_hmac_known_answer() {
+    printf("\n=== Testing HMAC known answers ===\n");
+
+    for (int i = 0; i < NUM_VECTORS; i++) {
+        printf("Test vector: %s\n", vectors[i].name);
+
+        buf_t key, data, out;
+        buf_view(&key, vectors[i].key, vectors[i].key_len);
+        buf_view(&data, vectors[i].data, vectors[i].data_len);
+        buf_init(&out, SHA256_HASH_SIZE);
+
+        hmac_sha256_hash(&key, &data, &out);
+        ASSERT_EQUAL_SIZE((size_t)SHA256_HASH_SIZE, out.size, "MAC should be 32 bytes long");
+        ASSERT_EQUAL_MEM(vectors[i].expected, out.data, SHA256_HASH_SIZE,
+                        "MAC should match the RFC 4231 vector");
+        buf_free(&out);
+    }
+
+    TEST_PASS();
+}
+
+// Test that a keyed context gives the same MACs, and can be reused
+void test_hmac_context() {
+    printf("\n=== Testing HMAC context ===\n");
+
+    for (int i = 0; i < NUM_VECTORS; i++) {
+        printf("Test vector: %s\n", vectors[i].name);
+
+        buf_t key, out;
+        buf_view(&key, vectors[i].key, vectors[i].key_len);
+        buf_init(&out, SHA256_HASH_SIZE);
+
+        hmac_sha256_ctx_t ctx;
+        hmac_sha256_init(&ctx, &key);
+
+        // Feed the message a few bytes at a time
+        for (size_t pos = 0; pos < vectors[i].data_len; pos += 7) {
+            size_t len = vectors[i].data_len - pos < 7 ? vectors[i].data_len - pos : 7;
+            buf_t piece;
+            buf_view(&piece, vectors[i].data + pos, len);
+            hmac_sha256_update(&ctx, &piece);
+        }
+        hmac_sha256_final(&ctx, &out);
+        ASSERT_EQUAL_MEM(vectors[i].expected, out.data, SHA256_HASH_SIZE,
+                        "Incremental MAC should match the RFC 4231 vector");
+
+        // A different message under the same key shouldn't change the next one
+        buf_t other;
+        buf_view(&other, "another message", 15);
+        hmac_sha256_reset(&ctx);
+        hmac_sha256_update(&ctx, &other);
+        hmac_sha256_final(&ctx, &out);
+        ASSERT_FALSE(memcmp(vectors[i].expected, out.data, SHA256_HASH_SIZE) == 0,
+                    "A different message should give a different MAC");
+
+        // Reusing the context after a reset gives the same MAC again
+        buf_t data;
+        buf_view(&data, vectors[i].data, vectors[i].data_len);
+        hmac_sha256_reset(&ctx);
+        hmac_sha256_update(&ctx, &data);
+        hmac_sha256_final(&ctx, &out);
+        ASSERT_EQUAL_MEM(vectors[i].expected, out.data, SHA256_HASH_SIZE,
+                        "Reused context should match the RFC 4231 vector");
+
+        buf_free(&out);
+    }
+
+    TEST_PASS();
+}
+
+// Test the two-compression MAC of a digest against the general one
+void test_hmac_hash_digest() {
+    printf("\n=== Testing HMAC of a digest ===\n");
+
+    for (int i = 0; i < NUM_VECTORS; i++) {
+        printf("Test vector: %s\n", vectors[i].name);
+
+        buf_t key, message, out;
+        buf_view(&key, vectors[i].key, vectors[i].key_len);
+        buf_view(&message, vectors[i].expected, SHA256_HASH_SIZE);
+        buf_init(&out, SHA256_HASH_SIZE);
+
+        // The expected MAC of the vector's own MAC, computed the long way
+        hmac_sha256_hash(&key, &message, &out);
+
+        hmac_sha256_ctx_t ctx;
+        hmac_sha256_init(&ctx, &key);
+
+        uint8_t digest[SHA256_HASH_SIZE];
+        hmac_sha256_hash_digest(&ctx, vectors[i].expected, digest);
+        ASSERT_EQUAL_MEM(out.data, digest, SHA256_HASH_SIZE,
+                        "Digest MAC should match the general MAC");
+
+        // The output can overwrite the input
+        memcpy(digest, vectors[i].expected, SHA256_HASH_SIZE);
+        hmac_sha256_hash_digest(&ctx, digest, digest);
+        ASSERT_EQUAL_MEM(out.data, digest, SHA256_HASH_SIZE,
+                        "Digest MAC should work in place");
+
+        // The current message of the context isn't affected
+        buf_t data;
+        buf_view(&data, vectors[i].data, vectors[i].data_len);
+        hmac_sha256_update(&ctx, &data);
+        hmac_sha256_final(&ctx, &out);
+        ASSERT_EQUAL_MEM(vectors[i].expected, out.data, SHA256_HASH_SIZE,
+                        "Context should still give the RFC 4231 MAC");
+
+        buf_free(&out);
+    }
+
+    TEST_PASS();
+}
+
+int main() {
+    printf("=== HMAC Test Suite ===\n");
+    printf("Platform: %s\n", PLATFORM_NAME);
+
+    init_vectors();
+
+    TEST_SUITE_BEGIN();
+
+    test_hmac_known_answer();
+    test_hmac_context();
+    test_hmac_hash_digest();
+
+    TEST_SUITE_END();
+}
@@ -0,0 +1,480 @@
+// For O_DIRECT
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Cross-platform compatibility
+#ifdef _WIN32
+    #include <windows.h>
+    #define PLATFORM_NAME "Windows"
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #define PLATFORM_NAME "Unix"
+#endif
+
+#include "constants.h"
+#include "core/buffer.h"
+#include "core/iostream.h"
+#include "crypto/cipher.h"
+#include "stddefs.h"
+#include "test_framework.h"
+
+// Constants for testing
+#define NUM_KINDS 3
+#define MAX_DATA_SIZE (1024 * 1024)
+#define DATA_SIZE (600 * 1024 + 123)
+#define TEST_PATH "/tmp/transcodine_iostream_test.bin"
+#define REFERENCE_PATH "/tmp/transcodine_iostream_reference.bin"
+
+// An odd header, so no offset in the stream lines up with a direct IO block
+#define HEADER_SIZE 37
+#define HEADER_BYTE 0xa5
+
+// How a stream reaches the file
+typedef enum {
+    STREAM_BUFFERED,
+    STREAM_DIRECT,
+    STREAM_MAPPED
+} stream_kind_t;
+
+static const char *kind_names[NUM_KINDS] = {"buffered", "direct", "mapped"};
+
+// An IO at an offset into the stream
+typedef struct {
+    size_t offset;
+    size_t len;
+} io_op_t;
+
+// The cleartext the file under test is expected to hold
+static uint8_t model[MAX_DATA_SIZE];
+static size_t model_size;
+
+// Scratch space for data going in and out of the streams
+static uint8_t scratch[MAX_DATA_SIZE];
+static uint8_t file_data[MAX_DATA_SIZE];
+static uint8_t reference_data[MAX_DATA_SIZE];
+
+static cipher_ctx_t cipher;
+static uint8_t iv_data[AES_IV_SIZE];
+static buf_t iv;
+
+// Helper function to fill a buffer with a repeatable pattern
+void create_test_data(uint8_t *data, size_t size, uint8_t seed) {
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)(i * 31 + seed);
+    }
+}
+
+// Helper function to set up the cipher shared by every stream
+void init_cipher() {
+    uint8_t key[AES_KEY_SIZE];
+    buf_t key_buf;
+    create_test_data(key, AES_KEY_SIZE, 0x3c);
+    buf_view(&key_buf, key, AES_KEY_SIZE);
+    cipher_init(&cipher, CIPHER_AES_CTR, &key_buf);
+    create_test_data(iv_data, AES_IV_SIZE, 0x77);
+    buf_view(&iv, iv_data, AES_IV_SIZE);
+}
+
+// Helper function to create a file holding nothing but the plain header
+void create_file(const char *path) {
+    uint8_t header[HEADER_SIZE];
+    memset(header, HEADER_BYTE, HEADER_SIZE);
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Error: Could not create %s\n", path);
+        exit(1);
+    }
+    fwrite(header, 1, HEADER_SIZE, file);
+    fclose(file);
+}
+
+// Helper function to read a whole file, returning its size
+size_t read_file(const char *path, uint8_t *data) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return 0;
+    size_t size = fread(data, 1, MAX_DATA_SIZE, file);
+    fclose(file);
+    return size;
+}
+
+// Helper function to open a file for a kind of stream. Returns -1 if the file
+// system doesn't support that kind.
+int open_stream(iostream_t *ios, const char *path, stream_kind_t kind) {
+    int flags = O_RDWR;
+    if (kind == STREAM_DIRECT) flags |= O_DIRECT;
+    int fd = open(path, flags);
+    if (fd < 0) return -1;
+
+    iostream_init_fd(ios, fd, &cipher, &iv, HEADER_SIZE);
+    if (kind == STREAM_MAPPED && !iostream_map(ios, IOSTREAM_RANDOM)) {
+        iostream_free(ios);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Helper function to write a patterned chunk at an offset into the stream,
+// applying the same change to the model
+void stream_write(iostream_t *ios, size_t offset, size_t len, uint8_t seed) {
+    buf_t data;
+    create_test_data(scratch, len, seed);
+    buf_view(&data, scratch, len);
+    iostream_seek(ios, offset);
+    iostream_write(ios, &data);
+
+    memcpy(model + offset, scratch, len);
+    if (offset + len > model_size) model_size = offset + len;
+}
+
+// Helper function to read a chunk from an offset into the scratch space
+void stream_read(iostream_t *ios, size_t offset, size_t len) {
+    buf_t data;
+    buf_view(&data, scratch, len);
+    data.size = 0;
+    iostream_seek(ios, offset);
+    iostream_read(ios, len, &data);
+}
+
+// Helper function to write the model to a file through a buffered stream
+void write_reference(const char *path) {
+    iostream_t ios;
+    create_file(path);
+    int fd = open_stream(&ios, path, STREAM_BUFFERED);
+    buf_t data;
+    buf_view(&data, model, model_size);
+    iostream_write(&ios, &data);
+    iostream_free(&ios);
+    close(fd);
+}
+
+// Test that unaligned writes through direct and buffered streams give the same
+// file, including writes which end inside a block
+void test_iostream_unaligned_writes() {
+    printf("\n=== Testing unaligned iostream writes ===\n");
+
+    // Start small and grow past a window, a direct block, and an io_uring block
+    const size_t fill_lengths[] = {1, 7, 100, 4095, 4097, 16383, 16384, 20000,
+                                   65539, 131072, 200001};
+
+    // Overwrites inside a block, across block boundaries, of exactly a window,
+    // and one which grows the file and ends inside a block
+    const io_op_t overwrites[] = {
+        {5000, 100},
+        {4090, 10},
+        {8191, 1},
+        {12345, 70000},
+        {100, IOSTREAM_WINDOW_SIZE},
+        {DATA_SIZE - 10, 5000}
+    };
+
+    size_t reference_size = 0;
+    for (int k = STREAM_BUFFERED; k <= STREAM_DIRECT; k++) {
+        iostream_t ios;
+        create_file(TEST_PATH);
+        int fd = open_stream(&ios, TEST_PATH, (stream_kind_t)k);
+        if (fd < 0) {
+            printf("Skipping unsupported stream: %s\n", kind_names[k]);
+            continue;
+        }
+        printf("Testing stream: %s\n", kind_names[k]);
+        ASSERT_TRUE(ios.direct == (k == STREAM_DIRECT),
+                   "Only descriptors opened with O_DIRECT should be direct");
+        model_size = 0;
+
+        // Fill the file sequentially with writes of awkward lengths
+        size_t offset = 0;
+        for (size_t i = 0; offset < DATA_SIZE; i++) {
+            size_t len = fill_lengths[i % (sizeof(fill_lengths) / sizeof(fill_lengths[0]))];
+            if (len > DATA_SIZE - offset) len = DATA_SIZE - offset;
+            stream_write(&ios, offset, len, (uint8_t)i);
+            offset += len;
+        }
+        ASSERT_EQUAL_SIZE((size_t)DATA_SIZE, iostream_tell(&ios),
+                         "Stream should be at the end of the writes");
+
+        for (size_t i = 0; i < sizeof(overwrites) / sizeof(overwrites[0]); i++) {
+            stream_write(&ios, overwrites[i].offset, overwrites[i].len,
+                         (uint8_t)(0x80 + i));
+        }
+
+        // Flushing cuts off the padding of a direct stream while it stays open
+        iostream_flush(&ios);
+        ASSERT_EQUAL_SIZE(HEADER_SIZE + model_size, iostream_file_size(fd),
+                         "Flushed file should have its real length");
+
+        // Writing after a flush pads the file again until the stream is freed
+        stream_write(&ios, model_size - 3, 6, 0xf0);
+        iostream_free(&ios);
+        close(fd);
+
+        size_t size = read_file(TEST_PATH, file_data);
+        ASSERT_EQUAL_SIZE(HEADER_SIZE + model_size, size,
+                         "Freed file should have its real length");
+        for (size_t i = 0; i < HEADER_SIZE; i++) {
+            ASSERT_TRUE(file_data[i] == HEADER_BYTE,
+                       "Header before the stream should be untouched");
+        }
+
+        // Every kind of stream should produce the same ciphertext
+        if (reference_size == 0) {
+            memcpy(reference_data, file_data, size);
+            reference_size = size;
+        } else {
+            ASSERT_EQUAL_SIZE(reference_size, size,
+                             "File should be as long as the buffered one");
+            ASSERT_EQUAL_MEM(reference_data, file_data, size,
+                            "File should match the buffered one");
+        }
+
+        // Decrypting the file gives back what was written
+        fd = open_stream(&ios, TEST_PATH, STREAM_BUFFERED);
+        stream_read(&ios, 0, model_size);
+        ASSERT_EQUAL_MEM(model, scratch, model_size,
+                        "File should decrypt to the data written");
+        iostream_free(&ios);
+        close(fd);
+    }
+
+    remove(TEST_PATH);
+    TEST_PASS();
+}
+
+// Test reads at unaligned offsets and lengths through every kind of stream
+void test_iostream_unaligned_reads() {
+    printf("\n=== Testing unaligned iostream reads ===\n");
+
+    const io_op_t reads[] = {
+        {0, 1},
+        {1, 4095},
+        {4095, 2},
+        {4096, 4096},
+        {5000, 100},
+        {16383, 16386},
+        {12345, 70000},
+        {100000, 150000},
+        {DATA_SIZE - 3, 3},
+        {0, DATA_SIZE}
+    };
+
+    create_test_data(model, DATA_SIZE, 0x21);
+    model_size = DATA_SIZE;
+    write_reference(REFERENCE_PATH);
+
+    for (int k = 0; k < NUM_KINDS; k++) {
+        iostream_t ios;
+        int fd = open_stream(&ios, REFERENCE_PATH, (stream_kind_t)k);
+        if (fd < 0) {
+            printf("Skipping unsupported stream: %s\n", kind_names[k]);
+            continue;
+        }
+        printf("Testing stream: %s\n", kind_names[k]);
+
+        for (size_t i = 0; i < sizeof(reads) / sizeof(reads[0]); i++) {
+            stream_read(&ios, reads[i].offset, reads[i].len);
+            ASSERT_EQUAL_MEM(model + reads[i].offset, scratch, reads[i].len,
+                            "Read should match the data written");
+            ASSERT_EQUAL_SIZE(reads[i].offset + reads[i].len, iostream_tell(&ios),
+                             "Stream should be at the end of the read");
+        }
+
+        // Read the whole file again in odd-sized pieces, one after another
+        iostream_seek(&ios, 0);
+        size_t offset = 0;
+        for (size_t len = 1; offset < DATA_SIZE; len = len * 3 + 1) {
+            if (len > DATA_SIZE - offset) len = DATA_SIZE - offset;
+            buf_t data;
+            buf_view(&data, scratch, len);
+            data.size = 0;
+            iostream_read(&ios, len, &data);
+            ASSERT_EQUAL_MEM(model + offset, scratch, len,
+                            "Sequential read should match the data written");
+            offset += len;
+        }
+
+        iostream_free(&ios);
+        close(fd);
+    }
+
+    remove(REFERENCE_PATH);
+    TEST_PASS();
+}
+
+// Test seeking forward and back, past the window and inside a mapping
+void test_iostream_seek() {
+    printf("\n=== Testing iostream seek ===\n");
+
+    // Each seek lands outside the window left by the read before it, except
+    // the ones going back to a record which was just read
+    const io_op_t reads[] = {
+        {0, 10},
+        {39990, 10},
+        {5, 20},
+        {50000, 100},
+        {49990, 20},
+        {50050, 100},
+        {DATA_SIZE - IOSTREAM_WINDOW_SIZE - 1, IOSTREAM_WINDOW_SIZE + 1},
+        {0, 10},
+        {DATA_SIZE - 1, 1}
+    };
+
+    create_test_data(model, DATA_SIZE, 0x4f);
+    model_size = DATA_SIZE;
+    write_reference(REFERENCE_PATH);
+
+    for (int k = 0; k < NUM_KINDS; k++) {
+        iostream_t ios;
+        int fd = open_stream(&ios, REFERENCE_PATH, (stream_kind_t)k);
+        if (fd < 0) {
+            printf("Skipping unsupported stream: %s\n", kind_names[k]);
+            continue;
+        }
+        printf("Testing stream: %s\n", kind_names[k]);
+
+        for (size_t i = 0; i < sizeof(reads) / sizeof(reads[0]); i++) {
+            stream_read(&ios, reads[i].offset, reads[i].len);
+            ASSERT_EQUAL_MEM(model + reads[i].offset, scratch, reads[i].len,
+                            "Read after a seek should match the data written");
+        }
+
+        // Skipping and seeking only move the offset
+        iostream_seek(&ios, 1000);
+        iostream_skip(&ios, 234);
+        ASSERT_EQUAL_SIZE((size_t)1234, iostream_tell(&ios),
+                         "Skip should move on from the seek");
+        stream_read(&ios, iostream_tell(&ios), 10);
+        ASSERT_EQUAL_MEM(model + 1234, scratch, 10,
+                        "Read after a skip should match the data written");
+
+        if (k == STREAM_MAPPED) {
+            ASSERT_NOT_NULL(ios.map, "Reads shouldn't drop the mapping");
+        }
+
+        iostream_free(&ios);
+        close(fd);
+    }
+
+    remove(REFERENCE_PATH);
+    TEST_PASS();
+}
+
+// Test going back over records written with a vectored write
+void test_iostream_seek_writev() {
+    printf("\n=== Testing iostream seek after writev ===\n");
+
+    // Records shaped like bin entries. The small one stays in the window, the
+    // large one goes out in a single vectored write, and the last one grows the
+    // file.
+    const size_t record_offsets[] = {3000, 20000, DATA_SIZE - 100};
+    const size_t record_data_lens[] = {20, 30000, 70001};
+
+    for (int k = 0; k < NUM_KINDS; k++) {
+        create_test_data(model, DATA_SIZE, 0x6a);
+        model_size = DATA_SIZE;
+        write_reference(TEST_PATH);
+
+        iostream_t ios;
+        int fd = open_stream(&ios, TEST_PATH, (stream_kind_t)k);
+        if (fd < 0) {
+            printf("Skipping unsupported stream: %s\n", kind_names[k]);
+            continue;
+        }
+        printf("Testing stream: %s\n", kind_names[k]);
+
+        // Mapped streams are read first, so the write has to drop the mapping
+        if (k == STREAM_MAPPED) {
+            stream_read(&ios, 10000, 5000);
+            ASSERT_EQUAL_MEM(model + 10000, scratch, 5000,
+                            "Mapped read should match the data written");
+        }
+
+        for (size_t i = 0; i < sizeof(record_offsets) / sizeof(record_offsets[0]); i++) {
+            size_t offset = record_offsets[i];
+            size_t data_len = record_data_lens[i];
+
+            // Build the record in the scratch space, then apply it to the model
+            uint8_t type[BIN_MAGIC_SIZE];
+            size_t header[2] = {7, data_len};
+            create_test_data(type, BIN_MAGIC_SIZE, (uint8_t)(0x10 + i));
+            create_test_data(scratch, data_len, (uint8_t)(0x30 + i));
+
+            buf_t type_buf, header_buf, data_buf;
+            buf_view(&type_buf, type, BIN_MAGIC_SIZE);
+            buf_view(&header_buf, header, sizeof(header));
+            buf_view(&data_buf, scratch, data_len);
+            const buf_t *record[3];
+            record[0] = &type_buf;
+            record[1] = &header_buf;
+            record[2] = &data_buf;
+
+            // Read over the old bytes first, so the window holds them
+            stream_read(&ios, offset - 50, 100);
+            ASSERT_EQUAL_MEM(model + offset - 50, scratch, 100,
+                            "Bytes under the record should match the data written");
+            create_test_data(scratch, data_len, (uint8_t)(0x30 + i));
+
+            iostream_seek(&ios, offset);
+            iostream_writev(&ios, record, 3);
+            size_t total = BIN_MAGIC_SIZE + sizeof(header) + data_len;
+            ASSERT_EQUAL_SIZE(offset + total, iostream_tell(&ios),
+                             "Stream should be at the end of the record");
+
+            memcpy(model + offset, type, BIN_MAGIC_SIZE);
+            memcpy(model + offset + BIN_MAGIC_SIZE, header, sizeof(header));
+            memcpy(model + offset + BIN_MAGIC_SIZE + sizeof(header), scratch,
+                   data_len);
+            if (offset + total > model_size) model_size = offset + total;
+
+            // Go back over the record and the bytes around it before flushing
+            size_t start = offset - 50;
+            size_t len = total + 50;
+            if (start + len + 50 <= model_size) len += 50;
+            stream_read(&ios, start, len);
+            ASSERT_EQUAL_MEM(model + start, scratch, len,
+                            "Record should read back after a seek");
+        }
+
+        if (k == STREAM_MAPPED) {
+            ASSERT_NULL(ios.map, "Writes should drop the mapping");
+        }
+
+        // Everything written should be readable from the start again
+        stream_read(&ios, 0, model_size);
+        ASSERT_EQUAL_MEM(model, scratch, model_size,
+                        "Whole stream should read back after the writes");
+        iostream_free(&ios);
+        close(fd);
+
+        ASSERT_EQUAL_SIZE(HEADER_SIZE + model_size, read_file(TEST_PATH, file_data),
+                         "File should end at the last record");
+        fd = open_stream(&ios, TEST_PATH, STREAM_BUFFERED);
+        stream_read(&ios, 0, model_size);
+        ASSERT_EQUAL_MEM(model, scratch, model_size,
+                        "File should decrypt to the records written");
+        iostream_free(&ios);
+        close(fd);
+    }
+
+    remove(TEST_PATH);
+    TEST_PASS();
+}
+
+int main() {
+    printf("=== IOStream Test Suite ===\n");
+    printf("Platform: %s\n", PLATFORM_NAME);
+
+    init_cipher();
+
+    TEST_SUITE_BEGIN();
+
+    test_iostream_unaligned_writes();
+    test_iostream_unaligned_reads();
+    test_iostream_seek();
+    test_iostream_seek_writev();
+
+    TEST_SUITE_END();
+}
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Cross-platform compatibility
+#ifdef _WIN32
+    #include <windows.h>
+    #define PLATFORM_NAME "Windows"
+#else
+    #include <unistd.h>
+    #define PLATFORM_NAME "Unix"
+#endif
+
+#include "core/buffer.h"
+#include "crypto/pbkdf2.h"
+#include "crypto/sha256.h"
+#include "stddefs.h"
+#include "test_framework.h"
+
+// Constants for testing
+#define MAX_KEY_SIZE 128
+#define NUM_JOBS 24
+
+static const sha256_backend_t backends[] = {
+    SHA256_BACKEND_PORTABLE,
+    SHA256_BACKEND_SHANI
+};
+
+static const char *backend_names[] = {"portable", "SHA-NI"};
+
+// Helper function to convert a hex string to binary
+void hex_to_bin(const char *hex, uint8_t *out, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        sscanf(&hex[i * 2], "%02hhx", &out[i]);
+    }
+}
+
+// Test PBKDF2-HMAC-SHA256 against published vectors for each backend
+void test_pbkdf2_known_answer() {
+    printf("\n=== Testing PBKDF2 known answers ===\n");
+
+    // The first vector is from Section 11 of RFC 7914
+    struct {
+        const char *password;
+        const char *salt;
+        size_t iterations;
+        size_t dklen;
+        const char *expected_hex;
+    } test_vectors[] = {
+        {
+            "passwd", "salt", 1, 64,
+            "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+            "49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783"
+        },
+        {
+            "password", "salt", 1, 32,
+            "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b"
+        },
+        {
+            "password", "salt", 4096, 32,
+            "c5e478d59288c841aa530db6845c4c8d962893a001ce4e11a4963873aa98134a"
+        },
+        {
+            "passwordPASSWORDpassword",
+            "saltSALTsaltSALTsaltSALTsaltSALTsalt", 4096, 40,
+            "348c89dbcbd32b2f32d814b8116e84cf2b17347ebc1800181c4e2a1fb8dd53e1"
+            "c635518c7dac47e9"
+        }
+    };
+
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        if (!sha256_set_backend(backends[b])) {
+            printf("Skipping unsupported backend: %s\n", backend_names[b]);
+            continue;
+        }
+        printf("Testing backend: %s\n", backend_names[b]);
+
+        for (size_t i = 0; i < sizeof(test_vectors) / sizeof(test_vectors[0]); i++) {
+            uint8_t expected[MAX_KEY_SIZE];
+            hex_to_bin(test_vectors[i].expected_hex, expected,
+                       test_vectors[i].dklen);
+
+            buf_t password, salt, key;
+            buf_view(&password, (void *)test_vectors[i].password,
+                     strlen(test_vectors[i].password));
+            buf_view(&salt, (void *)test_vectors[i].salt,
+                     strlen(test_vectors[i].salt));
+            buf_init(&key, test_vectors[i].dklen);
+
+            pbkdf2_hmac_sha256_hash(&password, &salt, test_vectors[i].iterations,
+                                    &key, test_vectors[i].dklen);
+            ASSERT_EQUAL_SIZE(test_vectors[i].dklen, key.size,
+                            "Derived key should have the requested length");
+            ASSERT_EQUAL_MEM(expected, key.data, test_vectors[i].dklen,
+                            "Derived key should match the published vector");
+            buf_free(&key);
+        }
+    }
+
+    sha256_set_backend(SHA256_BACKEND_PORTABLE);
+    TEST_PASS();
+}
+
+// Test that a batch of derivations gives the same keys as separate calls
+void test_pbkdf2_hash_many() {
+    printf("\n=== Testing batched PBKDF2 ===\n");
+
+    // Mix lengths which take one, two, and four output blocks, so the chains
+    // of a single job end up in different lanes
+    const size_t dklens[] = {1, 16, 32, 33, 64, 100};
+    const size_t iterations[] = {1, 2, 100, 1000};
+
+    char passwords[NUM_JOBS][32];
+    char salts[NUM_JOBS][32];
+    buf_t password_bufs[NUM_JOBS];
+    buf_t salt_bufs[NUM_JOBS];
+    pbkdf2_job_t jobs[NUM_JOBS];
+
+    for (size_t i = 0; i < NUM_JOBS; i++) {
+        sprintf(passwords[i], "password-%zu", i);
+        sprintf(salts[i], "salt-%zu", i * 7);
+        buf_view(&password_bufs[i], passwords[i], strlen(passwords[i]));
+        buf_view(&salt_bufs[i], salts[i], strlen(salts[i]));
+        jobs[i].data = &password_bufs[i];
+        jobs[i].salt = &salt_bufs[i];
+        jobs[i].iterations = iterations[i % 4];
+        jobs[i].dklen = dklens[i % 6];
+    }
+
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        if (!sha256_set_backend(backends[b])) {
+            printf("Skipping unsupported backend: %s\n", backend_names[b]);
+            continue;
+        }
+        printf("Testing backend: %s\n", backend_names[b]);
+
+        buf_t outputs[NUM_JOBS];
+        for (size_t i = 0; i < NUM_JOBS; i++) {
+            buf_init(&outputs[i], MAX_KEY_SIZE);
+            jobs[i].out = &outputs[i];
+        }
+        pbkdf2_hmac_sha256_hash_many(jobs, NUM_JOBS);
+
+        for (size_t i = 0; i < NUM_JOBS; i++) {
+            buf_t expected;
+            buf_init(&expected, MAX_KEY_SIZE);
+            pbkdf2_hmac_sha256_hash(jobs[i].data, jobs[i].salt,
+                                    jobs[i].iterations, &expected,
+                                    jobs[i].dklen);
+
+            ASSERT_EQUAL_SIZE(jobs[i].dklen, outputs[i].size,
+                            "Batched key should have the requested length");
+            ASSERT_EQUAL_MEM(expected.data, outputs[i].data, jobs[i].dklen,
+                            "Batched key should match a separate derivation");
+            buf_free(&expected);
+            buf_free(&outputs[i]);
+        }
+    }
+
+    sha256_set_backend(SHA256_BACKEND_PORTABLE);
+    TEST_PASS();
+}
+
+int main() {
+    printf("=== PBKDF2 Test Suite ===\n");
+    printf("Platform: %s\n", PLATFORM_NAME);
+
+    // Chains only share SIMD lanes once they outnumber the threads, so keep
+    // the pool small enough for the batched test to reach the lanes
+#ifndef _WIN32
+    setenv("TRANSCODINE_THREADS", "2", 0);
+#endif
+
+    TEST_SUITE_BEGIN();
+
+    test_pbkdf2_known_answer();
+    test_pbkdf2_hash_many();
+
+    TEST_SUITE_END();
+}
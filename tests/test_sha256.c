@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Cross-platform compatibility
+#ifdef _WIN32
+    #include <windows.h>
+    #define PLATFORM_NAME "Windows"
+#else
+    #include <unistd.h>
+    #define PLATFORM_NAME "Unix"
+#endif
+
+#include "core/buffer.h"
+#include "crypto/sha256.h"
+#include "crypto/sha256_mb.h"
+#include "crypto/sha256_ni.h"
+#include "stddefs.h"
+#include "test_framework.h"
+
+// Constants for testing
+#define MAX_TEST_DATA_SIZE 4096
+
+// Helper function to convert a hex string to binary
+void hex_to_bin(const char *hex, uint8_t *out, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        sscanf(&hex[i * 2], "%02hhx", &out[i]);
+    }
+}
+
+// Helper function to fill a buffer with a repeatable pattern
+void create_test_data(uint8_t *data, size_t size, uint8_t seed) {
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)(i * 31 + seed);
+    }
+}
+
+// Helper function to hash raw memory in one call
+void hash_data(const uint8_t *data, size_t len, sha256_hash_t *digest) {
+    buf_t buf;
+    buf_view(&buf, (void *)data, len);
+    sha256_hash(&buf, digest);
+}
+
+// Test the hash against the vectors from FIPS 180-4 for each backend
+void test_sha256_known_answer() {
+    printf("\n=== Testing SHA256 known answers ===\n");
+
+    struct {
+        const char *input;
+        const char *expected_hex;
+    } test_vectors[] = {
+        {
+            "",
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+        },
+        {
+            "abc",
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"
+        },
+        {
+            "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+            "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"
+        },
+        {
+            "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+            "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+            "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"
+        }
+    };
+
+    const sha256_backend_t backends[] = {
+        SHA256_BACKEND_PORTABLE,
+        SHA256_BACKEND_SHANI
+    };
+    const char *backend_names[] = {"portable", "SHA-NI"};
+
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        if (!sha256_set_backend(backends[b])) {
+            printf("Skipping unsupported backend: %s\n", backend_names[b]);
+            continue;
+        }
+        printf("Testing backend: %s\n", backend_names[b]);
+
+        for (size_t i = 0; i < sizeof(test_vectors) / sizeof(test_vectors[0]); i++) {
+            uint8_t expected[SHA256_HASH_SIZE];
+            hex_to_bin(test_vectors[i].expected_hex, expected, SHA256_HASH_SIZE);
+
+            sha256_hash_t digest;
+            hash_data((const uint8_t *)test_vectors[i].input,
+                      strlen(test_vectors[i].input), &digest);
+            ASSERT_EQUAL_MEM(expected, digest.bytes, SHA256_HASH_SIZE,
+                            "Hash should match the FIPS 180-4 vector");
+        }
+    }
+
+    sha256_set_backend(SHA256_BACKEND_PORTABLE);
+    TEST_PASS();
+}
+
+// Test that the SHA extensions give the same hashes as the portable code
+void test_sha256_ni_matches_portable() {
+    printf("\n=== Testing SHA-NI against portable SHA256 ===\n");
+
+    if (!sha256_ni_available()) {
+        TEST_SKIP("The processor doesn't support the SHA extensions");
+    }
+
+    // Lengths around the padding boundary, where the length no longer fits in
+    // the last block, along with whole and partial multi-block messages
+    const size_t lengths[] = {0, 1, 55, 56, 63, 64, 65, 119, 120, 128, 1000,
+                              MAX_TEST_DATA_SIZE};
+    uint8_t data[MAX_TEST_DATA_SIZE];
+    create_test_data(data, MAX_TEST_DATA_SIZE, 0x6b);
+
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        sha256_hash_t expected, digest;
+
+        sha256_set_backend(SHA256_BACKEND_PORTABLE);
+        hash_data(data, lengths[i], &expected);
+
+        sha256_set_backend(SHA256_BACKEND_SHANI);
+        hash_data(data, lengths[i], &digest);
+
+        printf("Testing length %zu\n", lengths[i]);
+        ASSERT_EQUAL_MEM(expected.bytes, digest.bytes, SHA256_HASH_SIZE,
+                        "SHA-NI hash should match the portable hash");
+    }
+
+    // The compression functions should agree on the raw state as well
+    uint32_t expected_state[8], state[8];
+    memcpy(expected_state, sha256_initial_state, sizeof(expected_state));
+    memcpy(state, sha256_initial_state, sizeof(state));
+    sha256_set_backend(SHA256_BACKEND_PORTABLE);
+    sha256_compress(expected_state, data, MAX_TEST_DATA_SIZE / SHA256_BLOCK_SIZE);
+    sha256_ni_compress(state, data, MAX_TEST_DATA_SIZE / SHA256_BLOCK_SIZE);
+    ASSERT_EQUAL_MEM(expected_state, state, sizeof(state),
+                    "SHA-NI state should match the portable state");
+
+    sha256_set_backend(SHA256_BACKEND_PORTABLE);
+    TEST_PASS();
+}
+
+// Test that the multi-buffer lanes give the same states as the portable code
+void test_sha256_mb_matches_portable() {
+    printf("\n=== Testing multi-buffer SHA256 against portable SHA256 ===\n");
+
+    if (!sha256_mb_available()) {
+        printf("No SIMD kernels, so the lanes run one after another\n");
+    }
+    sha256_set_backend(SHA256_BACKEND_PORTABLE);
+
+    uint8_t data[SHA256_MB_LANES * 4 * SHA256_BLOCK_SIZE];
+    create_test_data(data, sizeof(data), 0x4f);
+
+    for (size_t lanes = 1; lanes <= SHA256_MB_LANES; lanes++) {
+        uint32_t expected[SHA256_MB_LANES][8];
+        uint32_t states[SHA256_MB_LANES][8];
+        const uint8_t *blocks[SHA256_MB_LANES];
+
+        // Every lane starts from a different state and hashes different data
+        for (size_t l = 0; l < lanes; l++) {
+            memcpy(expected[l], sha256_initial_state, sizeof(expected[l]));
+            sha256_compress(expected[l], data + l * SHA256_BLOCK_SIZE, 1);
+            memcpy(states[l], expected[l], sizeof(states[l]));
+        }
+
+        // Compress a few blocks into each lane, one block per call
+        for (size_t round = 0; round < 3; round++) {
+            for (size_t l = 0; l < lanes; l++) {
+                blocks[l] = data + ((l * 4 + round + 1) * SHA256_BLOCK_SIZE);
+                sha256_compress(expected[l], blocks[l], 1);
+            }
+            sha256_mb_compress(states, blocks, lanes);
+        }
+
+        printf("Testing %zu lanes\n", lanes);
+        ASSERT_EQUAL_MEM(expected, states, lanes * sizeof(states[0]),
+                        "Every lane should match the portable state");
+    }
+
+    TEST_PASS();
+}
+
+// Test whole messages of different lengths hashed side by side in the lanes
+void test_sha256_mb_messages() {
+    printf("\n=== Testing multi-buffer SHA256 messages ===\n");
+
+    const size_t lengths[SHA256_MB_LANES] = {0, 55, 56, 64, 65, 119, 120, 200};
+    uint8_t data[MAX_TEST_DATA_SIZE];
+    uint8_t padded[SHA256_MB_LANES][4 * SHA256_BLOCK_SIZE];
+    size_t num_blocks[SHA256_MB_LANES];
+    uint32_t states[SHA256_MB_LANES][8];
+    create_test_data(data, MAX_TEST_DATA_SIZE, 0x3c);
+    sha256_set_backend(SHA256_BACKEND_PORTABLE);
+
+    // Pad each message by hand, with the bit length at the end of its last block
+    for (size_t l = 0; l < SHA256_MB_LANES; l++) {
+        size_t len = lengths[l];
+        uint64_t bits = (uint64_t)len * 8;
+        num_blocks[l] = (len + 8) / SHA256_BLOCK_SIZE + 1;
+        memset(padded[l], 0, sizeof(padded[l]));
+        memcpy(padded[l], data, len);
+        padded[l][len] = 0x80;
+        for (int i = 0; i < 8; i++) {
+            padded[l][num_blocks[l] * SHA256_BLOCK_SIZE - 1 - i] =
+                (uint8_t)(bits >> (8 * i));
+        }
+        memcpy(states[l], sha256_initial_state, sizeof(states[l]));
+    }
+
+    // Lanes drop out of the batch once their message runs out of blocks
+    for (size_t round = 0; round < 4; round++) {
+        uint32_t batch[SHA256_MB_LANES][8];
+        const uint8_t *blocks[SHA256_MB_LANES];
+        size_t owners[SHA256_MB_LANES];
+        size_t lanes = 0;
+
+        for (size_t l = 0; l < SHA256_MB_LANES; l++) {
+            if (round >= num_blocks[l]) continue;
+            memcpy(batch[lanes], states[l], sizeof(batch[lanes]));
+            blocks[lanes] = padded[l] + round * SHA256_BLOCK_SIZE;
+            owners[lanes++] = l;
+        }
+        if (lanes == 0) break;
+
+        sha256_mb_compress(batch, blocks, lanes);
+        for (size_t i = 0; i < lanes; i++) {
+            memcpy(states[owners[i]], batch[i], sizeof(batch[i]));
+        }
+    }
+
+    for (size_t l = 0; l < SHA256_MB_LANES; l++) {
+        sha256_hash_t expected;
+        hash_data(data, lengths[l], &expected);
+
+        uint8_t digest[SHA256_HASH_SIZE];
+        for (int i = 0; i < 8; i++) {
+            digest[i * 4] = (uint8_t)(states[l][i] >> 24);
+            digest[i * 4 + 1] = (uint8_t)(states[l][i] >> 16);
+            digest[i * 4 + 2] = (uint8_t)(states[l][i] >> 8);
+            digest[i * 4 + 3] = (uint8_t)states[l][i];
+        }
+
+        printf("Testing length %zu\n", lengths[l]);
+        ASSERT_EQUAL_MEM(expected.bytes, digest, SHA256_HASH_SIZE,
+                        "Multi-buffer hash should match the portable hash");
+    }
+
+    TEST_PASS();
+}
+
+// Test that hashing in pieces gives the same result as hashing in one call
+void test_sha256_incremental() {
+    printf("\n=== Testing incremental SHA256 ===\n");
+
+    const size_t splits[] = {1, 3, 55, 56, 64, 65, 200};
+    uint8_t data[MAX_TEST_DATA_SIZE];
+    create_test_data(data, MAX_TEST_DATA_SIZE, 0x2d);
+
+    sha256_hash_t expected;
+    hash_data(data, 1000, &expected);
+
+    for (size_t i = 0; i < sizeof(splits) / sizeof(splits[0]); i++) {
+        sha256_ctx_t ctx;
+        sha256_init(&ctx);
+
+        // Feed the same message through pieces of the given size
+        for (size_t pos = 0; pos < 1000; pos += splits[i]) {
+            size_t len = 1000 - pos < splits[i] ? 1000 - pos : splits[i];
+            buf_t piece;
+            buf_view(&piece, data + pos, len);
+            sha256_update(&ctx, &piece);
+        }
+
+        sha256_hash_t digest;
+        sha256_finalize(&ctx, &digest);
+        ASSERT_EQUAL_MEM(expected.bytes, digest.bytes, SHA256_HASH_SIZE,
+                        "Incremental hash should match the one-shot hash");
+    }
+
+    TEST_PASS();
+}
+
+int main() {
+    printf("=== SHA256 Test Suite ===\n");
+    printf("Platform: %s\n", PLATFORM_NAME);
+
+    TEST_SUITE_BEGIN();
+
+    test_sha256_known_answer();
+    test_sha256_ni_matches_portable();
+    test_sha256_mb_matches_portable();
+    test_sha256_mb_messages();
+    test_sha256_incremental();
+
+    TEST_SUITE_END();
+}